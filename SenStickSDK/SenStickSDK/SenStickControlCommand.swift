@@ -14,6 +14,7 @@ public enum SenStickControlCommand : UInt8, CustomStringConvertible
     case stopping      = 0x00
     case starting      = 0x01
     case formatStorage = 0x10
+    case wipeStorage   = 0x11
     case deepSleep     = 0x20
     case enterDFUMode  = 0x40
     
@@ -23,6 +24,7 @@ public enum SenStickControlCommand : UInt8, CustomStringConvertible
         case .stopping      : return "Stopping"
         case .starting      : return "Starting"
         case .formatStorage : return "FormatStorage"
+        case .wipeStorage   : return "WipeStorage"
         case .deepSleep     : return "DeepSleep"
         case .enterDFUMode  : return "EnterDFUMode"
         }
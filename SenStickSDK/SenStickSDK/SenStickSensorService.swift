@@ -18,6 +18,10 @@ public protocol SenStickSensorServiceDelegate : class
     func didFinishedLogData(_ sender: AnyObject)
 }
 
+// ログデータのギャップマーカーのバイト。ファームウェアのsenstick_log_definition.hのLOG_GAP_MARKER_BYTE。
+// 全てのバイトがこの値のレコード(マーカー)の次のレコードは、全て0ならマーカーの値のサンプル、それ以外なら抜けたサンプル数(先頭2バイト、リトルエンディアン)。
+private let logGapMarkerByte: UInt8 = 0x80
+
 // センサーそれぞれのサービスを表すクラスです。
 // センサーの種類が異なっても、処理フローは同じです。それを吸収するために、ジェネリックを使います。DataTypeはセンサそれぞれのデータ型, RangeTypeはセンサーのレンジ型を示します。
 
@@ -55,6 +59,8 @@ open class SenStickSensorService<DataType: SensorDataPackableType, RangeType: Ra
         }
     }
     var logData: [DataType] = []
+    // ログデータで、マーカーを読んで、次のレコードを待っている。マーカーと次のレコードは、別のパケットに分かれることがある。
+    var isLogGapMarkerPending: Bool = false
 
     // MARK: - Properties
     
@@ -98,6 +104,9 @@ open class SenStickSensorService<DataType: SensorDataPackableType, RangeType: Ra
 
     open fileprivate(set) var logID: SensorLogID?
 
+    // 読み出したログの、ギャップマーカーが示す抜けたサンプル数の合計。ログIDを書き込むと0に戻ります。
+    open fileprivate(set) var logMissingSampleCount: Int = 0
+
     open fileprivate(set) var logMetaData: SensorLogMetaData<RangeType>? {
         didSet {
             DispatchQueue.main.async(execute: {
@@ -177,6 +186,22 @@ open class SenStickSensorService<DataType: SensorDataPackableType, RangeType: Ra
             let startIndex = 1 + size * i
             let endIndex   = startIndex + size
             let unit       = Array(value[startIndex..<endIndex])
+            // ギャップマーカーはデータにしない
+            if isLogGapMarkerPending {
+                isLogGapMarkerPending = false
+                if unit.contains(where: { $0 != 0 }) {
+                    logMissingSampleCount += Int(unit[0]) | (Int(unit[1]) << 8)
+                    continue
+                }
+                // エスケープ。マーカーと同じ値のサンプル
+                let marker = [UInt8](repeating: logGapMarkerByte, count: size)
+                array.append( DataType.unpack(settingData!.range, value: marker)! )
+                continue
+            }
+            if !unit.contains(where: { $0 != logGapMarkerByte }) {
+                isLogGapMarkerPending = true
+                continue
+            }
             let logunit    = DataType.unpack(settingData!.range, value: unit)!
             array.append( logunit )
         }
@@ -221,7 +246,8 @@ open class SenStickSensorService<DataType: SensorDataPackableType, RangeType: Ra
             if let d = unpackDataArray(metadata.range, value: data) {
 //                debugPrint("\(#function) count \(d.count)")
                 // データの終端は、必ず送る。データ取りこぼしが起きないように、データ更新も呼び出す。
-                if d.count == 0 {
+                // ギャップマーカーだけのパケットも空の配列になるので、終端はパケットで判定する。
+                if data.count == 1 {
                     DispatchQueue.main.async(execute: {
                         self.delegate?.didUpdateLogData(self)
                         self.delegate?.didFinishedLogData(self)
@@ -269,6 +295,8 @@ open class SenStickSensorService<DataType: SensorDataPackableType, RangeType: Ra
         device.setNotify(self.sensorLogDataChar, enabled: false)
 
         self.logID = logID
+        self.isLogGapMarkerPending = false
+        self.logMissingSampleCount = 0
         let data = logID.pack()
         device.writeValue(sensorLogIDChar, value: data)
         updateLogMetaData()
@@ -0,0 +1,129 @@
+#include "ahrs.h"
+
+// 補正に使う方程式の数。重力の3軸と、地磁気の3軸。
+#define NUM_OF_EQUATIONS 6
+
+/**
+ * Private methods
+ */
+
+// 1/sqrt(x)。libmを使わず、指数部からの初期値に、ニュートン法を2回かける(相対誤差は1e-5程度)。xは正の数。
+static float invSqrt(float x)
+{
+    union {
+        float    f;
+        uint32_t i;
+    } value;
+    value.f = x;
+    value.i = 0x5f3759df - (value.i >> 1);
+    const float half_x = 0.5f * x;
+    value.f = value.f * (1.5f - half_x * value.f * value.f);
+    value.f = value.f * (1.5f - half_x * value.f * value.f);
+    return value.f;
+}
+
+// ベクトルを単位ベクトルにします。0ならfalseを返します。
+static bool normalizeVector(ahrs_vector_t *p_vector)
+{
+    const float norm2 = p_vector->x * p_vector->x + p_vector->y * p_vector->y + p_vector->z * p_vector->z;
+    if(norm2 <= 0.0f) {
+        return false;
+    }
+    const float r = invSqrt(norm2);
+    p_vector->x *= r;
+    p_vector->y *= r;
+    p_vector->z *= r;
+    return true;
+}
+
+/**
+ * Public methods
+ */
+void ahrsInit(ahrs_t *p_ahrs, float beta)
+{
+    p_ahrs->w    = 1.0f;
+    p_ahrs->x    = 0.0f;
+    p_ahrs->y    = 0.0f;
+    p_ahrs->z    = 0.0f;
+    p_ahrs->beta = beta;
+}
+
+void ahrsUpdate(ahrs_t *p_ahrs, const ahrs_vector_t *p_rotation_rate, const ahrs_vector_t *p_acceleration, const ahrs_vector_t *p_magnetic_field, float dt)
+{
+    const float q0 = p_ahrs->w;
+    const float q1 = p_ahrs->x;
+    const float q2 = p_ahrs->y;
+    const float q3 = p_ahrs->z;
+    const float gx = p_rotation_rate->x;
+    const float gy = p_rotation_rate->y;
+    const float gz = p_rotation_rate->z;
+
+    // 角速度による姿勢の変化率 0.5 * q * (0, gx, gy, gz)
+    float dq0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    float dq1 = 0.5f * ( q0 * gx + q2 * gz - q3 * gy);
+    float dq2 = 0.5f * ( q0 * gy - q1 * gz + q3 * gx);
+    float dq3 = 0.5f * ( q0 * gz + q1 * gy - q2 * gx);
+
+    ahrs_vector_t a = *p_acceleration;
+    ahrs_vector_t m = *p_magnetic_field;
+    if(normalizeVector(&a)) {
+        // 今の姿勢から予測した重力と地磁気の向きと、測った向きの差(f)を、姿勢で微分したヤコビアン(j)から、差を小さくする向き(勾配 j^T f)を求める。
+        float f[NUM_OF_EQUATIONS];
+        float j[NUM_OF_EQUATIONS][4];
+        int num_of_equations = 3;
+
+        f[0] = 2.0f * (q1 * q3 - q0 * q2) - a.x;
+        f[1] = 2.0f * (q0 * q1 + q2 * q3) - a.y;
+        f[2] = 2.0f * (0.5f - q1 * q1 - q2 * q2) - a.z;
+        j[0][0] = -2.0f * q2; j[0][1] =  2.0f * q3; j[0][2] = -2.0f * q0; j[0][3] = 2.0f * q1;
+        j[1][0] =  2.0f * q1; j[1][1] =  2.0f * q0; j[1][2] =  2.0f * q3; j[1][3] = 2.0f * q2;
+        j[2][0] =  0.0f;      j[2][1] = -4.0f * q1; j[2][2] = -4.0f * q2; j[2][3] = 0.0f;
+
+        if(normalizeVector(&m)) {
+            // 地磁気を地球の座標系に回し、水平成分(bx)と鉛直成分(bz)を基準の向きにする。地磁気の伏角によらず、補正は主に方位(ヨー)に効く。
+            const float hx = 2.0f * (m.x * (0.5f - q2 * q2 - q3 * q3) + m.y * (q1 * q2 - q0 * q3) + m.z * (q1 * q3 + q0 * q2));
+            const float hy = 2.0f * (m.x * (q1 * q2 + q0 * q3) + m.y * (0.5f - q1 * q1 - q3 * q3) + m.z * (q2 * q3 - q0 * q1));
+            const float bz = 2.0f * (m.x * (q1 * q3 - q0 * q2) + m.y * (q2 * q3 + q0 * q1) + m.z * (0.5f - q1 * q1 - q2 * q2));
+            const float bx2 = hx * hx + hy * hy;
+            const float bx  = (bx2 > 0.0f) ? bx2 * invSqrt(bx2) : 0.0f;
+
+            f[3] = 2.0f * bx * (0.5f - q2 * q2 - q3 * q3) + 2.0f * bz * (q1 * q3 - q0 * q2) - m.x;
+            f[4] = 2.0f * bx * (q1 * q2 - q0 * q3) + 2.0f * bz * (q0 * q1 + q2 * q3) - m.y;
+            f[5] = 2.0f * bx * (q0 * q2 + q1 * q3) + 2.0f * bz * (0.5f - q1 * q1 - q2 * q2) - m.z;
+            j[3][0] = -2.0f * bz * q2;                   j[3][1] =  2.0f * bz * q3;
+            j[3][2] = -4.0f * bx * q2 - 2.0f * bz * q0;  j[3][3] = -4.0f * bx * q3 + 2.0f * bz * q1;
+            j[4][0] = -2.0f * bx * q3 + 2.0f * bz * q1;  j[4][1] =  2.0f * bx * q2 + 2.0f * bz * q0;
+            j[4][2] =  2.0f * bx * q1 + 2.0f * bz * q3;  j[4][3] = -2.0f * bx * q0 + 2.0f * bz * q2;
+            j[5][0] =  2.0f * bx * q2;                   j[5][1] =  2.0f * bx * q3 - 4.0f * bz * q1;
+            j[5][2] =  2.0f * bx * q0 - 4.0f * bz * q2;  j[5][3] =  2.0f * bx * q1;
+            num_of_equations = NUM_OF_EQUATIONS;
+        }
+
+        float s[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for(int i = 0; i < num_of_equations; i++) {
+            for(int k = 0; k < 4; k++) {
+                s[k] += j[i][k] * f[i];
+            }
+        }
+        // 勾配の向きに、betaの速さで姿勢を戻す
+        const float norm2 = s[0] * s[0] + s[1] * s[1] + s[2] * s[2] + s[3] * s[3];
+        if(norm2 > 0.0f) {
+            const float r = p_ahrs->beta * invSqrt(norm2);
+            dq0 -= r * s[0];
+            dq1 -= r * s[1];
+            dq2 -= r * s[2];
+            dq3 -= r * s[3];
+        }
+    }
+
+    // 積分して、単位クォータニオンに戻す
+    float w = q0 + dq0 * dt;
+    float x = q1 + dq1 * dt;
+    float y = q2 + dq2 * dt;
+    float z = q3 + dq3 * dt;
+    const float r = invSqrt(w * w + x * x + y * y + z * z);
+    p_ahrs->w = w * r;
+    p_ahrs->x = x * r;
+    p_ahrs->y = y * r;
+    p_ahrs->z = z * r;
+}
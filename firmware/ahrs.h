@@ -0,0 +1,39 @@
+#ifndef ahrs_h
+#define ahrs_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * 姿勢推定(AHRS)。Madgwickの勾配降下法のフィルタで、ジャイロの角速度を積分した姿勢を、加速度(重力の向き)と地磁気(北の向き)で補正します。
+ *
+ * 姿勢は、センサーの座標系から地球の座標系(z軸が鉛直上向き、x軸が磁北の水平成分の向き)への回転を表す単位クォータニオン(w, x, y, z)です。
+ * 加速度と地磁気は向きだけを使うので、単位は問いません。ただし、3軸は加速度と同じ座標系に揃えること。
+ * NRF52はCortex-M4のFPUで、単精度の浮動小数点数で計算します。
+ */
+
+typedef struct {
+    float x;
+    float y;
+    float z;
+} ahrs_vector_t;
+
+typedef struct {
+    float w;
+    float x;
+    float y;
+    float z;
+    float beta;     // 補正のゲイン(ラジアン/秒)。大きいほど加速度と地磁気に速く追従し、ジャイロの積分の誤差を早く打ち消すが、動きの加速度の影響を受ける。
+} ahrs_t;
+
+// 姿勢の推定の既定のゲイン
+#define AHRS_DEFAULT_BETA 0.1f
+
+// 姿勢を単位クォータニオン(回転なし)に初期化します。
+void ahrsInit(ahrs_t *p_ahrs, float beta);
+
+// 1サンプル分、姿勢を更新します。p_rotation_rateは角速度(ラジアン/秒)、dtはサンプルの間隔(秒)。
+// 加速度が0なら、ジャイロの積分だけで更新します。地磁気が0なら、加速度だけで補正します(ヨーはジャイロの積分だけ)。
+void ahrsUpdate(ahrs_t *p_ahrs, const ahrs_vector_t *p_rotation_rate, const ahrs_vector_t *p_acceleration, const ahrs_vector_t *p_magnetic_field, float dt);
+
+#endif /* ahrs_h */
@@ -26,29 +26,41 @@ static void setSensorWakeupHandler(bool shouldWakeUp, const sensor_service_setti
     }
 }
 
-// センサーの値を読み込みます。
-static uint8_t getSensorDataHandler(uint8_t *p_buffer, samplingDurationType duration_ms)
+static sensorDataCallbackType _callback;
+
+static void sensorDataReadyHandler(const uint8_t *p_data, uint8_t length)
+{
+    (_callback)(BrightnessSensor, p_data, length);
+}
+
+// 変換時間(ミリ秒)
+#define BRIGHTNESS_CONVERSION_MS 150
+
+// センサーの値の読み込みを要求します。変換待ちの間は、変換の終わる時刻に呼び出すように、*p_wakeup_msを指定します。
+static bool requestSensorDataHandler(samplingDurationType duration_ms, sensorDataCallbackType callback, samplingDurationType *p_wakeup_ms)
 {
     switch(_state) {
         case 0: // トリガー、ステート1に遷移する。
             _state = 1;
             triggerBrightnessData();
-            return 0;
+            *p_wakeup_ms = BRIGHTNESS_CONVERSION_MS + 1;
+            return false;
 
-        case 1: // 150ミリ秒待つ。
-            if( duration_ms > 150 ) {
-                _state = 2;
+        case 1: // 150ミリ秒待って、データ取得。
+            if( duration_ms <= BRIGHTNESS_CONVERSION_MS ) {
+                *p_wakeup_ms = BRIGHTNESS_CONVERSION_MS + 1;
+                return false;
+            }
+            _callback = callback;
+            if( ! requestBrightnessData(sensorDataReadyHandler) ) {
+                return false;
             }
-            return 0;
-
-        case 2:  // データ取得。
             _state = 0;
-            getBrightnessData((BrightnessData_t *)p_buffer);
-            return sizeof(BrightnessData_t);
+            return true;
 
         default:
             _state = 0;
-            return 0;
+            return false;
     }
 }
 
@@ -76,9 +88,13 @@ const senstick_sensor_base_t brightnessSensorBase =
         BRIGHTNESS_SENSOR_STORAGE_START_ADDRESS, // スタートアドレス
         BRIGHTNESS_SENSOR_STORAGE_SIZE           // サイズ
     },
+    sensorBus_twi,
+    300,                        // 変換のトリガーと読み出しで、I2Cバスを300マイクロ秒使う
+    151000,                     // 変換に150ミリ秒かかり、変換の終わる時刻の呼び出しで読み出す
+    0,                          // 符号なしの値なので、間引きは使えない
     initSensorHandler,
     setSensorWakeupHandler,
-    getSensorDataHandler,
+    requestSensorDataHandler,
     getMaxMinValueHandler,
     getBLEDataHandler
 };
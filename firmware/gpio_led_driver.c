@@ -16,6 +16,7 @@
 //      動作         100ミリ秒 1回光る
 //      ロギング     100ミリ秒 2回光る
 //      ログいっぱい  100ミリ秒 3回光る
+//      全消去中     100ミリ秒 4回光る
 // 接続時は1秒、非接続時は3秒
 
 APP_TIMER_DEF(m_led_timer_id);
@@ -49,7 +50,7 @@ static void updateNextBlink(void)
         int period = isConnected ? 3000 : 6000;
         
         senstick_control_command_t command = senstick_getControlCommand();
-        int count = (command == sensorShouldWork) ? 2 : 1;
+        int count = (command == sensorShouldWork) ? 2 : (command == wipingStorage) ? 4 : 1;
         
         startBlinking(count, period);
     } else {
@@ -25,11 +25,18 @@ static void setSensorWakeupHandler(bool shouldWakeUp, const sensor_service_setti
     }
 }
 
-// センサーの値を読み込みます。
-static uint8_t getSensorDataHandler(uint8_t *p_buffer, samplingDurationType duration_ms)
+static sensorDataCallbackType _callback;
+
+static void sensorDataReadyHandler(const uint8_t *p_data, uint8_t length)
+{
+    (_callback)(GyroSensor, p_data, length);
+}
+
+// センサーの値の読み込みを要求します。
+static bool requestSensorDataHandler(samplingDurationType duration_ms, sensorDataCallbackType callback, samplingDurationType *p_wakeup_ms)
 {
-    getRotationRateData(p_buffer);
-    return sizeof(RotationRateData_t);
+    _callback = callback;
+    return requestRotationRateData(sensorDataReadyHandler);
 }
 
 // srcとdstのセンサデータの最大値/最小値をp_srcに入れます。p_srcは破壊されます。
@@ -58,9 +65,13 @@ const senstick_sensor_base_t gyroSensorBase =
         GYRO_SENSOR_STORAGE_START_ADDRESS, // スタートアドレス
         GYRO_SENSOR_STORAGE_SIZE           // サイズ
     },
+    sensorBus_twiNineAxes,      // 9軸センサーの読み出しでまとめて読み出す
+    330,                        // I2Cバスを330マイクロ秒使う
+    1000,                       // チップは1ミリ秒ごとにサンプリングする
+    3,                          // x, y, zを間引きのフィルタに通せる
     initSensorHandler,
     setSensorWakeupHandler,
-    getSensorDataHandler,
+    requestSensorDataHandler,
     getMaxMinValueHandler,
     getBLEDataHandler
 };
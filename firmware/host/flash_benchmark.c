@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_sensor_base.h"
+#include "superblock_controller.h"
+
+#include "acceleration_sensor_base.h"
+#include "gyro_sensor_base.h"
+#include "magnetic_sensor_base.h"
+#include "brightness_sensor_base.h"
+#include "uv_sensor_base.h"
+#include "humidity_sensor_base.h"
+#include "pressure_sensor_base.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// ワークロードごとに、書き込み増幅、消去回数、ストール時間を計測します。
+//   ./flash_benchmark [イメージファイル]
+// イメージファイルを指定すると、フラッシュの内容をそのファイルに残します。
+
+static const senstick_sensor_base_t *m_p_sensor_bases[] = {
+    &accelerationSensorBase,
+    &gyroSensorBase,
+    &magneticSensorBase,
+    &brightnessSensorBase,
+    &uvSensorBase,
+    &humiditySensorBase,
+    &pressureSensorBase,
+};
+#define NUM_OF_SENSORS (sizeof(m_p_sensor_bases) / sizeof(m_p_sensor_bases[0]))
+
+static void clearStatistics(void)
+{
+    flashEmulatorClearStatistics();
+    clearLogEraseStatistics();
+}
+
+static void printStatistics(const char *p_name, uint64_t logical_bytes)
+{
+    flash_emulator_statistics_t statistics;
+    flash_memory_statistics_t   driver_statistics;
+    log_erase_statistics_t      erase_statistics;
+    flashEmulatorGetStatistics(&statistics);
+    flashMemoryGetStatistics(&driver_statistics);
+    getLogEraseStatistics(&erase_statistics);
+
+    printf("== %s\n", p_name);
+    printf("  elapsed            %10.3f s\n", statistics.elapsedUs / 1e6);
+    printf("  logical bytes      %10llu\n", (unsigned long long)logical_bytes);
+    printf("  programmed bytes   %10llu\n", (unsigned long long)statistics.programBytes);
+    if(logical_bytes > 0) {
+        printf("  write amplification %9.3f\n", (double)statistics.programBytes / logical_bytes);
+    }
+    printf("  page programs      %10u\n", driver_statistics.pageProgramCount);
+    printf("  sector erases      %10u\n", driver_statistics.sectorEraseCount);
+    printf("  block erases       %10u\n", driver_statistics.blockEraseCount);
+    printf("  erased bytes       %10llu\n", (unsigned long long)statistics.eraseBytes);
+    printf("  erase suspends     %10u\n", driver_statistics.eraseSuspendCount);
+    printf("  flash busy         %10.1f %%\n", statistics.elapsedUs > 0 ? 100.0 * statistics.busyUs / statistics.elapsedUs : 0.0);
+    printf("  stall              %10.3f ms (%u times)\n", statistics.stallUs / 1e3, statistics.stallCount);
+    printf("  erase waits        %10u\n", erase_statistics.eraseWaitCount);
+    printf("  program violations %10u\n", statistics.programViolationCount);
+    printf("  max sector erases  %10u\n", statistics.maxSectorEraseCount);
+}
+
+// (a) log_controllerへの直接の書き込み。10ミリ秒ごとに6バイトのサンプルを60秒間。
+static void benchmarkDirectLog(void)
+{
+    static log_context_t log;
+    static uint8_t write_buffer[LOG_WRITE_BUFFER_SIZE];
+    const flash_address_info_t *p_address_info = &accelerationSensorBase.address_info;
+
+    formatLogPool();
+    formatLog(p_address_info);
+    clearStatistics();
+
+    createLog(&log, write_buffer, 0, 10, 0, p_address_info);
+    uint64_t logical_bytes = 0;
+    for(int i = 0; i < 6000; i++) {
+        uint8_t sample[6];
+        for(int j = 0; j < sizeof(sample); j++) {
+            sample[j] = (uint8_t)(i + j);
+        }
+        logical_bytes += writeLog(&log, sample, sizeof(sample));
+        flashEmulatorAdvance(10000);
+    }
+    closeLog(&log);
+
+    printStatistics("log_controller, 6 bytes / 10 ms, 60 s", logical_bytes);
+}
+
+// サンプリングクロックの統計を表示します。TIMER2の動作時間は、HFCLKが動き続けた時間。
+static void printClockStatistics(const host_clock_statistics_t *p_before)
+{
+    host_clock_statistics_t after;
+    hostPlatformGetClockStatistics(&after);
+    printf("  TIMER2 running     %10.3f s (%u interrupts)\n", (after.timer2RunningUs - p_before->timer2RunningUs) / 1e6, after.timer2InterruptCount - p_before->timer2InterruptCount);
+    printf("  RTC2 running       %10.3f s (%u interrupts)\n", (after.rtc2RunningUs - p_before->rtc2RunningUs) / 1e6, after.rtc2InterruptCount - p_before->rtc2InterruptCount);
+}
+
+// 設定済みのセンサーで60秒間ロギングし、統計を表示します。
+static void runSensorLogging(const char *p_name)
+{
+    host_clock_statistics_t clock_statistics;
+    clearStatistics();
+    hostPlatformGetClockStatistics(&clock_statistics);
+
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(60000);
+    senstick_setControlCommand(sensorShouldSleep);
+    waitFlashCommandQueueEmpty();
+
+    // 作られたログのヘッダから、書き込まれたデータ量を得る
+    uint64_t logical_bytes = 0;
+    uint8_t log_id = senstick_getCurrentLogCount() - 1;
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        static log_context_t log;
+        openLog(&log, log_id, &(m_p_sensor_bases[i]->address_info));
+        logical_bytes += log.header.size;
+    }
+
+    printStatistics(p_name, logical_bytes);
+    printClockStatistics(&clock_statistics);
+}
+
+// (b) 全センサーのロギング。加速度、ジャイロ、地磁気は10ミリ秒、その他は200ミリ秒で60秒間。
+static void benchmarkSensorLogging(void)
+{
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        hostWriteSensorSetting((sensor_device_t)i, sensorServiceCommand_sensing_and_logging, (i <= MagneticFieldSensor) ? 10000 : 200000, 0);
+    }
+    runSensorLogging("senstick_sensor_controller, all sensors, 60 s");
+}
+
+// (f) 環境センサーだけのロギング。照度、紫外線、湿度、気圧を200ミリ秒で60秒間。サンプリングクロックはRTC2になる。
+static void benchmarkEnvironmentLogging(void)
+{
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        if(i <= MagneticFieldSensor) {
+            hostWriteSensorSetting((sensor_device_t)i, sensorServiceCommand_stop, 200000, 0);
+        } else {
+            hostWriteSensorSetting((sensor_device_t)i, sensorServiceCommand_sensing_and_logging, 200000, 0);
+        }
+    }
+    runSensorLogging("senstick_sensor_controller, environment sensors, 60 s");
+}
+
+// (c) ストレージのフォーマット。
+static void benchmarkFormat(void)
+{
+    clearStatistics();
+    senstick_setControlCommand(formattingStorage);
+    waitFlashCommandQueueEmpty();
+    printStatistics("formattingStorage", 0);
+}
+
+// 起動時のマウント処理(main.c)を実行し、その時間とフラッシュの読み出し回数を表示します。
+static void measureMount(const char *p_name)
+{
+    flash_memory_statistics_t driver_statistics;
+
+    hostPlatformReset();
+    initFlashMemory();
+    initLogController();
+    clearStatistics();
+    const uint64_t start_us = flashEmulatorGetTime();
+
+    initSuperblockController();
+    initSenstickDataModel();
+    initMetaDataLogController();
+    initSenstickSensorController(0);
+    senstick_mountStorage();
+
+    const uint64_t elapsed_us = flashEmulatorGetTime() - start_us;
+    flashMemoryGetStatistics(&driver_statistics);
+    printf("== mount, %s\n", p_name);
+    printf("  logs               %10u\n", senstick_getCurrentLogCount());
+    printf("  elapsed            %10.3f ms\n", elapsed_us / 1e3);
+    printf("  reads              %10u\n", driver_statistics.readCount);
+    printf("  page programs      %10u\n", driver_statistics.pageProgramCount);
+
+    senstick_setControlCommand(sensorShouldSleep);
+}
+
+// (d) 起動時のマウント。ログを50個記録した状態で、スーパーブロックありとなし(従来の方法)を比べる。
+static void benchmarkMount(void)
+{
+    while(senstick_getCurrentLogCount() < 50) {
+        senstick_setControlCommand(sensorShouldWork);
+        hostPlatformRun(100);
+        senstick_setControlCommand(sensorShouldSleep);
+    }
+    superblockFormat();
+    measureMount("metadata and log headers");
+    measureMount("superblock");
+}
+
+// (e) ストレージの全消去。進捗が100になるまで実行する。
+static void benchmarkWipe(void)
+{
+    clearStatistics();
+    senstick_setControlCommand(wipingStorage);
+    while(senstick_getStorageWipeProgress() < 100) {
+        hostPlatformRun(100);
+    }
+    printStatistics("wipingStorage", 0);
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit((argc > 1) ? argv[1] : NULL);
+    hostBoot();
+
+    benchmarkDirectLog();
+    benchmarkFormat();
+    benchmarkSensorLogging();
+    benchmarkEnvironmentLogging();
+    benchmarkMount();
+    benchmarkWipe();
+
+    flashEmulatorDeinit();
+    return 0;
+}
@@ -0,0 +1,667 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <nrf_assert.h>
+#include <nordic_common.h>
+#include <app_error.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "flash_emulator.h"
+
+// コマンドキューの深さ。実機のドライバと同じ。
+#define FLASH_COMMAND_QUEUE_SIZE 16
+
+// WIPのポーリング間隔(マイクロ秒)。実機のドライバと同じ値で、ビジー時間をこの間隔に切り上げる。
+#define FLASH_PROGRAM_POLLING_INTERVAL_US     500
+#define FLASH_ERASE_POLLING_INTERVAL_US       2000
+#define FLASH_BLOCK_ERASE_POLLING_INTERVAL_US 10000
+
+#define NUM_OF_SECTORS (MX25L25635F_FLASH_SIZE / MX25L25635F_SECTOR_SIZE)
+
+typedef enum {
+    EMULATOR_COMMAND_READ,
+    EMULATOR_COMMAND_PROGRAM,
+    EMULATOR_COMMAND_ERASE,
+} emulator_command_type_t;
+
+// キューに積まれる1つのコマンド
+typedef struct {
+    emulator_command_type_t type;
+    uint32_t address;
+    uint32_t length;            // 読み書きのバイト数、または消去のバイト数
+    uint8_t  *p_data;
+    flash_command_callback_t callback;
+    void     *p_context;
+
+    bool     isStarted;
+    uint64_t remainingNs;       // 完了までの残り時間
+} emulator_command_t;
+
+typedef struct {
+    emulator_command_t items[FLASH_COMMAND_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+} emulator_command_queue_t;
+
+typedef struct {
+    uint8_t *p_memory;
+    int      fd;
+
+    emulator_command_queue_t queue;
+    emulator_command_queue_t backgroundQueue;
+    emulator_command_t *p_current;
+    bool isBackground;
+    bool isEraseSuspended;
+    bool isPowerDown;
+    bool isRunning;             // コールバックからの再入を防ぐ
+
+    uint64_t now;               // CPUの模擬時刻(ナノ秒)
+    uint64_t deviceTime;        // フラッシュが処理を終えた時刻(ナノ秒)
+
+    flash_emulator_timing_t timing;
+    flash_emulator_time_handler_t timeHandler;
+
+    flash_memory_statistics_t   statistics;
+    flash_emulator_statistics_t emulatorStatistics;
+    uint64_t statisticsStartTime; // 統計をクリアした時刻(ナノ秒)
+    uint32_t sectorEraseCounts[NUM_OF_SECTORS];
+} flash_emulator_context_t;
+
+static flash_emulator_context_t m_context;
+
+/**
+ * Private methods
+ */
+static emulator_command_t *getQueueHead(emulator_command_queue_t *p_queue)
+{
+    return &(p_queue->items[p_queue->head]);
+}
+
+static bool canExecuteForegroundCommand(void)
+{
+    if(m_context.queue.count == 0) {
+        return false;
+    }
+    return ! (m_context.isEraseSuspended && getQueueHead(&m_context.queue)->type == EMULATOR_COMMAND_ERASE);
+}
+
+// ビジー時間を、ドライバのポーリング間隔に切り上げる。
+static uint64_t roundUpToPolling(uint64_t busy_us, uint32_t interval_us)
+{
+    return ((busy_us + interval_us - 1) / interval_us) * interval_us;
+}
+
+static uint64_t spiTransferNs(uint32_t bytes)
+{
+    return (uint64_t)bytes * m_context.timing.spiBytePeriodNs;
+}
+
+// コマンドの実行時間。SPI転送(WREN、コマンド、アドレス、ダミー、データ)と、書き込み/消去のビジー時間。
+static uint64_t getCommandDurationNs(const emulator_command_t *p_command)
+{
+    const flash_emulator_timing_t *p_timing = &(m_context.timing);
+    switch(p_command->type) {
+        case EMULATOR_COMMAND_READ:
+            // FASTREAD4B: コマンド1 + アドレス4 + ダミー1
+            return spiTransferNs(1 + 4 + 1 + p_command->length);
+        case EMULATOR_COMMAND_PROGRAM:
+            return spiTransferNs(1 + 1 + 4 + p_command->length + 2)
+                + roundUpToPolling(p_timing->pageProgramUs, FLASH_PROGRAM_POLLING_INTERVAL_US) * 1000;
+        case EMULATOR_COMMAND_ERASE:
+        default:
+            if(p_command->length == MX25L25635F_BLOCK64K_SIZE) {
+                return spiTransferNs(1 + 1 + 4 + 2) + roundUpToPolling(p_timing->block64kEraseUs, FLASH_BLOCK_ERASE_POLLING_INTERVAL_US) * 1000;
+            } else if(p_command->length == MX25L25635F_BLOCK32K_SIZE) {
+                return spiTransferNs(1 + 1 + 4 + 2) + roundUpToPolling(p_timing->block32kEraseUs, FLASH_BLOCK_ERASE_POLLING_INTERVAL_US) * 1000;
+            }
+            return spiTransferNs(1 + 1 + 4 + 2) + roundUpToPolling(p_timing->sectorEraseUs, FLASH_ERASE_POLLING_INTERVAL_US) * 1000;
+    }
+}
+
+// ページプログラム。書き込みはページの中で折り返し、256バイトを超えるデータは最後の256バイトだけが書き込まれる。
+static void programPage(uint32_t address, const uint8_t *p_data, uint32_t length)
+{
+    if(length > MX25L25635F_PAGE_SIZE) {
+        p_data += length - MX25L25635F_PAGE_SIZE;
+        length  = MX25L25635F_PAGE_SIZE;
+    }
+    const uint32_t page_address = address - (address % MX25L25635F_PAGE_SIZE);
+    for(uint32_t i=0; i < length; i++) {
+        uint32_t target = page_address + ((address + i) % MX25L25635F_PAGE_SIZE);
+        uint8_t  value  = m_context.p_memory[target];
+        // プログラムはビットを0にすることしかできない
+        if((value & p_data[i]) != p_data[i]) {
+            m_context.emulatorStatistics.programViolationCount++;
+        }
+        m_context.p_memory[target] = value & p_data[i];
+    }
+    m_context.emulatorStatistics.programBytes += length;
+}
+
+static void eraseRange(uint32_t address, uint32_t length)
+{
+    memset(&(m_context.p_memory[address]), 0xff, length);
+    for(uint32_t sector = address / MX25L25635F_SECTOR_SIZE; sector < (address + length) / MX25L25635F_SECTOR_SIZE; sector++) {
+        m_context.sectorEraseCounts[sector]++;
+        m_context.emulatorStatistics.maxSectorEraseCount = MAX(m_context.emulatorStatistics.maxSectorEraseCount, m_context.sectorEraseCounts[sector]);
+    }
+    m_context.emulatorStatistics.eraseBytes += length;
+}
+
+// コマンドの実行を開始します。統計はドライバと同じく、開始時に数える。
+static void startCommand(emulator_command_t *p_command)
+{
+    p_command->isStarted   = true;
+    p_command->remainingNs = getCommandDurationNs(p_command);
+
+    switch(p_command->type) {
+        case EMULATOR_COMMAND_READ:
+            m_context.statistics.readCount++;
+            break;
+        case EMULATOR_COMMAND_PROGRAM:
+            m_context.statistics.pageProgramCount++;
+            m_context.statistics.programByteCount += p_command->length;
+            break;
+        case EMULATOR_COMMAND_ERASE:
+            if(p_command->length == MX25L25635F_SECTOR_SIZE) {
+                m_context.statistics.sectorEraseCount++;
+            } else {
+                m_context.statistics.blockEraseCount++;
+            }
+            break;
+    }
+}
+
+// 次に実行するコマンドを選びます。通常のコマンドを、バックグラウンドの消去より優先します。
+static bool selectNextCommand(void)
+{
+    if(canExecuteForegroundCommand()) {
+        m_context.p_current    = getQueueHead(&m_context.queue);
+        m_context.isBackground = false;
+    } else if(m_context.backgroundQueue.count > 0) {
+        m_context.p_current    = getQueueHead(&m_context.backgroundQueue);
+        m_context.isBackground = true;
+        if(m_context.isEraseSuspended) {
+            m_context.isEraseSuspended        = false;
+            m_context.p_current->remainingNs += (uint64_t)m_context.timing.resumeLatencyUs * 1000;
+        }
+    } else {
+        return false;
+    }
+
+    if( ! m_context.p_current->isStarted) {
+        startCommand(m_context.p_current);
+    }
+    return true;
+}
+
+// 実行中のコマンドを完了させ、データを反映し、コールバックを呼び出します。
+static void completeCommand(void)
+{
+    emulator_command_t command = *(m_context.p_current);
+    emulator_command_queue_t *p_queue = m_context.isBackground ? &m_context.backgroundQueue : &m_context.queue;
+
+    p_queue->head = (p_queue->head + 1) % FLASH_COMMAND_QUEUE_SIZE;
+    p_queue->count--;
+    m_context.p_current = NULL;
+
+    switch(command.type) {
+        case EMULATOR_COMMAND_READ:
+            memcpy(command.p_data, &(m_context.p_memory[command.address]), command.length);
+            m_context.emulatorStatistics.readBytes += command.length;
+            break;
+        case EMULATOR_COMMAND_PROGRAM:
+            programPage(command.address, command.p_data, command.length);
+            break;
+        case EMULATOR_COMMAND_ERASE:
+            eraseRange(command.address, command.length);
+            break;
+    }
+
+    if(command.callback != NULL) {
+        (command.callback)(command.p_context);
+    }
+}
+
+// フラッシュの処理を、時刻untilまで進めます。stopAfterCompletionならば、コマンドが1つ完了した時点で止めます。
+// コマンドが1つでも完了したらtrueを返します。
+static bool runDevice(uint64_t until, bool stopAfterCompletion)
+{
+    bool did_complete = false;
+
+    if(m_context.isRunning) {
+        return false;
+    }
+    m_context.isRunning = true;
+
+    while(true) {
+        if(m_context.p_current == NULL && ! selectNextCommand()) {
+            m_context.deviceTime = MAX(m_context.deviceTime, until);
+            break;
+        }
+
+        // バックグラウンドの消去中に通常のコマンドが来ていれば、消去をサスペンドする
+        if(m_context.isBackground && canExecuteForegroundCommand()) {
+            const uint64_t latency = (uint64_t)m_context.timing.suspendLatencyUs * 1000;
+            m_context.isEraseSuspended = true;
+            m_context.p_current        = NULL;
+            m_context.deviceTime      += latency;
+            m_context.emulatorStatistics.busyUs += latency / 1000;
+            m_context.statistics.eraseSuspendCount++;
+            continue;
+        }
+
+        if(m_context.deviceTime >= until) {
+            break;
+        }
+
+        const uint64_t finish = m_context.deviceTime + m_context.p_current->remainingNs;
+        if(finish > until) {
+            m_context.p_current->remainingNs    -= until - m_context.deviceTime;
+            m_context.emulatorStatistics.busyUs += (until - m_context.deviceTime) / 1000;
+            m_context.deviceTime = until;
+            break;
+        }
+        m_context.emulatorStatistics.busyUs += m_context.p_current->remainingNs / 1000;
+        m_context.p_current->remainingNs = 0;
+        m_context.deviceTime = finish;
+
+        completeCommand();
+        did_complete = true;
+        if(stopAfterCompletion) {
+            break;
+        }
+    }
+
+    m_context.isRunning = false;
+    return did_complete;
+}
+
+// CPUの模擬時刻を進めます。その間の割り込みは、時刻ハンドラが処理します。
+static void setCPUTime(uint64_t time)
+{
+    if(time <= m_context.now) {
+        return;
+    }
+    const uint64_t from = m_context.now;
+    m_context.now = time;
+    if(m_context.timeHandler != NULL) {
+        (m_context.timeHandler)(from / 1000, m_context.now / 1000);
+    }
+}
+
+static void enqueueCommand(emulator_command_queue_t *p_queue, const emulator_command_t *p_command)
+{
+    if(m_context.isPowerDown) {
+        fprintf(stderr, "flash_emulator: command issued in deep power down.\n");
+        APP_ERROR_CHECK(NRF_ERROR_INVALID_STATE);
+    }
+
+    // 現在時刻までフラッシュの処理を進めてから、キューに積む。キューがいっぱいならば、空くまで待つ。
+    runDevice(m_context.now, false);
+    while(p_queue->count >= FLASH_COMMAND_QUEUE_SIZE) {
+        waitFlashCommandProgress();
+    }
+
+    emulator_command_t *p_item = &(p_queue->items[(p_queue->head + p_queue->count) % FLASH_COMMAND_QUEUE_SIZE]);
+    *p_item = *p_command;
+    p_item->isStarted   = false;
+    p_item->remainingNs = 0;
+    p_queue->count++;
+}
+
+static void setCommand(emulator_command_t *p_command, emulator_command_type_t type, uint32_t address, uint32_t length, uint8_t *p_data, flash_command_callback_t callback, void *p_context)
+{
+    memset(p_command, 0, sizeof(emulator_command_t));
+    p_command->type      = type;
+    p_command->address   = address;
+    p_command->length    = length;
+    p_command->p_data    = p_data;
+    p_command->callback  = callback;
+    p_command->p_context = p_context;
+}
+
+static void enqueueErase(emulator_command_queue_t *p_queue, uint32_t address, uint32_t length, flash_command_callback_t callback, void *p_context)
+{
+    // 実機と同じく、アドレスを含むセクター(ブロック)全体を消去する
+    ASSERT(address < MX25L25635F_FLASH_SIZE);
+    address -= address % length;
+
+    emulator_command_t command;
+    setCommand(&command, EMULATOR_COMMAND_ERASE, address, length, NULL, callback, p_context);
+    enqueueCommand(p_queue, &command);
+}
+
+static void syncCompletionHandler(void *p_context)
+{
+    *((volatile bool *)p_context) = true;
+}
+
+static void waitForCompletion(volatile bool *p_is_completed)
+{
+    while( ! *p_is_completed ) {
+        waitFlashCommandProgress();
+    }
+}
+
+static void unmapMemory(void)
+{
+    if(m_context.p_memory == NULL) {
+        return;
+    }
+    if(m_context.fd >= 0) {
+        msync(m_context.p_memory, MX25L25635F_FLASH_SIZE, MS_SYNC);
+        munmap(m_context.p_memory, MX25L25635F_FLASH_SIZE);
+        close(m_context.fd);
+    } else {
+        free(m_context.p_memory);
+    }
+    m_context.p_memory = NULL;
+    m_context.fd       = -1;
+}
+
+/**
+ * Emulator methods
+ */
+void flashEmulatorInit(const char *p_image_path)
+{
+    unmapMemory();
+
+    flash_emulator_time_handler_t handler = m_context.timeHandler;
+    memset(&m_context, 0, sizeof(flash_emulator_context_t));
+    m_context.fd          = -1;
+    m_context.timeHandler = handler;
+
+    // 既定の時間パラメータ。SPIは8MHz。書き込み/消去時間は、データシートの典型値に近い値。
+    m_context.timing.spiBytePeriodNs  = 1000;
+    m_context.timing.pageProgramUs    = MX25L25635F_PAGE_PROGRAM_TYPICAL_US;
+    m_context.timing.sectorEraseUs    = MX25L25635F_SECTOR_ERASE_TYPICAL_US;
+    m_context.timing.block32kEraseUs  = 250000;
+    m_context.timing.block64kEraseUs  = 450000;
+    m_context.timing.suspendLatencyUs = FLASH_ERASE_POLLING_INTERVAL_US / 2 + 20;
+    m_context.timing.resumeLatencyUs  = 100;
+
+    if(p_image_path == NULL) {
+        m_context.p_memory = malloc(MX25L25635F_FLASH_SIZE);
+        if(m_context.p_memory == NULL) {
+            APP_ERROR_CHECK(NRF_ERROR_NO_MEM);
+        }
+        memset(m_context.p_memory, 0xff, MX25L25635F_FLASH_SIZE);
+        return;
+    }
+
+    m_context.fd = open(p_image_path, O_RDWR | O_CREAT, 0644);
+    if(m_context.fd < 0) {
+        perror(p_image_path);
+        APP_ERROR_CHECK(NRF_ERROR_NOT_FOUND);
+    }
+    struct stat st;
+    fstat(m_context.fd, &st);
+    const bool is_new_image = (st.st_size == 0);
+    if(is_new_image) {
+        if(ftruncate(m_context.fd, MX25L25635F_FLASH_SIZE) != 0) {
+            perror(p_image_path);
+            APP_ERROR_CHECK(NRF_ERROR_NO_MEM);
+        }
+    } else if(st.st_size != MX25L25635F_FLASH_SIZE) {
+        fprintf(stderr, "flash_emulator: %s is not a %d byte image.\n", p_image_path, MX25L25635F_FLASH_SIZE);
+        APP_ERROR_CHECK(NRF_ERROR_INVALID_LENGTH);
+    }
+    m_context.p_memory = mmap(NULL, MX25L25635F_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_context.fd, 0);
+    if(m_context.p_memory == MAP_FAILED) {
+        perror(p_image_path);
+        APP_ERROR_CHECK(NRF_ERROR_NO_MEM);
+    }
+    if(is_new_image) {
+        memset(m_context.p_memory, 0xff, MX25L25635F_FLASH_SIZE);
+    }
+}
+
+void flashEmulatorDeinit(void)
+{
+    unmapMemory();
+}
+
+void flashEmulatorSetTiming(const flash_emulator_timing_t *p_timing)
+{
+    m_context.timing = *p_timing;
+}
+
+void flashEmulatorGetTiming(flash_emulator_timing_t *p_timing)
+{
+    *p_timing = m_context.timing;
+}
+
+void flashEmulatorSetTimeHandler(flash_emulator_time_handler_t handler)
+{
+    m_context.timeHandler = handler;
+}
+
+void flashEmulatorAdvance(uint32_t us)
+{
+    const uint64_t target = m_context.now + (uint64_t)us * 1000;
+    runDevice(target, false);
+    setCPUTime(target);
+}
+
+void flashEmulatorPowerFail(void)
+{
+    runDevice(m_context.now, false);
+
+    // 実行中の書き込み/消去は、反映しない
+    memset(&(m_context.queue),           0, sizeof(emulator_command_queue_t));
+    memset(&(m_context.backgroundQueue), 0, sizeof(emulator_command_queue_t));
+    m_context.p_current        = NULL;
+    m_context.isEraseSuspended = false;
+    m_context.isPowerDown      = false;
+    m_context.deviceTime       = m_context.now;
+}
+
+uint64_t flashEmulatorGetTime(void)
+{
+    return m_context.now / 1000;
+}
+
+const uint8_t *flashEmulatorGetMemory(void)
+{
+    return m_context.p_memory;
+}
+
+void flashEmulatorGetStatistics(flash_emulator_statistics_t *p_statistics)
+{
+    *p_statistics = m_context.emulatorStatistics;
+    p_statistics->elapsedUs = (m_context.now - m_context.statisticsStartTime) / 1000;
+}
+
+void flashEmulatorClearStatistics(void)
+{
+    const uint32_t max_erase_count = m_context.emulatorStatistics.maxSectorEraseCount;
+    memset(&(m_context.emulatorStatistics), 0, sizeof(flash_emulator_statistics_t));
+    m_context.emulatorStatistics.maxSectorEraseCount = max_erase_count;
+    m_context.statisticsStartTime = m_context.now;
+    flashMemoryClearStatistics();
+}
+
+/**
+ * spi_slave_mx25_flash_memory.h
+ */
+void initFlashMemory(void)
+{
+    ASSERT(m_context.p_memory != NULL);
+
+    memset(&(m_context.queue), 0, sizeof(emulator_command_queue_t));
+    memset(&(m_context.backgroundQueue), 0, sizeof(emulator_command_queue_t));
+    m_context.p_current        = NULL;
+    m_context.isEraseSuspended = false;
+    m_context.isPowerDown      = false;
+}
+
+bool isFlashBusy(void)
+{
+    runDevice(m_context.now, false);
+    return (m_context.p_current != NULL);
+}
+
+bool isFlashCommandQueueEmpty(void)
+{
+    runDevice(m_context.now, false);
+    return (m_context.queue.count == 0 && m_context.backgroundQueue.count == 0);
+}
+
+void waitFlashCommandQueueEmpty(void)
+{
+    while( ! isFlashCommandQueueEmpty() ) {
+        waitFlashCommandProgress();
+    }
+}
+
+// 現在時刻までに完了するコマンドがなければ、次のコマンド完了まで模擬時刻を進めます。
+void waitFlashCommandProgress(void)
+{
+    if(runDevice(m_context.now, false)) {
+        return;
+    }
+    if(m_context.queue.count == 0 && m_context.backgroundQueue.count == 0) {
+        // 待っている条件が、フラッシュのコマンドでは満たされない
+        fprintf(stderr, "flash_emulator: waiting with an empty command queue.\n");
+        APP_ERROR_CHECK(NRF_ERROR_INVALID_STATE);
+    }
+
+    runDevice(UINT64_MAX, true);
+    if(m_context.deviceTime > m_context.now) {
+        m_context.emulatorStatistics.stallUs += (m_context.deviceTime - m_context.now) / 1000;
+        m_context.emulatorStatistics.stallCount++;
+        setCPUTime(m_context.deviceTime);
+    }
+}
+
+void writeFlashAsync(uint32_t address, uint8_t *p_buffer, uint32_t size, flash_command_callback_t callback, void *p_context)
+{
+    ASSERT((address + size) <= MX25L25635F_FLASH_SIZE);
+
+    // ページ境界で分割して書き込む。コールバックは最後のページにのみ設定する。
+    while(size > 0) {
+        uint32_t length  = MIN(size, MX25L25635F_PAGE_SIZE - (address % MX25L25635F_PAGE_SIZE));
+        bool     is_last = (length == size);
+        emulator_command_t command;
+        setCommand(&command, EMULATOR_COMMAND_PROGRAM, address, length, p_buffer,
+                   is_last ? callback : NULL, is_last ? p_context : NULL);
+        enqueueCommand(&m_context.queue, &command);
+
+        address  += length;
+        p_buffer += length;
+        size     -= length;
+    }
+}
+
+void readFlashAsync(uint32_t address, uint8_t *p_buffer, uint32_t size, flash_command_callback_t callback, void *p_context)
+{
+    ASSERT((address + size) <= MX25L25635F_FLASH_SIZE);
+
+    emulator_command_t command;
+    setCommand(&command, EMULATOR_COMMAND_READ, address, size, p_buffer, callback, p_context);
+    enqueueCommand(&m_context.queue, &command);
+}
+
+void erase4kSectorAsync(uint32_t address, flash_command_callback_t callback, void *p_context)
+{
+    enqueueErase(&m_context.queue, address, MX25L25635F_SECTOR_SIZE, callback, p_context);
+}
+
+void eraseFlashAsync(uint32_t address, uint32_t size, flash_command_callback_t callback, void *p_context)
+{
+    ASSERT((address % MX25L25635F_SECTOR_SIZE) == 0);
+    ASSERT((size    % MX25L25635F_SECTOR_SIZE) == 0);
+
+    while(size > 0) {
+        // アドレスの境界と残りサイズから、使える最大の消去単位を選ぶ
+        uint32_t unit;
+        if((address % MX25L25635F_BLOCK64K_SIZE) == 0 && size >= MX25L25635F_BLOCK64K_SIZE) {
+            unit = MX25L25635F_BLOCK64K_SIZE;
+        } else if((address % MX25L25635F_BLOCK32K_SIZE) == 0 && size >= MX25L25635F_BLOCK32K_SIZE) {
+            unit = MX25L25635F_BLOCK32K_SIZE;
+        } else {
+            unit = MX25L25635F_SECTOR_SIZE;
+        }
+
+        const bool is_last = (size == unit);
+        enqueueErase(&m_context.queue, address, unit, is_last ? callback : NULL, is_last ? p_context : NULL);
+
+        address += unit;
+        size    -= unit;
+    }
+}
+
+void erase4kSectorInBackground(uint32_t address, flash_command_callback_t callback, void *p_context)
+{
+    enqueueErase(&m_context.backgroundQueue, address, MX25L25635F_SECTOR_SIZE, callback, p_context);
+}
+
+void writeFlash(uint32_t address, uint8_t *p_buffer, uint32_t size)
+{
+    volatile bool is_completed = false;
+    writeFlashAsync(address, p_buffer, size, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
+}
+
+void readFlashSequential(uint32_t address, uint8_t *p_buffer, uint32_t size)
+{
+    if(size == 0) {
+        return ;
+    }
+
+    volatile bool is_completed = false;
+    readFlashAsync(address, p_buffer, size, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
+}
+
+void readFlash(uint32_t address, uint8_t *p_buffer, uint8_t size)
+{
+    readFlashSequential(address, p_buffer, size);
+}
+
+void erase4kSector(uint32_t address)
+{
+    volatile bool is_completed = false;
+    erase4kSectorAsync(address, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
+}
+
+void formatFlash(uint32_t address, int size)
+{
+    ASSERT(size >= 0);
+
+    if(size == 0) {
+        return;
+    }
+
+    volatile bool is_completed = false;
+    eraseFlashAsync(address, (uint32_t)size, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
+}
+
+void flashMemoryGetStatistics(flash_memory_statistics_t *p_statistics)
+{
+    *p_statistics = m_context.statistics;
+}
+
+void flashMemoryClearStatistics(void)
+{
+    memset(&(m_context.statistics), 0, sizeof(flash_memory_statistics_t));
+}
+
+void flashMemoryEnterDeepPowerDown(void)
+{
+    waitFlashCommandQueueEmpty();
+    m_context.isPowerDown = true;
+}
+
+void flashMemoryReleasePowerDown(void)
+{
+    m_context.isPowerDown = false;
+}
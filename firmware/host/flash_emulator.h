@@ -0,0 +1,78 @@
+#ifndef flash_emulator_h
+#define flash_emulator_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+
+/**
+ * ホスト(Linux)で、spi_slave_mx25_flash_memory.c の代わりにリンクする、MX25L25635Fのエミュレータ。
+ * spi_slave_mx25_flash_memory.h のAPIをそのまま提供し、32MBのメモリ配列をRAM、またはファイルをmmapして保持します。
+ *
+ * NORフラッシュの振る舞い:
+ *  - プログラムはビットを0にすることしかできない(書き込み値は元の値とのAND)。0を1にしようとしたバイトは違反として数える。
+ *  - 消去はバイトを0xFFにする。消去単位は4KB/32KB/64KB。
+ *  - ページプログラムはページ(256バイト)の中で折り返す。
+ *
+ * 時間のモデル:
+ *  - CPUの模擬時刻(now)と、フラッシュが処理を終えた時刻を別々に持つ。コマンドはキューの順に、フラッシュが空き次第実行される。
+ *  - コマンドの時間 = SPI転送時間 + 書き込み/消去のビジー時間(WIP)。ビジー時間は、ドライバのポーリング間隔に切り上げる。
+ *  - バックグラウンドの消去は、通常のコマンドが積まれるとサスペンドされ、通常のコマンドの後で再開される。
+ *  - 完了コールバックは、そのコマンドの完了時刻に達した時に呼び出される(割り込みの代わり)。
+ *  - 完了待ちのループ(waitFlashCommandProgress)では、模擬時刻を次のコマンド完了まで進め、その時間をストール時間として数える。
+ */
+
+// 時間のパラメータ(マイクロ秒)。既定値は flashEmulatorInit() で設定されます。
+typedef struct {
+    uint32_t spiBytePeriodNs;   // SPIの1バイトの転送時間(ナノ秒)。8MHzで1000ns。
+    uint32_t pageProgramUs;     // tPP
+    uint32_t sectorEraseUs;     // tSE (4KB)
+    uint32_t block32kEraseUs;   // tBE32 (32KB)
+    uint32_t block64kEraseUs;   // tBE (64KB)
+    uint32_t suspendLatencyUs;  // バックグラウンドの消去をサスペンドするまでの時間(ポーリング待ち+tESL)
+    uint32_t resumeLatencyUs;   // 消去を再開してから、消去が進み始めるまでの時間
+} flash_emulator_timing_t;
+
+// エミュレータの統計
+typedef struct {
+    uint64_t elapsedUs;            // 統計をクリアしてからの、CPUの模擬時刻の経過時間
+    uint64_t busyUs;               // フラッシュがコマンドを実行していた時間
+    uint64_t stallUs;              // CPUがコマンドの完了を待って止まっていた時間
+    uint32_t stallCount;           // 完了待ちが発生した回数
+    uint64_t readBytes;            // 読み出したバイト数
+    uint64_t programBytes;         // プログラムしたバイト数
+    uint64_t eraseBytes;           // 消去したバイト数
+    uint32_t programViolationCount;// 消去されていないビットを1にしようとしたバイト数
+    uint32_t maxSectorEraseCount;  // セクターごとの消去回数の最大値
+} flash_emulator_statistics_t;
+
+// エミュレータを初期化します。p_image_pathがNULLならRAMに、そうでなければそのファイルをmmapしてフラッシュの内容を保持します。
+// 新しく作ったファイル、およびRAMの内容は、消去済み(0xFF)です。
+void flashEmulatorInit(const char *p_image_path);
+// エミュレータを終了します。mmapしたファイルは同期されます。
+void flashEmulatorDeinit(void);
+
+void flashEmulatorSetTiming(const flash_emulator_timing_t *p_timing);
+void flashEmulatorGetTiming(flash_emulator_timing_t *p_timing);
+
+// 模擬時刻が進んだ時に呼び出されるハンドラ。from_usからto_usまでの間に発生する、フラッシュ以外の割り込み(タイマーなど)を処理します。
+// 完了待ちでCPUが止まっている間も呼び出されます。ハンドラの中からフラッシュのAPIを呼び出さないこと。
+typedef void (*flash_emulator_time_handler_t)(uint64_t from_us, uint64_t to_us);
+void flashEmulatorSetTimeHandler(flash_emulator_time_handler_t handler);
+
+// CPUの模擬時刻を進めます。その間に完了したコマンドのコールバックが呼び出されます。
+void flashEmulatorAdvance(uint32_t us);
+// 電源断を模擬します。現在時刻までに完了したコマンドだけが反映され、キューに残ったコマンドは捨てられます(コールバックは呼ばれない)。
+void flashEmulatorPowerFail(void);
+// CPUの模擬時刻を返します。
+uint64_t flashEmulatorGetTime(void);
+
+// フラッシュの内容を、キューを介さずに直接参照します。テストでの確認用。
+const uint8_t *flashEmulatorGetMemory(void);
+
+void flashEmulatorGetStatistics(flash_emulator_statistics_t *p_statistics);
+// 統計をクリアします。flashMemoryClearStatistics()も呼び出します。セクターごとの消去回数はクリアしません。
+void flashEmulatorClearStatistics(void);
+
+#endif /* flash_emulator_h */
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nrf.h>
+#include <nrf_soc.h>
+#include <nrf_delay.h>
+#include <app_error.h>
+#include <app_scheduler.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// スケジューラのキュー。実機の SCHED_QUEUE_SIZE と同じ深さ。
+#define HOST_SCHED_QUEUE_SIZE     20
+#define HOST_SCHED_MAX_EVENT_SIZE 32
+
+typedef struct {
+    app_sched_event_handler_t handler;
+    uint16_t event_size;
+    uint8_t  data[HOST_SCHED_MAX_EVENT_SIZE];
+} host_sched_event_t;
+
+typedef struct {
+    host_sched_event_t events[HOST_SCHED_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+
+    bool     isTimer2Running;
+    uint32_t timer2Counter;        // 最後に反映した時刻の、カウンタの値
+    uint64_t timer2CounterUs;      // カウンタを最後に反映した模擬時刻
+    bool     isInTimer2Interrupt;
+    uint64_t timer2InterruptUs;    // 割り込みハンドラの実行中は、コンペアが一致した時刻
+    uint32_t timer2InterruptCount;
+    uint64_t timer2RunningUs;      // TIMER2が動いていた時間の合計
+
+    bool     isRtc2Running;
+    uint64_t rtc2Ticks;            // 最後に反映した時刻の、カウンタの値(24ビットに切り詰める前)
+    uint64_t rtc2TicksUs;          // カウンタを最後に反映した模擬時刻
+    uint64_t rtc2Fraction;         // 最後に反映した時刻の、1カウントに満たない端数(マイクロ秒 x 32768)
+    bool     isInRtc2Interrupt;
+    uint64_t rtc2InterruptUs;
+    uint32_t rtc2InterruptCount;
+    uint64_t rtc2RunningUs;
+} host_platform_context_t;
+
+static host_platform_context_t m_context;
+
+// CHECK()が失敗した回数
+static int m_failure_count = 0;
+
+NRF_TIMER_Type host_timer2;
+NRF_RTC_Type   host_rtc2;
+CoreDebug_Type host_core_debug;
+DWT_Type       host_dwt;
+uint32_t       SystemCoreClock = 64000000;
+
+// senstick_sensor_controller.c
+extern void TIMER2_IRQHandler(void);
+extern void RTC2_IRQHandler(void);
+
+#define RTC_FREQUENCY    32768
+#define RTC_COUNTER_MASK 0xffffff
+
+/**
+ * Private methods
+ */
+// TIMER2のカウンタのビット幅のマスク
+static uint32_t getTimer2CounterMask(void)
+{
+    return (host_timer2.BITMODE == TIMER_BITMODE_BITMODE_32Bit) ? 0xffffffff : 0xffff;
+}
+
+// カウンタを、模擬時刻now_usまで進めます。
+static void advanceTimer2Counter(uint64_t now_us)
+{
+    if(now_us <= m_context.timer2CounterUs) {
+        return;
+    }
+    if(m_context.isTimer2Running) {
+        m_context.timer2Counter = (uint32_t)(m_context.timer2Counter + (now_us - m_context.timer2CounterUs)) & getTimer2CounterMask();
+        m_context.timer2RunningUs += now_us - m_context.timer2CounterUs;
+    }
+    m_context.timer2CounterUs = now_us;
+}
+
+// TIMER2のタスクレジスタへの書き込みを、模擬時刻now_usで反映します。
+static void updateTimer2Tasks(uint64_t now_us)
+{
+    advanceTimer2Counter(now_us);
+    if(host_timer2.TASKS_SHUTDOWN || host_timer2.TASKS_STOP) {
+        host_timer2.TASKS_SHUTDOWN = 0;
+        host_timer2.TASKS_STOP     = 0;
+        m_context.isTimer2Running  = false;
+    }
+    if(host_timer2.TASKS_CLEAR) {
+        host_timer2.TASKS_CLEAR = 0;
+        m_context.timer2Counter = 0;
+    }
+    if(host_timer2.TASKS_START) {
+        host_timer2.TASKS_START   = 0;
+        m_context.isTimer2Running = true;
+    }
+    for(int i = 0; i < 6; i++) {
+        if(host_timer2.TASKS_CAPTURE[i]) {
+            host_timer2.TASKS_CAPTURE[i] = 0;
+            host_timer2.CC[i] = m_context.timer2Counter;
+        }
+    }
+}
+
+// RTC2のカウンタを、模擬時刻now_usまで進めます。
+static void advanceRtc2Counter(uint64_t now_us)
+{
+    if(now_us <= m_context.rtc2TicksUs) {
+        return;
+    }
+    if(m_context.isRtc2Running) {
+        const uint64_t scaled   = (now_us - m_context.rtc2TicksUs) * RTC_FREQUENCY + m_context.rtc2Fraction;
+        m_context.rtc2Ticks    += scaled / 1000000;
+        m_context.rtc2Fraction  = scaled % 1000000;
+        m_context.rtc2RunningUs += now_us - m_context.rtc2TicksUs;
+    }
+    m_context.rtc2TicksUs = now_us;
+}
+
+// RTC2のタスクレジスタへの書き込みを、模擬時刻now_usで反映し、COUNTERを更新します。
+static void updateRtc2Tasks(uint64_t now_us)
+{
+    advanceRtc2Counter(now_us);
+    if(host_rtc2.TASKS_STOP) {
+        host_rtc2.TASKS_STOP    = 0;
+        m_context.isRtc2Running = false;
+    }
+    if(host_rtc2.TASKS_CLEAR) {
+        host_rtc2.TASKS_CLEAR  = 0;
+        m_context.rtc2Ticks    = 0;
+        m_context.rtc2Fraction = 0;
+    }
+    if(host_rtc2.TASKS_START) {
+        host_rtc2.TASKS_START   = 0;
+        m_context.isRtc2Running = true;
+    }
+    host_rtc2.COUNTER = (uint32_t)(m_context.rtc2Ticks & RTC_COUNTER_MASK);
+}
+
+// from_usからto_usまでの間の、RTC2のコンペア割り込みを発生させます。
+static void dispatchRtc2Interrupts(uint64_t from_us, uint64_t to_us)
+{
+    updateRtc2Tasks(from_us);
+    while(m_context.isRtc2Running) {
+        // 次にカウンタがCC[0]に一致する時刻。今一致していれば、一周後。
+        uint64_t interval = (host_rtc2.CC[0] - m_context.rtc2Ticks) & RTC_COUNTER_MASK;
+        if(interval == 0) {
+            interval = (uint64_t)RTC_COUNTER_MASK + 1;
+        }
+        // カウンタが進む時刻(端数を考慮して切り上げ)
+        const uint64_t compare_us = m_context.rtc2TicksUs + (interval * 1000000 - m_context.rtc2Fraction + RTC_FREQUENCY - 1) / RTC_FREQUENCY;
+        if(compare_us > to_us) {
+            break;
+        }
+        updateRtc2Tasks(compare_us);
+        host_rtc2.EVENTS_COMPARE[0] = 1;
+        m_context.rtc2InterruptCount++;
+        m_context.isInRtc2Interrupt = true;
+        m_context.rtc2InterruptUs   = compare_us;
+        RTC2_IRQHandler();
+        m_context.isInRtc2Interrupt = false;
+        updateRtc2Tasks(compare_us);
+    }
+    updateRtc2Tasks(to_us);
+}
+
+// 模擬時刻が進んだ時に、その間のTIMER2とRTC2のコンペア割り込みと、センサーの割り込みを発生させます。
+static void timeHandler(uint64_t from_us, uint64_t to_us)
+{
+    updateTimer2Tasks(from_us);
+    while(m_context.isTimer2Running) {
+        // 次にカウンタがCC[0]に一致する時刻。今一致していれば、一周後。
+        const uint32_t mask = getTimer2CounterMask();
+        uint64_t interval = (host_timer2.CC[0] - m_context.timer2Counter) & mask;
+        if(interval == 0) {
+            interval = (uint64_t)mask + 1;
+        }
+        const uint64_t compare_us = m_context.timer2CounterUs + interval;
+        if(compare_us > to_us) {
+            break;
+        }
+        advanceTimer2Counter(compare_us);
+        host_timer2.EVENTS_COMPARE[0] = 1;
+        m_context.timer2InterruptCount++;
+        m_context.isInTimer2Interrupt = true;
+        m_context.timer2InterruptUs   = compare_us;
+        TIMER2_IRQHandler();
+        m_context.isInTimer2Interrupt = false;
+        updateTimer2Tasks(compare_us);
+    }
+    updateTimer2Tasks(to_us);
+    dispatchRtc2Interrupts(from_us, to_us);
+    hostSensorDevicesAdvance(from_us, to_us);
+}
+
+/**
+ * Public methods
+ */
+void hostPlatformInit(const char *p_image_path)
+{
+    memset(&m_context, 0, sizeof(host_platform_context_t));
+    memset(&host_timer2, 0, sizeof(NRF_TIMER_Type));
+    memset(&host_rtc2, 0, sizeof(NRF_RTC_Type));
+
+    flashEmulatorInit(p_image_path);
+    flashEmulatorSetTimeHandler(timeHandler);
+}
+
+void hostPlatformReset(void)
+{
+    // 電源断。フラッシュの処理中のコマンドは失われ、タイマーとスケジューラのキューはクリアされる。
+    flashEmulatorPowerFail();
+    memset(&host_timer2, 0, sizeof(NRF_TIMER_Type));
+    m_context.isTimer2Running = false;
+    m_context.timer2Counter   = 0;
+    memset(&host_rtc2, 0, sizeof(NRF_RTC_Type));
+    m_context.isRtc2Running   = false;
+    m_context.rtc2Ticks       = 0;
+    m_context.head            = 0;
+    m_context.count           = 0;
+}
+
+// スケジューラのキューにある、呼び出した時点のイベントだけを処理します。
+// 処理中に積まれたイベントは、次の呼び出しで処理する。過負荷でタスクが自分を積み直し続けても、模擬時刻が進む。
+static void executeQueuedSchedulerEvents(void)
+{
+    uint16_t count = m_context.count;
+    while(count-- > 0 && m_context.count > 0) {
+        host_sched_event_t event = m_context.events[m_context.head];
+        m_context.head = (m_context.head + 1) % HOST_SCHED_QUEUE_SIZE;
+        m_context.count--;
+        (event.handler)(event.event_size > 0 ? event.data : NULL, event.event_size);
+    }
+}
+
+void hostPlatformRun(uint32_t ms)
+{
+    const uint64_t end_us = flashEmulatorGetTime() + (uint64_t)ms * 1000;
+    while(flashEmulatorGetTime() < end_us) {
+        executeQueuedSchedulerEvents();
+        flashEmulatorAdvance(1000);
+    }
+    executeQueuedSchedulerEvents();
+}
+
+NRF_TIMER_Type *hostTimer2Sync(void)
+{
+    updateTimer2Tasks(m_context.isInTimer2Interrupt ? m_context.timer2InterruptUs : flashEmulatorGetTime());
+    return &host_timer2;
+}
+
+NRF_RTC_Type *hostRtc2Sync(void)
+{
+    updateRtc2Tasks(m_context.isInRtc2Interrupt ? m_context.rtc2InterruptUs : flashEmulatorGetTime());
+    return &host_rtc2;
+}
+
+uint32_t hostPlatformGetTimer2InterruptCount(void)
+{
+    return m_context.timer2InterruptCount;
+}
+
+uint32_t hostPlatformGetRtc2InterruptCount(void)
+{
+    return m_context.rtc2InterruptCount;
+}
+
+void hostPlatformGetClockStatistics(host_clock_statistics_t *p_statistics)
+{
+    p_statistics->timer2RunningUs      = m_context.timer2RunningUs;
+    p_statistics->timer2InterruptCount = m_context.timer2InterruptCount;
+    p_statistics->rtc2RunningUs        = m_context.rtc2RunningUs;
+    p_statistics->rtc2InterruptCount   = m_context.rtc2InterruptCount;
+}
+
+void hostCheckFailed(const char *p_file, int line, const char *p_condition)
+{
+    fprintf(stderr, "%s:%d: CHECK failed: %s\n", p_file, line, p_condition);
+    m_failure_count++;
+}
+
+int hostTestResult(const char *p_name)
+{
+    if(m_failure_count > 0) {
+        fprintf(stderr, "%s: %d failures.\n", p_name, m_failure_count);
+        return 1;
+    }
+    printf("%s: OK\n", p_name);
+    return 0;
+}
+
+void hostBoot(void)
+{
+    initFlashMemory();
+    initLogController();
+    initSuperblockController();
+    initSenstickDataModel();
+    initMetaDataLogController();
+    initSenstickSensorController(0);
+    senstick_mountStorage();
+    senstick_setControlCommand(sensorShouldSleep);
+}
+
+void hostBootAndFormatStorage(void)
+{
+    hostBoot();
+    senstick_setControlCommand(formattingStorage);
+    waitFlashCommandQueueEmpty();
+}
+
+bool hostWriteSensorSetting(sensor_device_t device_type, sensor_service_command_t command, uint32_t period_us, uint8_t decimation)
+{
+    sensor_service_setting_t setting = { command, 0, 0, period_us, decimation };
+    uint8_t buffer[SENSOR_SERVICE_SETTING_MAX_SIZE];
+    uint8_t length = serializesensor_service_setting(buffer, &setting);
+    return senstickSensorControllerWriteSetting(device_type, buffer, length);
+}
+
+void host_app_error_handler(uint32_t error_code, uint32_t line_num, const char *p_file_name)
+{
+    fprintf(stderr, "error 0x%x at %s:%u (t=%llu us)\n", error_code, p_file_name, line_num, (unsigned long long)flashEmulatorGetTime());
+    abort();
+}
+
+void nrf_delay_us(uint32_t us)
+{
+    flashEmulatorAdvance(us);
+}
+
+void nrf_delay_ms(uint32_t ms)
+{
+    flashEmulatorAdvance(ms * 1000);
+}
+
+uint32_t sd_nvic_ClearPendingIRQ(IRQn_Type IRQn)
+{
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_nvic_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_nvic_EnableIRQ(IRQn_Type IRQn)
+{
+    return NRF_SUCCESS;
+}
+
+/**
+ * app_scheduler.h
+ */
+uint32_t app_sched_event_put(void *p_event_data, uint16_t event_size, app_sched_event_handler_t handler)
+{
+    if(event_size > HOST_SCHED_MAX_EVENT_SIZE) {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if(m_context.count >= HOST_SCHED_QUEUE_SIZE) {
+        return NRF_ERROR_NO_MEM;
+    }
+    host_sched_event_t *p_event = &(m_context.events[(m_context.head + m_context.count) % HOST_SCHED_QUEUE_SIZE]);
+    p_event->handler    = handler;
+    p_event->event_size = event_size;
+    if(p_event_data != NULL && event_size > 0) {
+        memcpy(p_event->data, p_event_data, event_size);
+    }
+    m_context.count++;
+    return NRF_SUCCESS;
+}
+
+void app_sched_execute(void)
+{
+    while(m_context.count > 0) {
+        host_sched_event_t event = m_context.events[m_context.head];
+        m_context.head = (m_context.head + 1) % HOST_SCHED_QUEUE_SIZE;
+        m_context.count--;
+        (event.handler)(event.event_size > 0 ? event.data : NULL, event.event_size);
+    }
+}
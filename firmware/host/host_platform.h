@@ -0,0 +1,81 @@
+#ifndef host_platform_h
+#define host_platform_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "twi_slave_nine_axes_sensor.h"
+#include "senstick_sensor_base_data.h"
+
+/**
+ * ホストビルドの実行環境。SDKのスケジューラ、メールボックス、TIMER2とRTC2の割り込みを、フラッシュエミュレータの模擬時刻の上で再現します。
+ */
+
+// フラッシュエミュレータを初期化し、模擬時刻の割り込みハンドラを登録します。p_image_pathはflashEmulatorInit()に渡されます。
+void hostPlatformInit(const char *p_image_path);
+
+// 電源断からのリセットを模擬します。フラッシュのキューに残ったコマンド、TIMER2、スケジューラのキューを破棄します。
+// ファームウェアの状態は、呼び出し側が初期化関数を呼び直して初期化すること。
+void hostPlatformReset(void);
+
+// メインループを、模擬時刻でmsミリ秒分実行します。1ミリ秒ごとにスケジューラのイベントを処理します。
+void hostPlatformRun(uint32_t ms);
+
+// hostPlatformInit()からの、TIMER2の割り込みの回数を返します。
+uint32_t hostPlatformGetTimer2InterruptCount(void);
+// hostPlatformInit()からの、RTC2の割り込みの回数を返します。
+uint32_t hostPlatformGetRtc2InterruptCount(void);
+
+// サンプリングクロックの統計。TIMER2が動いている間はHFCLKが動き続ける。RTC2はLFCLKで動く。
+typedef struct {
+    uint64_t timer2RunningUs;
+    uint32_t timer2InterruptCount;
+    uint64_t rtc2RunningUs;
+    uint32_t rtc2InterruptCount;
+} host_clock_statistics_t;
+// hostPlatformInit()からの、サンプリングクロックの統計を返します。
+void hostPlatformGetClockStatistics(host_clock_statistics_t *p_statistics);
+
+// 模擬時刻が進んだ時に、from_usからto_usまでの間に発生する、センサーの割り込み(9軸センサーのINTピン)を処理します。host_sensor_devices.c
+void hostSensorDevicesAdvance(uint64_t from_us, uint64_t to_us);
+// 加速度とジャイロの読み出し(startNineAxesMotionRead())の回数を返します。host_sensor_devices.c
+uint32_t hostSensorDevicesGetMotionReadCount(void);
+// 加速度、ジャイロ、地磁気の読み出しで、データレディ割り込みを使っていない時に返すサンプルを指定します。NULLなら合成データに戻す。host_sensor_devices.c
+void hostSensorDevicesSetMotionSample(const NineAxesFifoData_t *p_sample);
+// 次のcount回のrequestNineAxesMotionData()を、前の読み出しが終わっていないとして断ります。TWIが混んでいる時の模擬。host_sensor_devices.c
+void hostSensorDevicesRejectMotionRequests(uint32_t count);
+// 周期読み出し(startNineAxesSensorPeriodicRead())で、ハンドラにバッチを渡した回数を返します。host_sensor_devices.c
+uint32_t hostSensorDevicesGetPeriodicReadBatchCount(void);
+
+// I2Cバスの模擬の統計。読み出しは積まれた模擬時刻から順にバスを使い、バスが空くまでの連続した転送を1つのバーストとする。host_sensor_devices.c
+typedef struct {
+    uint32_t burstCount;   // バーストの数
+    uint32_t maxBurstUs;   // 最も長いバーストの時間。サンプリングの1回の割り込みが積む、I2Cの転送の最悪の長さ。
+    uint64_t totalBusUs;   // バスを使った時間の合計
+} host_bus_statistics_t;
+void hostSensorDevicesGetBusStatistics(host_bus_statistics_t *p_statistics);
+void hostSensorDevicesClearBusStatistics(void);
+
+/**
+ * テストの共通処理。
+ */
+// 条件が成り立たなければ、場所と条件を表示して、失敗を数えます。
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        hostCheckFailed(__FILE__, __LINE__, #cond); \
+    } \
+} while(0)
+void hostCheckFailed(const char *p_file, int line, const char *p_condition);
+// テストの結果を表示して、プロセスの終了コードを返します。失敗がなければ "p_name: OK" を表示して0を返します。
+int hostTestResult(const char *p_name);
+
+// 起動時の処理(main.c)。フラッシュ、ログ、スーパーブロック、データモデル、センサーコントローラを初期化し、ストレージをマウントして、センサーを止めます。
+void hostBoot(void);
+// hostBoot()の後、ストレージをフォーマットします。フォーマットの完了まで待ちます。
+void hostBootAndFormatStorage(void);
+
+// センサーの設定を、BLEの書き込みと同じくシリアライズして書き込みます。設定が受け入れられなければfalseを返します。
+// period_usはマイクロ秒の周期。ミリ秒の倍数なら、コントローラがミリ秒の周期に直す。decimationは間引き(0または1なら使わない)。
+bool hostWriteSensorSetting(sensor_device_t device_type, sensor_service_command_t command, uint32_t period_us, uint8_t decimation);
+
+#endif /* host_platform_h */
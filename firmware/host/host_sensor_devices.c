@@ -0,0 +1,405 @@
+#include <string.h>
+
+#include "twi_slave_nine_axes_sensor.h"
+#include "twi_slave_brightness_sensor.h"
+#include "twi_slave_humidity_sensor.h"
+#include "twi_slave_pressure_sensor.h"
+#include "twi_slave_uv_sensor.h"
+#include "senstick_sensor_base.h"
+#include "acceleration_sensor_base.h"
+#include "gyro_sensor_base.h"
+#include "magnetic_sensor_base.h"
+#include "brightness_sensor_base.h"
+#include "uv_sensor_base.h"
+#include "humidity_sensor_base.h"
+#include "pressure_sensor_base.h"
+#include "orientation_sensor_base.h"
+#include "twi_manager.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+/**
+ * ホストビルドで、TWIのセンサードライバを置き換えるスタブ。
+ * センサーは全て初期化に成功し、呼び出しごとに値が変わる合成データを返します。
+ * 読み出しの要求(request...())は、TWIのキューを介さず、その場でハンドラを呼び出して完了します。
+ * I2Cバスの時間は、サンプルのデータの読み出しごとに、センサーのbusTimeUs(senstick_sensor_base_t)を使うものとして数えます。
+ */
+
+static uint16_t m_counter;
+
+// 9軸センサーのFIFO。模擬時刻でperiod_msごとに1フレームが溜まる。フレームの値は、FIFOを開始してからのフレーム番号。
+typedef struct {
+    bool     isAcceleration;
+    bool     isRotationRate;
+    uint8_t  periodMs;
+    uint64_t startUs;
+    uint32_t readFrames;
+} host_nine_axes_fifo_t;
+static host_nine_axes_fifo_t m_fifo;
+
+// 9軸センサーのデータレディ割り込み。模擬時刻でperiod_msごとにハンドラを呼び出す。
+// その間の加速度とジャイロのデータは、割り込みを開始してからのサンプル番号(加速度はn、ジャイロは-n)。
+typedef struct {
+    nine_axes_data_ready_handler_t handler;
+    uint8_t  periodMs;
+    uint64_t nextUs;
+    int16_t  sampleNumber;
+} host_nine_axes_data_ready_t;
+static host_nine_axes_data_ready_t m_data_ready;
+
+// 加速度、ジャイロ、地磁気(I2Cマスター)の読み出しステージ。startNineAxesMotionRead()で、要求されたハンドラに同じサンプルを渡す。
+// isFixedSampleなら、データレディ割り込みを使っていない時のサンプルは、合成データの代わりにfixedSample。
+typedef struct {
+    sensor_data_ready_handler_t accelerationHandler;
+    sensor_data_ready_handler_t rotationRateHandler;
+    sensor_data_ready_handler_t magneticFieldHandler;
+    nine_axes_motion_handler_t  sampleHandler;
+    uint32_t           sampleTimestampUs;
+    uint32_t           rejectedSampleRequests; // requestNineAxesMotionData()を、TWIが混んでいるとして断る残りの回数
+    bool               isFixedSample;
+    NineAxesFifoData_t fixedSample;
+    uint32_t readCount;
+} host_nine_axes_motion_read_t;
+static host_nine_axes_motion_read_t m_motion_read;
+
+// ハードウェアの周期読み出し。模擬時刻でperiod_usごとに1サンプルを読み出し、batch_sizeのサンプルごとにハンドラを呼び出す。
+// サンプルの値は、開始してからのサンプル番号(加速度と地磁気はn、ジャイロは-n)。
+typedef struct {
+    nine_axes_fifo_handler_t handler;
+    bool     isMagneticField;
+    uint32_t periodUs;
+    uint8_t  batchSize;
+    uint64_t startUs;
+    uint32_t readSamples;
+    uint32_t batchCount;
+} host_nine_axes_periodic_read_t;
+static host_nine_axes_periodic_read_t m_periodic_read;
+
+// I2Cバスの模擬。busyUntilUsまでバスが使われている。
+typedef struct {
+    uint64_t burstStartUs;
+    uint64_t busyUntilUs;
+    host_bus_statistics_t statistics;
+} host_bus_t;
+static host_bus_t m_bus;
+
+// 今の模擬時刻に、bus_usマイクロ秒の読み出しを積みます。バスが使用中なら、前の読み出しに続けて転送する。
+static void useBus(uint32_t bus_us)
+{
+    const uint64_t now = flashEmulatorGetTime();
+    if(now >= m_bus.busyUntilUs) {
+        m_bus.burstStartUs = now;
+        m_bus.busyUntilUs  = now;
+        m_bus.statistics.burstCount++;
+    }
+    m_bus.busyUntilUs += bus_us;
+    m_bus.statistics.totalBusUs += bus_us;
+    m_bus.statistics.maxBurstUs  = MAX(m_bus.statistics.maxBurstUs, (uint32_t)(m_bus.busyUntilUs - m_bus.burstStartUs));
+}
+
+void hostSensorDevicesGetBusStatistics(host_bus_statistics_t *p_statistics)
+{
+    *p_statistics = m_bus.statistics;
+}
+
+void hostSensorDevicesClearBusStatistics(void)
+{
+    memset(&(m_bus.statistics), 0, sizeof(host_bus_statistics_t));
+}
+
+static void fillSyntheticData(uint8_t *p_data, int length)
+{
+    for(int i=0; i < length; i++) {
+        p_data[i] = (uint8_t)(m_counter + i * 37);
+    }
+    m_counter++;
+}
+
+// 読み出しの要求は、その場で完了してハンドラを呼び出す(TWIのキューが常に空いている場合)。
+static bool requestSyntheticData(sensor_data_ready_handler_t handler, uint8_t length)
+{
+    uint8_t data[MAX_SENSOR_RAW_DATA_SIZE];
+    fillSyntheticData(data, length);
+    (handler)(data, length);
+    return true;
+}
+
+// twi_slave_nine_axes_sensor.h
+bool initNineAxesSensor(void) { return true; }
+void sleepNineAxesSensor(void)
+{
+    memset(&m_fifo, 0, sizeof(m_fifo));
+    memset(&m_data_ready, 0, sizeof(m_data_ready));
+    m_motion_read.accelerationHandler = NULL;
+    m_motion_read.rotationRateHandler  = NULL;
+    m_motion_read.magneticFieldHandler = NULL;
+    m_motion_read.sampleHandler        = NULL;
+    stopNineAxesSensorPeriodicRead();
+}
+void awakeNineAxesSensor(void) { }
+void setNineAxesSensorAccelerationRange(AccelerationRange_t range) { }
+static RotationRange_t m_rotation_range;
+void setNineAxesSensorRotationRange(RotationRange_t range) { m_rotation_range = range; }
+RotationRange_t getNineAxesSensorRotationRange(void) { return m_rotation_range; }
+void setNineAxesSensorFifo(bool acceleration, bool rotation_rate, uint8_t period_ms)
+{
+    m_fifo.isAcceleration = acceleration && (period_ms > 0);
+    m_fifo.isRotationRate = rotation_rate && (period_ms > 0);
+    m_fifo.periodMs       = period_ms;
+    m_fifo.startUs        = flashEmulatorGetTime();
+    m_fifo.readFrames     = 0;
+}
+uint8_t getNineAxesSensorFifoData(NineAxesFifoData_t *p_data, uint8_t max_count)
+{
+    if(!(m_fifo.isAcceleration || m_fifo.isRotationRate)) {
+        return 0;
+    }
+    const uint32_t frames = (uint32_t)((flashEmulatorGetTime() - m_fifo.startUs) / (m_fifo.periodMs * 1000));
+    uint8_t count = (frames - m_fifo.readFrames < max_count) ? (uint8_t)(frames - m_fifo.readFrames) : max_count;
+    for(int i = 0; i < count; i++) {
+        const int16_t n = (int16_t)(m_fifo.readFrames + i);
+        p_data[i].acceleration.x = n;
+        p_data[i].acceleration.y = n;
+        p_data[i].acceleration.z = n;
+        p_data[i].rotationRate.x = -n;
+        p_data[i].rotationRate.y = -n;
+        p_data[i].rotationRate.z = -n;
+    }
+    m_fifo.readFrames += count;
+    return count;
+}
+void setNineAxesSensorDataReady(uint8_t period_ms, nine_axes_data_ready_handler_t handler)
+{
+    m_data_ready.handler      = (period_ms > 0) ? handler : NULL;
+    m_data_ready.periodMs     = period_ms;
+    m_data_ready.nextUs       = flashEmulatorGetTime() + period_ms * 1000;
+    m_data_ready.sampleNumber = -1;
+}
+bool requestNineAxesSensorFifoData(nine_axes_fifo_handler_t handler)
+{
+    NineAxesFifoData_t samples[42];
+    uint8_t count;
+    while((count = getNineAxesSensorFifoData(samples, sizeof(samples) / sizeof(samples[0]))) > 0) {
+        // フレームごとに、加速度とジャイロのデータ(12バイト)
+        useBus(accelerationSensorBase.busTimeUs + (uint32_t)count * 12 * TWI_BYTE_TIME_NS / 1000);
+        (handler)(samples, count);
+    }
+    return true;
+}
+bool requestAccelerationData(sensor_data_ready_handler_t handler)
+{
+    if(m_motion_read.accelerationHandler != NULL) {
+        return false;
+    }
+    m_motion_read.accelerationHandler = handler;
+    return true;
+}
+bool requestRotationRateData(sensor_data_ready_handler_t handler)
+{
+    if(m_motion_read.rotationRateHandler != NULL) {
+        return false;
+    }
+    m_motion_read.rotationRateHandler = handler;
+    return true;
+}
+bool startNineAxesMotionRead(void)
+{
+    if(m_motion_read.accelerationHandler == NULL && m_motion_read.rotationRateHandler == NULL && m_motion_read.magneticFieldHandler == NULL
+       && m_motion_read.sampleHandler == NULL) {
+        return false;
+    }
+    // 1回の読み出しで、同じサンプルの加速度、ジャイロ、地磁気を取得する
+    AccelerationData_t  acceleration;
+    RotationRateData_t  rotation_rate;
+    MagneticFieldData_t magnetic_field;
+    if(m_data_ready.handler == NULL && m_motion_read.isFixedSample) {
+        acceleration   = m_motion_read.fixedSample.acceleration;
+        rotation_rate  = m_motion_read.fixedSample.rotationRate;
+        magnetic_field = m_motion_read.fixedSample.magneticField;
+    } else if(m_data_ready.handler == NULL) {
+        fillSyntheticData((uint8_t *)&acceleration,   sizeof(acceleration));
+        fillSyntheticData((uint8_t *)&rotation_rate,  sizeof(rotation_rate));
+        fillSyntheticData((uint8_t *)&magnetic_field, sizeof(magnetic_field));
+    } else {
+        acceleration.x   = acceleration.y   = acceleration.z   = m_data_ready.sampleNumber;
+        rotation_rate.x  = rotation_rate.y  = rotation_rate.z  = -m_data_ready.sampleNumber;
+        magnetic_field.x = magnetic_field.y = magnetic_field.z = m_data_ready.sampleNumber;
+    }
+    m_motion_read.readCount++;
+    // 1回の読み出しで、最も長い読み出しの時間に、他のセンサーのデータの転送時間を加える。姿勢の1サンプルは、全てのデータを読み出す。
+    const senstick_sensor_base_t *p_bases[] = { &accelerationSensorBase, &gyroSensorBase, &magneticSensorBase };
+    const bool is_sample = (m_motion_read.sampleHandler != NULL);
+    const bool is_requested[] = { is_sample || m_motion_read.accelerationHandler != NULL, is_sample || m_motion_read.rotationRateHandler != NULL, is_sample || m_motion_read.magneticFieldHandler != NULL };
+    uint32_t bus_us = 0;
+    uint32_t max_us = 0;
+    for(int i = 0; i < 3; i++) {
+        if(is_requested[i]) {
+            bus_us += p_bases[i]->rawSensorDataSize * TWI_BYTE_TIME_NS / 1000;
+            max_us  = MAX(max_us, p_bases[i]->busTimeUs - p_bases[i]->rawSensorDataSize * TWI_BYTE_TIME_NS / 1000);
+        }
+    }
+    useBus(bus_us + max_us);
+    
+    sensor_data_ready_handler_t acceleration_handler   = m_motion_read.accelerationHandler;
+    sensor_data_ready_handler_t rotation_rate_handler  = m_motion_read.rotationRateHandler;
+    sensor_data_ready_handler_t magnetic_field_handler = m_motion_read.magneticFieldHandler;
+    m_motion_read.accelerationHandler  = NULL;
+    m_motion_read.rotationRateHandler  = NULL;
+    m_motion_read.magneticFieldHandler = NULL;
+    nine_axes_motion_handler_t sample_handler = m_motion_read.sampleHandler;
+    m_motion_read.sampleHandler        = NULL;
+    if(acceleration_handler != NULL) {
+        (acceleration_handler)((const uint8_t *)&acceleration, sizeof(acceleration));
+    }
+    if(rotation_rate_handler != NULL) {
+        (rotation_rate_handler)((const uint8_t *)&rotation_rate, sizeof(rotation_rate));
+    }
+    if(magnetic_field_handler != NULL) {
+        (magnetic_field_handler)((const uint8_t *)&magnetic_field, sizeof(magnetic_field));
+    }
+    if(sample_handler != NULL) {
+        NineAxesFifoData_t sample = { acceleration, rotation_rate, magnetic_field };
+        (sample_handler)(&sample, m_motion_read.sampleTimestampUs);
+    }
+    return true;
+}
+bool requestNineAxesMotionData(nine_axes_motion_handler_t handler, uint32_t timestamp_us)
+{
+    if(m_motion_read.sampleHandler != NULL) {
+        return false;
+    }
+    if(m_motion_read.rejectedSampleRequests > 0) {
+        m_motion_read.rejectedSampleRequests--;
+        return false;
+    }
+    m_motion_read.sampleHandler     = handler;
+    m_motion_read.sampleTimestampUs = timestamp_us;
+    return true;
+}
+void hostSensorDevicesRejectMotionRequests(uint32_t count)
+{
+    m_motion_read.rejectedSampleRequests = count;
+}
+void hostSensorDevicesSetMotionSample(const NineAxesFifoData_t *p_sample)
+{
+    m_motion_read.isFixedSample = (p_sample != NULL);
+    if(p_sample != NULL) {
+        m_motion_read.fixedSample = *p_sample;
+    }
+}
+uint32_t hostSensorDevicesGetMotionReadCount(void)
+{
+    return m_motion_read.readCount;
+}
+// 周期読み出しで、to_usまでに読み出したサンプルを、max_countまでハンドラに渡します。
+static void deliverPeriodicReadSamples(uint64_t to_us, uint32_t max_count)
+{
+    NineAxesFifoData_t samples[TWI_PERIODIC_READ_MAX_BATCH_SIZE];
+    const uint32_t read_samples = (uint32_t)((to_us - m_periodic_read.startUs) / m_periodic_read.periodUs);
+    const uint32_t count        = MIN(read_samples - m_periodic_read.readSamples, max_count);
+    memset(samples, 0, sizeof(samples));
+    for(int i = 0; i < count; i++) {
+        const int16_t n = (int16_t)(m_periodic_read.readSamples + i);
+        samples[i].acceleration.x = samples[i].acceleration.y = samples[i].acceleration.z = n;
+        samples[i].rotationRate.x = samples[i].rotationRate.y = samples[i].rotationRate.z = -n;
+        if(m_periodic_read.isMagneticField) {
+            samples[i].magneticField.x = samples[i].magneticField.y = samples[i].magneticField.z = n;
+        }
+    }
+    m_periodic_read.readSamples += count;
+    if(count > 0) {
+        (m_periodic_read.handler)(samples, (uint8_t)count);
+    }
+}
+bool startNineAxesSensorPeriodicRead(bool magnetic_field, uint32_t period_us, uint8_t batch_size, nine_axes_fifo_handler_t handler)
+{
+    if(m_periodic_read.handler != NULL || period_us < TWI_PERIODIC_READ_MIN_PERIOD_US || batch_size == 0 || batch_size > TWI_PERIODIC_READ_MAX_BATCH_SIZE) {
+        return false;
+    }
+    m_periodic_read.handler         = handler;
+    m_periodic_read.isMagneticField = magnetic_field;
+    m_periodic_read.periodUs        = period_us;
+    m_periodic_read.batchSize       = batch_size;
+    m_periodic_read.startUs         = flashEmulatorGetTime();
+    m_periodic_read.readSamples     = 0;
+    return true;
+}
+uint32_t stopNineAxesSensorPeriodicRead(void)
+{
+    if(m_periodic_read.handler == NULL) {
+        return 0;
+    }
+    // 途中のバッチの残りを渡す
+    deliverPeriodicReadSamples(flashEmulatorGetTime(), m_periodic_read.batchSize);
+    m_periodic_read.handler = NULL;
+    return 0;
+}
+uint32_t hostSensorDevicesGetPeriodicReadBatchCount(void)
+{
+    return m_periodic_read.batchCount;
+}
+bool requestMagneticFieldData(sensor_data_ready_handler_t handler)
+{
+    if(m_motion_read.magneticFieldHandler != NULL) {
+        return false;
+    }
+    m_motion_read.magneticFieldHandler = handler;
+    return true;
+}
+
+void hostSensorDevicesAdvance(uint64_t from_us, uint64_t to_us)
+{
+    while(m_data_ready.handler != NULL && m_data_ready.nextUs <= to_us) {
+        m_data_ready.sampleNumber++;
+        m_data_ready.nextUs += m_data_ready.periodMs * 1000;
+        (m_data_ready.handler)();
+    }
+    while(m_periodic_read.handler != NULL
+          && m_periodic_read.startUs + (uint64_t)(m_periodic_read.readSamples + m_periodic_read.batchSize) * m_periodic_read.periodUs <= to_us) {
+        m_periodic_read.batchCount++;
+        deliverPeriodicReadSamples(to_us, m_periodic_read.batchSize);
+    }
+}
+
+// twi_slave_brightness_sensor.h
+bool initBrightnessSensor(void) { return true; }
+void triggerBrightnessData(void) { }
+bool requestBrightnessData(sensor_data_ready_handler_t handler)
+{
+    useBus(brightnessSensorBase.busTimeUs);
+    return requestSyntheticData(handler, sizeof(BrightnessData_t));
+}
+
+// twi_slave_humidity_sensor.h
+bool initHumiditySensor(void) { return true; }
+void triggerHumidityMeasurement(void) { }
+bool requestHumidityData(sensor_data_ready_handler_t handler)
+{
+    // 湿度と温度を、2回に分けて読み出す
+    useBus(humiditySensorBase.busTimeUs / 2);
+    return requestSyntheticData(handler, sizeof(HumidityData_t));
+}
+void triggerTemperatureMeasurement(void) { }
+bool requestTemperatureData(sensor_data_ready_handler_t handler)
+{
+    useBus(humiditySensorBase.busTimeUs / 2);
+    return requestSyntheticData(handler, sizeof(TemperatureData_t));
+}
+
+// twi_slave_pressure_sensor.h
+bool initPressureSensor(void) { return true; }
+void getPressureData(AirPressureData_t *p_data) { fillSyntheticData((uint8_t *)p_data, sizeof(AirPressureData_t)); }
+bool requestPressureData(sensor_data_ready_handler_t handler)
+{
+    useBus(pressureSensorBase.busTimeUs);
+    return requestSyntheticData(handler, sizeof(AirPressureData_t));
+}
+
+// twi_slave_uv_sensor.h
+bool initUVSensor(void) { return true; }
+bool requestUVSensorData(sensor_data_ready_handler_t handler)
+{
+    useBus(uvSensorBase.busTimeUs);
+    return requestSyntheticData(handler, sizeof(UltraVioletData_t));
+}
@@ -0,0 +1,77 @@
+#include <string.h>
+
+#include <nrf_sdm.h>
+#include <ble.h>
+
+#include "senstick_data_model.h"
+#include "senstick_control_service.h"
+#include "senstick_rtc.h"
+#include "sensor_service.h"
+#include "gpio_led_driver.h"
+#include "twi_manager.h"
+#include "advertising_manager.h"
+
+/**
+ * ホストビルドで、BLEのサービス、LED、TWIの電源、時計を置き換えるスタブ。
+ * ログとフラッシュの振る舞いには関わらないので、何もしないか、値を保持するだけ。
+ */
+
+static ble_date_time_t m_date_time = { 2016, 1, 1, 0, 0, 0 };
+
+// senstick_control_service.h
+void senstickControlService_observeControlCommand(senstick_control_command_t command) { }
+void senstickControlService_observeCurrentLogCount(uint8_t count) { }
+void senstickControlService_observeDiskFull(bool flag) { }
+void senstickControlService_observeStorageWipeProgress(uint8_t percent) { }
+
+// gpio_led_driver.h
+void ledDriver_observeControlCommand(senstick_control_command_t command) { }
+void ledDriver_observeButtonStatus(ButtonStatus_t status) { }
+
+// twi_manager.h
+void twiPowerUp(void) { }
+void twiPowerDown(void) { }
+// ホストのセンサードライバ(host_sensor_devices.c)は、読み出しをその場で完了するので、待つものはない。
+void twiWaitForIdle(void) { }
+
+// advertising_manager.h
+void startAdvertising(void) { }
+void stopAdvertising(void) { }
+
+// nrf_sdm.h
+uint32_t sd_power_gpregret_set(uint32_t gpregret_id, uint32_t gpregret_msk) { return NRF_SUCCESS; }
+uint32_t sd_ble_gap_disconnect(uint16_t conn_handle, uint8_t hci_status_code) { return NRF_SUCCESS; }
+void NVIC_SystemReset(void) { }
+
+// senstick_rtc.h
+void setSenstickRTCDateTime(const ble_date_time_t *p_date)
+{
+    m_date_time = *p_date;
+}
+
+void getSenstickRTCDateTime(ble_date_time_t *p_date)
+{
+    *p_date = m_date_time;
+}
+
+// sensor_service.h
+ret_code_t initSensorService(sensor_service_t *p_context, uint8_t uuid_type, sensor_device_t device_type)
+{
+    memset(p_context, 0, sizeof(sensor_service_t));
+    p_context->connection_handle = BLE_CONN_HANDLE_INVALID;
+    p_context->device_type       = device_type;
+    return NRF_SUCCESS;
+}
+
+void sensorService_handleBLEEvent(sensor_service_t *p_context, ble_evt_t * p_ble_evt) { }
+
+// 接続していないので、通知はいつも失敗する。
+bool sensorServiceNotifyRealtimeData(sensor_service_t *p_context, uint8_t *p_data, uint16_t length)
+{
+    return false;
+}
+
+bool sensorServiceNotifyLogData(sensor_service_t *p_context, uint8_t *p_data, uint16_t length)
+{
+    return false;
+}
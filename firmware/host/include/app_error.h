@@ -0,0 +1,20 @@
+#ifndef host_app_error_h
+#define host_app_error_h
+
+#include <stdint.h>
+#include "sdk_errors.h"
+
+// エラーはファイル名と行番号を表示して、プロセスを止める。
+void host_app_error_handler(uint32_t error_code, uint32_t line_num, const char *p_file_name);
+
+#define APP_ERROR_HANDLER(ERR_CODE) host_app_error_handler((ERR_CODE), __LINE__, __FILE__)
+
+#define APP_ERROR_CHECK(ERR_CODE)                       \
+    do {                                                \
+        const uint32_t LOCAL_ERR_CODE = (ERR_CODE);     \
+        if (LOCAL_ERR_CODE != NRF_SUCCESS) {            \
+            APP_ERROR_HANDLER(LOCAL_ERR_CODE);          \
+        }                                               \
+    } while (0)
+
+#endif /* host_app_error_h */
@@ -0,0 +1,12 @@
+#ifndef host_app_scheduler_h
+#define host_app_scheduler_h
+
+#include <stdint.h>
+#include "sdk_errors.h"
+
+typedef void (*app_sched_event_handler_t)(void *p_event_data, uint16_t event_size);
+
+uint32_t app_sched_event_put(void *p_event_data, uint16_t event_size, app_sched_event_handler_t handler);
+void app_sched_execute(void);
+
+#endif /* host_app_scheduler_h */
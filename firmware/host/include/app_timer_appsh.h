@@ -0,0 +1,11 @@
+#ifndef host_app_timer_appsh_h
+#define host_app_timer_appsh_h
+
+#include <stdint.h>
+#include "sdk_errors.h"
+
+#define APP_TIMER_SCHED_EVT_SIZE 8
+#define APP_TIMER_TICKS(MS, PRESCALER) (MS)
+#define APP_TIMER_DEF(NAME) static uint32_t NAME##_data; static uint32_t *NAME = &NAME##_data
+
+#endif /* host_app_timer_appsh_h */
@@ -0,0 +1,9 @@
+#ifndef host_app_util_h
+#define host_app_util_h
+
+#include <stdint.h>
+#include "nordic_common.h"
+
+#define CEIL_DIV(A, B) (((A) + (B) - 1) / (B))
+
+#endif /* host_app_util_h */
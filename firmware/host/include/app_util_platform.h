@@ -0,0 +1,13 @@
+#ifndef host_app_util_platform_h
+#define host_app_util_platform_h
+
+// ホストでは割り込みは模擬時刻の上で逐次に呼び出されるので、クリティカルセクションは不要。
+#define CRITICAL_REGION_ENTER() {
+#define CRITICAL_REGION_EXIT()  }
+
+#define APP_IRQ_PRIORITY_HIGH   2
+#define APP_IRQ_PRIORITY_LOW    6
+#define NRF_APP_PRIORITY_HIGH   1
+#define NRF_APP_PRIORITY_LOW    3
+
+#endif /* host_app_util_platform_h */
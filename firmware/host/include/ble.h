@@ -0,0 +1,30 @@
+#ifndef host_ble_h
+#define host_ble_h
+
+#include <stdint.h>
+
+#define BLE_CONN_HANDLE_INVALID 0xFFFF
+#define BLE_EVT_TX_COMPLETE     0x01
+
+typedef struct {
+    uint16_t evt_id;
+    uint16_t evt_len;
+} ble_evt_hdr_t;
+
+typedef struct {
+    ble_evt_hdr_t header;
+} ble_evt_t;
+
+typedef struct {
+    uint16_t uuid;
+    uint8_t  type;
+} ble_uuid_t;
+
+typedef struct {
+    uint16_t value_handle;
+    uint16_t user_desc_handle;
+    uint16_t cccd_handle;
+    uint16_t sccd_handle;
+} ble_gatts_char_handles_t;
+
+#endif /* host_ble_h */
@@ -0,0 +1,6 @@
+#ifndef host_ble_advertising_h
+#define host_ble_advertising_h
+
+#include "ble.h"
+
+#endif /* host_ble_advertising_h */
@@ -0,0 +1,15 @@
+#ifndef host_ble_date_time_h
+#define host_ble_date_time_h
+
+#include <stdint.h>
+
+typedef struct {
+    uint16_t year;
+    uint8_t  month;
+    uint8_t  day;
+    uint8_t  hours;
+    uint8_t  minutes;
+    uint8_t  seconds;
+} ble_date_time_t;
+
+#endif /* host_ble_date_time_h */
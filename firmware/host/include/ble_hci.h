@@ -0,0 +1,6 @@
+#ifndef host_ble_hci_h
+#define host_ble_hci_h
+
+#define BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION 0x13
+
+#endif /* host_ble_hci_h */
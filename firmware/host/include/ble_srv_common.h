@@ -0,0 +1,6 @@
+#ifndef host_ble_srv_common_h
+#define host_ble_srv_common_h
+
+#include "ble.h"
+
+#endif /* host_ble_srv_common_h */
@@ -0,0 +1,13 @@
+#ifndef host_nordic_common_h
+#define host_nordic_common_h
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
+#endif
+
+#define UNUSED_PARAMETER(X) ((void)(X))
+
+#endif /* host_nordic_common_h */
@@ -0,0 +1,101 @@
+#ifndef host_nrf_h
+#define host_nrf_h
+
+// ホストビルド用の nrf.h の代替。ファームウェアが直接触るペリフェラルのレジスタだけを、メモリ上の構造体で置き換える。
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    TIMER1_IRQn = 9,
+    TIMER2_IRQn = 10,
+    RTC2_IRQn   = 36,
+} IRQn_Type;
+
+typedef struct {
+    volatile uint32_t TASKS_START;
+    volatile uint32_t TASKS_STOP;
+    volatile uint32_t TASKS_CLEAR;
+    volatile uint32_t TASKS_SHUTDOWN;
+    volatile uint32_t TASKS_CAPTURE[6];
+    volatile uint32_t EVENTS_COMPARE[6];
+    volatile uint32_t SHORTS;
+    volatile uint32_t INTENSET;
+    volatile uint32_t MODE;
+    volatile uint32_t BITMODE;
+    volatile uint32_t PRESCALER;
+    volatile uint32_t CC[6];
+} NRF_TIMER_Type;
+
+// TIMER2はセンサーのサンプリング周期に使われる。NRF_TIMER2を参照するたびに、host_platform.c が前回書き込まれたタスク(START/STOP/CLEAR/SHUTDOWN/CAPTURE)を
+// 模擬時刻で反映する。カウンタがCC[0]に一致した時に、模擬時刻で割り込みを発生させる。
+extern NRF_TIMER_Type host_timer2;
+NRF_TIMER_Type *hostTimer2Sync(void);
+#define NRF_TIMER2 (hostTimer2Sync())
+
+#define TIMER_MODE_MODE_Timer                 0
+#define TIMER_BITMODE_BITMODE_16Bit           0
+#define TIMER_BITMODE_BITMODE_32Bit           3
+#define TIMER_BITMODE_BITMODE_Pos             0
+#define TIMER_SHORTS_COMPARE0_CLEAR_Enabled   1
+#define TIMER_SHORTS_COMPARE0_CLEAR_Pos       0
+#define TIMER_INTENSET_COMPARE0_Enabled       1
+#define TIMER_INTENSET_COMPARE0_Pos           16
+
+typedef struct {
+    volatile uint32_t TASKS_START;
+    volatile uint32_t TASKS_STOP;
+    volatile uint32_t TASKS_CLEAR;
+    volatile uint32_t EVENTS_COMPARE[4];
+    volatile uint32_t INTENSET;
+    volatile uint32_t EVTENSET;
+    volatile uint32_t COUNTER;
+    volatile uint32_t PRESCALER;
+    volatile uint32_t CC[4];
+} NRF_RTC_Type;
+
+// RTC2は、低消費電力のサンプリングクロックに使われる。NRF_RTC2を参照するたびに、host_platform.c がタスクとCOUNTERを模擬時刻で反映する。
+// カウンタは32.768kHz、24ビット。カウンタがCC[0]に一致した時に、模擬時刻で割り込みを発生させる。
+extern NRF_RTC_Type host_rtc2;
+NRF_RTC_Type *hostRtc2Sync(void);
+#define NRF_RTC2 (hostRtc2Sync())
+
+#define RTC_INTENSET_COMPARE0_Msk (1UL << 16)
+#define RTC_EVTENSET_COMPARE0_Msk (1UL << 16)
+
+// 割り込み処理時間の計測に使うDWTのサイクルカウンタ。ホストでは常に0で、処理時間は計測しない。
+typedef struct {
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+typedef struct {
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+extern CoreDebug_Type host_core_debug;
+extern DWT_Type       host_dwt;
+#define CoreDebug (&host_core_debug)
+#define DWT       (&host_dwt)
+
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk     (1UL << 0)
+
+// CPUのクロック周波数(system_nrf52.h)。ホストでは、NRF52の64MHz。
+extern uint32_t SystemCoreClock;
+
+// compiler_abstraction.h と、Cortex-M4のSIMD命令(CMSISの組み込み関数)の代替。
+#define __ALIGN(n) __attribute__((aligned(n)))
+
+// 2つの16ビットの積の和を、sumに加える。
+static inline uint32_t __SMLAD(uint32_t x, uint32_t y, uint32_t sum)
+{
+    return (uint32_t)((int32_t)sum + (int16_t)x * (int16_t)y + (int16_t)(x >> 16) * (int16_t)(y >> 16));
+}
+
+// bitsビットの符号付きの範囲に飽和させる。
+static inline int32_t __SSAT(int32_t value, uint32_t bits)
+{
+    const int32_t max = (int32_t)((1UL << (bits - 1)) - 1);
+    return (value > max) ? max : ((value < -max - 1) ? -max - 1 : value);
+}
+
+#endif /* host_nrf_h */
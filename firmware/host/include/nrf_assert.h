@@ -0,0 +1,8 @@
+#ifndef host_nrf_assert_h
+#define host_nrf_assert_h
+
+#include <assert.h>
+
+#define ASSERT(expr) assert(expr)
+
+#endif /* host_nrf_assert_h */
@@ -0,0 +1,10 @@
+#ifndef host_nrf_delay_h
+#define host_nrf_delay_h
+
+#include <stdint.h>
+
+// 待ち時間は、模擬時刻を進めることで表す。
+void nrf_delay_us(uint32_t us);
+void nrf_delay_ms(uint32_t ms);
+
+#endif /* host_nrf_delay_h */
@@ -0,0 +1,3 @@
+#ifndef host_nrf_dfu_settings_h
+#define host_nrf_dfu_settings_h
+#endif /* host_nrf_dfu_settings_h */
@@ -0,0 +1,10 @@
+#ifndef host_nrf_drv_twi_h
+#define host_nrf_drv_twi_h
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t drv_inst_idx;
+} nrf_drv_twi_t;
+
+#endif /* host_nrf_drv_twi_h */
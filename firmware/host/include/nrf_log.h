@@ -0,0 +1,18 @@
+#ifndef host_nrf_log_h
+#define host_nrf_log_h
+
+#include <stdio.h>
+
+// ファームウェアのデバッグ出力は、HOST_VERBOSE を定義した時だけ標準エラーに出す。
+#ifdef HOST_VERBOSE
+#define NRF_LOG_INTERNAL_DEBUG(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define NRF_LOG_INTERNAL_DEBUG(...) do { } while (0)
+#endif
+
+#define NRF_LOG_PRINTF(...)       NRF_LOG_INTERNAL_DEBUG(__VA_ARGS__)
+#define NRF_LOG_PRINTF_DEBUG(...) NRF_LOG_INTERNAL_DEBUG(__VA_ARGS__)
+#define NRF_LOG_INFO(...)         NRF_LOG_INTERNAL_DEBUG(__VA_ARGS__)
+#define NRF_LOG_DEBUG(...)        NRF_LOG_INTERNAL_DEBUG(__VA_ARGS__)
+
+#endif /* host_nrf_log_h */
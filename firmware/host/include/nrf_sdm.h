@@ -0,0 +1,10 @@
+#ifndef host_nrf_sdm_h
+#define host_nrf_sdm_h
+
+#include <stdint.h>
+
+uint32_t sd_power_gpregret_set(uint32_t gpregret_id, uint32_t gpregret_msk);
+uint32_t sd_ble_gap_disconnect(uint16_t conn_handle, uint8_t hci_status_code);
+void NVIC_SystemReset(void);
+
+#endif /* host_nrf_sdm_h */
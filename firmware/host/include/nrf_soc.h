@@ -0,0 +1,11 @@
+#ifndef host_nrf_soc_h
+#define host_nrf_soc_h
+
+#include <stdint.h>
+#include "nrf.h"
+
+uint32_t sd_nvic_ClearPendingIRQ(IRQn_Type IRQn);
+uint32_t sd_nvic_SetPriority(IRQn_Type IRQn, uint32_t priority);
+uint32_t sd_nvic_EnableIRQ(IRQn_Type IRQn);
+
+#endif /* host_nrf_soc_h */
@@ -0,0 +1,3 @@
+#ifndef host_sdk_config_h
+#define host_sdk_config_h
+#endif /* host_sdk_config_h */
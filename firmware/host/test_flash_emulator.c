@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// フラッシュエミュレータ自体のテスト。NORフラッシュの振る舞いと、時間のモデルを確認します。
+
+static void completion_handler(void *p_context)
+{
+    (*(int *)p_context)++;
+}
+
+// プログラムは元の値とのANDになり、0を1にしようとしたバイトは違反として数えられる。
+static void testProgramSemantics(void)
+{
+    const uint8_t *p_memory = flashEmulatorGetMemory();
+    flash_emulator_statistics_t statistics;
+
+    erase4kSector(0);
+    CHECK(p_memory[0] == 0xff && p_memory[4095] == 0xff);
+
+    flashEmulatorClearStatistics();
+    uint8_t data[2] = {0xf0, 0x0f};
+    writeFlash(0, data, 2);
+    CHECK(p_memory[0] == 0xf0 && p_memory[1] == 0x0f);
+
+    uint8_t over[2] = {0x3c, 0x0f};
+    writeFlash(0, over, 2);
+    CHECK(p_memory[0] == 0x30 && p_memory[1] == 0x0f);
+
+    flashEmulatorGetStatistics(&statistics);
+    CHECK(statistics.programViolationCount == 1);
+    CHECK(statistics.programBytes == 4);
+
+    // 読み出しは書き込んだ値を返す
+    uint8_t read[2];
+    readFlash(0, read, 2);
+    CHECK(read[0] == 0x30 && read[1] == 0x0f);
+
+    erase4kSector(0);
+    CHECK(p_memory[0] == 0xff && p_memory[1] == 0xff);
+}
+
+// ドライバはページ境界で分割するので、ページをまたぐ書き込みも連続したアドレスに書かれる。
+static void testPageBoundary(void)
+{
+    const uint8_t *p_memory = flashEmulatorGetMemory();
+    uint8_t data[300];
+    for(int i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+
+    erase4kSector(0x1000);
+    flash_memory_statistics_t driver_statistics;
+    flashMemoryClearStatistics();
+    writeFlash(0x1000 + 250, data, sizeof(data));
+    flashMemoryGetStatistics(&driver_statistics);
+    CHECK(driver_statistics.pageProgramCount == 3);
+    CHECK(memcmp(&p_memory[0x1000 + 250], data, sizeof(data)) == 0);
+    CHECK(p_memory[0x1000 + 249] == 0xff && p_memory[0x1000 + 550] == 0xff);
+}
+
+// 消去単位への切り下げと、ブロック消去。
+static void testErase(void)
+{
+    const uint8_t *p_memory = flashEmulatorGetMemory();
+    uint8_t zero[16];
+    memset(zero, 0, sizeof(zero));
+
+    writeFlash(0x20000,            zero, sizeof(zero));
+    writeFlash(0x20000 + 0x10000 - 16, zero, sizeof(zero));
+    writeFlash(0x30000,            zero, sizeof(zero));
+
+    // セクターの途中のアドレスを指定しても、そのセクター全体が消える
+    erase4kSector(0x20000 + 0x100);
+    CHECK(p_memory[0x20000] == 0xff);
+    CHECK(p_memory[0x20000 + 0x10000 - 1] == 0x00);
+
+    flash_memory_statistics_t driver_statistics;
+    flashMemoryClearStatistics();
+    formatFlash(0x20000, 0x10000);
+    flashMemoryGetStatistics(&driver_statistics);
+    CHECK(driver_statistics.blockEraseCount == 1 && driver_statistics.sectorEraseCount == 0);
+    CHECK(p_memory[0x20000 + 0x10000 - 1] == 0xff);
+    CHECK(p_memory[0x30000] == 0x00);
+    erase4kSector(0x30000);
+}
+
+// 時間のモデル。消去は、そのビジー時間以上かかる。非同期のコマンドは、時間を進めると完了する。
+static void testTiming(void)
+{
+    flash_emulator_timing_t timing;
+    flashEmulatorGetTiming(&timing);
+
+    uint64_t start = flashEmulatorGetTime();
+    erase4kSector(0x40000);
+    uint64_t elapsed = flashEmulatorGetTime() - start;
+    CHECK(elapsed >= timing.sectorEraseUs);
+    CHECK(elapsed <  timing.sectorEraseUs + 20000);
+
+    int completed = 0;
+    erase4kSectorAsync(0x41000, completion_handler, &completed);
+    CHECK(completed == 0);
+    CHECK(isFlashBusy());
+    flashEmulatorAdvance(timing.sectorEraseUs / 2);
+    CHECK(completed == 0);
+    flashEmulatorAdvance(timing.sectorEraseUs);
+    CHECK(completed == 1);
+    CHECK(isFlashCommandQueueEmpty());
+
+    // 時間を止めたまま待つと、その分はストールとして数えられる
+    flash_emulator_statistics_t statistics;
+    flashEmulatorClearStatistics();
+    erase4kSector(0x42000);
+    flashEmulatorGetStatistics(&statistics);
+    CHECK(statistics.stallCount >= 1);
+    CHECK(statistics.stallUs >= timing.sectorEraseUs);
+}
+
+// バックグラウンドの消去中に通常のコマンドを積むと、消去はサスペンドされ、通常のコマンドが先に完了する。
+static void testSuspend(void)
+{
+    const uint8_t *p_memory = flashEmulatorGetMemory();
+    flash_emulator_timing_t timing;
+    flashEmulatorGetTiming(&timing);
+
+    int erase_completed   = 0;
+    int program_completed = 0;
+    uint8_t data[4] = {1, 2, 3, 4};
+
+    erase4kSector(0x50000);
+    writeFlash(0x51000, data, sizeof(data));
+
+    flashMemoryClearStatistics();
+    erase4kSectorInBackground(0x51000, completion_handler, &erase_completed);
+    flashEmulatorAdvance(timing.sectorEraseUs / 4);
+    writeFlashAsync(0x50000, data, sizeof(data), completion_handler, &program_completed);
+
+    flashEmulatorAdvance(timing.suspendLatencyUs + timing.pageProgramUs + 2000);
+    CHECK(program_completed == 1);
+    CHECK(erase_completed == 0);
+    CHECK(memcmp(&p_memory[0x50000], data, sizeof(data)) == 0);
+
+    waitFlashCommandQueueEmpty();
+    CHECK(erase_completed == 1);
+    CHECK(p_memory[0x51000] == 0xff);
+
+    flash_memory_statistics_t driver_statistics;
+    flashMemoryGetStatistics(&driver_statistics);
+    CHECK(driver_statistics.eraseSuspendCount == 1);
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    initFlashMemory();
+
+    testProgramSemantics();
+    testPageBoundary();
+    testErase();
+    testTiming();
+    testSuspend();
+
+    return hostTestResult("test_flash_emulator");
+}
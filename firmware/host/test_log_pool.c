@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_sensor_base.h"
+#include "senstick_flash_address_definition.h"
+#include "acceleration_sensor_base.h"
+#include "gyro_sensor_base.h"
+#include "brightness_sensor_base.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// 共有のデータ領域から、エクステント単位でログに割り当てるテスト。
+
+#define POOL_SIZE ((uint32_t)LOG_NUM_OF_EXTENTS * LOG_EXTENT_SIZE)
+
+static log_context_t m_logs[3];
+static uint8_t m_write_buffers[3][LOG_WRITE_BUFFER_SIZE];
+
+static void formatStorage(void)
+{
+    formatLogPool();
+    formatLog(&(accelerationSensorBase.address_info));
+    formatLog(&(gyroSensorBase.address_info));
+    formatLog(&(brightnessSensorBase.address_info));
+}
+
+static uint8_t makeByte(int stream, uint32_t position)
+{
+    return (uint8_t)((position * 7 + stream * 31 + (position >> 8)) & 0x7f);
+}
+
+// 1つのセンサーだけで記録すると、共有領域のほぼ全てを使える。
+static void testSingleStreamUsesWholePool(void)
+{
+    const flash_address_info_t *p_address_info = &(accelerationSensorBase.address_info);
+    formatStorage();
+    CHECK(getLogFreeSize(p_address_info, 0) == POOL_SIZE);
+
+    createLog(&m_logs[0], m_write_buffers[0], 0, 10, 0, p_address_info);
+    uint8_t  buffer[240];
+    uint32_t written = 0;
+    while(true) {
+        for(int i = 0; i < sizeof(buffer); i++) {
+            buffer[i] = makeByte(0, written + i);
+        }
+        int length = writeLog(&m_logs[0], buffer, sizeof(buffer));
+        if(length == 0) {
+            break;
+        }
+        written += length;
+    }
+    closeLog(&m_logs[0]);
+    printf("test_log_pool: one sensor wrote %u bytes of %u bytes pool\n", written, POOL_SIZE);
+    CHECK(written > POOL_SIZE - sizeof(buffer));
+    CHECK(getLogFreeSize(p_address_info, written) < sizeof(buffer));
+
+    // 先頭、エクステントの境界をまたぐ位置、末尾を読み出して確認する
+    const uint32_t positions[] = { 0, LOG_EXTENT_SIZE - 5, 100 * LOG_EXTENT_SIZE - 3, written - 16 };
+    openLog(&m_logs[0], 0, p_address_info);
+    CHECK(m_logs[0].header.size == written);
+    for(int i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+        uint8_t data[16];
+        seekLog(&m_logs[0], positions[i]);
+        CHECK(readLog(&m_logs[0], data, sizeof(data)) == sizeof(data));
+        for(int j = 0; j < sizeof(data); j++) {
+            CHECK(data[j] == makeByte(0, positions[i] + j));
+        }
+    }
+}
+
+// 複数のセンサーのログが、エクステントを交互に使う。それぞれのログが、書いた順に読み出せる。
+static void testInterleavedStreams(void)
+{
+    const flash_address_info_t *p_address_infos[3] = {
+        &(accelerationSensorBase.address_info), &(gyroSensorBase.address_info), &(brightnessSensorBase.address_info)
+    };
+    const int      sample_sizes[3] = { 6, 6, 2 };
+    const uint32_t sizes[2][3]     = { { 300000, 200000, 1000 }, { 150000, 3, 70000 } };
+
+    formatStorage();
+    for(int log_id = 0; log_id < 2; log_id++) {
+        for(int s = 0; s < 3; s++) {
+            createLog(&m_logs[s], m_write_buffers[s], log_id, 10, 0, p_address_infos[s]);
+        }
+        // 少しずつ交互に書き込み、エクステントの割当を交互にする
+        bool did_write = true;
+        while(did_write) {
+            did_write = false;
+            for(int s = 0; s < 3; s++) {
+                uint8_t sample[6];
+                const uint32_t position = m_logs[s].header.startPosition + m_logs[s].writePosition;
+                if(m_logs[s].writePosition >= sizes[log_id][s] / sample_sizes[s] * sample_sizes[s]) {
+                    continue;
+                }
+                for(int i = 0; i < sample_sizes[s]; i++) {
+                    sample[i] = makeByte(s, position + i);
+                }
+                CHECK(writeLog(&m_logs[s], sample, sample_sizes[s]) == sample_sizes[s]);
+                did_write = true;
+            }
+        }
+        for(int s = 0; s < 3; s++) {
+            closeLog(&m_logs[s]);
+        }
+    }
+
+    // 各ログを、先頭から順に読み出して確認する。エクステント表は、エクステントが変わるごとに1回だけ読む。
+    for(int log_id = 0; log_id < 2; log_id++) {
+        for(int s = 0; s < 3; s++) {
+            flash_memory_statistics_t statistics;
+            openLog(&m_logs[s], log_id, p_address_infos[s]);
+            CHECK(m_logs[s].header.size == sizes[log_id][s] / sample_sizes[s] * sample_sizes[s]);
+
+            flashMemoryClearStatistics();
+            bool     is_equal = true;
+            uint32_t position = 0;
+            uint8_t  data[18];
+            int      length;
+            while((length = readLog(&m_logs[s], data, MIN(sizeof(data), m_logs[s].header.size - position))) > 0) {
+                for(int i = 0; i < length; i++) {
+                    is_equal &= (data[i] == makeByte(s, m_logs[s].header.startPosition + position + i));
+                }
+                position += length;
+            }
+            flashMemoryGetStatistics(&statistics);
+            CHECK(is_equal);
+            CHECK(position == m_logs[s].header.size);
+            const uint32_t num_of_extents = m_logs[s].header.size / LOG_EXTENT_SIZE + 2;
+            // キャッシュは読み出し位置から詰め直すので、1回のキャッシュで読めるのは (LOG_READ_CACHE_SIZE - sizeof(data)) バイト以上
+            CHECK(statistics.readCount <= (m_logs[s].header.size / (LOG_READ_CACHE_SIZE - sizeof(data)) + 1) + 2 * num_of_extents);
+        }
+    }
+
+    // 2つ目のログは、前のログの終端から、同じエクステントの続きに置かれる
+    log_context_t log;
+    openLog(&log, 0, p_address_infos[2]);
+    openLog(&m_logs[2], 1, p_address_infos[2]);
+    CHECK(m_logs[2].header.startPosition == log.header.startPosition + log.header.size);
+}
+
+// センサーの残り容量(サンプル数)は、センサーごとの区画ではなく、共有領域の空きから求める。
+static void testRemainingStorage(void)
+{
+    initSuperblockController();
+    initSenstickDataModel();
+    initMetaDataLogController();
+    initSenstickSensorController(0);
+    senstick_mountStorage();
+    senstick_setControlCommand(sensorShouldSleep);
+    senstick_setControlCommand(formattingStorage);
+
+    uint8_t buffer[20];
+    sensor_metadata_t metadata;
+    senstickSensorControllerReadMetaData(BrightnessSensor, buffer, sizeof(buffer));
+    deserializeSensorMetaData(&metadata, buffer);
+    CHECK(metadata.remainingStorage == POOL_SIZE / brightnessSensorBase.rawSensorDataSize);
+    senstickSensorControllerReadMetaData(AccelerationSensor, buffer, sizeof(buffer));
+    deserializeSensorMetaData(&metadata, buffer);
+    CHECK(metadata.remainingStorage == POOL_SIZE / accelerationSensorBase.rawSensorDataSize);
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    initFlashMemory();
+    initLogController();
+
+    testSingleStreamUsesWholePool();
+    testInterleavedStreams();
+    testRemainingStorage();
+
+    return hostTestResult("test_log_pool");
+}
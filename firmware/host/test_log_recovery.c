@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "superblock_controller.h"
+#include "senstick_sensor_base.h"
+#include "acceleration_sensor_base.h"
+#include "senstick_flash_address_definition.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// 記録中のリセットからの、ログの復旧のテスト。
+
+#define SAMPLE_SIZE 6
+
+// テストするログのヘッダ領域。データは共有領域のエクステントに置かれる。
+static const flash_address_info_t m_address_info = { ACCELERATION_SENSOR_STORAGE_START_ADDRESS, ACCELERATION_SENSOR_STORAGE_SIZE };
+
+static log_context_t m_log;
+static uint8_t m_write_buffer[LOG_WRITE_BUFFER_SIZE];
+
+// 電源断からのリセット。RAMの状態は、初期化関数で初期化する。
+static void reset(void)
+{
+    hostPlatformReset();
+    initFlashMemory();
+    initLogController();
+}
+
+static void formatStorage(void)
+{
+    formatLogPool();
+    formatLog(&m_address_info);
+}
+
+static void makeSample(uint32_t index, uint8_t *p_sample)
+{
+    for(int i = 0; i < SAMPLE_SIZE; i++) {
+        p_sample[i] = (uint8_t)((index + i) & 0x7f);
+    }
+}
+
+// 書き込んだログのデータが、サンプル列と一致するかを確認します。
+static bool verifyLog(uint8_t logID, uint32_t num_of_samples)
+{
+    openLog(&m_log, logID, &m_address_info);
+    for(uint32_t i = 0; i < num_of_samples; i++) {
+        uint8_t expected[SAMPLE_SIZE];
+        uint8_t sample[SAMPLE_SIZE];
+        makeSample(i, expected);
+        if(readLog(&m_log, sample, SAMPLE_SIZE) != SAMPLE_SIZE || memcmp(sample, expected, SAMPLE_SIZE) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 8MB近くを書いたところでリセット。復旧の時間と読み出し回数が、ログの大きさによらず小さいことを確認する。
+// 二分探索の読み出しに、エクステント表の読み出しが加わる。
+static void testRecoveryOnFullPartition(void)
+{
+    formatStorage();
+    createLog(&m_log, m_write_buffer, 0, 10, 0, &m_address_info);
+
+    const uint32_t num_of_samples = 0x800000 / SAMPLE_SIZE - 1000;
+    for(uint32_t i = 0; i < num_of_samples; i++) {
+        uint8_t sample[SAMPLE_SIZE];
+        makeSample(i, sample);
+        writeLog(&m_log, sample, SAMPLE_SIZE);
+    }
+    // フラッシュに書き出し済みのデータは残り、書き込みバッファのデータは失われる
+    waitFlashCommandQueueEmpty();
+    const uint32_t flushed_position = m_log.flushedPosition;
+    reset();
+
+    flash_memory_statistics_t statistics;
+    flashEmulatorClearStatistics();
+    const uint64_t start_us = flashEmulatorGetTime();
+    CHECK(recoverLog(0, SAMPLE_SIZE, &m_address_info));
+    const uint64_t recovery_us = flashEmulatorGetTime() - start_us;
+    flashMemoryGetStatistics(&statistics);
+    printf("test_log_recovery: 8MB log recovered in %llu us, %u reads\n", (unsigned long long)recovery_us, statistics.readCount);
+    CHECK(recovery_us < 20000);
+    CHECK(statistics.readCount < 60);
+
+    // 途中で切れたサンプルは、サンプル単位に切り上げられる
+    openLog(&m_log, 0, &m_address_info);
+    CHECK(m_log.header.size == ((flushed_position + SAMPLE_SIZE - 1) / SAMPLE_SIZE) * SAMPLE_SIZE);
+    CHECK(verifyLog(0, flushed_position / SAMPLE_SIZE));
+
+    // 閉じたログは復旧しない
+    CHECK( ! recoverLog(0, SAMPLE_SIZE, &m_address_info));
+}
+
+// 書き込みキューが残ったままのリセット。復旧したログの後ろに、次のログを書き込めることを確認する。
+static void testRecoveryWithPendingCommands(void)
+{
+    formatStorage();
+    createLog(&m_log, m_write_buffer, 0, 10, 0, &m_address_info);
+    for(uint32_t i = 0; i < 10000; i++) {
+        uint8_t sample[SAMPLE_SIZE];
+        makeSample(i, sample);
+        writeLog(&m_log, sample, SAMPLE_SIZE);
+    }
+    reset();
+
+    CHECK(recoverLog(0, SAMPLE_SIZE, &m_address_info));
+    openLog(&m_log, 0, &m_address_info);
+    const uint32_t recovered_size = m_log.header.size;
+    CHECK(recovered_size > 0 && recovered_size <= 10000 * SAMPLE_SIZE);
+    CHECK((recovered_size % SAMPLE_SIZE) == 0);
+    CHECK(verifyLog(0, recovered_size / SAMPLE_SIZE - 1));
+
+    flash_emulator_statistics_t statistics;
+    flashEmulatorClearStatistics();
+    createLog(&m_log, m_write_buffer, 1, 10, 0, &m_address_info);
+    for(uint32_t i = 0; i < 5000; i++) {
+        uint8_t sample[SAMPLE_SIZE];
+        makeSample(i, sample);
+        writeLog(&m_log, sample, SAMPLE_SIZE);
+    }
+    closeLog(&m_log);
+    flashEmulatorGetStatistics(&statistics);
+    CHECK(statistics.programViolationCount == 0);
+    CHECK(verifyLog(1, 5000));
+}
+
+// 0xffで終わるサンプルも、復旧後のサイズに含まれる。
+static void testRecoveryOfTrailingErasedValue(void)
+{
+    uint8_t sample[SAMPLE_SIZE] = { 1, 2, 3, 4, 0xff, 0xff };
+
+    formatStorage();
+    createLog(&m_log, m_write_buffer, 0, 10, 0, &m_address_info);
+    for(int i = 0; i < 100; i++) {
+        writeLog(&m_log, sample, SAMPLE_SIZE);
+    }
+    flushLog(&m_log);
+    waitFlashCommandQueueEmpty();
+    reset();
+
+    CHECK(recoverLog(0, SAMPLE_SIZE, &m_address_info));
+    openLog(&m_log, 0, &m_address_info);
+    CHECK(m_log.header.size == 100 * SAMPLE_SIZE);
+}
+
+// 書き込みを始める前のリセット。空のログとして復旧する。
+static void testRecoveryOfEmptyLog(void)
+{
+    formatStorage();
+    createLog(&m_log, m_write_buffer, 0, 10, 0, &m_address_info);
+    reset();
+
+    CHECK(recoverLog(0, SAMPLE_SIZE, &m_address_info));
+    openLog(&m_log, 0, &m_address_info);
+    CHECK(m_log.header.size == 0);
+    // ヘッダのないログIDは、復旧の対象ではない
+    CHECK( ! recoverLog(1, SAMPLE_SIZE, &m_address_info));
+}
+
+// センサーのロギング中のリセット。起動時にログが閉じられ、次のログを記録できる。
+static void testRecoveryAtBoot(void)
+{
+    hostBoot();
+    senstick_setControlCommand(formattingStorage);
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(5000);
+    reset();
+
+    hostBoot();
+    CHECK(senstick_getCurrentLogCount() == 1);
+    CHECK(senstick_isDiskFull() == false);
+
+    log_context_t log;
+    openLog(&log, 0, &(accelerationSensorBase.address_info));
+    CHECK(log.header.size > 0 && log.header.size != LOG_SIZE_NOT_CLOSED);
+
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    CHECK(senstick_getCurrentLogCount() == 2);
+    openLog(&log, 1, &(accelerationSensorBase.address_info));
+    CHECK(log.header.size > 0 && log.header.size != LOG_SIZE_NOT_CLOSED);
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    initFlashMemory();
+    initLogController();
+
+    testRecoveryOnFullPartition();
+    testRecoveryWithPendingCommands();
+    testRecoveryOfTrailingErasedValue();
+    testRecoveryOfEmptyLog();
+    testRecoveryAtBoot();
+
+    return hostTestResult("test_log_recovery");
+}
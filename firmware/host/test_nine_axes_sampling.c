@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "twi_slave_nine_axes_sensor.h"
+#include "acceleration_sensor_base.h"
+#include "gyro_sensor_base.h"
+#include "magnetic_sensor_base.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// 加速度とジャイロを、9軸センサーのチップのサンプリング周期に合わせて取得するテスト。
+// 10ミリ秒より短い周期はFIFOからまとめて、それ以上はデータレディ割り込みで読み出す。ミリ秒の倍数でない短い周期は、ハードウェアの周期読み出しで取得する。
+// ホストの9軸センサー(host_sensor_devices.c)は、チップのサンプル番号を値として返す。加速度はn、ジャイロは-n。
+
+// ログのサンプルが、チップのサンプル番号でstep間隔に並んでいるかを確認します。サンプル数を返します。
+static uint32_t checkLogSpacing(const flash_address_info_t *p_address_info, int sign, int step)
+{
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, p_address_info);
+
+    uint32_t count   = 0;
+    bool     is_even = true;
+    int16_t  previous = 0;
+    uint8_t  buffer[6];
+    while(readLog(&log, buffer, sizeof(buffer)) == sizeof(buffer)) {
+        int16_t x;
+        memcpy(&x, buffer, sizeof(x));
+        x *= sign;
+        // 最初のサンプルは、周期の分だけチップのサンプルが進んだ時点(サンプル番号 step - 1)
+        is_even &= (x == ((count == 0) ? (step - 1) : (previous + step)));
+        previous = x;
+        count++;
+    }
+    CHECK(is_even);
+    return count;
+}
+
+// 加速度2ミリ秒、ジャイロ3ミリ秒。チップは1ミリ秒でサンプリングし、それぞれ2、3フレームごとに取り出す。
+static void testFifoSampling(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 2000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 3000, 0));
+
+    // センサーの開始と停止の処理(ログの作成など)の間も、FIFOにはサンプルが溜まる。
+    const uint64_t start_us = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_ms = (uint32_t)((flashEmulatorGetTime() - start_us) / 1000);
+    waitFlashCommandQueueEmpty();
+
+    const uint32_t acceleration_count = checkLogSpacing(&(accelerationSensorBase.address_info), 1, 2);
+    const uint32_t rotation_count     = checkLogSpacing(&(gyroSensorBase.address_info), -1, 3);
+    printf("test_nine_axes_sampling: %u ms, acceleration %u samples, rotation rate %u samples\n", elapsed_ms, acceleration_count, rotation_count);
+    CHECK(acceleration_count >= 1000 / 2 && acceleration_count <= elapsed_ms / 2);
+    CHECK(rotation_count >= 1000 / 3 && rotation_count <= elapsed_ms / 3);
+}
+
+// 加速度10ミリ秒、ジャイロ30ミリ秒。チップは10ミリ秒でサンプリングし、データレディ割り込みで読み出す。TIMER2は動かない。
+static void testDataReadySampling(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 30000, 0));
+
+    const uint32_t timer2_count = hostPlatformGetTimer2InterruptCount();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    waitFlashCommandQueueEmpty();
+    CHECK(hostPlatformGetTimer2InterruptCount() == timer2_count);
+
+    const uint32_t acceleration_count = checkLogSpacing(&(accelerationSensorBase.address_info), 1, 1);
+    const uint32_t rotation_count     = checkLogSpacing(&(gyroSensorBase.address_info), -1, 3);
+    printf("test_nine_axes_sampling: data ready, acceleration %u samples, rotation rate %u samples\n", acceleration_count, rotation_count);
+    CHECK(acceleration_count >= 1000 / 10);
+    CHECK(rotation_count >= 1000 / 30);
+}
+
+// 同じ周期の加速度とジャイロは、サンプルごとに1回の読み出しで取得し、同じサンプルの値になる。
+static void testCoherentMotionRead(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 20000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 20000, 0));
+
+    const uint32_t read_count = hostSensorDevicesGetMotionReadCount();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    waitFlashCommandQueueEmpty();
+
+    const uint32_t acceleration_count = checkLogSpacing(&(accelerationSensorBase.address_info), 1, 1);
+    const uint32_t rotation_count     = checkLogSpacing(&(gyroSensorBase.address_info), -1, 1);
+    CHECK(acceleration_count >= 1000 / 20);
+    CHECK(acceleration_count == rotation_count);
+    CHECK(hostSensorDevicesGetMotionReadCount() - read_count == acceleration_count);
+}
+
+// 地磁気の周期がチップの周期の倍数なら、地磁気もデータレディ割り込みで、加速度とジャイロと同じ読み出しで取得する。
+// ホストの地磁気の値は、加速度と同じくチップのサンプル番号。
+static void testMagneticFieldInMotionRead(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 20000, 0));
+
+    const uint32_t timer2_count = hostPlatformGetTimer2InterruptCount();
+    const uint32_t read_count   = hostSensorDevicesGetMotionReadCount();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    waitFlashCommandQueueEmpty();
+    CHECK(hostPlatformGetTimer2InterruptCount() == timer2_count);
+
+    const uint32_t acceleration_count = checkLogSpacing(&(accelerationSensorBase.address_info), 1, 1);
+    const uint32_t magnetic_count     = checkLogSpacing(&(magneticSensorBase.address_info), 1, 2);
+    CHECK(magnetic_count >= 1000 / 20);
+    CHECK(hostSensorDevicesGetMotionReadCount() - read_count == acceleration_count);
+
+    // 地磁気は使わない設定に戻す
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_stop, 200000, 0));
+}
+
+// 加速度2500マイクロ秒(400Hz)、ジャイロ4000マイクロ秒(250Hz)。
+// ミリ秒の倍数でない加速度はTIMER2で読み出し、ジャイロはミリ秒の周期(4ミリ秒)になってチップのFIFOでサンプリングする。
+static void testMicrosecondSamplingPeriod(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 2500, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 4000, 0));
+
+    // マイクロ秒の周期は9バイト、ミリ秒の倍数なら従来の5バイトで読み出せる。ミリ秒の周期は切り捨て。
+    uint8_t buffer[SENSOR_SERVICE_SETTING_MAX_SIZE];
+    sensor_service_setting_t setting;
+    uint8_t length = senstickSensorControllerReadSetting(AccelerationSensor, buffer, sizeof(buffer));
+    deserializesensor_service_setting(&setting, buffer, length);
+    CHECK(length == 9 && setting.samplingDuration == 2 && setting.samplingPeriodUs == 2500);
+    length = senstickSensorControllerReadSetting(GyroSensor, buffer, sizeof(buffer));
+    deserializesensor_service_setting(&setting, buffer, length);
+    CHECK(length == 5 && setting.samplingDuration == 4 && setting.samplingPeriodUs == 0);
+
+    const uint32_t timer2_count = hostPlatformGetTimer2InterruptCount();
+    const uint64_t start_us     = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_us = (uint32_t)(flashEmulatorGetTime() - start_us);
+    waitFlashCommandQueueEmpty();
+
+    log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, &(accelerationSensorBase.address_info));
+    const uint32_t acceleration_count = log.header.size / sizeof(AccelerationData_t);
+    const uint32_t rotation_count     = checkLogSpacing(&(gyroSensorBase.address_info), -1, 1);
+    printf("test_nine_axes_sampling: %u us, acceleration %u samples at 2500 us, rotation rate %u samples at 4000 us, %u timer interrupts\n",
+           elapsed_us, acceleration_count, rotation_count, hostPlatformGetTimer2InterruptCount() - timer2_count);
+    CHECK(acceleration_count >= 1000000 / 2500 && acceleration_count <= elapsed_us / 2500);
+    CHECK(rotation_count >= 1000 / 4);
+    // TIMER2は10ミリ秒の刻みではなく、加速度のサンプルごと(とFIFOの読み出し)に割り込む
+    CHECK(hostPlatformGetTimer2InterruptCount() - timer2_count >= acceleration_count);
+}
+
+// 加速度とジャイロ2500マイクロ秒(400Hz)、地磁気20ミリ秒。ハードウェアの周期読み出しで、2500マイクロ秒ごとに3つのセンサーを1回で読み出す。
+// 読み出したサンプルは、NINE_AXES_FIFO_DRAIN_PERIOD_MS(20ミリ秒)の8サンプルごとにまとめて受け取る。TIMER2は動かない。
+static void testPeriodicRead(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 2500, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 2500, 0));
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 20000, 0));
+
+    const uint32_t timer2_count = hostPlatformGetTimer2InterruptCount();
+    const uint32_t batch_count  = hostSensorDevicesGetPeriodicReadBatchCount();
+    const uint64_t start_us     = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_us = (uint32_t)(flashEmulatorGetTime() - start_us);
+    waitFlashCommandQueueEmpty();
+    CHECK(hostPlatformGetTimer2InterruptCount() == timer2_count);
+
+    const uint32_t acceleration_count = checkLogSpacing(&(accelerationSensorBase.address_info), 1, 1);
+    const uint32_t rotation_count     = checkLogSpacing(&(gyroSensorBase.address_info), -1, 1);
+    const uint32_t magnetic_count     = checkLogSpacing(&(magneticSensorBase.address_info), 1, 8);
+    const uint32_t batches            = hostSensorDevicesGetPeriodicReadBatchCount() - batch_count;
+    printf("test_nine_axes_sampling: periodic read, %u us, acceleration %u samples, magnetic field %u samples, %u batches\n",
+           elapsed_us, acceleration_count, magnetic_count, batches);
+    CHECK(acceleration_count >= 1000000 / 2500 && acceleration_count <= elapsed_us / 2500);
+    CHECK(rotation_count == acceleration_count);
+    CHECK(magnetic_count == acceleration_count / 8);
+    CHECK(batches == acceleration_count / 8);
+
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_stop, 200000, 0));
+}
+
+// 1秒周期。チップの周期は255ミリ秒までなので、1000の約数の250ミリ秒でサンプリングし、4サンプルごとに取り出す。
+static void testLongSamplingDuration(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 1000000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 1000000, 0));
+
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(5000);
+    senstick_setControlCommand(sensorShouldSleep);
+    waitFlashCommandQueueEmpty();
+
+    CHECK(checkLogSpacing(&(accelerationSensorBase.address_info), 1, 4) >= 5);
+    CHECK(checkLogSpacing(&(gyroSensorBase.address_info), -1, 4) >= 5);
+}
+
+// 周期の下限。加速度とジャイロは1ミリ秒まで、地磁気は10ミリ秒まで。
+static void testSamplingDurationLimit(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 1000, 0));
+    CHECK(! hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 0, 0));
+    CHECK(! hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 999, 0));
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 1500, 0));
+    CHECK(! hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 9000, 0));
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    hostBootAndFormatStorage();
+
+    testFifoSampling();
+    testDataReadySampling();
+    testCoherentMotionRead();
+    testMagneticFieldInMotionRead();
+    testMicrosecondSamplingPeriod();
+    testPeriodicRead();
+    testLongSamplingDuration();
+    testSamplingDurationLimit();
+
+    return hostTestResult("test_nine_axes_sampling");
+}
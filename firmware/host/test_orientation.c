@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "value_types.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_sensor_base.h"
+#include "orientation_sensor_base.h"
+#include "twi_slave_nine_axes_sensor.h"
+#include "ahrs.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// 姿勢の推定のテスト。
+// 傾けて静止したセンサーの重力と地磁気から、回転なしの初期値が正しい姿勢に収束し、回転はジャイロの積分で追従する。
+// 姿勢のセンサー(OrientationSensor)は、9軸センサーの同じサンプルから計算したクォータニオン(Q14)を、他のセンサーと同じくログに記録する。
+
+// 地磁気の伏角(度)。地球の座標系(z軸が鉛直上向き)で、地磁気は北に向かって下を向く。
+#define MAGNETIC_DIP_DEGREES 49.0
+
+typedef struct {
+    double w, x, y, z;
+} quaternion_t;
+
+static double toRadians(double degrees)
+{
+    return degrees * M_PI / 180.0;
+}
+
+static quaternion_t multiply(quaternion_t a, quaternion_t b)
+{
+    quaternion_t q = {
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+        a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w
+    };
+    return q;
+}
+
+static quaternion_t fromAxisAngle(double x, double y, double z, double degrees)
+{
+    const double h = toRadians(degrees) / 2;
+    quaternion_t q = { cos(h), x * sin(h), y * sin(h), z * sin(h) };
+    return q;
+}
+
+// 地球の座標系のベクトルを、姿勢qのセンサーの座標系で見たベクトルにします(q^-1 v q)。
+static void toSensorFrame(quaternion_t q, const double *p_earth, double *p_sensor)
+{
+    const quaternion_t conjugate = { q.w, -q.x, -q.y, -q.z };
+    const quaternion_t v = { 0, p_earth[0], p_earth[1], p_earth[2] };
+    const quaternion_t r = multiply(multiply(conjugate, v), q);
+    p_sensor[0] = r.x;
+    p_sensor[1] = r.y;
+    p_sensor[2] = r.z;
+}
+
+// 2つの姿勢の差の回転角(度)。qと-qは同じ姿勢。
+static double getAngleDegrees(quaternion_t a, quaternion_t b)
+{
+    const double dot = fabs(a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z) / sqrt(a.w * a.w + a.x * a.x + a.y * a.y + a.z * a.z) / sqrt(b.w * b.w + b.x * b.x + b.y * b.y + b.z * b.z);
+    return 2 * acos(dot > 1 ? 1 : dot) * 180.0 / M_PI;
+}
+
+static quaternion_t getAhrsQuaternion(const ahrs_t *p_ahrs)
+{
+    quaternion_t q = { p_ahrs->w, p_ahrs->x, p_ahrs->y, p_ahrs->z };
+    return q;
+}
+
+// 姿勢qのセンサーが測る、重力と地磁気の向き。
+static void getSensorVectors(quaternion_t q, ahrs_vector_t *p_acceleration, ahrs_vector_t *p_magnetic_field)
+{
+    const double gravity[3]  = { 0, 0, 1 };
+    const double magnetic[3] = { cos(toRadians(MAGNETIC_DIP_DEGREES)), 0, -sin(toRadians(MAGNETIC_DIP_DEGREES)) };
+    double a[3], m[3];
+    toSensorFrame(q, gravity, a);
+    toSensorFrame(q, magnetic, m);
+    p_acceleration->x   = (float)a[0]; p_acceleration->y   = (float)a[1]; p_acceleration->z   = (float)a[2];
+    p_magnetic_field->x = (float)m[0]; p_magnetic_field->y = (float)m[1]; p_magnetic_field->z = (float)m[2];
+}
+
+// ロール30度、ピッチ-20度、ヨー120度。
+static quaternion_t getTiltedOrientation(void)
+{
+    return multiply(fromAxisAngle(0, 0, 1, 120), multiply(fromAxisAngle(0, 1, 0, -20), fromAxisAngle(1, 0, 0, 30)));
+}
+
+// 傾けて静止したセンサー。100Hzで、1秒の大きいゲインの後、1秒の既定のゲインで、1度以内に収束する。
+// 地磁気がなければ、重力の向き(ロールとピッチ)だけが合う。
+static void testStaticConvergence(void)
+{
+    const quaternion_t truth = getTiltedOrientation();
+    const ahrs_vector_t zero = { 0, 0, 0 };
+    ahrs_vector_t acceleration, magnetic_field;
+    getSensorVectors(truth, &acceleration, &magnetic_field);
+
+    ahrs_t ahrs;
+    ahrsInit(&ahrs, 2.5f);
+    for(int i = 0; i < 200; i++) {
+        if(i == 100) {
+            ahrs.beta = AHRS_DEFAULT_BETA;
+        }
+        ahrsUpdate(&ahrs, &zero, &acceleration, &magnetic_field, 0.01f);
+    }
+    const double error = getAngleDegrees(getAhrsQuaternion(&ahrs), truth);
+    printf("test_orientation: static, converged to %.3f degrees in 2 s\n", error);
+    CHECK(error < 1.0);
+    CHECK(fabs(ahrs.w * ahrs.w + ahrs.x * ahrs.x + ahrs.y * ahrs.y + ahrs.z * ahrs.z - 1.0) < 1e-4);
+
+    // 地磁気なし。推定した姿勢から見た重力の向きが合う。
+    ahrsInit(&ahrs, 2.5f);
+    for(int i = 0; i < 200; i++) {
+        ahrsUpdate(&ahrs, &zero, &acceleration, &zero, 0.01f);
+    }
+    ahrs_vector_t estimated_acceleration, unused;
+    getSensorVectors(getAhrsQuaternion(&ahrs), &estimated_acceleration, &unused);
+    const double cos_error = estimated_acceleration.x * acceleration.x + estimated_acceleration.y * acceleration.y + estimated_acceleration.z * acceleration.z;
+    CHECK(acos(cos_error > 1 ? 1 : cos_error) * 180.0 / M_PI < 1.0);
+}
+
+// 水平のまま、z軸まわりに毎秒90度で1秒回す。ジャイロの積分で追従し、重力と地磁気の補正で遅れない。
+// 補正は更新前の姿勢と新しいサンプルを比べるので、回転し続けると推定は1サンプル分(0.9度)ほど先行する。
+static void testRotationTracking(void)
+{
+    const double rate_degrees = 90;
+    const float dt = 0.01f;
+    const ahrs_vector_t rotation_rate = { 0, 0, (float)toRadians(rate_degrees) };
+    ahrs_t ahrs;
+    ahrsInit(&ahrs, AHRS_DEFAULT_BETA);
+    double max_error = 0;
+    for(int i = 1; i <= 100; i++) {
+        const quaternion_t truth = fromAxisAngle(0, 0, 1, rate_degrees * i * dt);
+        ahrs_vector_t acceleration, magnetic_field;
+        getSensorVectors(truth, &acceleration, &magnetic_field);
+        ahrsUpdate(&ahrs, &rotation_rate, &acceleration, &magnetic_field, dt);
+        const double error = getAngleDegrees(getAhrsQuaternion(&ahrs), truth);
+        max_error = (error > max_error) ? error : max_error;
+    }
+    printf("test_orientation: 90 deg/s yaw, max error %.3f degrees\n", max_error);
+    CHECK(max_error < rate_degrees * dt + 0.5);
+}
+
+// 1回の更新の時間。実機(NRF52)では、姿勢のセンサーがDWTのサイクル数と最大のサンプリング周波数を、スリープの時にログに出す。
+static void benchmarkAhrs(void)
+{
+    const int count = 1000000;
+    ahrs_t ahrs;
+    ahrs_vector_t acceleration, magnetic_field;
+    getSensorVectors(getTiltedOrientation(), &acceleration, &magnetic_field);
+    ahrs_vector_t rotation_rate = { 0.01f, -0.02f, 0.03f };
+    ahrsInit(&ahrs, AHRS_DEFAULT_BETA);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < count; i++) {
+        rotation_rate.x = -rotation_rate.x;
+        ahrsUpdate(&ahrs, &rotation_rate, &acceleration, &magnetic_field, 0.01f);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / count;
+    printf("test_orientation: %.1f ns per 9-axis update on host (w %.3f)\n", ns, ahrs.w);
+}
+
+// 傾けて静止した9軸センサーの生データ。加速度は2Gの範囲(1Gが16384)、地磁気はAK8963の軸(xとyが入れ替わり、zが逆向き)。
+static void getRawSample(quaternion_t q, NineAxesFifoData_t *p_sample)
+{
+    ahrs_vector_t a, m;
+    getSensorVectors(q, &a, &m);
+    memset(p_sample, 0, sizeof(NineAxesFifoData_t));
+    p_sample->acceleration.x  = (int16_t)lround(16384 * a.x);
+    p_sample->acceleration.y  = (int16_t)lround(16384 * a.y);
+    p_sample->acceleration.z  = (int16_t)lround(16384 * a.z);
+    p_sample->magneticField.x = (int16_t)lround(300 * m.y);
+    p_sample->magneticField.y = (int16_t)lround(300 * m.x);
+    p_sample->magneticField.z = (int16_t)lround(-300 * m.z);
+}
+
+// 姿勢を10ミリ秒で記録する。同じ周期の地磁気とは、9軸センサーの1回の読み出しを共有する。
+static void testOrientationLogging(void)
+{
+    CHECK(! hostWriteSensorSetting(OrientationSensor, sensorServiceCommand_sensing_and_logging, 1000, 0));
+    CHECK(hostWriteSensorSetting(OrientationSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+
+    const quaternion_t truth = getTiltedOrientation();
+    NineAxesFifoData_t sample;
+    getRawSample(truth, &sample);
+    hostSensorDevicesSetMotionSample(&sample);
+
+    const uint32_t start_reads = hostSensorDevicesGetMotionReadCount();
+    const uint64_t start_us = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(2000);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_us = (uint32_t)(flashEmulatorGetTime() - start_us);
+    const uint32_t reads = hostSensorDevicesGetMotionReadCount() - start_reads;
+    waitFlashCommandQueueEmpty();
+    hostSensorDevicesSetMotionSample(NULL);
+
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, &(orientationSensorBase.address_info));
+    const uint32_t count = log.header.size / orientationSensorBase.rawSensorDataSize;
+    OrientationData_t data;
+    int not_normalized = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        CHECK(readLog(&log, (uint8_t *)&data, sizeof(data)) == sizeof(data));
+        const double norm = sqrt((double)data.w * data.w + (double)data.x * data.x + (double)data.y * data.y + (double)data.z * data.z);
+        not_normalized += (fabs(norm - 16384) > 4) ? 1 : 0;
+    }
+    const quaternion_t logged = { data.w, data.x, data.y, data.z };
+    const double error = getAngleDegrees(logged, truth);
+    printf("test_orientation: orientation at 10 ms, %u samples in %u ms, %u 9-axis reads, last sample off by %.2f degrees\n",
+           count, elapsed_us / 1000, reads, error);
+    CHECK(log.header.samplingDuration == 10);
+    CHECK(count >= 2000 / 10 - 1 && count <= elapsed_us / 10000);
+    CHECK(reads <= count + 1);
+    CHECK(not_normalized == 0);
+    CHECK(error < 1.0);
+
+    uint8_t buffer[20];
+    CHECK((orientationSensorBase.getBLEDataHandler)(buffer, (uint8_t *)&data) == 8);
+    CHECK(readInt16AsLittleEndian(&buffer[0]) == data.w && readInt16AsLittleEndian(&buffer[6]) == data.z);
+}
+
+// TWIが混んで読み出しが遅れたサンプルは、前のサンプルからの実際の時間で積分する。
+// ジャイロだけ(加速度と地磁気が0)で、z軸まわりに毎秒約90度。200ミリ秒ごとに3回続けて読み出しを断ると、
+// 遅れたサンプルは4周期分の回転を含み、遅れを取り戻すサンプルは回転しない。回転角の合計は、経過時間の分になる。
+static void testDelayedSamples(void)
+{
+    const int16_t raw_rate = 11796; // 250dpsの範囲で、毎秒約90度
+    const double rate_degrees = raw_rate * 250.0 / 32768.0;
+    const int num_of_delays = 5;
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_stop, 10000, 0));
+    CHECK(hostWriteSensorSetting(OrientationSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+
+    NineAxesFifoData_t sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.rotationRate.z = raw_rate;
+    hostSensorDevicesSetMotionSample(&sample);
+
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(200);
+    for(int i = 0; i < num_of_delays; i++) {
+        hostSensorDevicesRejectMotionRequests(3);
+        hostPlatformRun(200);
+    }
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_ms = 200 * (1 + num_of_delays);
+    waitFlashCommandQueueEmpty();
+    hostSensorDevicesSetMotionSample(NULL);
+
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, &(orientationSensorBase.address_info));
+    const uint32_t count = log.header.size / orientationSensorBase.rawSensorDataSize;
+    const double step_degrees = rate_degrees * 0.01;
+    double yaw = 0;
+    double max_step = 0;
+    int num_of_long_steps = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        OrientationData_t data;
+        CHECK(readLog(&log, (uint8_t *)&data, sizeof(data)) == sizeof(data));
+        const double next_yaw = 2 * atan2(data.z, data.w) * 180.0 / M_PI;
+        const double step = next_yaw - yaw;
+        max_step = (step > max_step) ? step : max_step;
+        num_of_long_steps += (step > 3.5 * step_degrees) ? 1 : 0;
+        yaw = next_yaw;
+    }
+    const double expected = rate_degrees * elapsed_ms / 1000.0;
+    printf("test_orientation: %d delayed reads at 10 ms, %u samples in %u ms, yaw %.2f degrees (%.2f by elapsed time), longest step %.2f degrees\n",
+           num_of_delays, count, elapsed_ms, yaw, expected, max_step);
+    CHECK(num_of_long_steps == num_of_delays);
+    CHECK(max_step < 4.5 * step_degrees);
+    CHECK(fabs(yaw - expected) < 2 * step_degrees);
+}
+
+int main(int argc, char *argv[])
+{
+    testStaticConvergence();
+    testRotationTracking();
+    benchmarkAhrs();
+
+    hostPlatformInit(NULL);
+    hostBootAndFormatStorage();
+
+    testOrientationLogging();
+    testDelayedSamples();
+
+    return hostTestResult("test_orientation");
+}
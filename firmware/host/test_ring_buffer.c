@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring_buffer.h"
+
+#include "host_platform.h"
+
+// 可変長レコードのリングバッファのテスト。
+
+RING_BUFFER_DEF(m_ring, 64);
+
+static bool put(uint8_t tag, uint8_t length, uint8_t value)
+{
+    uint8_t *p_data = ringBufferReserve(&m_ring, tag, length);
+    if(p_data == NULL) {
+        return false;
+    }
+    memset(p_data, value, length);
+    ringBufferCommit(&m_ring);
+    return true;
+}
+
+// 先頭のレコードが、tag、length、valueで埋まったペイロードであることを確認して取り除きます。
+static bool get(uint8_t tag, uint8_t length, uint8_t value)
+{
+    uint8_t actual_tag, actual_length;
+    const uint8_t *p_data = ringBufferPeek(&m_ring, &actual_tag, &actual_length);
+    if(p_data == NULL || actual_tag != tag || actual_length != length) {
+        return false;
+    }
+    bool is_equal = true;
+    for(int i = 0; i < length; i++) {
+        is_equal &= (p_data[i] == value);
+    }
+    ringBufferRelease(&m_ring);
+    return is_equal;
+}
+
+// 確保したレコードは、公開するまで見えない。
+static void testCommitPublishes(void)
+{
+    uint8_t tag, length;
+    ringBufferInit(&m_ring);
+    uint8_t *p_data = ringBufferReserve(&m_ring, 3, 6);
+    CHECK(p_data != NULL);
+    memset(p_data, 0x55, 6);
+    CHECK(ringBufferPeek(&m_ring, &tag, &length) == NULL);
+    ringBufferCommit(&m_ring);
+    CHECK(get(3, 6, 0x55));
+    CHECK(ringBufferPeek(&m_ring, &tag, &length) == NULL);
+}
+
+// 1バイトのヘッダと6バイトのデータのレコードは、64バイトに9個入る。
+static void testFullAndHighWaterMark(void)
+{
+    ringBufferInit(&m_ring);
+    int count = 0;
+    while(put(0, 6, (uint8_t)count)) {
+        count++;
+    }
+    CHECK(count == 64 / 7);
+    CHECK(ringBufferGetHighWaterMark(&m_ring) == count * 7);
+    CHECK(get(0, 6, 0));
+    CHECK(put(1, 2, 0xaa));
+    ringBufferDiscard(&m_ring);
+    CHECK(ringBufferPeek(&m_ring, &(uint8_t){0}, &(uint8_t){0}) == NULL);
+    ringBufferClearHighWaterMark(&m_ring);
+    CHECK(ringBufferGetHighWaterMark(&m_ring) == 0);
+}
+
+// 長さの違うレコードを、何周も書いて読む。レコードはバッファの末尾で折り返さず、順序と内容が保たれる。
+static void testWrapAround(void)
+{
+    const uint8_t lengths[] = { 6, 2, 4, 6, 0, 15, 3 };
+    uint32_t put_count = 0;
+    uint32_t get_count = 0;
+    bool     is_ok     = true;
+
+    ringBufferInit(&m_ring);
+    for(int round = 0; round < 5000; round++) {
+        // 一杯になるまで書き込む
+        while(true) {
+            const uint8_t length = lengths[put_count % sizeof(lengths)];
+            if( ! put(put_count % (RING_BUFFER_MAX_TAG + 1), length, (uint8_t)put_count)) {
+                break;
+            }
+            put_count++;
+        }
+        const int n = 1 + round % 3;
+        for(int i = 0; i < n && get_count < put_count; i++) {
+            is_ok &= get(get_count % (RING_BUFFER_MAX_TAG + 1), lengths[get_count % sizeof(lengths)], (uint8_t)get_count);
+            get_count++;
+        }
+    }
+    printf("test_ring_buffer: %u records through 64 bytes, max %u bytes used\n", put_count, ringBufferGetHighWaterMark(&m_ring));
+    CHECK(is_ok);
+    CHECK(put_count >= 10000);
+    CHECK(ringBufferGetHighWaterMark(&m_ring) > 64 - (1 + 15) && ringBufferGetHighWaterMark(&m_ring) <= 64);
+}
+
+int main(int argc, char *argv[])
+{
+    testCommitPublishes();
+    testFullAndHighWaterMark();
+    testWrapAround();
+
+    return hostTestResult("test_ring_buffer");
+}
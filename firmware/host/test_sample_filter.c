@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_sensor_base.h"
+#include "acceleration_sensor_base.h"
+#include "twi_slave_nine_axes_sensor.h"
+#include "sample_filter.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// 間引きのフィルタのテスト。
+// 通過域の正弦波はそのまま通り、出力のナイキスト周波数を超える正弦波(折り返してエイリアスになる成分)は取り除かれる。
+// 10バイトの設定で間引きを指定すると、ログにはサンプリング周期 x 間引きの周期で、フィルタを通したサンプルが記録される。
+
+static sample_filter_t m_filter;
+
+// 周波数frequency(入力のサンプリング周波数を1とする)、振幅10000の正弦波を3チャネルに入れ、定常状態の出力の振幅の比(dB)を返します。
+static double getGainDb(uint8_t decimation, double frequency)
+{
+    sampleFilterInit(&m_filter, 3, decimation);
+    int16_t peak = 0;
+    int output_count = 0;
+    for(int n = 0; n < 4096; n++) {
+        const int16_t value = (int16_t)lround(10000 * sin(2 * M_PI * frequency * n));
+        const int16_t sample[3] = { value, value, (int16_t)-value };
+        int16_t output[3];
+        if( ! sampleFilterProcess(&m_filter, (const uint8_t *)sample, (uint8_t *)output) ) {
+            continue;
+        }
+        output_count++;
+        CHECK(output[0] == output[1] && output[2] == -output[0]);
+        // 過去のサンプルが入れ替わった後の、定常状態の振幅
+        if(n >= 2 * SAMPLE_FILTER_MAX_TAPS) {
+            peak = (abs(output[0]) > peak) ? abs(output[0]) : peak;
+        }
+    }
+    CHECK(output_count == 4096 / decimation);
+    return 20 * log10((peak > 0 ? peak : 1) / 10000.0);
+}
+
+// 直流はゲイン1で、端数もなくそのまま通る。最大値でも、積和があふれない。
+static void testDirectCurrent(void)
+{
+    const uint8_t decimations[] = { 2, 4, 8 };
+    for(int i = 0; i < sizeof(decimations); i++) {
+        sampleFilterInit(&m_filter, 1, decimations[i]);
+        int16_t output;
+        const int16_t values[] = { 1234, INT16_MAX, INT16_MIN };
+        for(int j = 0; j < 3; j++) {
+            sampleFilterReset(&m_filter);
+            for(int n = 0; n < decimations[i] * 4; n++) {
+                if(sampleFilterProcess(&m_filter, (const uint8_t *)&values[j], (uint8_t *)&output)) {
+                    CHECK(output == values[j]);
+                }
+            }
+        }
+    }
+}
+
+// 通過域(0.2 / 間引き)は1dB以内、出力のナイキスト周波数の1.4倍(0.7 / 間引き)は-50dB以下。
+static void testFrequencyResponse(void)
+{
+    const uint8_t decimations[] = { 2, 4, 8 };
+    for(int i = 0; i < sizeof(decimations); i++) {
+        const uint8_t d = decimations[i];
+        const double pass_db = getGainDb(d, 0.2 / d);
+        const double stop_db = getGainDb(d, 0.7 / d);
+        printf("test_sample_filter: decimation %d, %d taps, passband %.2f dB, stopband %.1f dB\n", d, 8 * d, pass_db, stop_db);
+        CHECK(pass_db > -1.0 && pass_db < 0.1);
+        CHECK(stop_db < -50.0);
+    }
+    CHECK(! isValidSampleFilterDecimation(0) && isValidSampleFilterDecimation(1) && ! isValidSampleFilterDecimation(3) && ! isValidSampleFilterDecimation(16));
+}
+
+// 入力サンプル1つあたりの処理時間。実機では、センサーコントローラがDWTのサイクル数を、サンプリングの停止時にログに出す。
+static void benchmarkFilter(void)
+{
+    const uint8_t decimations[] = { 2, 4, 8 };
+    for(int i = 0; i < sizeof(decimations); i++) {
+        sampleFilterInit(&m_filter, 3, decimations[i]);
+        const int count = 1000000;
+        int16_t sample[3] = { 0, 0, 0 };
+        int16_t output[3];
+        volatile int16_t sink = 0;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int n = 0; n < count; n++) {
+            sample[0] = (int16_t)n;
+            if(sampleFilterProcess(&m_filter, (const uint8_t *)sample, (uint8_t *)output)) {
+                sink += output[0];
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        const double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / count;
+        // 3チャネル x タップ数 / 間引き = 24回の積和(SMLADで12命令)が、入力サンプル1つあたりの計算量
+        printf("test_sample_filter: decimation %d, 3 channels, %d MACs, %.1f ns per input sample on host\n", decimations[i], 3 * 8, ns);
+    }
+}
+
+// 加速度を10ミリ秒で取得して、間引き2で20ミリ秒ごとに記録する。ホストのデータレディ割り込みの加速度は、サンプル番号の直線なので、
+// 直流のゲインが1の対称なフィルタを通しても、間引き後の隣り合うサンプルの差は2のまま。
+static void testDecimatedLogging(void)
+{
+    CHECK(! hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 10000, 3));
+    CHECK(! hostWriteSensorSetting(BrightnessSensor, sensorServiceCommand_sensing_and_logging, 200000, 2));
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 10000, 2));
+
+    uint8_t buffer[20];
+    CHECK(senstickSensorControllerReadSetting(AccelerationSensor, buffer, sizeof(buffer)) == 10 && buffer[9] == 2);
+
+    const uint64_t start_us = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(2000);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_us = (uint32_t)(flashEmulatorGetTime() - start_us);
+    waitFlashCommandQueueEmpty();
+
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, &(accelerationSensorBase.address_info));
+    const uint32_t count = log.header.size / accelerationSensorBase.rawSensorDataSize;
+    printf("test_sample_filter: acceleration at 10 ms, decimation 2, %u samples in %u ms, logged period %d ms\n", count, elapsed_us / 1000, log.header.samplingDuration);
+    CHECK(log.header.samplingDuration == 20);
+    CHECK(count >= 2000 / 20 - 1 && count <= elapsed_us / 20000);
+
+    AccelerationData_t previous, data;
+    int mismatch = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        CHECK(readLog(&log, (uint8_t *)&data, sizeof(data)) == sizeof(data));
+        // 最初の8サンプル(フィルタの長さの半分)は、最初のサンプルで埋めた過去のサンプルの影響が残る
+        if(i > 8 && (data.x - previous.x != 2 || data.x != data.y || data.y != data.z)) {
+            mismatch++;
+        }
+        previous = data;
+    }
+    CHECK(mismatch == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    testDirectCurrent();
+    testFrequencyResponse();
+    benchmarkFilter();
+
+    hostPlatformInit(NULL);
+    hostBootAndFormatStorage();
+
+    testDecimatedLogging();
+
+    return hostTestResult("test_sample_filter");
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_log_definition.h"
+#include "acceleration_sensor_base.h"
+#include "gyro_sensor_base.h"
+#include "magnetic_sensor_base.h"
+#include "value_types.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// フラッシュの書き込みが追いつかないときのテスト。
+// リングバッファが一杯になってもリセットせず、捨てたサンプルを数え、ログにはギャップマーカーを書く。
+// ホストの9軸センサーは、FIFOのフレーム番号を値として返す(加速度はn、ジャイロは-n)。
+
+typedef struct {
+    uint32_t sampleCount;  // 記録されたサンプル数
+    uint32_t missingCount; // ギャップマーカーが示す、抜けたサンプル数の合計
+    uint32_t gapCount;     // ギャップマーカーの数
+    bool     isAligned;    // 抜けたサンプル数を足すと、サンプルの値(フレーム番号)が周期ごとに並ぶ
+} log_scan_t;
+
+// ログから1サンプル分のレコードを読みます。ログの終わりならfalseを返します。
+// ギャップマーカーなら、*p_gap_countに抜けたサンプル数を入れます。サンプルなら*p_gap_countは0で、p_bufferにサンプルの値が入ります。
+static bool readLogRecord(log_context_t *p_log, uint8_t *p_buffer, int size, uint16_t *p_gap_count)
+{
+    *p_gap_count = 0;
+    if(readLog(p_log, p_buffer, size) != size) {
+        return false;
+    }
+    bool is_marker = true;
+    for(int i = 0; i < size; i++) {
+        is_marker &= (p_buffer[i] == LOG_GAP_MARKER_BYTE);
+    }
+    if( ! is_marker ) {
+        return true;
+    }
+    // マーカーの次のレコードが全て0なら、マーカーの値のサンプル
+    uint8_t follower[20];
+    if(readLog(p_log, follower, size) != size) {
+        return false;
+    }
+    bool is_escape = true;
+    for(int i = 0; i < size; i++) {
+        is_escape &= (follower[i] == 0);
+    }
+    if( ! is_escape ) {
+        *p_gap_count = readUInt16AsLittleEndian(follower);
+        CHECK(*p_gap_count > 0);
+    }
+    return true;
+}
+
+// 最後のログを読み、ギャップマーカーを数えます。サンプルの値は、フレーム番号 x sign が step ごとに並ぶ。
+static void scanLog(const flash_address_info_t *p_address_info, int sign, int step, log_scan_t *p_scan)
+{
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, p_address_info);
+
+    memset(p_scan, 0, sizeof(log_scan_t));
+    p_scan->isAligned = true;
+    int32_t expected = step - 1;
+    uint8_t buffer[6];
+    uint16_t gap_count;
+    while(readLogRecord(&log, buffer, sizeof(buffer), &gap_count)) {
+        if(gap_count > 0) {
+            p_scan->missingCount += gap_count;
+            p_scan->gapCount++;
+            expected += gap_count * step;
+            continue;
+        }
+        int16_t x;
+        memcpy(&x, buffer, sizeof(x));
+        p_scan->isAligned &= ((int16_t)(x * sign) == (int16_t)expected);
+        expected += step;
+        p_scan->sampleCount++;
+    }
+}
+
+// 加速度1ミリ秒、ジャイロ2ミリ秒(9KB/s)を、ページプログラムに40ミリ秒かかるフラッシュ(6.4KB/s)に記録する。
+// 加速度は最も周期が短いので、リングバッファの使用量が多い間は間引かれる。
+static void testOverload(void)
+{
+    flash_emulator_timing_t timing, slow_timing;
+    flashEmulatorGetTiming(&timing);
+    slow_timing = timing;
+    slow_timing.pageProgramUs = 40000;
+
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 1000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 2000, 0));
+
+    const uint64_t start_us = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    flashEmulatorSetTiming(&slow_timing);
+    hostPlatformRun(3000);
+    flashEmulatorSetTiming(&timing);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_ms = (uint32_t)((flashEmulatorGetTime() - start_us) / 1000);
+    waitFlashCommandQueueEmpty();
+
+    uint8_t buffer[20];
+    const uint8_t length = senstickSensorControllerReadDropStatistics(buffer, sizeof(buffer));
+    const uint16_t high_water_mark = readUInt16AsLittleEndian(&buffer[0]);
+    const uint16_t acceleration_dropped = readUInt16AsLittleEndian(&buffer[2 + 2 * AccelerationSensor]);
+    const uint16_t rotation_dropped     = readUInt16AsLittleEndian(&buffer[2 + 2 * GyroSensor]);
+
+    log_scan_t acceleration, rotation;
+    scanLog(&(accelerationSensorBase.address_info), 1, 1, &acceleration);
+    scanLog(&(gyroSensorBase.address_info), -1, 2, &rotation);
+    printf("test_sample_overload: %u ms, ring max %u bytes, acceleration %u samples + %u missing in %u gaps (%u dropped), rotation rate %u samples + %u missing in %u gaps (%u dropped)\n",
+           elapsed_ms, high_water_mark,
+           acceleration.sampleCount, acceleration.missingCount, acceleration.gapCount, acceleration_dropped,
+           rotation.sampleCount, rotation.missingCount, rotation.gapCount, rotation_dropped);
+
+    CHECK(length == 2 + 2 * 8);
+    CHECK(high_water_mark > 0);
+    CHECK(acceleration_dropped > 0);
+    CHECK(acceleration.isAligned && rotation.isAligned);
+    // 捨てたサンプルは、最後のものも含めて、全てギャップマーカーに記録される
+    CHECK(acceleration.missingCount == acceleration_dropped);
+    CHECK(rotation.missingCount == rotation_dropped);
+    // 抜けたサンプルを含めると、時間の分のサンプルが揃う
+    CHECK(acceleration.sampleCount + acceleration.missingCount >= 3000 && acceleration.sampleCount + acceleration.missingCount <= elapsed_ms);
+    CHECK(rotation.sampleCount + rotation.missingCount >= 3000 / 2 && rotation.sampleCount + rotation.missingCount <= elapsed_ms / 2);
+    // 間引くのは加速度だけなので、ジャイロの方が記録できた割合が高い
+    CHECK(acceleration.sampleCount * (rotation.sampleCount + rotation.missingCount) < rotation.sampleCount * (acceleration.sampleCount + acceleration.missingCount));
+}
+
+// 過負荷でなければ、サンプルは捨てない。統計はサンプリングの開始でクリアされる。
+static void testNoOverload(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 2000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 2000, 0));
+
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    waitFlashCommandQueueEmpty();
+
+    uint8_t buffer[20];
+    senstickSensorControllerReadDropStatistics(buffer, sizeof(buffer));
+    log_scan_t acceleration;
+    scanLog(&(accelerationSensorBase.address_info), 1, 1, &acceleration);
+    CHECK(readUInt16AsLittleEndian(&buffer[2 + 2 * AccelerationSensor]) == 0);
+    CHECK(readUInt16AsLittleEndian(&buffer[2 + 2 * GyroSensor]) == 0);
+    CHECK(acceleration.gapCount == 0 && acceleration.isAligned && acceleration.sampleCount >= 1000 / 2);
+}
+
+// ギャップマーカーと同じ値のサンプルは、値を変えずに記録され、ギャップとは区別して読み出せる。
+static void testMarkerValuedSample(void)
+{
+    NineAxesFifoData_t sample;
+    memset(&sample, LOG_GAP_MARKER_BYTE, sizeof(sample));
+    hostSensorDevicesSetMotionSample(&sample);
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_stop, 10000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_stop, 10000, 0));
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(200);
+    senstick_setControlCommand(sensorShouldSleep);
+    waitFlashCommandQueueEmpty();
+    hostSensorDevicesSetMotionSample(NULL);
+
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, &(magneticSensorBase.address_info));
+    uint32_t sample_count = 0;
+    uint32_t gap_count_total = 0;
+    uint8_t buffer[6];
+    uint16_t gap_count;
+    while(readLogRecord(&log, buffer, sizeof(buffer), &gap_count)) {
+        gap_count_total += gap_count;
+        for(int i = 0; i < sizeof(buffer) && gap_count == 0; i++) {
+            CHECK(buffer[i] == LOG_GAP_MARKER_BYTE);
+        }
+        sample_count += (gap_count == 0) ? 1 : 0;
+    }
+    printf("test_sample_overload: %u marker-valued magnetic field samples, %u bytes logged\n", sample_count, log.header.size);
+    CHECK(gap_count_total == 0);
+    CHECK(sample_count >= 200 / 10 - 1);
+    CHECK(log.header.size == sample_count * 2 * sizeof(buffer));
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    hostBootAndFormatStorage();
+
+    testOverload();
+    testNoOverload();
+    testMarkerValuedSample();
+
+    return hostTestResult("test_sample_overload");
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_sensor_base.h"
+#include "humidity_sensor_base.h"
+#include "value_types.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// サンプリングの受け入れ制御のテスト。
+// センサーごとのバスの時間と変換の時間から、設定全体のI2Cバス、フラッシュ、リングバッファの負荷を見積もり、上限を超える設定を受け入れない。
+
+static void stopAllSensors(void)
+{
+    for(int i = 0; i <= OrientationSensor; i++) {
+        CHECK(hostWriteSensorSetting((sensor_device_t)i, sensorServiceCommand_stop, 200000, 0));
+    }
+}
+
+// [I2Cバス, フラッシュ, リングバッファ]の余裕(1000分率)を読み出します。
+static void readHeadroom(int16_t *p_headroom)
+{
+    uint8_t buffer[20];
+    CHECK(senstickSensorControllerReadSamplingHeadroom(buffer, sizeof(buffer)) == 6);
+    for(int i = 0; i < 3; i++) {
+        p_headroom[i] = readInt16AsLittleEndian(&buffer[2 * i]);
+    }
+}
+
+// 変換を待つセンサーは、変換の時間(変換の終わる時刻の呼び出しを含む)より短い周期を受け入れない。
+// 以前の固定の下限(200ミリ秒)より短くても、変換が間に合えば受け入れ、周期ごとに1サンプルを記録する。
+static void testConversionLatency(void)
+{
+    stopAllSensors();
+    CHECK(! hostWriteSensorSetting(BrightnessSensor, sensorServiceCommand_sensing_and_logging, 150000, 0));
+    CHECK(hostWriteSensorSetting(BrightnessSensor, sensorServiceCommand_sensing_and_logging, 160000, 0));
+    CHECK(! hostWriteSensorSetting(HumidityAndTemperatureSensor, sensorServiceCommand_sensing_and_logging, 30000, 0));
+    CHECK(hostWriteSensorSetting(HumidityAndTemperatureSensor, sensorServiceCommand_sensing_and_logging, 40000, 0));
+    CHECK(! hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 9000, 0));
+    CHECK(! hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 999, 0));
+
+    const uint64_t start_us = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1200);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_us = (uint32_t)(flashEmulatorGetTime() - start_us);
+    waitFlashCommandQueueEmpty();
+
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, &(humiditySensorBase.address_info));
+    const uint32_t humidity_count = log.header.size / humiditySensorBase.rawSensorDataSize;
+    printf("test_sampling_admission: humidity %u samples in %u ms at 40 ms\n", humidity_count, elapsed_us / 1000);
+    CHECK(humidity_count >= 1200 / 40 - 1 && humidity_count <= elapsed_us / 40000);
+}
+
+// I2Cバス。加速度とジャイロ(1ミリ秒)は9軸センサーの1回の読み出しでまとめて読み出すので、
+// 加速度は読み出しの時間(330マイクロ秒)、ジャイロはデータの転送時間(6バイト、135マイクロ秒)を使う。
+static void testBusLoad(void)
+{
+    int16_t headroom[3];
+
+    stopAllSensors();
+    readHeadroom(headroom);
+    CHECK(headroom[0] == 900 && headroom[1] == 500 && headroom[2] == 1000);
+
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 1000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 1000, 0));
+    readHeadroom(headroom);
+    CHECK(headroom[0] == 900 - (330 + 135));
+
+    // 気圧(読み出し500マイクロ秒)を1ミリ秒では、バスの使用率が上限を超える。2ミリ秒なら受け入れる。
+    CHECK(! hostWriteSensorSetting(AirPressureSensor, sensorServiceCommand_sensing_and_logging, 1000, 0));
+    CHECK(hostWriteSensorSetting(AirPressureSensor, sensorServiceCommand_sensing_and_logging, 2000, 0));
+    readHeadroom(headroom);
+    printf("test_sampling_admission: headroom bus %d, flash %d, ring %d permille\n", headroom[0], headroom[1], headroom[2]);
+    CHECK(headroom[0] == 900 - (330 + 135 + 250));
+    CHECK(headroom[1] > 0 && headroom[1] < 500 && headroom[2] > 0 && headroom[2] < 1000);
+
+    // 余裕がなくても、止める設定は受け入れる
+    CHECK(! hostWriteSensorSetting(UltraVioletSensor, sensorServiceCommand_sensing_and_logging, 500, 0));
+    CHECK(hostWriteSensorSetting(AirPressureSensor, sensorServiceCommand_stop, 1000, 0));
+    CHECK(hostWriteSensorSetting(UltraVioletSensor, sensorServiceCommand_sensing_and_logging, 500, 0));
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    hostBootAndFormatStorage();
+
+    testConversionLatency();
+    testBusLoad();
+
+    return hostTestResult("test_sampling_admission");
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_sensor_base.h"
+#include "acceleration_sensor_base.h"
+#include "magnetic_sensor_base.h"
+#include "brightness_sensor_base.h"
+#include "uv_sensor_base.h"
+#include "humidity_sensor_base.h"
+#include "pressure_sensor_base.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// サンプリングクロックの選択のテスト。
+// TIMER2で読み出すセンサーの周期がすべて10ミリ秒以上ならRTC2(32.768kHz)で、それより短い周期があればTIMER2(1MHz)で時刻を数える。
+
+// 最後のログのサンプル数を返します。
+static uint32_t getSampleCount(const senstick_sensor_base_t *p_base)
+{
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, &(p_base->address_info));
+    return log.header.size / p_base->rawSensorDataSize;
+}
+
+// 環境センサー(200ミリ秒)と地磁気(20ミリ秒)。RTC2で数え、TIMER2は動かさない。
+// 変換待ちのある照度と湿度も、サンプルの時刻からの経過時間で状態を進めて、周期ごとに1サンプルを記録する。
+static void testRtcClock(void)
+{
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 20000, 0));
+    CHECK(hostWriteSensorSetting(BrightnessSensor, sensorServiceCommand_sensing_and_logging, 200000, 0));
+    CHECK(hostWriteSensorSetting(HumidityAndTemperatureSensor, sensorServiceCommand_sensing_and_logging, 200000, 0));
+    CHECK(hostWriteSensorSetting(AirPressureSensor, sensorServiceCommand_sensing_and_logging, 200000, 0));
+
+    host_clock_statistics_t before, after;
+    hostPlatformGetClockStatistics(&before);
+    const uint64_t start_us = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(2000);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_us = (uint32_t)(flashEmulatorGetTime() - start_us);
+    waitFlashCommandQueueEmpty();
+    hostPlatformGetClockStatistics(&after);
+
+    const uint32_t magnetic_count   = getSampleCount(&magneticSensorBase);
+    const uint32_t brightness_count = getSampleCount(&brightnessSensorBase);
+    const uint32_t humidity_count   = getSampleCount(&humiditySensorBase);
+    const uint32_t pressure_count   = getSampleCount(&pressureSensorBase);
+    printf("test_sampling_clock: RTC2 %.3f s, %u interrupts, magnetic field %u, brightness %u, humidity %u, pressure %u samples\n",
+           (after.rtc2RunningUs - before.rtc2RunningUs) / 1e6, after.rtc2InterruptCount - before.rtc2InterruptCount,
+           magnetic_count, brightness_count, humidity_count, pressure_count);
+    CHECK(after.timer2RunningUs == before.timer2RunningUs && after.timer2InterruptCount == before.timer2InterruptCount);
+    CHECK(after.rtc2RunningUs - before.rtc2RunningUs >= 2000000);
+    CHECK(magnetic_count >= 2000 / 20 && magnetic_count <= elapsed_us / 20000);
+    CHECK(pressure_count >= 2000 / 200 && pressure_count <= elapsed_us / 200000);
+    // 照度は150ミリ秒、湿度と温度は32ミリ秒の変換待ちの後に読み出す
+    CHECK(brightness_count >= 2000 / 200 - 1 && brightness_count <= elapsed_us / 200000);
+    CHECK(humidity_count >= 2000 / 200 - 1 && humidity_count <= elapsed_us / 200000);
+}
+
+// ミリ秒の倍数でない加速度(1500マイクロ秒)を加えると、RTC2の分解能では足りないので、TIMER2で数える。
+// 地磁気の周期(20ミリ秒)が加速度の周期の倍数でないので、9軸センサーの周期読み出しは使わない。
+static void testTimerClock(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 1500, 0));
+
+    host_clock_statistics_t before, after;
+    hostPlatformGetClockStatistics(&before);
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(1000);
+    senstick_setControlCommand(sensorShouldSleep);
+    waitFlashCommandQueueEmpty();
+    hostPlatformGetClockStatistics(&after);
+
+    CHECK(after.rtc2RunningUs == before.rtc2RunningUs && after.rtc2InterruptCount == before.rtc2InterruptCount);
+    CHECK(after.timer2RunningUs - before.timer2RunningUs >= 1000000);
+    CHECK(getSampleCount(&accelerationSensorBase) >= 1000000 / 1500);
+    CHECK(getSampleCount(&magneticSensorBase) >= 1000 / 20);
+}
+
+// 環境センサー(200ミリ秒)だけ。変換待ちの照度と湿度は、変換の終わる時刻にだけ呼び出すので、
+// サンプルごとの割り込みは、照度2回(トリガーと読み出し)、湿度3回(湿度のトリガー、湿度の読み出しと温度のトリガー、温度の読み出し)、紫外線と気圧は1回ずつ。
+static void testConversionWakeups(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_stop, 200000, 0));
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_stop, 200000, 0));
+    CHECK(hostWriteSensorSetting(UltraVioletSensor, sensorServiceCommand_sensing_and_logging, 200000, 0));
+
+    host_clock_statistics_t before, after;
+    hostPlatformGetClockStatistics(&before);
+    const uint64_t start_us = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(10000);
+    senstick_setControlCommand(sensorShouldSleep);
+    const uint32_t elapsed_us = (uint32_t)(flashEmulatorGetTime() - start_us);
+    waitFlashCommandQueueEmpty();
+    hostPlatformGetClockStatistics(&after);
+
+    const uint32_t interrupt_count  = after.rtc2InterruptCount - before.rtc2InterruptCount;
+    const uint32_t brightness_count = getSampleCount(&brightnessSensorBase);
+    const uint32_t humidity_count   = getSampleCount(&humiditySensorBase);
+    printf("test_sampling_clock: environmental sensors only, %u interrupts in %u ms, brightness %u, uv %u, humidity %u, pressure %u samples\n",
+           interrupt_count, elapsed_us / 1000, brightness_count, getSampleCount(&uvSensorBase), humidity_count, getSampleCount(&pressureSensorBase));
+    CHECK(after.timer2RunningUs == before.timer2RunningUs && after.timer2InterruptCount == before.timer2InterruptCount);
+    CHECK(interrupt_count <= (elapsed_us / 200000 + 1) * (2 + 3 + 1 + 1));
+    CHECK(brightness_count >= 10000 / 200 - 1 && brightness_count <= elapsed_us / 200000);
+    CHECK(humidity_count >= 10000 / 200 - 1 && humidity_count <= elapsed_us / 200000);
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    hostBootAndFormatStorage();
+
+    testRtcClock();
+    testTimerClock();
+    testConversionWakeups();
+
+    return hostTestResult("test_sampling_clock");
+}
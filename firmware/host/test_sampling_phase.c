@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_sensor_base.h"
+#include "acceleration_sensor_base.h"
+#include "brightness_sensor_base.h"
+#include "uv_sensor_base.h"
+#include "humidity_sensor_base.h"
+#include "pressure_sensor_base.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// サンプリングの位相のテスト。
+// TIMER2で読み出すセンサーの最初のサンプルの時刻をずらして、同じ時刻に重なる読み出し(I2Cのバースト)を短くする。周期は変えない。
+// SAMPLING_PHASE_STAGGER_ENABLED=0でビルドした比較用(test_sampling_phase_unstaggered)は、位相をずらさない時のバーストを表示する。
+
+#ifndef SAMPLING_PHASE_STAGGER_ENABLED
+#define SAMPLING_PHASE_STAGGER_ENABLED 1
+#endif
+#if SAMPLING_PHASE_STAGGER_ENABLED
+#define TEST_NAME "test_sampling_phase"
+#else
+#define TEST_NAME "test_sampling_phase_unstaggered"
+#endif
+
+// 最後のログのサンプル数を返します。
+static uint32_t getSampleCount(const senstick_sensor_base_t *p_base)
+{
+    static log_context_t log;
+    openLog(&log, senstick_getCurrentLogCount() - 1, &(p_base->address_info));
+    return log.header.size / p_base->rawSensorDataSize;
+}
+
+// run_msミリ秒サンプリングして、最も長いI2Cのバーストの時間を返します。
+static uint32_t runSampling(uint32_t run_ms, uint32_t *p_elapsed_us)
+{
+    host_bus_statistics_t statistics;
+    hostSensorDevicesClearBusStatistics();
+    const uint64_t start_us = flashEmulatorGetTime();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(run_ms);
+    senstick_setControlCommand(sensorShouldSleep);
+    *p_elapsed_us = (uint32_t)(flashEmulatorGetTime() - start_us);
+    waitFlashCommandQueueEmpty();
+    hostSensorDevicesGetBusStatistics(&statistics);
+    return statistics.maxBurstUs;
+}
+
+// 姿勢を除く、全てのセンサーが既定の200ミリ秒。加速度、ジャイロ、地磁気は9軸センサーのデータレディ割り込みで1回の読み出しにまとめ、
+// 位相をずらさなければ、同じ時刻に照度、紫外線、湿度、気圧のTIMER2の読み出しが重なる。
+static void testDefaultPeriods(void)
+{
+    for(int i = 0; i <= AirPressureSensor; i++) {
+        CHECK(hostWriteSensorSetting((sensor_device_t)i, sensorServiceCommand_sensing_and_logging, 200000, 0));
+    }
+    uint32_t elapsed_us;
+    const uint32_t max_burst_us = runSampling(4000, &elapsed_us);
+
+    const senstick_sensor_base_t *p_bases[] = { &brightnessSensorBase, &uvSensorBase, &humiditySensorBase, &pressureSensorBase };
+    uint32_t counts[4];
+    for(int i = 0; i < 4; i++) {
+        counts[i] = getSampleCount(p_bases[i]);
+        // 周期は変わらないので、時間の分のサンプルが揃う(変換を待つセンサーは、最後のサンプルが終わらないことがある)
+        CHECK(counts[i] >= 4000 / 200 - 1 && counts[i] <= elapsed_us / 200000);
+    }
+    printf(TEST_NAME ": 200 ms x 7 sensors, worst I2C burst %u us, brightness %u, uv %u, humidity %u, pressure %u samples\n",
+           max_burst_us, counts[0], counts[1], counts[2], counts[3]);
+#if SAMPLING_PHASE_STAGGER_ENABLED
+    // 重ならなければ、最も長いバーストは1つの読み出し(加速度、ジャイロ、地磁気の読み出し)
+    CHECK(max_burst_us <= accelerationSensorBase.busTimeUs * 2);
+#else
+    CHECK(max_burst_us >= accelerationSensorBase.busTimeUs + uvSensorBase.busTimeUs + pressureSensorBase.busTimeUs);
+#endif
+}
+
+// 周期の違うセンサー。周期の最大公約数の中で位相をずらす。加速度(10ミリ秒)の読み出しとも重ならない。
+static void testMixedPeriods(void)
+{
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    CHECK(hostWriteSensorSetting(GyroSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 20000, 0));
+    CHECK(hostWriteSensorSetting(HumidityAndTemperatureSensor, sensorServiceCommand_sensing_and_logging, 60000, 0));
+    CHECK(hostWriteSensorSetting(AirPressureSensor, sensorServiceCommand_sensing_and_logging, 100000, 0));
+    CHECK(hostWriteSensorSetting(UltraVioletSensor, sensorServiceCommand_sensing_and_logging, 50000, 0));
+    CHECK(hostWriteSensorSetting(BrightnessSensor, sensorServiceCommand_sensing_and_logging, 200000, 0));
+    uint32_t elapsed_us;
+    const uint32_t max_burst_us = runSampling(3000, &elapsed_us);
+
+    const uint32_t humidity_count = getSampleCount(&humiditySensorBase);
+    const uint32_t pressure_count = getSampleCount(&pressureSensorBase);
+    const uint32_t uv_count       = getSampleCount(&uvSensorBase);
+    printf(TEST_NAME ": mixed periods, worst I2C burst %u us, humidity %u, pressure %u, uv %u samples\n",
+           max_burst_us, humidity_count, pressure_count, uv_count);
+    CHECK(humidity_count >= 3000 / 60 - 1 && humidity_count <= elapsed_us / 60000);
+    CHECK(pressure_count >= 3000 / 100 && pressure_count <= elapsed_us / 100000);
+    CHECK(uv_count >= 3000 / 50 && uv_count <= elapsed_us / 50000);
+#if SAMPLING_PHASE_STAGGER_ENABLED
+    CHECK(max_burst_us <= accelerationSensorBase.busTimeUs * 2);
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    hostBootAndFormatStorage();
+
+    testDefaultPeriods();
+    testMixedPeriods();
+
+    return hostTestResult(TEST_NAME);
+}
@@ -0,0 +1,25 @@
+#include <stdio.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "test_storage.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// オンデバイスのストレージテスト(test_storage.c)を、エミュレータの上で実行します。
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+    initFlashMemory();
+
+    do_storage_test();
+
+    flash_emulator_statistics_t statistics;
+    flashEmulatorGetStatistics(&statistics);
+    if(statistics.programViolationCount != 0) {
+        fprintf(stderr, "test_storage: %u bytes programmed over unerased bits.\n", statistics.programViolationCount);
+        return 1;
+    }
+    printf("test_storage: OK (%.3f s simulated)\n", statistics.elapsedUs / 1e6);
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "log_controller.h"
+#include "metadata_log_controller.h"
+#include "superblock_controller.h"
+#include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
+#include "senstick_flash_address_definition.h"
+
+#include "flash_emulator.h"
+#include "host_platform.h"
+
+// 起動時のスーパーブロックによるマウントのテスト。
+
+// スーパーブロックでマウントする時の読み出し回数(インデックスと最新のレコード)
+#define SUPERBLOCK_MOUNT_READ_COUNT 2
+// 領域の先頭のスロットはインデックス。残りのスロットがレコード。
+#define SUPERBLOCK_RECORD_SIZE      128
+#define SUPERBLOCK_NUM_OF_RECORDS   (SUPERBLOCK_STORAGE_SIZE / SUPERBLOCK_RECORD_SIZE - 1)
+
+// 起動時の処理(main.c)。フラッシュの読み出し回数を返します。
+static uint32_t boot(void)
+{
+    flash_memory_statistics_t statistics;
+
+    hostPlatformReset();
+    initFlashMemory();
+    initLogController();
+    flashMemoryClearStatistics();
+
+    initSuperblockController();
+    initSenstickDataModel();
+    initMetaDataLogController();
+    initSenstickSensorController(0);
+    senstick_mountStorage();
+
+    flashMemoryGetStatistics(&statistics);
+    senstick_setControlCommand(sensorShouldSleep);
+    return statistics.readCount;
+}
+
+static void logSession(uint32_t ms)
+{
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(ms);
+    senstick_setControlCommand(sensorShouldSleep);
+}
+
+// スーパーブロックがあれば、決まった回数の読み出しでマウントできる。
+static void testMount(void)
+{
+    boot();
+    senstick_setControlCommand(formattingStorage);
+    CHECK(hostWriteSensorSetting(AccelerationSensor, sensorServiceCommand_sensing_and_logging, 10000, 0));
+    CHECK(hostWriteSensorSetting(HumidityAndTemperatureSensor, sensorServiceCommand_sensing_and_logging, 200000, 0));
+    // 間引きは、予約だった領域に記録する
+    CHECK(hostWriteSensorSetting(MagneticFieldSensor, sensorServiceCommand_sensing_and_logging, 20000, 4));
+    for(int i = 0; i < 20; i++) {
+        logSession(500);
+    }
+    CHECK(senstick_getCurrentLogCount() == 20);
+
+    uint32_t read_count = boot();
+    CHECK(read_count == SUPERBLOCK_MOUNT_READ_COUNT);
+    CHECK(senstick_getCurrentLogCount() == 20);
+    CHECK(senstick_isDiskFull() == false);
+
+    // 設定もスーパーブロックから読み込まれる
+    uint8_t buffer[SENSOR_SERVICE_SETTING_MAX_SIZE];
+    sensor_service_setting_t setting;
+    uint8_t length = senstickSensorControllerReadSetting(AccelerationSensor, buffer, sizeof(buffer));
+    deserializesensor_service_setting(&setting, buffer, length);
+    CHECK(setting.command == sensorServiceCommand_sensing_and_logging && setting.samplingDuration == 10);
+    length = senstickSensorControllerReadSetting(MagneticFieldSensor, buffer, sizeof(buffer));
+    deserializesensor_service_setting(&setting, buffer, length);
+    CHECK(length == 10 && setting.samplingDuration == 20 && setting.decimation == 4);
+
+    // 次のログも、前のログの後ろに書かれる
+    logSession(500);
+    CHECK(senstick_getCurrentLogCount() == 21);
+}
+
+// 記録中のリセットでは、従来の方法でマウントしてログを復旧し、スーパーブロックを書き直す。
+static void testMountAfterResetWhileLogging(void)
+{
+    boot();
+    senstick_setControlCommand(sensorShouldWork);
+    hostPlatformRun(500);
+
+    uint32_t read_count = boot();
+    CHECK(read_count > 1);
+    CHECK(senstick_getCurrentLogCount() == 22);
+
+    read_count = boot();
+    CHECK(read_count == SUPERBLOCK_MOUNT_READ_COUNT);
+    CHECK(senstick_getCurrentLogCount() == 22);
+}
+
+// 最新のレコードが壊れていれば、古いレコードは使わずに、従来の方法でマウントする。
+static void testTornRecord(void)
+{
+    boot();
+    logSession(100);
+    const uint8_t count = senstick_getCurrentLogCount();
+
+    // 書き込み途中で電源が落ちたレコード
+    const uint8_t *p_memory = flashEmulatorGetMemory();
+    int index = 0;
+    while(p_memory[SUPERBLOCK_STORAGE_START_ADDRESS + index] != 0xff) {
+        index++;
+    }
+    CHECK(index < SUPERBLOCK_NUM_OF_RECORDS);
+    uint8_t used_mark = 0x00;
+    writeFlash(SUPERBLOCK_STORAGE_START_ADDRESS + index, &used_mark, sizeof(used_mark));
+    uint8_t torn[16];
+    memset(torn, 0x00, sizeof(torn));
+    writeFlash(SUPERBLOCK_STORAGE_START_ADDRESS + (index + 1) * SUPERBLOCK_RECORD_SIZE, torn, sizeof(torn));
+
+    uint32_t read_count = boot();
+    CHECK(read_count > 1);
+    CHECK(senstick_getCurrentLogCount() == count);
+}
+
+// 全消去の後は、従来の方法でマウントする。
+static void testMountAfterWipe(void)
+{
+    boot();
+    senstick_setControlCommand(wipingStorage);
+    while(senstick_getStorageWipeProgress() < 100) {
+        hostPlatformRun(100);
+    }
+    uint32_t read_count = boot();
+    CHECK(read_count > 1);
+    CHECK(senstick_getCurrentLogCount() == 0);
+    CHECK(boot() == SUPERBLOCK_MOUNT_READ_COUNT);
+}
+
+// 領域は、全てのスロットを使ってから消去する。消去の後も、最新のレコードでマウントできる。
+static void testWear(void)
+{
+    boot();
+    superblock_t superblock;
+    CHECK(superblockRead(&superblock));
+
+    superblockFormat();
+    flash_memory_statistics_t statistics;
+    flashMemoryClearStatistics();
+    for(int i = 0; i < SUPERBLOCK_NUM_OF_RECORDS; i++) {
+        superblock.logCount = i;
+        superblockWrite(&superblock);
+    }
+    flashMemoryGetStatistics(&statistics);
+    CHECK(statistics.sectorEraseCount == 0);
+
+    superblock.logCount = SUPERBLOCK_NUM_OF_RECORDS;
+    superblockWrite(&superblock);
+    flashMemoryGetStatistics(&statistics);
+    printf("test_superblock: %u records, %u sector erases\n", SUPERBLOCK_NUM_OF_RECORDS + 1, statistics.sectorEraseCount);
+    CHECK(statistics.sectorEraseCount == 1);
+
+    flashMemoryClearStatistics();
+    initSuperblockController();
+    flashMemoryGetStatistics(&statistics);
+    superblock_t mounted;
+    CHECK(statistics.readCount == SUPERBLOCK_MOUNT_READ_COUNT);
+    CHECK(superblockRead(&mounted) && mounted.logCount == SUPERBLOCK_NUM_OF_RECORDS);
+}
+
+int main(int argc, char *argv[])
+{
+    hostPlatformInit(NULL);
+
+    testMount();
+    testMountAfterResetWhileLogging();
+    testTornRecord();
+    testMountAfterWipe();
+    testWear();
+
+    return hostTestResult("test_superblock");
+}
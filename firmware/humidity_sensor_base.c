@@ -29,43 +29,62 @@ static void setSensorWakeupHandler(bool shouldWakeUp, const sensor_service_setti
     }
 }
 
-// センサーの値を読み込みます。
-static uint8_t getSensorDataHandler(uint8_t *p_buffer, samplingDurationType duration_ms)
+static sensorDataCallbackType _callback;
+
+static void humidityDataReadyHandler(const uint8_t *p_data, uint8_t length)
+{
+    memcpy(&_sensorData.humidity, p_data, sizeof(HumidityData_t));
+}
+
+static void temperatureDataReadyHandler(const uint8_t *p_data, uint8_t length)
+{
+    memcpy(&_sensorData.temperature, p_data, sizeof(TemperatureData_t));
+    //NRF_LOG_PRINTF_DEBUG("humidity:H0x%04x T0x%04x.\n", _sensorData.humidity, _sensorData.temperature);
+    (_callback)(HumidityAndTemperatureSensor, (const uint8_t *)&_sensorData, sizeof(HumidityAndTemperatureData_t));
+}
+
+// 湿度と温度の変換時間(ミリ秒)。湿度は15ミリ秒、温度は11ミリ秒に余裕を見る。
+#define HUMIDITY_CONVERSION_MS    20
+#define TEMPERATURE_CONVERSION_MS (HUMIDITY_CONVERSION_MS + 1 + 11)
+
+// センサーの値の読み込みを要求します。変換待ちの間は、変換の終わる時刻に呼び出すように、*p_wakeup_msを指定します。
+static bool requestSensorDataHandler(samplingDurationType duration_ms, sensorDataCallbackType callback, samplingDurationType *p_wakeup_ms)
 {
     switch(_state) {
         case 0: // 湿度をトリガー。
             _state = 1;
             triggerHumidityMeasurement();
-            return 0;
+            *p_wakeup_ms = HUMIDITY_CONVERSION_MS + 1;
+            return false;
             
-        case 1: // 湿度の取得時間を待つ。15ミリ秒。
-            if(duration_ms > 20) {
-                _state = 2;
+        case 1: // 湿度の取得時間を待って、湿度のデータ取得。温度のトリガー。キューに積んだ順に実行される。
+            if(duration_ms <= HUMIDITY_CONVERSION_MS) {
+                *p_wakeup_ms = HUMIDITY_CONVERSION_MS + 1;
+                return false;
             }
-            return 0;
-            
-        case 2: // 湿度のデータ取得。温度のトリガー。
-            _state = 3;
-            getHumidityData(&_sensorData.humidity);
+            if( ! requestHumidityData(humidityDataReadyHandler) ) {
+                return false;
+            }
+            _state = 2;
             triggerTemperatureMeasurement();
-            return 0;
+            *p_wakeup_ms = TEMPERATURE_CONVERSION_MS + 1;
+            return false;
             
-        case 3: // 温度の取得時間を待つ。11ミリ秒。
-            if(duration_ms > (20 + 1 + 11)) {
-                _state = 4;
+        case 2: // 温度の取得時間を待って、温度のデータを取得。
+            if(duration_ms <= TEMPERATURE_CONVERSION_MS) {
+                *p_wakeup_ms = TEMPERATURE_CONVERSION_MS + 1;
+                return false;
+            }
+            _callback = callback;
+            if( ! requestTemperatureData(temperatureDataReadyHandler) ) {
+                return false;
             }
-            return 0;
-            
-        case 4: // 温度のデータを取得。
             _state = 0;
-            getTemperatureData(&_sensorData.temperature);
-            memcpy(p_buffer, &_sensorData, sizeof(HumidityAndTemperatureData_t));
-            //NRF_LOG_PRINTF_DEBUG("humidity:H0x%04x T0x%04x.\n", p_data->humidity, p_data->temperature);
-            return sizeof(HumidityAndTemperatureData_t);
+            return true;
             
         default:
             _state = 0;
-            return 0;
+            return false;
     }
 }
 
@@ -94,9 +113,13 @@ const senstick_sensor_base_t humiditySensorBase =
         HUMIDITY_SENSOR_STORAGE_START_ADDRESS, // スタートアドレス
         HUMIDITY_SENSOR_STORAGE_SIZE           // サイズ
     },
+    sensorBus_twi,
+    600,                        // 湿度と温度のトリガーと読み出しで、I2Cバスを600マイクロ秒使う
+    33000,                      // 湿度(20ミリ秒)と温度(11ミリ秒)の変換を、変換の終わる時刻の呼び出しで待つ
+    0,                          // 符号なしの値なので、間引きは使えない
     initSensorHandler,
     setSensorWakeupHandler,
-    getSensorDataHandler,
+    requestSensorDataHandler,
     getMaxMinValueHandler,
     getBLEDataHandler
 };
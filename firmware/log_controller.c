@@ -1,27 +1,334 @@
+#include <stddef.h>
+#include <string.h>
 #include <nrf_assert.h>
 #include <nordic_common.h>
+#include <app_util.h>
 
 #include "log_controller.h"
 #include "spi_slave_mx25_flash_memory.h"
+#include "senstick_log_definition.h"
+#include "senstick_flash_address_definition.h"
 
-#define SECTOR_SIZE MX25L25635F_SECTOR_SIZE
+#define PAGE_SIZE   MX25L25635F_PAGE_SIZE
+
+// ストリームのエクステント表。ヘッダセクターの中ほどに置き、ストリームのエクステントごとに、共有領域の中のエクステントの番号を2バイトで記録する。
+// エクステントはストリームの先頭から順に割り当てるので、未割当(LOG_EXTENT_NONE)の値は末尾に連続する。
+// ストリーム内の位置から、エクステントの番号を1回の読み出しで引けるので、readLog()とseekLog()は、エクステントが変わるごとに2バイトを読むだけで済む。
+#define EXTENT_LIST_OFFSET   0x800
+
+// 消去済みビットマップ。ヘッダセクターの後半に置き、ストリームのセクターごとに1ビットを割り当てる。
+// フォーマットで消去され(1)、先行消去が完了したセクターのビットを0にする。ストリームのセクターは先頭から順に消去されるので、
+// 0のビットは先頭から連続する。記録中のリセットからの復旧で、データの終端を探す範囲を、フォーマット後に消去された領域に限るために使う。
+#define ERASED_BITMAP_OFFSET 0xc00
+
+// 共有領域の、次に割り当てるエクステントの番号。エクステントは番号の順に割り当てるので、割当表は先頭から連続して使われている。
+// LOG_EXTENT_NONEならば未確定で、最初に必要になった時に、割当表を二分探索して求める。
+static uint16_t m_next_free_extent = LOG_EXTENT_NONE;
+
+// フラッシュへの非同期書き込み中のデータを保持するバッファ。全てのログで共有する。
+#define NUM_OF_PROGRAM_BUFFERS 4
+
+typedef struct {
+    volatile bool isBusy;
+    uint8_t data[LOG_WRITE_BUFFER_SIZE];
+} program_buffer_t;
+
+static program_buffer_t m_program_buffers[NUM_OF_PROGRAM_BUFFERS];
+
+// 書き込み完了で、バッファを解放する。SPIの割り込みコンテキストから呼び出される。
+static void programCompletionHandler(void *p_context)
+{
+    ((program_buffer_t *)p_context)->isBusy = false;
+}
+
+// 先行消去の統計
+static log_erase_statistics_t m_erase_statistics = { UINT32_MAX, 0 };
+
+// 空いているバッファを取得します。全て書き込み中ならば、どれかが空くまで待ちます。
+// バッファを確保するのはメインコンテキストだけなので、確保の競合はない。
+static program_buffer_t *allocateProgramBuffer(void)
+{
+    while(true) {
+        for(int i=0; i < NUM_OF_PROGRAM_BUFFERS; i++) {
+            if( ! m_program_buffers[i].isBusy ) {
+                m_program_buffers[i].isBusy = true;
+                return &(m_program_buffers[i]);
+            }
+        }
+        waitFlashCommandProgress();
+    }
+}
+
+static uint32_t getHeaderAddress(uint32_t start_address, uint8_t logid)
+{
+    return start_address + sizeof(log_header_t) * logid;
+}
 
 static void readHeader(uint32_t start_address, uint8_t logid, log_header_t *p_header)
 {
-    readFlash(start_address + sizeof(log_header_t) * logid, (uint8_t *)p_header, sizeof(log_header_t));
+    readFlash(getHeaderAddress(start_address, logid), (uint8_t *)p_header, sizeof(log_header_t));
+}
+
+// 共有領域の次に割り当てるエクステントの番号を返します。全て割り当て済みならば、LOG_NUM_OF_EXTENTSを返します。
+static uint16_t getNextFreeExtent(void)
+{
+    if(m_next_free_extent == LOG_EXTENT_NONE) {
+        uint16_t low  = 0;
+        uint16_t high = LOG_NUM_OF_EXTENTS;
+        while(low < high) {
+            uint16_t middle = low + (high - low) / 2;
+            uint8_t  owner;
+            readFlash(LOG_EXTENT_TABLE_START_ADDRESS + middle, &owner, sizeof(uint8_t));
+            if(owner != 0xff) {
+                low  = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        m_next_free_extent = low;
+    }
+    return m_next_free_extent;
+}
+
+// ストリームのnumber番目のエクステントの、共有領域の中の番号を読み出します。未割当ならばLOG_EXTENT_NONEを返します。
+static uint16_t readExtentIndex(uint32_t header_start_address, uint16_t number)
+{
+    uint16_t index = LOG_EXTENT_NONE;
+    if(number < LOG_NUM_OF_EXTENTS) {
+        readFlash(header_start_address + EXTENT_LIST_OFFSET + number * sizeof(uint16_t), (uint8_t *)&index, sizeof(uint16_t));
+    }
+    return index;
+}
+
+// ストリーム内の位置を、フラッシュのアドレスに変換します。エクステント表を読むのは、直前と違うエクステントを参照した時だけ。
+static uint32_t getFlashAddress(uint32_t header_start_address, log_extent_cursor_t *p_cursor, uint32_t position)
+{
+    const uint16_t number = position / LOG_EXTENT_SIZE;
+    if(p_cursor->index == LOG_EXTENT_NONE || p_cursor->number != number) {
+        p_cursor->number = number;
+        p_cursor->index  = readExtentIndex(header_start_address, number);
+    }
+    ASSERT(p_cursor->index < LOG_NUM_OF_EXTENTS);
+    return LOG_POOL_START_ADDRESS + p_cursor->index * LOG_EXTENT_SIZE + position % LOG_EXTENT_SIZE;
+}
+
+// ストリームの位置positionから後ろで、エクステントを割り当て済みの領域の終端位置を返します。
+// 割当は先行消去の範囲までなので、positionの後ろに割り当て済みのエクステントは、高々1つ。
+static uint32_t readAllocatedPosition(uint32_t header_start_address, uint32_t position)
+{
+    uint16_t number = position / LOG_EXTENT_SIZE;
+    while(readExtentIndex(header_start_address, number) != LOG_EXTENT_NONE) {
+        number++;
+    }
+    return number * LOG_EXTENT_SIZE;
+}
+
+// ストリームのnumber番目に、共有領域のエクステントを割り当てます。空きがなければfalseを返します。
+// 割当表に持ち主(ヘッダセクターの番号)を記録してから、ストリームのエクステント表につなぐ。間でリセットされたエクステントは、使われずに残る。
+static bool allocateExtent(uint32_t header_start_address, uint16_t number)
+{
+    uint16_t index = getNextFreeExtent();
+    if(index >= LOG_NUM_OF_EXTENTS) {
+        return false;
+    }
+    
+    uint8_t owner = (uint8_t)(header_start_address / SECTOR_SIZE);
+    ASSERT(owner != 0xff);
+    writeFlash(LOG_EXTENT_TABLE_START_ADDRESS + index, &owner, sizeof(uint8_t));
+    writeFlash(header_start_address + EXTENT_LIST_OFFSET + number * sizeof(uint16_t), (uint8_t *)&index, sizeof(uint16_t));
+    m_next_free_extent = index + 1;
+    return true;
+}
+
+// ストリームの位置end_positionまで、エクステントを割り当てます。共有領域に空きがなければfalseを返します。
+static bool allocateStream(log_context_t *p_context, uint32_t end_position)
+{
+    while(p_context->allocatedPosition < end_position) {
+        if( ! allocateExtent(p_context->headerStartAddress, p_context->allocatedPosition / LOG_EXTENT_SIZE)) {
+            return false;
+        }
+        p_context->allocatedPosition += LOG_EXTENT_SIZE;
+    }
+    return true;
+}
+
+// ストリームのデータを読み出します。エクステントの境界で分けて読み出します。
+static void readStream(uint32_t header_start_address, log_extent_cursor_t *p_cursor, uint32_t position, uint8_t *p_data, uint32_t length)
+{
+    while(length > 0) {
+        uint32_t size = MIN(length, LOG_EXTENT_SIZE - position % LOG_EXTENT_SIZE);
+        readFlashSequential(getFlashAddress(header_start_address, p_cursor, position), p_data, size);
+        position += size;
+        p_data   += size;
+        length   -= size;
+    }
+}
+
+// ログ内の位置positionから、フラッシュに書き出し済みのデータを読み出します。
+static void readLogFlash(log_context_t *p_context, uint32_t position, uint8_t *p_data, uint32_t length)
+{
+    readStream(p_context->headerStartAddress, &(p_context->extentCursor), p_context->header.startPosition + position, p_data, length);
+}
+
+// ビットマップの書き込みデータ。バイトの中で、対象のビットまでを0にした値。それより前のビットは、記録済みで0になっている。
+static const uint8_t m_erased_bitmap_values[8] = { 0xfe, 0xfc, 0xf8, 0xf0, 0xe0, 0xc0, 0x80, 0x00 };
+
+// 先行消去が完了したセクターを、消去済みビットマップに記録します。
+// データの書き込みより先にキューに積むので、データが書き込まれたセクターは、必ずビットマップに記録されている。
+static void markErasedSectors(log_context_t *p_context)
+{
+    const uint32_t erased_position = p_context->erasedPosition;
+    
+    while(p_context->markedPosition < erased_position) {
+        uint32_t sector = p_context->markedPosition / SECTOR_SIZE;
+        writeFlashAsync(p_context->headerStartAddress + ERASED_BITMAP_OFFSET + sector / 8, (uint8_t *)&(m_erased_bitmap_values[sector % 8]), 1, NULL, NULL);
+        p_context->markedPosition += SECTOR_SIZE;
+    }
+}
+
+// 消去済みビットマップを読み出し、フォーマット後に消去されたストリームの領域の終端位置を返します。
+static uint32_t readErasedPosition(const flash_address_info_t *p_address_info)
+{
+    const uint32_t num_of_sectors = LOG_NUM_OF_EXTENTS * (LOG_EXTENT_SIZE / SECTOR_SIZE);
+    uint8_t  bitmap[32];
+    uint32_t sector = 0;
+    
+    for(uint32_t i = 0; i < CEIL_DIV(num_of_sectors, 8); i += sizeof(bitmap)) {
+        uint32_t length = MIN(sizeof(bitmap), CEIL_DIV(num_of_sectors, 8) - i);
+        readFlashSequential(p_address_info->startAddress + ERASED_BITMAP_OFFSET + i, bitmap, length);
+        for(uint32_t j = 0; j < length; j++) {
+            for(int bit = 0; bit < 8; bit++) {
+                if((bitmap[j] & (1 << bit)) != 0 || sector >= num_of_sectors) {
+                    return sector * SECTOR_SIZE;
+                }
+                sector++;
+            }
+        }
+    }
+    return sector * SECTOR_SIZE;
+}
+
+// ストリームの位置startからendまでを読み出し、0xffでない最後のバイトの次の位置を返します。全て0xffならば、startを返します。
+static uint32_t findDataEnd(uint32_t header_start_address, log_extent_cursor_t *p_cursor, uint32_t start, uint32_t end)
+{
+    uint8_t buffer[PAGE_SIZE];
+    ASSERT((end - start) <= PAGE_SIZE);
+    
+    readStream(header_start_address, p_cursor, start, buffer, end - start);
+    for(int i = (end - start); i > 0; i--) {
+        if(buffer[i - 1] != 0xff) {
+            return start + i;
+        }
+    }
+    return start;
+}
+
+// 先行消去の完了で、消去済み領域を1セクター進める。SPIの割り込みコンテキストから呼び出される。
+// バックグラウンドの消去は要求した順に完了する。
+static void eraseCompletionHandler(void *p_context)
+{
+    ((log_context_t *)p_context)->erasedPosition += SECTOR_SIZE;
+}
+
+// 書き込み位置のセクターから、LOG_ERASE_AHEAD_SECTORS先のセクターまでの消去を、バックグラウンドで要求します。
+// 消去する範囲には、先にエクステントを割り当てる。共有領域に空きがなければ、割り当て済みの範囲までを消去する。
+static void scheduleEraseAhead(log_context_t *p_context)
+{
+    uint32_t write_position = p_context->header.startPosition + p_context->writePosition;
+    uint32_t target         = (write_position / SECTOR_SIZE + 1 + LOG_ERASE_AHEAD_SECTORS) * SECTOR_SIZE;
+    if( ! allocateStream(p_context, target)) {
+        target = MIN(target, p_context->allocatedPosition);
+    }
+    
+    while(p_context->eraseRequestedPosition < target) {
+        erase4kSectorInBackground(getFlashAddress(p_context->headerStartAddress, &(p_context->extentCursor), p_context->eraseRequestedPosition), eraseCompletionHandler, p_context);
+        p_context->eraseRequestedPosition += SECTOR_SIZE;
+    }
+}
+
+// ログのデータを、キャッシュを使わずに読み出します。書き込み中のログでは、フラッシュに書き出されていない部分を書き込みバッファから読み出します。
+static void readLogDataWithoutCache(log_context_t *p_context, uint32_t position, uint8_t *p_data, int length)
+{
+    // 読み込み専用のログ、またはフラッシュに書き出し済みの範囲は、フラッシュから読み出す
+    if( ! p_context->canWrite || (position + length) <= p_context->flushedPosition) {
+        readLogFlash(p_context, position, p_data, length);
+        return;
+    }
+    
+    int flash_length = 0;
+    if( position < p_context->flushedPosition) {
+        flash_length = p_context->flushedPosition - position;
+        readLogFlash(p_context, position, p_data, flash_length);
+    }
+    // 残りは書き込みバッファにある。バッファが満ちると書き出されるので、バッファの中で折り返すことはない。
+    uint32_t offset = (p_context->header.startPosition + position + flash_length) % LOG_WRITE_BUFFER_SIZE;
+    memcpy(&(p_data[flash_length]), &(p_context->p_writeBuffer[offset]), length - flash_length);
+}
+
+// キャッシュの範囲内ならtrueを返します。
+static bool isInReadCache(log_context_t *p_context, uint32_t position, int length)
+{
+    return (p_context->cacheLength > 0)
+        && (position >= p_context->cachePosition)
+        && ((position + length) <= (p_context->cachePosition + p_context->cacheLength));
+}
+
+// ログのデータを読み出します。フラッシュに書き出し済みの範囲は、読み出し位置からキャッシュにまとめて先読みします。
+// 書き込み中のログで、まだ書き出されていない部分は、キャッシュせずに書き込みバッファから読み出します。
+static void readLogData(log_context_t *p_context, uint32_t position, uint8_t *p_data, int length)
+{
+    if( ! isInReadCache(p_context, position, length)) {
+        uint32_t flash_data_end = p_context->canWrite ? p_context->flushedPosition : p_context->header.size;
+        if( (position + length) <= flash_data_end && length <= LOG_READ_CACHE_SIZE) {
+            p_context->cachePosition = position;
+            p_context->cacheLength   = MIN(LOG_READ_CACHE_SIZE, flash_data_end - position);
+            readLogFlash(p_context, position, p_context->readCache, p_context->cacheLength);
+        }
+    }
+    
+    if( isInReadCache(p_context, position, length)) {
+        memcpy(p_data, &(p_context->readCache[position - p_context->cachePosition]), length);
+    } else {
+        readLogDataWithoutCache(p_context, position, p_data, length);
+    }
 }
 
 /**
  * Public methods
  */
+void initLogController(void)
+{
+    memset(m_program_buffers, 0, sizeof(m_program_buffers));
+    clearLogEraseStatistics();
+    m_next_free_extent = LOG_EXTENT_NONE;
+}
+
+void formatLogPool(void)
+{
+ASSERT(LOG_NUM_OF_EXTENTS <= LOG_EXTENT_TABLE_SIZE); // 割当表は、エクステントあたり1バイト。
+    formatFlash(LOG_EXTENT_TABLE_START_ADDRESS, LOG_EXTENT_TABLE_SIZE);
+    m_next_free_extent = 0;
+}
+
 void formatLog(const flash_address_info_t *p_address_info)
 {
-    // 先頭2セクタ(ヘッダ+データの最初のセクタ)をフォーマット
-    formatFlash(p_address_info->startAddress, SECTOR_SIZE * 2);
+    // ヘッダセクタ(ヘッダ、エクステント表、消去済みビットマップ)をフォーマット。データは、エクステントを割り当てた時に先行消去する。
+    formatFlash(p_address_info->startAddress, SECTOR_SIZE);
 }
 
-void createLog(log_context_t *p_context, uint8_t logID, samplingDurationType samplingDuration, uint16_t measurementRange, const flash_address_info_t *p_address_info)
+uint32_t getLogFreeSize(const flash_address_info_t *p_address_info, uint32_t end_position)
 {
+    uint32_t allocated_position = readAllocatedPosition(p_address_info->startAddress, end_position);
+    uint32_t free_size          = (LOG_NUM_OF_EXTENTS - getNextFreeExtent()) * LOG_EXTENT_SIZE;
+    if(allocated_position > end_position) {
+        free_size += allocated_position - end_position;
+    }
+    return free_size;
+}
+
+void createLog(log_context_t *p_context, uint8_t *p_write_buffer, uint8_t logID, samplingDurationType samplingDuration, uint16_t measurementRange, const flash_address_info_t *p_address_info)
+{
+    ASSERT(p_write_buffer != NULL);
     memset(p_context, 0, sizeof(log_context_t));
 
     // 書き込み対象のヘッダを読み込み、まだ書き込まれていないこと(logID == 0xff)を確認します。
@@ -35,19 +342,41 @@ void createLog(log_context_t *p_context, uint8_t logID, samplingDurationType sam
     p_context->header.samplingDuration  = samplingDuration;
     p_context->header.measurementRange  = measurementRange;
     
-    // もしもlogIDが > 0 ならば、前のヘッダ情報からスタートアドレスとサイズを設定します
-ASSERT(SECTOR_SIZE / sizeof(log_header_t) > 255 ); // ヘッダに1セクタを割り当てているので、ログID0-255のヘッダを収められる容量があることを仮定。
+    // もしもlogIDが > 0 ならば、前のヘッダ情報から、ストリーム内の開始位置を設定します
+ASSERT(sizeof(log_header_t) * MAX_NUM_OF_LOG <= EXTENT_LIST_OFFSET); // ヘッダセクターの前半に、全てのログIDのヘッダを収められることを仮定。
+ASSERT(LOG_NUM_OF_EXTENTS * sizeof(uint16_t) <= (ERASED_BITMAP_OFFSET - EXTENT_LIST_OFFSET)); // エクステント表に、共有領域の全てのエクステントを収められることを仮定。
+ASSERT(LOG_NUM_OF_EXTENTS * (LOG_EXTENT_SIZE / SECTOR_SIZE) <= (SECTOR_SIZE - ERASED_BITMAP_OFFSET) * 8); // 後半のビットマップに、ストリームの全てのセクターを収められることを仮定。
     if(logID == 0) {
-        p_context->header.startAddress = p_address_info->startAddress + SECTOR_SIZE;
+        p_context->header.startPosition = 0;
     } else {
         log_header_t previous_header;
         readHeader(p_address_info->startAddress, logID -1 , &previous_header);
 ASSERT(previous_header.logID == (logID -1));
-        p_context->header.startAddress = previous_header.startAddress + previous_header.size;
+        p_context->header.startPosition = previous_header.startPosition + previous_header.size;
     }
 
-    p_context->header.size = (p_address_info->startAddress + p_address_info->size) - p_context->header.startAddress;
-    p_context->canWrite    = true;
+    // 記録中のサイズは未記録。書き込める大きさは、共有領域の空きで決まる。
+    p_context->header.size   = LOG_SIZE_NOT_CLOSED;
+    p_context->canWrite      = true;
+    p_context->p_writeBuffer = p_write_buffer;
+    
+    // ヘッダを、サイズを未記録のまま書き込みます。記録中にリセットされても、recoverLog()でこのログを復旧できます。
+    writeFlash(getHeaderAddress(p_address_info->startAddress, logID), (uint8_t *)&(p_context->header), sizeof(log_header_t));
+    
+    p_context->extentCursor.index  = LOG_EXTENT_NONE;
+    p_context->allocatedPosition   = readAllocatedPosition(p_address_info->startAddress, p_context->header.startPosition);
+    if(p_context->header.startPosition < p_context->allocatedPosition) {
+        // 書き込み開始位置のセクターは、前のログの先行消去で、消去済み。
+        p_context->erasedPosition = (p_context->header.startPosition / SECTOR_SIZE + 1) * SECTOR_SIZE;
+        p_context->markedPosition = (p_context->header.startPosition / SECTOR_SIZE) * SECTOR_SIZE;
+    } else {
+        // 開始位置のエクステントが未割当(最初のログ、または共有領域が一杯だった)。割り当てたエクステントを先頭から消去する。
+        p_context->erasedPosition = p_context->header.startPosition;
+        p_context->markedPosition = p_context->header.startPosition;
+    }
+    p_context->eraseRequestedPosition = p_context->erasedPosition;
+    markErasedSectors(p_context);
+    scheduleEraseAhead(p_context);
 }
 
 // ログを開きます。すでに書き込まれたlogIDの場合は、readonlyで開かれます。
@@ -62,6 +391,13 @@ void openLog(log_context_t *p_context, uint8_t logID, const flash_address_info_t
     
     p_context->headerStartAddress = p_address_info->startAddress;
     p_context->header             = header;
+    p_context->extentCursor.index = LOG_EXTENT_NONE;
+}
+
+void readLogHeader(uint8_t logID, const flash_address_info_t *p_address_info, log_header_t *p_header)
+{
+    readHeader(p_address_info->startAddress, logID, p_header);
+    ASSERT(p_header->logID == logID);
 }
 
 // ログを閉じます。
@@ -71,16 +407,69 @@ void closeLog(log_context_t *p_context)
         return;
     }
     
-    // ヘッダを書き込みます
+    // バッファに残っているデータを書き出します
+    flushLog(p_context);
+    // 先行消去の完了を待ちます。完了通知がこのコンテキストを更新するため。
+    while(p_context->erasedPosition != p_context->eraseRequestedPosition) {
+        waitFlashCommandProgress();
+    }
+    
+    // ヘッダのサイズを書き込みます。ヘッダの他の値は、createLog()で書き込み済み。
     p_context->header.size = p_context->writePosition;
-    writeFlash(p_context->headerStartAddress + sizeof(log_header_t) * p_context->header.logID, (uint8_t *)&(p_context->header), sizeof(log_header_t));
+    writeFlash(getHeaderAddress(p_context->headerStartAddress, p_context->header.logID) + offsetof(log_header_t, size), (uint8_t *)&(p_context->header.size), sizeof(uint32_t));
+}
+
+bool recoverLog(uint8_t logID, uint8_t unit_size, const flash_address_info_t *p_address_info)
+{
+    log_header_t header;
+    readHeader(p_address_info->startAddress, logID, &header);
+    if(header.logID != logID || header.size != LOG_SIZE_NOT_CLOSED) {
+        return false;
+    }
+    
+    // データは、ログの先頭から消去済み領域の中に、ページ単位で先頭から順に書き込まれている。
+    // 消去済みのページを二分探索して、最初の消去済みページを求める。ページの検索範囲は[low, high)。位置はストリーム内の位置。
+    // エクステントは64KB境界に揃っているので、ページがエクステントをまたぐことはない。
+    const uint32_t header_start_address = p_address_info->startAddress;
+    log_extent_cursor_t cursor = { 0, LOG_EXTENT_NONE };
+    const uint32_t start_position  = header.startPosition;
+    const uint32_t erased_position = MAX(start_position, readErasedPosition(p_address_info));
+    uint32_t low  = start_position / PAGE_SIZE;
+    uint32_t high = CEIL_DIV(erased_position, PAGE_SIZE);
+    while(low < high) {
+        uint32_t page      = low + (high - low) / 2;
+        uint32_t page_from = MAX(start_position, page * PAGE_SIZE);
+        uint32_t page_to   = MIN(erased_position, (page + 1) * PAGE_SIZE);
+        if(findDataEnd(header_start_address, &cursor, page_from, page_to) == page_from) {
+            high = page;
+        } else {
+            low  = page + 1;
+        }
+    }
+    // データの終端は、最初の消去済みページの前のページの中にある。
+    uint32_t end_position = start_position;
+    if(low > start_position / PAGE_SIZE) {
+        end_position = findDataEnd(header_start_address, &cursor, MAX(start_position, (low - 1) * PAGE_SIZE), MIN(erased_position, low * PAGE_SIZE));
+    }
+    
+    // 0xffで終わるサンプルのために、サンプル単位に切り上げる。
+    header.size = MIN(CEIL_DIV(end_position - start_position, unit_size) * unit_size, erased_position - start_position);
+    writeFlash(getHeaderAddress(header_start_address, logID) + offsetof(log_header_t, size), (uint8_t *)&(header.size), sizeof(uint32_t));
+    
+    // 次のログは、書き込み開始位置のセクターが、割り当て済みならば消去済みだと仮定する。消去済み領域を使い切っていれば、ここで消去する。
+    const uint32_t next_position = start_position + header.size;
+    if(next_position >= erased_position && readExtentIndex(header_start_address, next_position / LOG_EXTENT_SIZE) != LOG_EXTENT_NONE) {
+        erase4kSector(getFlashAddress(header_start_address, &cursor, next_position));
+    }
+    return true;
 }
 
 void reOpenLog(log_context_t *p_dst_context, log_context_t *p_src_context)
 {
     memcpy(p_dst_context, p_src_context, sizeof(log_context_t));
-    p_dst_context->header.size = p_dst_context->writePosition;
-    p_dst_context->canWrite    = false;
+    p_dst_context->header.size   = p_dst_context->writePosition;
+    p_dst_context->canWrite      = false;
+    p_dst_context->p_writeBuffer = NULL;
 }
 
 // 書き込めたサイズを返します。
@@ -89,16 +478,58 @@ int writeLog(log_context_t *p_context, uint8_t *p_data, int length)
     ASSERT(p_context != NULL);
     ASSERT(p_context->canWrite);
 
-    // 書き込み領域チェック
-    if( (p_context->writePosition + length) > p_context->header.size) {
+    // 書き込み領域チェック。通常は先行消去でエクステントを割り当て済み。
+    if( ! allocateStream(p_context, p_context->header.startPosition + p_context->writePosition + length)) {
         return 0;
     }
     
-    writeFlash(p_context->header.startAddress + p_context->writePosition, p_data, length);
-    p_context->writePosition += length;
+    // 書き込みバッファに貯めて、バッファの末尾(ページ境界)に達したらフラッシュに書き出す
+    int index = 0;
+    while(index < length) {
+        uint32_t offset = (p_context->header.startPosition + p_context->writePosition) % LOG_WRITE_BUFFER_SIZE;
+        uint32_t size   = MIN(LOG_WRITE_BUFFER_SIZE - offset, length - index);
+        memcpy(&(p_context->p_writeBuffer[offset]), &(p_data[index]), size);
+        index                    += size;
+        p_context->writePosition += size;
+        
+        if( (offset + size) == LOG_WRITE_BUFFER_SIZE) {
+            flushLog(p_context);
+        }
+    }
     return length;
 }
 
+void flushLog(log_context_t *p_context)
+{
+    ASSERT(p_context != NULL);
+    
+    uint32_t length = p_context->writePosition - p_context->flushedPosition;
+    if( ! p_context->canWrite || length == 0) {
+        return;
+    }
+    
+    // 書き込みバッファは次のデータで上書きされるので、共有バッファにコピーして非同期に書き込む。
+    // この後のreadFlash()は、キューでこの書き込みの後に実行されるので、書き込んだデータが読み出される。
+    // バッファはエクステントの境界(64KB)をまたがないので、書き出し先は1つのエクステントの中にある。
+    uint32_t position = p_context->header.startPosition + p_context->flushedPosition;
+    
+    // 書き出し先が消去済みであることを確認する。通常は先行消去が間に合っている。
+    scheduleEraseAhead(p_context);
+    if((position + length) > p_context->erasedPosition) {
+        m_erase_statistics.eraseWaitCount++;
+        while((position + length) > p_context->erasedPosition) {
+            waitFlashCommandProgress();
+        }
+    }
+    m_erase_statistics.minEraseAheadMargin = MIN(m_erase_statistics.minEraseAheadMargin, p_context->erasedPosition - (position + length));
+    markErasedSectors(p_context);
+    
+    program_buffer_t *p_buffer = allocateProgramBuffer();
+    memcpy(p_buffer->data, &(p_context->p_writeBuffer[position % LOG_WRITE_BUFFER_SIZE]), length);
+    writeFlashAsync(getFlashAddress(p_context->headerStartAddress, &(p_context->extentCursor), position), p_buffer->data, length, programCompletionHandler, p_buffer);
+    p_context->flushedPosition = p_context->writePosition;
+}
+
 // 読み込んだサイズを返します。
 int readLog(log_context_t *p_context, uint8_t *p_data, int length)
 {
@@ -114,7 +545,7 @@ int readLog(log_context_t *p_context, uint8_t *p_data, int length)
             return 0;
         }
     }
-    readFlash(p_context->header.startAddress + p_context->readPosition, p_data, length);
+    readLogData(p_context, p_context->readPosition, p_data, length);
     p_context->readPosition += length;
     return length;
 }
@@ -125,5 +556,19 @@ int seekLog(log_context_t *p_context, int position)
     ASSERT(p_context != NULL);
     
     p_context->readPosition = position;
+    if( ! isInReadCache(p_context, position, 0)) {
+        p_context->cacheLength = 0;
+    }
     return position;
 }
+
+void getLogEraseStatistics(log_erase_statistics_t *p_statistics)
+{
+    *p_statistics = m_erase_statistics;
+}
+
+void clearLogEraseStatistics(void)
+{
+    m_erase_statistics.minEraseAheadMargin = UINT32_MAX;
+    m_erase_statistics.eraseWaitCount      = 0;
+}
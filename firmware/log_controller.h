@@ -7,9 +7,36 @@
 #include "senstick_types.h"
 #include "senstick_sensor_base_data.h"
 
+// 書き込みバッファのサイズ。フラッシュのページサイズ(256バイト)の約数であること。
+// バッファはフラッシュのアドレスに揃えて使うので、バッファが満ちたときの書き込みは常にページ境界で終わる。
+#ifdef NRF51
+#define LOG_WRITE_BUFFER_SIZE 32
+#else // NRF52
+#define LOG_WRITE_BUFFER_SIZE 256
+#endif
+
+// 読み出しキャッシュのサイズ。readLog()は、この単位でフラッシュから先読みする。
+#ifdef NRF51
+#define LOG_READ_CACHE_SIZE 32
+#else // NRF52
+#define LOG_READ_CACHE_SIZE 256
+#endif
+
+// 書き込み位置より先に、消去しておくセクター数。
+#define LOG_ERASE_AHEAD_SECTORS 2
+
+// ログのデータ領域は、全てのセンサーのログで共有する領域から、エクステント(LOG_EXTENT_SIZE)単位で割り当てる。
+// ヘッダ領域ごとに1本のストリームがあり、ストリームはヘッダセクターのエクステント表で、割り当てたエクステントを順につなぐ。
+// ログは、ストリームの中に順に置かれる。ヘッダのstartPositionとログ内の位置は、ストリームの先頭からのバイト位置。
+// エクステント表の未割当の値。
+#define LOG_EXTENT_NONE 0xffff
+
+// 記録中のログのヘッダのサイズ。ヘッダはcreateLog()でこの値のまま書き込み、closeLog()でサイズを書き込む。
+#define LOG_SIZE_NOT_CLOSED 0xffffffff
+
 // ログのヘッダ構造
 typedef struct {
-    uint32_t startAddress; // データ開始位置
+    uint32_t startPosition; // データ開始位置(ストリーム内の位置)
     uint32_t size;         // データバイトサイズ
     
     uint8_t              logID;
@@ -17,6 +44,12 @@ typedef struct {
     uint16_t             measurementRange;
 } log_header_t;
 
+// ストリーム内の位置を、フラッシュのアドレスに変換するときに、直前に参照したエクステント。
+typedef struct {
+    uint16_t number; // ストリームの先頭から数えた、エクステントの番号
+    uint16_t index;  // 共有領域の中の、エクステントの番号。LOG_EXTENT_NONEならば無効。
+} log_extent_cursor_t;
+
 typedef struct {
     uint32_t headerStartAddress; // ヘッダ開始アドレス
     log_header_t header;
@@ -28,30 +61,88 @@ typedef struct {
     
     uint32_t readPosition;
     uint32_t writePosition;
+    
+    // フラッシュに書き出し済みの位置。flushedPositionからwritePositionまでのデータは、書き込みバッファにある。
+    uint32_t flushedPosition;
+    // 書き込みバッファ(LOG_WRITE_BUFFER_SIZEバイト)。createLog()で渡される。読み込み専用のログではNULL。インデックスは (アドレス % LOG_WRITE_BUFFER_SIZE)。
+    uint8_t *p_writeBuffer;
+    
+    // 読み出しキャッシュ。ログ内の位置 cachePosition から cacheLength バイトのデータを保持する。cacheLengthが0なら無効。
+    uint32_t cachePosition;
+    uint32_t cacheLength;
+    uint8_t  readCache[LOG_READ_CACHE_SIZE];
+    
+    // 直前に参照したエクステント
+    log_extent_cursor_t extentCursor;
+    // ストリームにエクステントを割り当て済みの領域の、終端位置。
+    uint32_t allocatedPosition;
+    
+    // 以下はストリーム内の位置。
+    // 消去済み領域の終端位置。書き込み位置からここまでは消去済み。バックグラウンドの消去完了で更新される。
+    volatile uint32_t erasedPosition;
+    // 消去を要求済みの領域の終端位置。
+    uint32_t eraseRequestedPosition;
+    // 消去済みビットマップに記録した領域の終端位置。
+    uint32_t markedPosition;
 } log_context_t;
 
-// ログ領域をフォーマットします。
+// 先行消去の統計
+typedef struct {
+    uint32_t minEraseAheadMargin; // フラッシュへの書き出し時に、書き出し末尾より先に消去済みだったバイト数の最小値
+    uint32_t eraseWaitCount;      // 消去が間に合わず、書き出しが消去の完了を待った回数
+} log_erase_statistics_t;
+
+// 初期化関数。書き込み中の共有バッファを解放します。エクステントの空きは、最初に必要になった時に割当表から求めます。
+void initLogController(void);
+
+// 共有のデータ領域をフォーマットします。エクステントの割当表を消去します。
+void formatLogPool(void);
+
+// ログ領域(ヘッダセクター)をフォーマットします。ストリームは空になります。共有のデータ領域は、formatLogPool()でフォーマットします。
 void formatLog(const flash_address_info_t *p_address_info);
 
-//
-void createLog(log_context_t *p_context, uint8_t logID, samplingDurationType samplingDuration, uint16_t measurementRange, const flash_address_info_t *p_address_info);
+// ストリームの位置end_positionより後ろに書き込めるバイト数を返します。
+// ストリームに割り当て済みのエクステントの残りと、共有領域の空きエクステントの合計です。
+uint32_t getLogFreeSize(const flash_address_info_t *p_address_info, uint32_t end_position);
+
+// ログを書き込みモードで作ります。ヘッダは、サイズを未記録(LOG_SIZE_NOT_CLOSED)のまま書き込まれます。
+// p_write_bufferは、LOG_WRITE_BUFFER_SIZEバイトの書き込みバッファ。ログを閉じるまで、他のログに使わないこと。
+void createLog(log_context_t *p_context, uint8_t *p_write_buffer, uint8_t logID, samplingDurationType samplingDuration, uint16_t measurementRange, const flash_address_info_t *p_address_info);
 
 // ログを読み込みモードで開きます。失敗した時はfalseが返ってきます。
 void openLog(log_context_t *p_context, uint8_t logID, const flash_address_info_t *p_address_info);
 
-// ログを閉じます。
+// ログのヘッダだけを読み込みます。ログの位置とサイズだけが必要な時に、コンテキストを使わずに済みます。
+void readLogHeader(uint8_t logID, const flash_address_info_t *p_address_info, log_header_t *p_header);
+
+// ログを閉じます。書き込みバッファに残っているデータは、フラッシュに書き出されます。
+// 要求済みの先行消去が完了するまで待ちます。
 void closeLog(log_context_t *p_context);
 
+// 記録中のリセットで閉じられなかったログを復旧します。ヘッダのサイズが未記録ならば、データの終端を探してサイズを書き込み、trueを返します。
+// データの終端は、消去済みビットマップが示す範囲の中で、最初の消去済みページを二分探索して求めます。
+// サイズは、unit_size(1サンプルのバイト数)の倍数に切り上げます。
+bool recoverLog(uint8_t logID, uint8_t unit_size, const flash_address_info_t *p_address_info);
+
 // 読み込み専用で再オープン。ログ構造体をコピーする。
 void reOpenLog(log_context_t *p_dst_context, log_context_t *p_src_context);
 
-// 書き込めたサイズを返します。
+// 書き込みバッファの内容を、フラッシュに非同期に書き出します。
+void flushLog(log_context_t *p_context);
+
+// 書き込めたサイズを返します。データは書き込みバッファに貯められ、バッファが満ちた時にフラッシュに書き出されます。
+// 共有領域にエクステントが残っていなければ、0を返します。
 int writeLog(log_context_t *p_context, uint8_t *p_data, int length);
 
-// 読み込んだサイズを返します。
+// 読み込んだサイズを返します。書き込み中のログでは、まだフラッシュに書き出されていないデータも読み出せます。
 int readLog(log_context_t *p_context, uint8_t *p_data, int length);
 
 // 読み出し位置をシークします。シーク位置を返します。書き込み位置はseekされません。
+// 読み出しキャッシュの範囲外にシークした場合は、キャッシュを破棄します。
 int seekLog(log_context_t *p_context, int position);
 
+// 先行消去の統計を取得/クリアします。
+void getLogEraseStatistics(log_erase_statistics_t *p_statistics);
+void clearLogEraseStatistics(void);
+
 #endif /* log_controller_h */
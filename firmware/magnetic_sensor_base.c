@@ -24,11 +24,18 @@ static void setSensorWakeupHandler(bool shouldWakeUp, const sensor_service_setti
     }
 }
 
-// センサーの値を読み込みます。
-static uint8_t getSensorDataHandler(uint8_t *p_buffer, samplingDurationType duration_ms)
+static sensorDataCallbackType _callback;
+
+static void sensorDataReadyHandler(const uint8_t *p_data, uint8_t length)
+{
+    (_callback)(MagneticFieldSensor, p_data, length);
+}
+
+// センサーの値の読み込みを要求します。
+static bool requestSensorDataHandler(samplingDurationType duration_ms, sensorDataCallbackType callback, samplingDurationType *p_wakeup_ms)
 {
-    getMagneticFieldData(p_buffer);
-    return sizeof(MagneticFieldData_t);
+    _callback = callback;
+    return requestMagneticFieldData(sensorDataReadyHandler);
 }
 
 // srcとdstのセンサデータの最大値/最小値をp_srcに入れます。p_srcは破壊されます。
@@ -57,9 +64,17 @@ const senstick_sensor_base_t magneticSensorBase =
         MAGNETIC_SENSOR_STORAGE_START_ADDRESS, // スタートアドレス
         MAGNETIC_SENSOR_STORAGE_SIZE           // サイズ
     },
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+    sensorBus_twiNineAxes,      // 9軸センサーの読み出しでまとめて読み出す
+#else
+    sensorBus_twi,
+#endif
+    360,                        // I2Cバスを360マイクロ秒使う
+    10000,                      // AK8963の連続測定モード(100Hz)
+    3,                          // x, y, zを間引きのフィルタに通せる
     initSensorHandler,
     setSensorWakeupHandler,
-    getSensorDataHandler,
+    requestSensorDataHandler,
     getMaxMinValueHandler,
     getBLEDataHandler
 };
@@ -54,6 +54,8 @@
 
 #include "spi_slave_mx25_flash_memory.h"
 #include "metadata_log_controller.h"
+#include "log_controller.h"
+#include "superblock_controller.h"
 #include "senstick_flash_address_definition.h"
 
 static ble_uuid_t m_advertisiong_uuid;
@@ -284,6 +286,8 @@ int main(void)
     initLEDDriver();
     initButtonMonitoring();
     initFlashMemory();
+    initLogController();
+    initSuperblockController();
 
     initSenstickDataModel();
     initMetaDataLogController();
@@ -328,28 +332,8 @@ int main(void)
     initTwiExtService(uuid_type);
 #endif
     
-    // 不揮発メモリのフォーマット処理
-    if( ! isMetaLogFormatted() ) {
-        metaLogFormatStorage();
-        senstickSensorControllerFormatStorage();
-    }
-
-    // 初期値設定
-    uint8_t count = 0;
-    // メタ領域の容量チェック
-    bool is_storage_full = false;
-    metaDataLogGetLogCount(&count, &is_storage_full);
-NRF_LOG_PRINTF_DEBUG("FLASH_END_ADDR: 0x%0x\n", PRESSURE_SENSOR_STORAGE_END_ADDRESS);
-NRF_LOG_PRINTF_DEBUG("meta, count:%d is_full:%d\n", count, is_storage_full);
-    senstick_setCurrentLogCount(count);
-    // データ領域のチェック, データ領域があれば
-    if( count > 0 ) {
-        bool isFull      = senstickSensorControllerIsDataFull(count -1);
-        is_storage_full |= isFull;
-NRF_LOG_PRINTF_DEBUG("data area: is_full:%d\n", isFull);
-    }
-    // フラグ設定
-    senstick_setDiskFull(is_storage_full);
+    // 不揮発メモリのマウント。ログ数とディスクフルの状態を設定する。
+    senstick_mountStorage();
 
     // 電源が入れば、ログ取り開始
     senstick_setControlCommand(sensorShouldSleep);
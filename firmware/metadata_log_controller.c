@@ -21,7 +21,11 @@
 #include "senstick_data_model.h"
 
 // 領域フォーマット済を示すint32のマジックワード, ファームウェアのリビジョンで変化する。
-#define MAGIC_WORD (0xab5a ^ FIRMWARE_REVISION)
+// フラッシュの割当(senstick_flash_address_definition.h)を変えたら、基準値も変えて、起動時にフォーマットさせる。
+#define MAGIC_WORD (0xab5b ^ FIRMWARE_REVISION)
+
+// ログ数を数える時に、1回の読み出しで読むエントリ数
+#define NUM_OF_SCAN_ENTRIES 8
 
 typedef struct {
     uint8_t is_closed_value; // 0x00 closed, 0xff is not closed
@@ -112,27 +116,44 @@ bool isMetaLogFormatted(void)
     return (i == MAGIC_WORD);
 }
 
-// 有効なログの数を取得します。0はログがないことを示します。
-void metaDataLogGetLogCount(uint8_t *p_count, bool *p_is_header_full)
+// 閉じられたログのエントリを先頭から数えます。閉じられていないエントリがあれば、p_is_unclosedをtrueにします。
+static uint8_t scanLogEntries(bool *p_is_unclosed)
 {
-    meta_log_content_t content;
+    meta_log_content_t contents[NUM_OF_SCAN_ENTRIES];
     uint8_t count = 0;
-    bool is_header_full = false;
+    bool is_unclosed  = false;
+    bool did_find_end = false;
     
-    for(uint8_t i=0; i < MAX_NUM_OF_LOG; i++) {
-        metaDataLogRead(i, &content);
-        // log_id が0xff(フラッシュが初期化されている)ならば、処理終了
-        if(content.log_id == 0xff) {
-            break;
-        }
-        // フラグが閉じていないならば、
-        if(content.is_closed_value != 0x00) {
-            is_header_full = true;
-            break;
+    // エントリは連続して並んでいるので、まとめて読み出す
+    for(uint8_t i=0; i < MAX_NUM_OF_LOG && ! did_find_end; i += NUM_OF_SCAN_ENTRIES) {
+        uint8_t num_of_entries = MIN(NUM_OF_SCAN_ENTRIES, MAX_NUM_OF_LOG - i);
+        readFlashSequential(getTargetAddress(i), (uint8_t *)contents, num_of_entries * sizeof(meta_log_content_t));
+        for(uint8_t j=0; j < num_of_entries; j++) {
+            // log_id が0xff(フラッシュが初期化されている)ならば、処理終了
+            if(contents[j].log_id == 0xff) {
+                did_find_end = true;
+                break;
+            }
+            // フラグが閉じていないならば、
+            if(contents[j].is_closed_value != 0x00) {
+                is_unclosed  = true;
+                did_find_end = true;
+                break;
+            }
+            count++;
         }
-        count++;
     }
     
+    *p_is_unclosed = is_unclosed;
+    return count;
+}
+
+// 有効なログの数を取得します。0はログがないことを示します。
+void metaDataLogGetLogCount(uint8_t *p_count, bool *p_is_header_full)
+{
+    bool is_header_full = false;
+    uint8_t count = scanLogEntries(&is_header_full);
+    
     if( count == MAX_NUM_OF_LOG) {
         is_header_full = true;
     }
@@ -141,6 +162,18 @@ void metaDataLogGetLogCount(uint8_t *p_count, bool *p_is_header_full)
     *p_is_header_full = is_header_full;
 }
 
+bool metaDataLogFindUnclosedLog(uint8_t *p_logid)
+{
+    bool is_unclosed = false;
+    *p_logid = scanLogEntries(&is_unclosed);
+    return is_unclosed;
+}
+
+void metaDataLogCloseLog(uint8_t logid)
+{
+    closeLog(logid);
+}
+
 // ターゲットIDの時刻を返します。もしもターゲットIDが存在しなければ、なにもしません。
 void metaDataLogReadDateTime(uint8_t logid, ble_date_time_t *p_date)
 {
@@ -196,6 +229,7 @@ void metaDatalog_observeControlCommand(senstick_control_command_t old_command, s
 //            NRF_LOG_PRINTF_DEBUG("metaDatalog_observeControlCommand:hour:%d min:%d\n", datetime.hours, datetime.minutes);
             break;
         case formattingStorage:
+        case wipingStorage:
             metaLogFormatStorage();
             break;
         case shouldDeviceSleep:
@@ -19,6 +19,11 @@ bool isMetaLogFormatted(void);
 // 有効なログの数を取得します。0はログがないことを示します。
 void metaDataLogGetLogCount(uint8_t *p_count, bool *p_is_header_full);
 
+// 記録中のリセットで、閉じられていないログがあれば、そのIDを取得してtrueを返します。
+bool metaDataLogFindUnclosedLog(uint8_t *p_logid);
+// ログのエントリを閉じます。
+void metaDataLogCloseLog(uint8_t logid);
+
 // ターゲットIDの時刻を返します。もしもターゲットIDが存在しなければ、なにもしません。
 void metaDataLogReadDateTime(uint8_t logid, ble_date_time_t *p_date);
 
@@ -26,7 +26,8 @@
 
 #if (GPIOTE_ENABLED == 1)
 #define GPIOTE_CONFIG_USE_SWI_EGU false
-#define GPIOTE_CONFIG_IRQ_PRIORITY APP_IRQ_PRIORITY_LOW
+// 9軸センサーのデータレディ割り込みでTWIを読み出すので、TIMER2と同じ優先度にする。
+#define GPIOTE_CONFIG_IRQ_PRIORITY APP_IRQ_PRIORITY_HIGH
 #define GPIOTE_CONFIG_NUM_OF_LOW_POWER_EVENTS 1
 #endif
 
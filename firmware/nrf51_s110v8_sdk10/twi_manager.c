@@ -3,6 +3,7 @@
 #include <nrf_drv_twi.h>
 #include <nrf_drv_gpiote.h>
 #include <nrf_delay.h>
+#include <nrf_assert.h>
 #include <sdk_errors.h>
 #include <app_error.h>
 
@@ -63,6 +64,68 @@ bool readFromTwiSlave(uint8_t twi_address, uint8_t target_register, uint8_t *dat
     return (err_code == NRF_SUCCESS);
 }
 
+// nRF51(SDK10)のTWIドライバは、ブロッキングで使っている。トランザクションはキューに積まず、その場で実行して完了ハンドラを呼び出す。
+bool twiEnqueueTransaction(const twi_transaction_t *p_transaction)
+{
+    bool is_success = true;
+    
+    if(p_transaction->txLength > 0) {
+        is_success = (TwiSlave_TX(p_transaction->address, p_transaction->txData, p_transaction->txLength, (p_transaction->rxLength > 0)) == NRF_SUCCESS);
+    }
+    if(is_success && p_transaction->rxLength > 0) {
+        is_success = (TwiSlave_RX(p_transaction->address, p_transaction->p_rxData, p_transaction->rxLength) == NRF_SUCCESS);
+    }
+    if(p_transaction->handler != NULL) {
+        (p_transaction->handler)(is_success, p_transaction->p_context);
+    }
+    return true;
+}
+
+bool twiEnqueueRead(uint8_t twi_address, uint8_t target_register, uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context)
+{
+    twi_transaction_t transaction;
+    transaction.address   = twi_address;
+    transaction.txLength  = 1;
+    transaction.txData[0] = target_register;
+    transaction.rxLength  = length;
+    transaction.p_rxData  = p_data;
+    transaction.handler   = handler;
+    transaction.p_context = p_context;
+    return twiEnqueueTransaction(&transaction);
+}
+
+bool twiEnqueueWrite(uint8_t twi_address, const uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context)
+{
+    ASSERT(length <= TWI_TRANSACTION_MAX_TX_LENGTH);
+    
+    twi_transaction_t transaction;
+    transaction.address   = twi_address;
+    transaction.txLength  = length;
+    memcpy(transaction.txData, p_data, length);
+    transaction.rxLength  = 0;
+    transaction.p_rxData  = NULL;
+    transaction.handler   = handler;
+    transaction.p_context = p_context;
+    return twiEnqueueTransaction(&transaction);
+}
+
+bool twiEnqueueReceive(uint8_t twi_address, uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context)
+{
+    twi_transaction_t transaction;
+    transaction.address   = twi_address;
+    transaction.txLength  = 0;
+    transaction.rxLength  = length;
+    transaction.p_rxData  = p_data;
+    transaction.handler   = handler;
+    transaction.p_context = p_context;
+    return twiEnqueueTransaction(&transaction);
+}
+
+// トランザクションはその場で実行しているので、待つものはない。
+void twiWaitForIdle(void)
+{
+}
+
 void initTWIManager(void)
 {
     ret_code_t err_code;
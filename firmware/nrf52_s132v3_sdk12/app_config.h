@@ -45,18 +45,28 @@
 #define TWI_DEFAULT_CONFIG_FREQUENCY 26738688
 
 // TWI0および1を使用する。
+// 9軸センサーのTWI0は、EasyDMA(TWIM)にする。リストモードの読み出しを、TIMER3からPPIで起動する(twiStartPeriodicRead())。
 #define TWI0_ENABLED 1
-#define TWI0_USE_EASY_DMA 0
+#define TWI0_USE_EASY_DMA 1
 #define TWI1_ENABLED 1
 #define TWI1_USE_EASY_DMA 0
 //#define TWI_CONFIG_LOG_ENABLED 1
 
+// ===
+// GPIOTE。9軸センサーのINTピンのデータレディ割り込みで、TWIを読み出す。
+// センサーのサンプリングのTIMER2(APP_IRQ_PRIORITY_HIGH)と同じ優先度にして、TWIの読み出しが互いに割り込まないようにする。
+#define GPIOTE_CONFIG_IRQ_PRIORITY 2
+
+// PPI。TWI0の周期読み出しで、TIMER3、TIMER4とTWIMのイベントとタスクをつなぐ。
+#define PPI_ENABLED 1
+
 // UARTは使用しない。
 #define UART_ENABLED 0
 
 // ===
 // ライブラリ。
-#define APP_MAILBOX_ENABLED   1
+// センサーのサンプルは、ring_buffer.cで受け渡す。
+#define APP_MAILBOX_ENABLED   0
 #define APP_SCHEDULER_ENABLED 1
 
 // ===
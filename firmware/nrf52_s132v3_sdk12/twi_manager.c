@@ -1,80 +1,508 @@
 #include <string.h>
 
 #include <nrf_drv_twi.h>
+#include <nrf_drv_ppi.h>
 #include <nrf_gpio.h>
 #include <nrf_delay.h>
+#include <nrf_assert.h>
 #include <sdk_errors.h>
 #include <app_error.h>
+#include <app_util_platform.h>
 
 #include "senstick_util.h"
 #include "senstick_io_definition.h"
 #include "twi_manager.h"
 
+// バスごとのトランザクションのキューの深さ。
+#define TWI_TRANSACTION_QUEUE_SIZE 8
+
+// TWIの割り込み優先度。センサーのTIMER2、GPIOTEと同じにして、それらの割り込みの中で積んだトランザクションが、割り込みを抜けてから順に実行されるようにする。
+#define TWI_IRQ_PRIORITY APP_IRQ_PRIORITY_HIGH
+
+// バスのコンテキスト。キューの先頭が実行中のトランザクション。
+typedef struct {
+    const nrf_drv_twi_t *p_twi;
+    twi_transaction_t queue[TWI_TRANSACTION_QUEUE_SIZE];
+    uint8_t head;
+    volatile uint8_t count;
+    // トランザクションの実行中、または完了ハンドラの呼び出し中
+    volatile bool isRunning;
+    // 周期読み出しがバスを使っている。その間、キューのトランザクションは開始しない。
+    volatile bool isPeriodicReading;
+} twi_bus_context_t;
+
+// 周期読み出しのトリガーとサンプル数のカウンタ。TIMER0はSoftDevice、TIMER2はセンサーのサンプリングクロックが使う。
+#define PERIODIC_READ_TRIGGER_TIMER NRF_TIMER3
+#define PERIODIC_READ_COUNTER_TIMER NRF_TIMER4
+// TIMER3のプリスケーラ。16MHz / 2^4 = 1MHz。
+#define PERIODIC_READ_PRESCALER_1US 4
+// 止めるときに、転送中の読み出しが終わるのを待つ時間。
+#define PERIODIC_READ_TRANSFER_US   1000
+
+// twi0の周期読み出し。リングバッファは2バッチ分で、前半をハンドラに渡している間に、後半に読み出す。
+// TIMER4はTWIMのSTOPPEDを数え、CC[0](1バッチ)で割り込み、CC[1](2バッチ)で割り込んでカウンタをクリアする。
+// CC[1]ではPPIがトリガーのチャネルグループを止めるので、CPUが受信の位置をリングの先頭に戻すまで、次の読み出しは始まらない。
+// CC[2]には、トリガーごとにその時点のサンプル数をキャプチャする。リングの末尾の後のトリガーは、取りこぼしとして数える。
+typedef struct {
+    bool isRunning;
+    uint8_t txData[1];      // 読み出しを開始するレジスタアドレス。EasyDMAで送るのでRAMに置く。
+    nrf_drv_twi_xfer_desc_t xferDesc;
+    uint8_t sampleSize;
+    uint8_t batchSize;
+    twi_periodic_read_handler_t handler;
+    nrf_ppi_channel_t triggerChannel;   // TIMER3 COMPARE[0] -> TWIM STARTTX。triggerGroupに入れる。
+    nrf_ppi_channel_t captureChannel;   // TIMER3 COMPARE[0] -> TIMER4 CAPTURE[2]
+    nrf_ppi_channel_t countChannel;     // TWIM STOPPED -> TIMER4 COUNT
+    nrf_ppi_channel_t ringEndChannel;   // TIMER4 COMPARE[1] -> triggerGroupのDISABLE
+    nrf_ppi_channel_group_t triggerGroup;
+    uint32_t missedTriggerCount;
+    uint8_t ring[2 * TWI_PERIODIC_READ_MAX_BATCH_SIZE * TWI_PERIODIC_READ_MAX_SAMPLE_SIZE];
+} twi_periodic_read_t;
+
+// 完了まで待つ呼び出しのコンテキスト
+typedef struct {
+    volatile bool isDone;
+    volatile bool isSuccess;
+} twi_blocking_context_t;
+
 // twi0は9軸、twiはその他センサーが接続するバス。
 const nrf_drv_twi_t twi0 = NRF_DRV_TWI_INSTANCE(0);
 const nrf_drv_twi_t twi  = NRF_DRV_TWI_INSTANCE(1);
 static bool _isTwiPowerOn;
 
-ret_code_t TwiSlave_TX(uint8_t address, uint8_t const *p_data, uint32_t length, bool xfer_pending)
+static twi_bus_context_t m_twi0_bus;
+static twi_bus_context_t m_twi_bus;
+
+static twi_periodic_read_t m_periodic_read;
+
+/**
+ * Private methods
+ */
+
+// TWI_MPU9250_ADDRESS, TWI_AK8963_ADDRESS はtwi0, その他はtwi
+static twi_bus_context_t *getBusContext(uint8_t address)
+{
+    return (address == TWI_MPU9250_ADDRESS || address == TWI_AK8963_ADDRESS) ? &m_twi0_bus : &m_twi_bus;
+}
+
+// キューの先頭のトランザクションを取り出して、完了ハンドラを呼び出します。
+// ハンドラの中で積まれたトランザクションを、ここで開始しないように、isRunningは立てたまま呼び出す。
+static void completeTransaction(twi_bus_context_t *p_bus, bool is_success)
 {
-    // TWI_MPU9250_ADDRESS, TWI_AK8963_ADDRESS はtwi0, その他はtwi
-    const nrf_drv_twi_t *p_twi = (address == TWI_MPU9250_ADDRESS || address == TWI_AK8963_ADDRESS) ? &twi0 : &twi;
-    ret_code_t err_code = nrf_drv_twi_tx(p_twi, address, p_data, length, xfer_pending);
-    if(err_code != NRF_SUCCESS) {
-        NRF_LOG_PRINTF_DEBUG("\nTwiSlave_TX(), err:0x%08x address:0x%02x.", err_code, address);
-    } else {
-//        NRF_LOG_PRINTF_DEBUG("\nTwiSlave_TX(), address:0x%02x.", address);
+    twi_transaction_t transaction;
+    
+    CRITICAL_REGION_ENTER();
+    transaction  = p_bus->queue[p_bus->head];
+    p_bus->head  = (p_bus->head + 1) % TWI_TRANSACTION_QUEUE_SIZE;
+    p_bus->count--;
+    CRITICAL_REGION_EXIT();
+    
+    if( ! is_success) {
+        NRF_LOG_PRINTF_DEBUG("\ntwi transaction failed, address:0x%02x.", transaction.address);
+    }
+    if(transaction.handler != NULL) {
+        (transaction.handler)(is_success, transaction.p_context);
     }
-    return err_code;
 }
 
-ret_code_t TwiSlave_RX(uint8_t address, uint8_t *p_data, uint32_t length)
+// バスが止まっていれば、キューの先頭のトランザクションを開始します。
+static void startNextTransaction(twi_bus_context_t *p_bus)
 {
-    const nrf_drv_twi_t *p_twi = (address == TWI_MPU9250_ADDRESS || address == TWI_AK8963_ADDRESS) ? &twi0 : &twi;
-    ret_code_t err_code = nrf_drv_twi_rx(p_twi, address, p_data, length);
-    if(err_code != NRF_SUCCESS) {
-        NRF_LOG_PRINTF_DEBUG("\nTwiSlave_RX(), err:0x%08x address:0x%02x.", err_code, address);
-    } else {
-//        NRF_LOG_PRINTF_DEBUG("\nTwiSlave_RX(), address:0x%02x.", address);
+    while(true) {
+        bool should_start = false;
+        CRITICAL_REGION_ENTER();
+        if( ! p_bus->isRunning && ! p_bus->isPeriodicReading && p_bus->count > 0) {
+            p_bus->isRunning = true;
+            should_start     = true;
+        }
+        CRITICAL_REGION_EXIT();
+        if( ! should_start) {
+            return;
+        }
+        
+        twi_transaction_t *p_transaction = &(p_bus->queue[p_bus->head]);
+        nrf_drv_twi_xfer_desc_t xfer_desc;
+        if(p_transaction->txLength > 0 && p_transaction->rxLength > 0) {
+            xfer_desc = (nrf_drv_twi_xfer_desc_t)NRF_DRV_TWI_XFER_DESC_TXRX(p_transaction->address, p_transaction->txData, p_transaction->txLength, p_transaction->p_rxData, p_transaction->rxLength);
+        } else if(p_transaction->txLength > 0) {
+            xfer_desc = (nrf_drv_twi_xfer_desc_t)NRF_DRV_TWI_XFER_DESC_TX(p_transaction->address, p_transaction->txData, p_transaction->txLength);
+        } else {
+            xfer_desc = (nrf_drv_twi_xfer_desc_t)NRF_DRV_TWI_XFER_DESC_RX(p_transaction->address, p_transaction->p_rxData, p_transaction->rxLength);
+        }
+        ret_code_t err_code = nrf_drv_twi_xfer(p_bus->p_twi, &xfer_desc, 0);
+        if(err_code == NRF_SUCCESS) {
+            return;
+        }
+        // 開始できなければ、失敗として完了させ、次のトランザクションへ。
+        completeTransaction(p_bus, false);
+        p_bus->isRunning = false;
     }
-    return err_code;
 }
 
+// TWIドライバのイベントハンドラ。p_contextはバスのコンテキスト。
+static void twiEventHandler(nrf_drv_twi_evt_t const *p_event, void *p_context)
+{
+    twi_bus_context_t *p_bus = (twi_bus_context_t *)p_context;
+    
+    completeTransaction(p_bus, (p_event->type == NRF_DRV_TWI_EVT_DONE));
+    p_bus->isRunning = false;
+    startNextTransaction(p_bus);
+}
 
-bool writeToTwiSlave(uint8_t twi_address, uint8_t target_register, const uint8_t *data, uint8_t length)
+static void blockingTransactionHandler(bool is_success, void *p_context)
 {
-    ret_code_t err_code;
+    twi_blocking_context_t *p_blocking = (twi_blocking_context_t *)p_context;
+    p_blocking->isSuccess = is_success;
+    p_blocking->isDone    = true;
+}
+
+// トランザクションを積み、完了まで待ちます。
+static bool executeTransaction(twi_transaction_t *p_transaction)
+{
+    // 待っている間にTWIの割り込みが入れること。
+    ASSERT(current_int_priority_get() > TWI_IRQ_PRIORITY);
     
-    // 先頭バイトは、レジスタアドレス
-    uint8_t buffer[length + 1];
-    buffer[0] = target_register;
-    memcpy(&(buffer[1]), data, length);
+    twi_blocking_context_t blocking = { false, false };
+    p_transaction->handler   = blockingTransactionHandler;
+    p_transaction->p_context = &blocking;
     
-    // I2C書き込み
-    err_code = TwiSlave_TX(twi_address, buffer, (length + 1), false);
-    return (err_code == NRF_SUCCESS);
+    // キューがいっぱいなら、空くまで待つ
+    while( ! twiEnqueueTransaction(p_transaction) ) {
+    }
+    while( ! blocking.isDone ) {
+    }
+    return blocking.isSuccess;
 }
 
-bool readFromTwiSlave(uint8_t twi_address, uint8_t target_register, uint8_t *data, uint8_t length)
+static void initBusContext(twi_bus_context_t *p_bus, const nrf_drv_twi_t *p_twi)
+{
+    memset(p_bus, 0, sizeof(twi_bus_context_t));
+    p_bus->p_twi = p_twi;
+}
+
+// 周期読み出しの転送を設定します。受信の位置はリングの先頭。開始はTIMER3のトリガーから。
+static void setupPeriodicReadTransfer(void)
+{
+    const uint32_t flags = NRF_DRV_TWI_FLAG_HOLD_XFER | NRF_DRV_TWI_FLAG_RX_POSTINC | NRF_DRV_TWI_FLAG_REPEATED_XFER | NRF_DRV_TWI_FLAG_NO_XFER_EVT_HANDLER;
+    ret_code_t err_code = nrf_drv_twi_xfer(&twi0, &(m_periodic_read.xferDesc), flags);
+    APP_ERROR_CHECK(err_code);
+}
+
+// PPIのチャネルとグループを確保し、周期読み出しのタイマーを設定します。
+static void initPeriodicRead(void)
 {
     ret_code_t err_code;
     
-    // 読み出しターゲットアドレスを設定
-    uint8_t buffer0 = target_register;
-    err_code = TwiSlave_TX(twi_address, &buffer0, 1, true);
-    if(err_code != NRF_SUCCESS) {
+    memset(&m_periodic_read, 0, sizeof(twi_periodic_read_t));
+    
+    err_code = nrf_drv_ppi_init();
+    if(err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED) {
+        APP_ERROR_CHECK(err_code);
+    }
+    err_code = nrf_drv_ppi_channel_alloc(&(m_periodic_read.triggerChannel));
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_alloc(&(m_periodic_read.captureChannel));
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_alloc(&(m_periodic_read.countChannel));
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_alloc(&(m_periodic_read.ringEndChannel));
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_group_alloc(&(m_periodic_read.triggerGroup));
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_include_in_group(m_periodic_read.triggerChannel, m_periodic_read.triggerGroup);
+    APP_ERROR_CHECK(err_code);
+    
+    err_code = nrf_drv_ppi_channel_assign(m_periodic_read.triggerChannel,
+                                          (uint32_t)&(PERIODIC_READ_TRIGGER_TIMER->EVENTS_COMPARE[0]),
+                                          nrf_drv_twi_start_task_get(&twi0, NRF_DRV_TWI_XFER_TXRX));
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_assign(m_periodic_read.captureChannel,
+                                          (uint32_t)&(PERIODIC_READ_TRIGGER_TIMER->EVENTS_COMPARE[0]),
+                                          (uint32_t)&(PERIODIC_READ_COUNTER_TIMER->TASKS_CAPTURE[2]));
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_assign(m_periodic_read.countChannel,
+                                          nrf_drv_twi_stopped_event_get(&twi0),
+                                          (uint32_t)&(PERIODIC_READ_COUNTER_TIMER->TASKS_COUNT));
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_assign(m_periodic_read.ringEndChannel,
+                                          (uint32_t)&(PERIODIC_READ_COUNTER_TIMER->EVENTS_COMPARE[1]),
+                                          nrf_drv_ppi_task_addr_group_disable_get(m_periodic_read.triggerGroup));
+    APP_ERROR_CHECK(err_code);
+    
+    // TIMER3は周期ごとにコンペアして、カウンタをクリアする。
+    PERIODIC_READ_TRIGGER_TIMER->TASKS_SHUTDOWN = 1;
+    PERIODIC_READ_TRIGGER_TIMER->MODE      = TIMER_MODE_MODE_Timer;
+    PERIODIC_READ_TRIGGER_TIMER->BITMODE   = TIMER_BITMODE_BITMODE_32Bit << TIMER_BITMODE_BITMODE_Pos;
+    PERIODIC_READ_TRIGGER_TIMER->PRESCALER = PERIODIC_READ_PRESCALER_1US;
+    PERIODIC_READ_TRIGGER_TIMER->SHORTS    = TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+    
+    // TIMER4はカウンタ。2バッチでクリアする。割り込みはTWIと同じ優先度にして、キューの完了ハンドラと互いに割り込まないようにする。
+    PERIODIC_READ_COUNTER_TIMER->TASKS_SHUTDOWN = 1;
+    PERIODIC_READ_COUNTER_TIMER->MODE      = TIMER_MODE_MODE_Counter;
+    PERIODIC_READ_COUNTER_TIMER->BITMODE   = TIMER_BITMODE_BITMODE_32Bit << TIMER_BITMODE_BITMODE_Pos;
+    PERIODIC_READ_COUNTER_TIMER->SHORTS    = TIMER_SHORTS_COMPARE1_CLEAR_Msk;
+    PERIODIC_READ_COUNTER_TIMER->INTENSET  = TIMER_INTENSET_COMPARE0_Msk | TIMER_INTENSET_COMPARE1_Msk;
+    
+    err_code = sd_nvic_ClearPendingIRQ(TIMER4_IRQn);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_SetPriority(TIMER4_IRQn, TWI_IRQ_PRIORITY);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_EnableIRQ(TIMER4_IRQn);
+    APP_ERROR_CHECK(err_code);
+}
+
+// 周期読み出しの割り込みハンドラ。バッチが揃うごとに呼び出される。
+void TIMER4_IRQHandler(void)
+{
+    twi_periodic_read_t *p_read = &m_periodic_read;
+    
+    // リングの前半が揃った
+    if(PERIODIC_READ_COUNTER_TIMER->EVENTS_COMPARE[0]) {
+        PERIODIC_READ_COUNTER_TIMER->EVENTS_COMPARE[0] = 0;
+        (p_read->handler)(p_read->ring, p_read->batchSize);
+    }
+    // リングの後半が揃った。PPIがトリガーを止めているので、転送中の読み出しはない。
+    if(PERIODIC_READ_COUNTER_TIMER->EVENTS_COMPARE[1]) {
+        PERIODIC_READ_COUNTER_TIMER->EVENTS_COMPARE[1] = 0;
+        // 最後のトリガーは、リングの最後のサンプルを読み出したもの(その時点のサンプル数は 2 * batchSize - 1)のはず。
+        if(PERIODIC_READ_COUNTER_TIMER->CC[2] != 2 * p_read->batchSize - 1) {
+            p_read->missedTriggerCount++;
+        }
+        // 受信の位置をリングの先頭に戻してから、トリガーを再開する。後半は、次に前半が揃うまでに渡し終える。
+        setupPeriodicReadTransfer();
+        nrf_drv_ppi_group_enable(p_read->triggerGroup);
+        (p_read->handler)(&(p_read->ring[p_read->batchSize * p_read->sampleSize]), p_read->batchSize);
+    }
+}
+
+/**
+ * Public methods
+ */
+
+bool twiEnqueueTransaction(const twi_transaction_t *p_transaction)
+{
+    ASSERT(p_transaction->txLength <= TWI_TRANSACTION_MAX_TX_LENGTH);
+    ASSERT(p_transaction->txLength > 0 || p_transaction->rxLength > 0);
+    
+    twi_bus_context_t *p_bus = getBusContext(p_transaction->address);
+    bool result = false;
+    
+    CRITICAL_REGION_ENTER();
+    if(p_bus->count < TWI_TRANSACTION_QUEUE_SIZE) {
+        p_bus->queue[(p_bus->head + p_bus->count) % TWI_TRANSACTION_QUEUE_SIZE] = *p_transaction;
+        p_bus->count++;
+        result = true;
+    }
+    CRITICAL_REGION_EXIT();
+    
+    if(result) {
+        startNextTransaction(p_bus);
+    }
+    return result;
+}
+
+bool twiEnqueueRead(uint8_t twi_address, uint8_t target_register, uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context)
+{
+    twi_transaction_t transaction;
+    transaction.address   = twi_address;
+    transaction.txLength  = 1;
+    transaction.txData[0] = target_register;
+    transaction.rxLength  = length;
+    transaction.p_rxData  = p_data;
+    transaction.handler   = handler;
+    transaction.p_context = p_context;
+    return twiEnqueueTransaction(&transaction);
+}
+
+bool twiEnqueueWrite(uint8_t twi_address, const uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context)
+{
+    ASSERT(length <= TWI_TRANSACTION_MAX_TX_LENGTH);
+    
+    twi_transaction_t transaction;
+    transaction.address   = twi_address;
+    transaction.txLength  = length;
+    memcpy(transaction.txData, p_data, length);
+    transaction.rxLength  = 0;
+    transaction.p_rxData  = NULL;
+    transaction.handler   = handler;
+    transaction.p_context = p_context;
+    return twiEnqueueTransaction(&transaction);
+}
+
+bool twiEnqueueReceive(uint8_t twi_address, uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context)
+{
+    twi_transaction_t transaction;
+    transaction.address   = twi_address;
+    transaction.txLength  = 0;
+    transaction.rxLength  = length;
+    transaction.p_rxData  = p_data;
+    transaction.handler   = handler;
+    transaction.p_context = p_context;
+    return twiEnqueueTransaction(&transaction);
+}
+
+bool twiStartPeriodicRead(uint8_t twi_address, uint8_t target_register, uint8_t sample_size, uint32_t period_us, uint8_t batch_size, twi_periodic_read_handler_t handler)
+{
+    ASSERT(current_int_priority_get() > TWI_IRQ_PRIORITY);
+    ASSERT(sample_size > 0 && sample_size <= TWI_PERIODIC_READ_MAX_SAMPLE_SIZE);
+    ASSERT(batch_size > 0 && batch_size <= TWI_PERIODIC_READ_MAX_BATCH_SIZE);
+    ASSERT(getBusContext(twi_address) == &m_twi0_bus);
+    
+    twi_periodic_read_t *p_read = &m_periodic_read;
+    if(p_read->isRunning || period_us < TWI_PERIODIC_READ_MIN_PERIOD_US) {
         return false;
     }
     
-    // データを読み出し
-    err_code = TwiSlave_RX(twi_address, data, length);
+    // キューのトランザクションが終わるのを待って、twi0を周期読み出しに渡す
+    bool is_idle = false;
+    while( ! is_idle ) {
+        CRITICAL_REGION_ENTER();
+        is_idle = (m_twi0_bus.count == 0 && ! m_twi0_bus.isRunning);
+        m_twi0_bus.isPeriodicReading = is_idle;
+        CRITICAL_REGION_EXIT();
+    }
+    
+    p_read->isRunning          = true;
+    p_read->txData[0]          = target_register;
+    p_read->xferDesc           = (nrf_drv_twi_xfer_desc_t)NRF_DRV_TWI_XFER_DESC_TXRX(twi_address, p_read->txData, 1, p_read->ring, sample_size);
+    p_read->sampleSize         = sample_size;
+    p_read->batchSize          = batch_size;
+    p_read->handler            = handler;
+    p_read->missedTriggerCount = 0;
+    setupPeriodicReadTransfer();
+    
+    PERIODIC_READ_COUNTER_TIMER->TASKS_CLEAR = 1;
+    PERIODIC_READ_COUNTER_TIMER->CC[0] = batch_size;
+    PERIODIC_READ_COUNTER_TIMER->CC[1] = 2 * batch_size;
+    PERIODIC_READ_COUNTER_TIMER->CC[2] = 2 * batch_size - 1;
+    PERIODIC_READ_COUNTER_TIMER->EVENTS_COMPARE[0] = 0;
+    PERIODIC_READ_COUNTER_TIMER->EVENTS_COMPARE[1] = 0;
+    PERIODIC_READ_COUNTER_TIMER->TASKS_START = 1;
+    
+    nrf_drv_ppi_channel_enable(p_read->captureChannel);
+    nrf_drv_ppi_channel_enable(p_read->countChannel);
+    nrf_drv_ppi_channel_enable(p_read->ringEndChannel);
+    nrf_drv_ppi_group_enable(p_read->triggerGroup);
+    
+    PERIODIC_READ_TRIGGER_TIMER->TASKS_CLEAR = 1;
+    PERIODIC_READ_TRIGGER_TIMER->CC[0] = period_us;
+    PERIODIC_READ_TRIGGER_TIMER->TASKS_START = 1;
+    
+    return true;
+}
+
+uint32_t twiStopPeriodicRead(void)
+{
+    ASSERT(current_int_priority_get() > TWI_IRQ_PRIORITY);
+    
+    twi_periodic_read_t *p_read = &m_periodic_read;
+    if( ! p_read->isRunning ) {
+        return 0;
+    }
+    
+    // トリガーを止めて、転送中の読み出しが終わるのを待つ
+    nrf_drv_ppi_group_disable(p_read->triggerGroup);
+    PERIODIC_READ_TRIGGER_TIMER->TASKS_SHUTDOWN = 1;
+    nrf_delay_us(PERIODIC_READ_TRANSFER_US);
+    
+    nrf_drv_ppi_channel_disable(p_read->captureChannel);
+    nrf_drv_ppi_channel_disable(p_read->countChannel);
+    nrf_drv_ppi_channel_disable(p_read->ringEndChannel);
+    PERIODIC_READ_COUNTER_TIMER->TASKS_CAPTURE[3] = 1;
+    const uint32_t count = PERIODIC_READ_COUNTER_TIMER->CC[3];
+    PERIODIC_READ_COUNTER_TIMER->TASKS_SHUTDOWN = 1;
+    
+    // バッチに満たない残りを渡す。前半が揃っていれば、前半はもう渡している。
+    if(count > p_read->batchSize) {
+        (p_read->handler)(&(p_read->ring[p_read->batchSize * p_read->sampleSize]), count - p_read->batchSize);
+    } else if(count > 0 && count < p_read->batchSize) {
+        (p_read->handler)(p_read->ring, count);
+    }
+    p_read->isRunning = false;
+    
+    // twi0をキューに戻す。次のトランザクションで、TWIMのショートカットとリストモードは設定し直される。
+    m_twi0_bus.isPeriodicReading = false;
+    startNextTransaction(&m_twi0_bus);
+    
+    return p_read->missedTriggerCount;
+}
+
+void twiWaitForIdle(void)
+{
+    ASSERT(current_int_priority_get() > TWI_IRQ_PRIORITY);
+    
+    // 完了ハンドラの中で次のトランザクションが積まれるので、キューが空で、かつ実行中でないことを見る。
+    while(m_twi0_bus.count > 0 || m_twi0_bus.isRunning || m_twi_bus.count > 0 || m_twi_bus.isRunning) {
+    }
+}
+
+// xfer_pending(ストップコンディションを出さない)は、キューを介すると次の受信とつなげられないので使えない。レジスタの読み出しは readFromTwiSlave() を使う。
+ret_code_t TwiSlave_TX(uint8_t address, uint8_t const *p_data, uint32_t length, bool xfer_pending)
+{
+    ASSERT( ! xfer_pending );
+    ASSERT(length <= TWI_TRANSACTION_MAX_TX_LENGTH);
+    
+    twi_transaction_t transaction;
+    transaction.address   = address;
+    transaction.txLength  = length;
+    memcpy(transaction.txData, p_data, length);
+    transaction.rxLength  = 0;
+    transaction.p_rxData  = NULL;
+    if( ! executeTransaction(&transaction) ) {
+        NRF_LOG_PRINTF_DEBUG("\nTwiSlave_TX(), address:0x%02x.", address);
+        return NRF_ERROR_INTERNAL;
+    }
+    return NRF_SUCCESS;
+}
+
+ret_code_t TwiSlave_RX(uint8_t address, uint8_t *p_data, uint32_t length)
+{
+    twi_transaction_t transaction;
+    transaction.address   = address;
+    transaction.txLength  = 0;
+    transaction.rxLength  = length;
+    transaction.p_rxData  = p_data;
+    if( ! executeTransaction(&transaction) ) {
+        NRF_LOG_PRINTF_DEBUG("\nTwiSlave_RX(), address:0x%02x.", address);
+        return NRF_ERROR_INTERNAL;
+    }
+    return NRF_SUCCESS;
+}
+
+bool writeToTwiSlave(uint8_t twi_address, uint8_t target_register, const uint8_t *data, uint8_t length)
+{
+    ASSERT((length + 1) <= TWI_TRANSACTION_MAX_TX_LENGTH);
+    
+    // 先頭バイトは、レジスタアドレス
+    twi_transaction_t transaction;
+    transaction.address   = twi_address;
+    transaction.txLength  = length + 1;
+    transaction.txData[0] = target_register;
+    memcpy(&(transaction.txData[1]), data, length);
+    transaction.rxLength  = 0;
+    transaction.p_rxData  = NULL;
+    
+    // I2C書き込み
+    return executeTransaction(&transaction);
+}
+
+bool readFromTwiSlave(uint8_t twi_address, uint8_t target_register, uint8_t *data, uint8_t length)
+{
+    // 読み出しターゲットアドレスを送信して、リピーテッドスタートでデータを読み出す
+    twi_transaction_t transaction;
+    transaction.address   = twi_address;
+    transaction.txLength  = 1;
+    transaction.txData[0] = target_register;
+    transaction.rxLength  = length;
+    transaction.p_rxData  = data;
     
-    return (err_code == NRF_SUCCESS);
+    return executeTransaction(&transaction);
 }
 
 void initTWIManager(void)
 {
     _isTwiPowerOn = false;
+    initPeriodicRead();
     
     // TWIの電源のIOピン設定, ドライブストレンクスを"強"に
     nrf_gpio_cfg(PIN_NUMBER_TWI_POWER,
@@ -106,15 +534,21 @@ void twiPowerUp(void)
     ret_code_t err_code;
     nrf_drv_twi_config_t config = NRF_DRV_TWI_DEFAULT_CONFIG;
     
+    // 9軸センサーのバスは、FIFOのまとめ読みのために400kHzにする。
     config.scl = PIN_NUMBER_TWI1_SCL;
     config.sda = PIN_NUMBER_TWI1_SDA;
-    err_code = nrf_drv_twi_init(&twi0, &config, NULL, NULL);
+    config.frequency = NRF_TWI_FREQ_400K;
+    config.interrupt_priority = TWI_IRQ_PRIORITY;
+    initBusContext(&m_twi0_bus, &twi0);
+    err_code = nrf_drv_twi_init(&twi0, &config, twiEventHandler, &m_twi0_bus);
     APP_ERROR_CHECK(err_code);
     nrf_drv_twi_enable(&twi0);
     
     config.scl = PIN_NUMBER_TWI2_SCL;
     config.sda = PIN_NUMBER_TWI2_SDA;
-    err_code = nrf_drv_twi_init(&twi, &config, NULL, NULL);
+    config.frequency = (nrf_twi_frequency_t)TWI_DEFAULT_CONFIG_FREQUENCY;
+    initBusContext(&m_twi_bus, &twi);
+    err_code = nrf_drv_twi_init(&twi, &config, twiEventHandler, &m_twi_bus);
     APP_ERROR_CHECK(err_code);
     nrf_drv_twi_enable(&twi);
 }
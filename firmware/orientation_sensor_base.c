@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <nrf.h>
+#include <nrf_log.h>
+#include "senstick_util.h"
+#include "value_types.h"
+#include "twi_slave_nine_axes_sensor.h"
+#include "ahrs.h"
+
+#include "orientation_sensor_base.h"
+#include "senstick_sensor_controller.h"
+
+#include "senstick_sensor_base_data.h"
+#include "senstick_flash_address_definition.h"
+
+// 姿勢は、9軸センサーの加速度、ジャイロ、地磁気の同じサンプルから、TWIの完了割り込みで計算する仮想のセンサー。
+// 設定の測定レンジは、姿勢の推定のゲイン(ahrs_tのbeta)をミリラジアン/秒で指定する。
+// ORIENTATION_MIN_BETA_MRAD未満(0や、他のセンサーのレンジのコード)なら既定値(AHRS_DEFAULT_BETA)、ORIENTATION_MAX_BETA_MRADより大きければORIENTATION_MAX_BETA_MRADにする。
+// 地磁気のオフセット(ハードアイアン)は補正しない。
+// NRF51はFPUがなく、浮動小数点数の計算が割り込みに収まらないので、使えない(初期化に失敗する)。
+
+// サンプリングの開始直後の、収束を速めるゲインと、その時間。回転なしの初期値から、静止していれば1秒ほどで重力と地磁気の向きに揃う。
+#define ORIENTATION_STARTUP_BETA 2.5f
+#define ORIENTATION_STARTUP_US   1000000
+
+// 設定で指定できるゲインの範囲(ミリラジアン/秒)。上限は、収束を速めるゲインと同じ。
+#define ORIENTATION_MIN_BETA_MRAD 10
+#define ORIENTATION_MAX_BETA_MRAD 2500
+
+// ジャイロの最も狭い範囲(250dps)の、1LSBあたりの角速度(ラジアン/秒)。範囲が1段広がるごとに2倍。
+#define ROTATION_RATE_250DPS_SCALE (250.0f / 32768.0f * 3.14159265f / 180.0f)
+
+typedef struct {
+    ahrs_t   ahrs;
+    float    beta;               // 収束した後のゲイン
+    float    rotationRateScale;  // ジャイロの値から、ラジアン/秒への係数
+    uint32_t samplingPeriodUs;   // サンプリング周期(マイクロ秒)。最初のサンプルで、姿勢を積分する時間。
+    uint32_t lastTimestampUs;    // 前のサンプルの時刻(マイクロ秒)
+    bool     hasLastTimestamp;
+    uint32_t startupSamples;     // 収束を速めるゲインで更新する、残りのサンプル数
+
+    // 1サンプルの姿勢の計算時間(CPUのサイクル数)。スリープでログに出す。
+    uint32_t fusionCount;
+    uint32_t fusionMaxCycles;
+    uint64_t fusionTotalCycles;
+} orientation_sensor_context_t;
+
+static orientation_sensor_context_t _context;
+
+// 計算時間と、CPUの全てを使ったときの最大のサンプリング周波数をログに出します。
+static void logFusionProfile(void)
+{
+    if(_context.fusionCount == 0) {
+        return;
+    }
+    // ログを無効にしたビルドでも未使用の変数を残さないように、平均はマクロの引数の中で計算する
+    NRF_LOG_PRINTF_DEBUG("orientation fusion: count:%d max:%d avg:%d cycles, max rate %d Hz.\n",
+                         _context.fusionCount, _context.fusionMaxCycles, (uint32_t)(_context.fusionTotalCycles / _context.fusionCount),
+                         (_context.fusionMaxCycles > 0) ? (SystemCoreClock / _context.fusionMaxCycles) : 0);
+}
+
+// センサーの初期化。
+static bool initSensorHandler(void)
+{
+#ifdef NRF52
+    return initNineAxesSensor();
+#else // NRF51
+    return false;
+#endif
+}
+
+// 設定の測定レンジ(ミリラジアン/秒)から、収束した後のゲインを返します。
+static float getBeta(uint16_t measurement_range)
+{
+    if(measurement_range < ORIENTATION_MIN_BETA_MRAD) {
+        return AHRS_DEFAULT_BETA;
+    }
+    return MIN(measurement_range, ORIENTATION_MAX_BETA_MRAD) / 1000.0f;
+}
+
+// センサーのwakeup/sleepを指定します
+static void setSensorWakeupHandler(bool shouldWakeUp, const sensor_service_setting_t *p_setting)
+{
+    if(shouldWakeUp) {
+        awakeNineAxesSensor();
+        // ジャイロの範囲は、ジャイロの設定で決まる。ジャイロは、先に起こされて範囲を設定している。
+        _context.rotationRateScale = ROTATION_RATE_250DPS_SCALE * (float)(1 << getNineAxesSensorRotationRange());
+        const uint32_t period_us   = getSensorServiceSamplingPeriodUs(p_setting);
+        _context.samplingPeriodUs  = period_us;
+        _context.hasLastTimestamp  = false;
+        _context.startupSamples    = (period_us > 0) ? (ORIENTATION_STARTUP_US / period_us) : 0;
+        _context.beta              = getBeta(p_setting->measurementRange);
+        ahrsInit(&(_context.ahrs), (_context.startupSamples > 0) ? ORIENTATION_STARTUP_BETA : _context.beta);
+
+        _context.fusionCount       = 0;
+        _context.fusionMaxCycles   = 0;
+        _context.fusionTotalCycles = 0;
+    } else {
+        logFusionProfile();
+        sleepNineAxesSensor();
+    }
+}
+
+static sensorDataCallbackType _callback;
+
+// -1.0〜1.0を、Q14に丸めます。
+static int16_t toQ14(float value)
+{
+    return (int16_t)(value * 16384.0f + ((value >= 0.0f) ? 0.5f : -0.5f));
+}
+
+// 9軸センサーの1サンプルから、姿勢を更新します。TWIの完了割り込みから呼び出される。
+// 姿勢は、前のサンプルの時刻からの時間で積分する。TWIが混んで読み出しが遅れても、サンプルの間隔は周期に決め打ちしない。
+static void motionDataHandler(const NineAxesFifoData_t *p_sample, uint32_t timestamp_us)
+{
+    const uint32_t start_cycles = senstickSensorControllerGetCycleCount();
+
+    const ahrs_vector_t rotation_rate = {
+        p_sample->rotationRate.x * _context.rotationRateScale,
+        p_sample->rotationRate.y * _context.rotationRateScale,
+        p_sample->rotationRate.z * _context.rotationRateScale
+    };
+    const ahrs_vector_t acceleration = { p_sample->acceleration.x, p_sample->acceleration.y, p_sample->acceleration.z };
+    // AK8963の軸は、加速度とジャイロの軸に対して、xとyが入れ替わり、zが逆向き
+    const ahrs_vector_t magnetic_field = { p_sample->magneticField.y, p_sample->magneticField.x, -p_sample->magneticField.z };
+
+    if(_context.startupSamples > 0) {
+        _context.startupSamples--;
+        if(_context.startupSamples == 0) {
+            _context.ahrs.beta = _context.beta;
+        }
+    }
+    const uint32_t interval_us = _context.hasLastTimestamp ? (timestamp_us - _context.lastTimestampUs) : _context.samplingPeriodUs;
+    _context.lastTimestampUs  = timestamp_us;
+    _context.hasLastTimestamp = true;
+    ahrsUpdate(&(_context.ahrs), &rotation_rate, &acceleration, &magnetic_field, interval_us / 1000000.0f);
+
+    OrientationData_t data;
+    data.w = toQ14(_context.ahrs.w);
+    data.x = toQ14(_context.ahrs.x);
+    data.y = toQ14(_context.ahrs.y);
+    data.z = toQ14(_context.ahrs.z);
+
+    const uint32_t cycles = senstickSensorControllerGetCycleCount() - start_cycles;
+    _context.fusionCount++;
+    _context.fusionTotalCycles += cycles;
+    _context.fusionMaxCycles    = (cycles > _context.fusionMaxCycles) ? cycles : _context.fusionMaxCycles;
+
+    (_callback)(OrientationSensor, (const uint8_t *)&data, sizeof(OrientationData_t));
+}
+
+// センサーの値の読み込みを要求します。サンプルの時刻は、読み出しを開始するサンプリングクロックの時刻。
+// 変換待ちはないので、*p_wakeup_msは指定しない。前のサンプルが読み出されていなければ、タイマ割り込み周期の後に呼び直される。
+static bool requestSensorDataHandler(samplingDurationType duration_ms, sensorDataCallbackType callback, samplingDurationType *p_wakeup_ms)
+{
+    _callback = callback;
+    return requestNineAxesMotionData(motionDataHandler, senstickSensorControllerGetSamplingTimeUs());
+}
+
+// srcとdstのセンサデータの最大値/最小値をp_srcに入れます。p_srcは破壊されます。
+static void getMaxMinValueHandler(bool isMax, uint8_t *p_src, uint8_t *p_dst)
+{
+    // TBD
+}
+
+// センサ構造体データをBLEのシリアライズしたバイナリ配列に変換します。
+static uint8_t getBLEDataHandler(uint8_t *p_dst, uint8_t *p_src)
+{
+    OrientationData_t data;
+    memcpy(&data, p_src, sizeof(OrientationData_t));
+    int16ToByteArrayLittleEndian(&(p_dst[0]), data.w);
+    int16ToByteArrayLittleEndian(&(p_dst[2]), data.x);
+    int16ToByteArrayLittleEndian(&(p_dst[4]), data.y);
+    int16ToByteArrayLittleEndian(&(p_dst[6]), data.z);
+
+    return 8;
+}
+
+const senstick_sensor_base_t orientationSensorBase =
+{
+    sizeof(OrientationData_t),  // sizeof(センサデータの構造体)
+    (2 * 4),                    // BLEでやり取りするシリアライズされたデータのサイズ
+    {
+        ORIENTATION_SENSOR_STORAGE_START_ADDRESS, // スタートアドレス
+        ORIENTATION_SENSOR_STORAGE_SIZE           // サイズ
+    },
+    sensorBus_twiNineAxes,      // 9軸センサーの読み出しでまとめて読み出す
+    650,                        // 加速度からI2Cマスターの地磁気までの20バイトを読み出す。I2Cバスを650マイクロ秒使う
+    2000,                       // 姿勢の計算はTWIの完了割り込みで行うので、割り込みの負荷を抑えて2ミリ秒を下限にする
+    0,                          // クォータニオンは、間引きのフィルタに通せない
+    initSensorHandler,
+    setSensorWakeupHandler,
+    requestSensorDataHandler,
+    getMaxMinValueHandler,
+    getBLEDataHandler
+};
@@ -0,0 +1,17 @@
+#ifndef orientation_sensor_base_h
+#define orientation_sensor_base_h
+
+#include "senstick_sensor_base.h"
+
+// 姿勢のデータ構造体。センサーの座標系から地球の座標系(z軸が鉛直上向き、x軸が磁北の水平成分の向き)への回転を表す単位クォータニオン。
+// 16ビット 符号付き数値。16384が1.0(Q14)。
+typedef struct {
+    int16_t w;
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} OrientationData_t;
+
+extern const senstick_sensor_base_t orientationSensorBase;
+
+#endif /* orientation_sensor_base_h */
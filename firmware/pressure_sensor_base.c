@@ -26,11 +26,18 @@ static void setSensorWakeupHandler(bool shouldWakeUp, const sensor_service_setti
     }
 }
 
-// センサーの値を読み込みます。
-static uint8_t getSensorDataHandler(uint8_t *p_buffer, samplingDurationType duration_ms)
+static sensorDataCallbackType _callback;
+
+static void sensorDataReadyHandler(const uint8_t *p_data, uint8_t length)
+{
+    (_callback)(AirPressureSensor, p_data, length);
+}
+
+// センサーの値の読み込みを要求します。
+static bool requestSensorDataHandler(samplingDurationType duration_ms, sensorDataCallbackType callback, samplingDurationType *p_wakeup_ms)
 {
-    getPressureData((AirPressureData_t *)p_buffer);
-    return sizeof(AirPressureData_t);
+    _callback = callback;
+    return requestPressureData(sensorDataReadyHandler);
 }
 
 // srcとdstのセンサデータの最大値/最小値をp_srcに入れます。p_srcは破壊されます。
@@ -58,9 +65,13 @@ const senstick_sensor_base_t pressureSensorBase =
         PRESSURE_SENSOR_STORAGE_START_ADDRESS, // スタートアドレス
         PRESSURE_SENSOR_STORAGE_SIZE           // サイズ
     },
+    sensorBus_twi,
+    500,                        // 読み出しと次の変換のトリガーで、I2Cバスを500マイクロ秒使う
+    0,                          // 読み出しの後に次の変換を始めるので、読み出しは変換を待たない
+    0,                          // 32ビットの値なので、間引きは使えない
     initSensorHandler,
     setSensorWakeupHandler,
-    getSensorDataHandler,
+    requestSensorDataHandler,
     getMaxMinValueHandler,
     getBLEDataHandler
 };
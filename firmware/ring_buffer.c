@@ -0,0 +1,106 @@
+#include <stddef.h>
+
+#include <nrf_assert.h>
+
+#include "ring_buffer.h"
+
+// 折り返しのマーカー。末尾の残りを飛ばして、先頭から読む。
+#define RING_BUFFER_WRAP_MARKER 0xff
+
+#define HEADER_TAG_SHIFT   4
+#define HEADER_LENGTH_MASK 0x0f
+
+void ringBufferInit(ring_buffer_t *p_ring)
+{
+    ASSERT(p_ring->size > 0 && p_ring->size <= 32768 && (p_ring->size & (p_ring->size - 1)) == 0);
+
+    p_ring->writeIndex    = 0;
+    p_ring->readIndex     = 0;
+    p_ring->reservedIndex = 0;
+    p_ring->highWaterMark = 0;
+}
+
+uint8_t *ringBufferReserve(ring_buffer_t *p_ring, uint8_t tag, uint8_t length)
+{
+    ASSERT(tag <= RING_BUFFER_MAX_TAG && length <= RING_BUFFER_MAX_LENGTH);
+
+    const uint16_t write_index = p_ring->writeIndex;
+    const uint16_t used        = (uint16_t)(write_index - p_ring->readIndex);
+    const uint16_t offset      = write_index & (p_ring->size - 1);
+    const uint16_t tail_size   = p_ring->size - offset;
+    const uint16_t record_size = 1 + length;
+    // 末尾に入らなければ、末尾の残りを余白にして先頭から書く
+    const uint16_t padding     = (tail_size < record_size) ? tail_size : 0;
+
+    if(used + padding + record_size > p_ring->size) {
+        return NULL;
+    }
+    if(padding > 0) {
+        p_ring->p_buffer[offset] = RING_BUFFER_WRAP_MARKER;
+    }
+    const uint16_t record_offset = (offset + padding) & (p_ring->size - 1);
+    p_ring->p_buffer[record_offset] = (uint8_t)((tag << HEADER_TAG_SHIFT) | length);
+    p_ring->reservedIndex = write_index + padding + record_size;
+
+    return &(p_ring->p_buffer[record_offset + 1]);
+}
+
+void ringBufferCommit(ring_buffer_t *p_ring)
+{
+    const uint16_t used = (uint16_t)(p_ring->reservedIndex - p_ring->readIndex);
+    if(used > p_ring->highWaterMark) {
+        p_ring->highWaterMark = used;
+    }
+    // ペイロードとヘッダを書いた後に、書き込み位置を1回だけ書き込んで公開する
+    p_ring->writeIndex = p_ring->reservedIndex;
+}
+
+const uint8_t *ringBufferPeek(ring_buffer_t *p_ring, uint8_t *p_tag, uint8_t *p_length)
+{
+    uint16_t read_index = p_ring->readIndex;
+    if(read_index == p_ring->writeIndex) {
+        return NULL;
+    }
+
+    uint16_t offset = read_index & (p_ring->size - 1);
+    // マーカーは、その後のレコードと一緒に公開されるので、飛ばした先には必ずレコードがある
+    if(p_ring->p_buffer[offset] == RING_BUFFER_WRAP_MARKER) {
+        p_ring->readIndex = read_index + (p_ring->size - offset);
+        offset = 0;
+    }
+    const uint8_t header = p_ring->p_buffer[offset];
+    *p_tag    = header >> HEADER_TAG_SHIFT;
+    *p_length = header & HEADER_LENGTH_MASK;
+
+    return &(p_ring->p_buffer[offset + 1]);
+}
+
+void ringBufferRelease(ring_buffer_t *p_ring)
+{
+    const uint16_t read_index = p_ring->readIndex;
+    ASSERT(read_index != p_ring->writeIndex);
+
+    const uint8_t header = p_ring->p_buffer[read_index & (p_ring->size - 1)];
+    ASSERT(header != RING_BUFFER_WRAP_MARKER);
+    p_ring->readIndex = read_index + 1 + (header & HEADER_LENGTH_MASK);
+}
+
+void ringBufferDiscard(ring_buffer_t *p_ring)
+{
+    p_ring->readIndex = p_ring->writeIndex;
+}
+
+uint16_t ringBufferGetUsedSize(const ring_buffer_t *p_ring)
+{
+    return (uint16_t)(p_ring->writeIndex - p_ring->readIndex);
+}
+
+uint16_t ringBufferGetHighWaterMark(const ring_buffer_t *p_ring)
+{
+    return p_ring->highWaterMark;
+}
+
+void ringBufferClearHighWaterMark(ring_buffer_t *p_ring)
+{
+    p_ring->highWaterMark = (uint16_t)(p_ring->writeIndex - p_ring->readIndex);
+}
@@ -0,0 +1,59 @@
+#ifndef ring_buffer_h
+#define ring_buffer_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * 1つの生産者と1つの消費者の間で、可変長のレコードを受け渡すバイト列のリングバッファ。ロックを使いません。
+ *
+ * レコードは、1バイトのヘッダ(上位4ビットがタグ、下位4ビットがペイロードの長さ)と、ペイロードからなります。
+ * レコードはバッファの中で折り返さない。末尾に入らないときは、折り返しのマーカー(0xff)を置いて、先頭から書く。
+ *
+ * 生産者は ringBufferReserve() でバッファの中に直接領域を確保してペイロードを書き込み、ringBufferCommit() で書き込み位置を1回更新して公開します。
+ * 消費者は ringBufferPeek() でバッファの中のペイロードをそのまま参照し、ringBufferRelease() で読み出し位置を進めます。
+ * 書き込み位置は生産者だけが、読み出し位置は消費者だけが書き込みます。
+ */
+
+// タグとペイロードの長さの最大値。タグ15は、折り返しのマーカーに使う。
+#define RING_BUFFER_MAX_TAG     14
+#define RING_BUFFER_MAX_LENGTH  15
+
+typedef struct {
+    uint8_t           *p_buffer;
+    uint16_t          size;           // バッファのバイトサイズ。2のべき乗で、32768以下。
+    volatile uint16_t writeIndex;     // 書き込み位置。sizeで割った余りがバッファの位置になる、フリーランのカウンタ。生産者だけが書く。
+    volatile uint16_t readIndex;      // 読み出し位置。消費者だけが書く。
+    uint16_t          reservedIndex;  // 確保したレコードの終端。生産者だけが使う。
+    uint16_t          highWaterMark;  // 使用中のバイト数(折り返しの余白を含む)の最大値
+} ring_buffer_t;
+
+// リングバッファを定義します。sizeは2のべき乗。
+#define RING_BUFFER_DEF(name, size) \
+    static uint8_t name##_buffer[size]; \
+    static ring_buffer_t name = { name##_buffer, (size), 0, 0, 0, 0 }
+
+// 初期化関数。リングバッファを空にして、使用量の最大値をクリアします。生産者と消費者が止まっているときに呼び出すこと。
+void ringBufferInit(ring_buffer_t *p_ring);
+
+// 生産者: lengthバイトのペイロードの領域を確保して、その先頭を返します。空きがなければNULLを返します。
+// 書き込んだペイロードは、ringBufferCommit()を呼び出すまで消費者から見えない。
+uint8_t *ringBufferReserve(ring_buffer_t *p_ring, uint8_t tag, uint8_t length);
+// 生産者: 確保したレコードを公開します。
+void ringBufferCommit(ring_buffer_t *p_ring);
+
+// 消費者: 先頭のレコードのペイロードを返します。空ならNULLを返します。ペイロードはringBufferRelease()を呼び出すまで有効。
+const uint8_t *ringBufferPeek(ring_buffer_t *p_ring, uint8_t *p_tag, uint8_t *p_length);
+// 消費者: 先頭のレコードを取り除きます。
+void ringBufferRelease(ring_buffer_t *p_ring);
+// 消費者: 公開済みのレコードを、すべて取り除きます。
+void ringBufferDiscard(ring_buffer_t *p_ring);
+
+// 使用中のバイト数(折り返しの余白を含む)を返します。生産者から呼び出すと、実際の使用量以上の値になる。
+uint16_t ringBufferGetUsedSize(const ring_buffer_t *p_ring);
+// 使用中のバイト数の最大値を返します。
+uint16_t ringBufferGetHighWaterMark(const ring_buffer_t *p_ring);
+// 使用中のバイト数の最大値を、今の使用量に戻します。生産者が止まっているときに呼び出すこと。
+void ringBufferClearHighWaterMark(ring_buffer_t *p_ring);
+
+#endif /* ring_buffer_h */
@@ -0,0 +1,132 @@
+#include <string.h>
+
+#include <nrf.h>
+#include <nrf_assert.h>
+
+#include "sample_filter.h"
+
+// タップ数は間引きの8倍。
+#define TAPS_PER_DECIMATION 8
+
+// ローパスフィルタの係数(Q15)。ハミング窓の窓関数法で、カットオフ(-6dB)は 0.4 / 間引き(入力のサンプリング周波数を1とする)。
+// 出力のナイキスト周波数で約-16dB、0.6 / 間引き 以上で-40dB以下。係数の和は32768(直流のゲイン1)。
+// 係数の絶対値の和は44000以下なので、16ビットのサンプルとの積和は32ビットを超えない。
+// 対称なので、過去のサンプルとの積和の順序は問わない。
+static __ALIGN(4) const int16_t m_coefficients_2[2 * TAPS_PER_DECIMATION] = {
+    0, 183, 259, -541, -1665, 0, 6025, 12123, 12123, 6025, 0, -1665, -541, 259, 183, 0
+};
+static __ALIGN(4) const int16_t m_coefficients_4[4 * TAPS_PER_DECIMATION] = {
+    -17, 20, 73, 135, 164, 91, -129, -466, -783, -850, -435, 588, 2141, 3927, 5501, 6424,
+    6424, 5501, 3927, 2141, 588, -435, -850, -783, -466, -129, 91, 164, 135, 73, 20, -17
+};
+#if SAMPLE_FILTER_MAX_DECIMATION >= 8
+static __ALIGN(4) const int16_t m_coefficients_8[8 * TAPS_PER_DECIMATION] = {
+    -12, -4, 5, 17, 31, 48, 65, 79, 86, 83, 64, 26, -31, -106, -194, -284,
+    -366, -424, -442, -405, -300, -120, 139, 470, 862, 1295, 1744, 2182, 2578, 2904, 3137, 3257,
+    3257, 3137, 2904, 2578, 2182, 1744, 1295, 862, 470, 139, -120, -300, -405, -442, -424, -366,
+    -284, -194, -106, -31, 26, 64, 83, 86, 79, 65, 48, 31, 17, 5, -4, -12
+};
+#endif
+
+/**
+ * Private methods
+ */
+static const int16_t *getCoefficients(uint8_t decimation)
+{
+    switch(decimation) {
+        case 2: return m_coefficients_2;
+        case 4: return m_coefficients_4;
+#if SAMPLE_FILTER_MAX_DECIMATION >= 8
+        case 8: return m_coefficients_8;
+#endif
+        default: return NULL;
+    }
+}
+
+// 最も古いサンプルから並んだtaps個の過去のサンプルと、係数の積和(Q15)を、16ビットに丸めて返します。p_historyとp_coefficientsは4バイト境界、tapsは偶数。
+static int16_t getFilterOutput(const int16_t *p_history, const int16_t *p_coefficients, uint8_t taps)
+{
+    int32_t sum = 1 << 14; // 丸め
+#ifdef NRF52
+    // 2つのサンプルと2つの係数を32ビットで読み、SMLADで2つの積和を1命令で計算する
+    const uint32_t *p_x = (const uint32_t *)p_history;
+    const uint32_t *p_h = (const uint32_t *)p_coefficients;
+    for(int i = 0; i < taps / 2; i += 2) {
+        sum = (int32_t)__SMLAD(p_x[i],     p_h[i],     (uint32_t)sum);
+        sum = (int32_t)__SMLAD(p_x[i + 1], p_h[i + 1], (uint32_t)sum);
+    }
+    return (int16_t)__SSAT(sum >> 15, 16);
+#else // NRF51
+    for(int i = 0; i < taps; i++) {
+        sum += (int32_t)p_history[i] * p_coefficients[i];
+    }
+    sum >>= 15;
+    return (int16_t)((sum > INT16_MAX) ? INT16_MAX : ((sum < INT16_MIN) ? INT16_MIN : sum));
+#endif
+}
+
+/**
+ * Public methods
+ */
+bool isValidSampleFilterDecimation(uint8_t decimation)
+{
+    return decimation == 1 || getCoefficients(decimation) != NULL;
+}
+
+void sampleFilterInit(sample_filter_t *p_filter, uint8_t channel_count, uint8_t decimation)
+{
+    ASSERT(channel_count > 0 && channel_count <= SAMPLE_FILTER_MAX_CHANNELS);
+    ASSERT(getCoefficients(decimation) != NULL);
+
+    p_filter->p_coefficients = getCoefficients(decimation);
+    p_filter->channelCount   = channel_count;
+    p_filter->decimation     = decimation;
+    p_filter->taps           = decimation * TAPS_PER_DECIMATION;
+    p_filter->outputCount    = 0;
+    sampleFilterReset(p_filter);
+}
+
+void sampleFilterReset(sample_filter_t *p_filter)
+{
+    p_filter->writeIndex = 0;
+    p_filter->phase      = 0;
+    p_filter->isPrimed   = false;
+}
+
+bool sampleFilterProcess(sample_filter_t *p_filter, const uint8_t *p_sample, uint8_t *p_output)
+{
+    const uint8_t taps = p_filter->taps;
+    int16_t values[SAMPLE_FILTER_MAX_CHANNELS];
+    memcpy(values, p_sample, p_filter->channelCount * sizeof(int16_t));
+
+    // 最初のサンプルで過去のサンプルを埋めて、ステップの応答の立ち上がりを出さない
+    if( ! p_filter->isPrimed ) {
+        for(int c = 0; c < p_filter->channelCount; c++) {
+            for(int i = 0; i < 2 * taps; i++) {
+                p_filter->history[c][i] = values[c];
+            }
+        }
+        p_filter->isPrimed = true;
+    }
+
+    const uint8_t index = p_filter->writeIndex;
+    for(int c = 0; c < p_filter->channelCount; c++) {
+        p_filter->history[c][index]        = values[c];
+        p_filter->history[c][index + taps] = values[c];
+    }
+    p_filter->writeIndex = (index + 1 < taps) ? (index + 1) : 0;
+
+    // decimationごとに1つ出力する。タップ数は間引きの倍数なので、出力の時の最も古いサンプルの位置は、間引き(偶数)の倍数。
+    p_filter->phase++;
+    if(p_filter->phase < p_filter->decimation) {
+        return false;
+    }
+    p_filter->phase = 0;
+    for(int c = 0; c < p_filter->channelCount; c++) {
+        values[c] = getFilterOutput(&(p_filter->history[c][p_filter->writeIndex]), p_filter->p_coefficients, taps);
+    }
+    memcpy(p_output, values, p_filter->channelCount * sizeof(int16_t));
+    p_filter->outputCount++;
+
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef sample_filter_h
+#define sample_filter_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * センサーのサンプルの、アンチエイリアスのローパスフィルタと間引き(デシメーション)。
+ *
+ * サンプルは、先頭から並んだ16ビット符号付きのチャネル(加速度のx, y, zなど)として扱います。
+ * 入力のサンプルをdecimationごとに1つ出力し、出力の時だけ、直線位相のFIRフィルタ(Q15の係数)を計算します(ポリフェーズの間引き)。
+ * 係数は、ハミング窓の窓関数法で設計した表で、カットオフは出力のナイキスト周波数の0.8倍、直流のゲインは1です。
+ * NRF52は、Cortex-M4のSIMD命令(SMLAD)で、2つの積和を1命令で計算します。
+ */
+
+#define SAMPLE_FILTER_MAX_CHANNELS 3
+// 間引きの最大値と、タップ数の最大値。タップ数は間引きの8倍。
+#ifdef NRF51
+#define SAMPLE_FILTER_MAX_DECIMATION 4
+#else // NRF52
+#define SAMPLE_FILTER_MAX_DECIMATION 8
+#endif
+#define SAMPLE_FILTER_MAX_TAPS (8 * SAMPLE_FILTER_MAX_DECIMATION)
+
+typedef struct {
+    // チャネルごとの過去のサンプル。同じ値を2か所(i と i + taps)に書き、最も古いサンプルから並んだtaps個を、折り返さずに読めるようにする。
+    // 出力の時に読み始める位置は常に偶数なので、2つのサンプルを32ビットで読める。
+    int16_t        history[SAMPLE_FILTER_MAX_CHANNELS][2 * SAMPLE_FILTER_MAX_TAPS];
+    const int16_t  *p_coefficients;
+    uint32_t       outputCount;    // 出力したサンプル数
+    uint8_t        channelCount;
+    uint8_t        decimation;
+    uint8_t        taps;
+    uint8_t        writeIndex;     // 次のサンプルを書く位置
+    uint8_t        phase;          // 前の出力からの入力のサンプル数
+    bool           isPrimed;       // 過去のサンプルが埋まっている
+} sample_filter_t;
+
+// 間引きに指定できる値か?1(フィルタを使わない)、またはSAMPLE_FILTER_MAX_DECIMATION以下の2のべき乗。
+bool isValidSampleFilterDecimation(uint8_t decimation);
+
+// フィルタを初期化します。decimationは2以上の、有効な値。
+void sampleFilterInit(sample_filter_t *p_filter, uint8_t channel_count, uint8_t decimation);
+// 過去のサンプルを捨てます。抜けたサンプルの後は、次のサンプルで過去のサンプルを埋めて、そこから数え直す。
+void sampleFilterReset(sample_filter_t *p_filter);
+// サンプルを1つ入力します。出力するサンプルがあれば、p_outputにチャネルを書き込み、trueを返します。
+// p_sampleとp_outputは、アライメントに乗らなくてもよい。
+bool sampleFilterProcess(sample_filter_t *p_filter, const uint8_t *p_sample, uint8_t *p_output);
+
+#endif /* sample_filter_h */
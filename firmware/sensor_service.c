@@ -105,11 +105,11 @@ static void addService(sensor_service_t *p_context, uint8_t uuid_type)
     
     // セッティング
     params.uuid              = SENSOR_SETTING_CHAR_UUID + (uint16_t)p_context->device_type;
-    params.max_len           = 5;
+    params.max_len           = SENSOR_SERVICE_SETTING_MAX_SIZE; // 5バイト、マイクロ秒の周期を付けた9バイト、または間引きを付けた10バイト
     params.char_props.read   = true;
     params.char_props.write  = true;
     params.char_props.notify = false;
-    params.is_var_len        = false;
+    params.is_var_len        = true;
     params.is_defered_read   = true;
     params.is_defered_write  = true;
     params.read_access       = SEC_OPEN;
@@ -12,7 +12,7 @@
 
 /* Scheduler のパラメータ */
 //  Maximum size of events data in the application scheduler queue aligned to 32 bits
-//                                            MAX(BLE_STACK_HANDLER_SCHED_EVT_SIZE)) \
+//                                            MAX(BLE_STACK_HANDLER_SCHED_EVT_SIZE))
 
 #define SCHED_MAX_EVENT_DATA_SIZE   (CEIL_DIV( \
                                         MAX( \
@@ -18,6 +18,7 @@
 
 #include "senstick_control_service.h"
 #include "senstick_data_model.h"
+#include "senstick_sensor_controller.h"
 
 //コンテキスト構造体。
 typedef struct senstick_control_service_s {
@@ -29,6 +30,9 @@ typedef struct senstick_control_service_s {
     ble_gatts_char_handles_t rtc_char_handle;
     ble_gatts_char_handles_t abstract_text_char_handle;
     ble_gatts_char_handles_t device_name_char_handle;
+    ble_gatts_char_handles_t storage_wipe_progress_char_handle;
+    ble_gatts_char_handles_t sample_drop_statistics_char_handle;
+    ble_gatts_char_handles_t sampling_headroom_char_handle;
     
     uint16_t connection_handle;
 } senstick_control_service_t;
@@ -126,6 +130,10 @@ static void onRWAuthReq(ble_evt_t *p_ble_evt)
             length = onRWAuthReq_abstract_txt(buffer, GATT_MAX_DATA_LENGTH);
         } else if( p_auth_req->request.read.handle == context.device_name_char_handle.value_handle){
             length = onRWAuthReq_device_name(buffer, GATT_MAX_DATA_LENGTH);
+        } else if( p_auth_req->request.read.handle == context.sample_drop_statistics_char_handle.value_handle){
+            length = senstickSensorControllerReadDropStatistics(buffer, GATT_MAX_DATA_LENGTH);
+        } else if( p_auth_req->request.read.handle == context.sampling_headroom_char_handle.value_handle){
+            length = senstickSensorControllerReadSamplingHeadroom(buffer, GATT_MAX_DATA_LENGTH);
         } else {
             return; // ハンドラが一致しない、ここで終了。
         }
@@ -255,6 +263,51 @@ static void addService(uint8_t uuid_type)
     params.cccd_write_access = SEC_NO_ACCESS;
     err_code = characteristic_add(context.service_handle, &params, &context.device_name_char_handle);
     APP_ERROR_CHECK(err_code);
+    
+    // ストレージ全消去の進捗(%)
+    params.uuid              = STORAGE_WIPE_PROGRESS_CHAR_UUID;
+    params.max_len           = 1;
+    params.char_props.read   = true;
+    params.char_props.write  = false;
+    params.char_props.notify = true;
+    params.is_var_len        = false;
+    params.is_defered_read   = false;
+    params.is_defered_write  = false;
+    params.read_access       = SEC_OPEN;
+    params.write_access      = SEC_NO_ACCESS;
+    params.cccd_write_access = SEC_OPEN;
+    err_code = characteristic_add(context.service_handle, &params, &context.storage_wipe_progress_char_handle);
+    APP_ERROR_CHECK(err_code);
+    
+    // サンプリングの過負荷の統計(リングバッファの使用量の最大値と、センサーごとの捨てたサンプル数)
+    params.uuid              = SAMPLE_DROP_STATISTICS_CHAR_UUID;
+    params.max_len           = GATT_MAX_DATA_LENGTH;
+    params.char_props.read   = true;
+    params.char_props.write  = false;
+    params.char_props.notify = false;
+    params.is_var_len        = true;
+    params.is_defered_read   = true;
+    params.is_defered_write  = false;
+    params.read_access       = SEC_OPEN;
+    params.write_access      = SEC_NO_ACCESS;
+    params.cccd_write_access = SEC_NO_ACCESS;
+    err_code = characteristic_add(context.service_handle, &params, &context.sample_drop_statistics_char_handle);
+    APP_ERROR_CHECK(err_code);
+    
+    // サンプリングの設定全体の、I2Cバス、フラッシュ、リングバッファの上限までの余裕
+    params.uuid              = SAMPLING_HEADROOM_CHAR_UUID;
+    params.max_len           = GATT_MAX_DATA_LENGTH;
+    params.char_props.read   = true;
+    params.char_props.write  = false;
+    params.char_props.notify = false;
+    params.is_var_len        = true;
+    params.is_defered_read   = true;
+    params.is_defered_write  = false;
+    params.read_access       = SEC_OPEN;
+    params.write_access      = SEC_NO_ACCESS;
+    params.cccd_write_access = SEC_NO_ACCESS;
+    err_code = characteristic_add(context.service_handle, &params, &context.sampling_headroom_char_handle);
+    APP_ERROR_CHECK(err_code);
 }
 
 /**
@@ -347,3 +400,11 @@ void senstickControlService_observeDiskFull(bool flag)
                                      context.storage_status_char_handle.cccd_handle,
                                      &val, sizeof(uint8_t));
 }
+
+void senstickControlService_observeStorageWipeProgress(uint8_t percent)
+{
+    setValueAndNotify(context.connection_handle,
+                                     context.storage_wipe_progress_char_handle.value_handle,
+                                     context.storage_wipe_progress_char_handle.cccd_handle,
+                                     &percent, sizeof(uint8_t));
+}
@@ -11,6 +11,9 @@
 #define CONTROL_RTC_CHAR_UUID           0x7003
 #define CONTROL_ABSTRACT_TEXT_CHAR_UUID 0x7004
 #define DEVICE_NAME_CHAR_UUID           0x7005
+#define STORAGE_WIPE_PROGRESS_CHAR_UUID 0x7006
+#define SAMPLE_DROP_STATISTICS_CHAR_UUID 0x7007
+#define SAMPLING_HEADROOM_CHAR_UUID     0x7008
 
 // 初期化します
 uint32_t initSenstickControlService(uint8_t uuid_type);
@@ -20,4 +23,5 @@ void senstickControlService_handleBLEEvent(ble_evt_t * p_ble_evt);
 void senstickControlService_observeControlCommand(senstick_control_command_t command);
 void senstickControlService_observeCurrentLogCount(uint8_t count);
 void senstickControlService_observeDiskFull(bool flag);
+void senstickControlService_observeStorageWipeProgress(uint8_t percent);
 #endif /* senstick_control_service_h */
@@ -41,6 +41,7 @@ typedef struct {
     ButtonStatus_t button_status;
     bool is_disk_full;
     bool is_connected;
+    uint8_t wipe_progress;
     
     uint16_t conn_handle;
     bool is_waiting_disconnect_for_dfu;
@@ -160,6 +161,7 @@ void senstick_setControlCommand(senstick_control_command_t command)
     if(   command != sensorShouldSleep
        && command != sensorShouldWork
        && command != formattingStorage
+       && command != wipingStorage
        && command != shouldDeviceSleep
        && command != enterDFUmode) {
 //       NRF_LOG_PRINTF_DEBUG("_setControlCommand, unexpected command: %d.\n", command);
@@ -170,6 +172,11 @@ void senstick_setControlCommand(senstick_control_command_t command)
     if(context.command == command) {
         return;
     }
+    
+    // 全消去の実行中は、完了するまで他のコマンドを受け付けません。
+    if(context.command == wipingStorage && context.wipe_progress < 100) {
+        return;
+    }
 
     // コマンド実行のアボート。disk fullのときには sensorShouldWork 状態には遷移させません。
     if( command == sensorShouldWork && senstick_isDiskFull() ) {
@@ -192,6 +199,11 @@ void senstick_setControlCommand(senstick_control_command_t command)
     senstick_control_command_t new_command = command;
 
     context.command = command;
+    
+    // 全消去の進捗は、オブザーバが消去を開始する前に初期化しておく。
+    if(command == wipingStorage) {
+        senstick_setStorageWipeProgress(0);
+    }
 
     // 新しく作るログのID
     const uint8_t new_log_id = senstick_getCurrentLogCount();
@@ -229,6 +241,11 @@ void senstick_setControlCommand(senstick_control_command_t command)
             // フォーマット状態からの自動復帰
             senstick_setControlCommand(sensorShouldSleep);
             break;
+        case wipingStorage:
+            // 全消去はオブザーバで開始され、非同期に進む。進捗が100になったときに、sensorShouldSleepに戻る。
+            senstick_setDiskFull(false);
+            senstick_setCurrentLogCount( 0 );
+            break;
         case shouldDeviceSleep:
             // BLE接続していなければ、ここで電源を落とす。接続している場合は、切断完了時に電源を落とす。
             if( senstick_isConnected() == false) {
@@ -254,6 +271,52 @@ void senstick_setControlCommand(senstick_control_command_t command)
     }
 }
 
+// 本来はここに書くべきではないが、起動時の不揮発メモリのマウント処理。
+// スーパーブロックが有効ならば、そのインデックスとレコードの2回の読み出しでマウントする。無効ならば(フォーマット直後、記録中のリセット、書き込み中の電源断)、
+// メタデータとログのヘッダを読む従来の方法でマウントして、スーパーブロックを書き直す。
+void senstick_mountStorage(void)
+{
+    uint8_t count = 0;
+    bool is_storage_full = false;
+    
+    if( senstickSensorControllerMountSuperblock(&count, &is_storage_full) ) {
+NRF_LOG_PRINTF_DEBUG("superblock, count:%d is_full:%d\n", count, is_storage_full);
+        senstick_setCurrentLogCount(count);
+        senstick_setDiskFull(is_storage_full);
+        return;
+    }
+    
+    // 不揮発メモリのフォーマット処理
+    if( ! isMetaLogFormatted() ) {
+        metaLogFormatStorage();
+        senstickSensorControllerFormatStorage();
+    }
+
+    // 記録中にリセットされたログを復旧して、閉じる
+    uint8_t unclosed_log_id = 0;
+    if( metaDataLogFindUnclosedLog(&unclosed_log_id) ) {
+NRF_LOG_PRINTF_DEBUG("recover unclosed log:%d\n", unclosed_log_id);
+        senstickSensorControllerRecoverLog(unclosed_log_id);
+        metaDataLogCloseLog(unclosed_log_id);
+    }
+
+    // メタ領域の容量チェック
+    metaDataLogGetLogCount(&count, &is_storage_full);
+NRF_LOG_PRINTF_DEBUG("meta, count:%d is_full:%d\n", count, is_storage_full);
+    senstick_setCurrentLogCount(count);
+    // データ領域のチェック, データ領域があれば
+    if( count > 0 ) {
+        bool isFull      = senstickSensorControllerIsDataFull(count -1);
+        is_storage_full |= isFull;
+NRF_LOG_PRINTF_DEBUG("data area: is_full:%d\n", isFull);
+    }
+    // フラグ設定
+    senstick_setDiskFull(is_storage_full);
+    
+    // 次の起動のために、スーパーブロックを書き込む
+    senstickSensorControllerWriteSuperblock(count, is_storage_full);
+}
+
 // 現在有効なログデータ数, uint8_t
 uint8_t senstick_getCurrentLogCount(void)
 {
@@ -278,6 +341,22 @@ void senstick_setDiskFull(bool flag)
     senstickControlService_observeDiskFull(flag);
 }
 
+uint8_t senstick_getStorageWipeProgress(void)
+{
+    return context.wipe_progress;
+}
+void senstick_setStorageWipeProgress(uint8_t percent)
+{
+    context.wipe_progress = MIN(percent, 100);
+    
+    senstickControlService_observeStorageWipeProgress(context.wipe_progress);
+    
+    // 全消去状態からの自動復帰
+    if(context.wipe_progress == 100 && context.command == wipingStorage) {
+        senstick_setControlCommand(sensorShouldSleep);
+    }
+}
+
 // 現在の時刻
 void senstick_getCurrentDateTime(ble_date_time_t *p_datetime)
 {
@@ -15,6 +15,9 @@
 // 初期化
 void initSenstickDataModel(void);
 
+// 起動時に不揮発メモリをマウントし、ログ数とディスクフルの状態を設定します。
+void senstick_mountStorage(void);
+
 // コントロールコマンド
 senstick_control_command_t senstick_getControlCommand(void);
 void senstick_setControlCommand(senstick_control_command_t command);
@@ -27,6 +30,10 @@ void senstick_setCurrentLogCount(uint8_t count);
 uint8_t senstick_isDiskFull(void);
 void senstick_setDiskFull(bool flag);
 
+// ストレージ全消去の進捗(0-100%)。100になると、wipingStorageからsensorShouldSleepに戻る。
+uint8_t senstick_getStorageWipeProgress(void);
+void senstick_setStorageWipeProgress(uint8_t percent);
+
 // 現在の時刻
 void senstick_getCurrentDateTime(ble_date_time_t *p_datetime);
 void senstick_setCurrentDateTime(ble_date_time_t *p_datetime);
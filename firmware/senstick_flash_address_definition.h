@@ -7,8 +7,6 @@
 //#define STREAM_HEADER_SECTORS   3
 
 // データ書き込みは、次に書き込むセクターが事前に消去されていると仮定する。
-// そのため、データ領域の末尾で、次のセクターは消去されうる。
-// したがって、あるデータ領域と次のデータ領域の間には1セクタ空ける。
 
 // フラッシュメモリは、4kBを1セクター(消去単位)とする。
 //    int headerStartAddress; // ヘッダ領域スタートアドレス
@@ -35,24 +33,21 @@
 
 // メタデータ
 // ヘッダ       1セクタ
+// スーパーブロック 1セクタ
 // メタデータ    1セクタ
 // 空きセクタ    1セクタ
 
-// 2バイトを1単位として、96単位。(8192 - 3 - 7 ) / 96 = 85.2 1単位 85セクターとしよう。
-
-// 種類       サンプルのバイトサイズ  想定サンプリング数
-// 加速度     3x2= 6バイト          20ミリ秒           3 * 10
-// ジャイロ   6バイト               20ミリ秒           3 * 10
-// 地磁気     6バイト               20ミリ秒           3 * 10
-// 照度       2バイト               200ミリ秒          1
-// UV        2バイト               200ミリ秒          1
-// 湿度       4バイト               200ミリ秒          2
-// 気圧       4バイト               200ミリ秒          2
-//                                                  合計 96
-// センサごとのセクター割当
-// ヘッダ       1
-// データ
-// 空きセクタ    1
+// エクステント表    1セクタ
+// センサーのヘッダ  8セクタ (ヘッダ、エクステント表、消去済みビットマップ)
+// 空きセクタ       4セクタ (64KB境界まで)
+// ログのデータ     511エクステント (64KB単位で、全センサーで共有)
+
+// 以前はセンサーごとにデータ領域を固定で分けていた(2バイトのデータあたり85セクター)。
+// 1つのセンサーだけを記録すると、チップの大部分が空いたままディスクフルになるため、データ領域は共有にして、
+// 記録するセンサーに必要な分だけエクステントを割り当てる。
+// センサーごとのログは、そのセンサーに割り当てたエクステントをつないだ、1本のストリームに順に置く。
+// 書き込みは次のセクターを先行消去するが、消去はストリームの中で行うので、センサー間に空きセクタは要らない。
+
 #define SECTOR_SIZE       0x1000
 
 // メタデータの領域
@@ -60,41 +55,61 @@
 #define SENSOR_SETTING_STORAGE_SIZE          (1 * SECTOR_SIZE)
 #define SENSOR_SETTING_STORAGE_END_ADDRESS   (SENSOR_SETTING_STORAGE_START_ADDRESS + SENSOR_SETTING_STORAGE_SIZE)
 
-#define METADATA_STORAGE_START_ADDRESS (SENSOR_SETTING_STORAGE_END_ADDRESS + SECTOR_SIZE)
+// スーパーブロックの領域。設定とメタデータの間のセクタを使う。
+#define SUPERBLOCK_STORAGE_START_ADDRESS SENSOR_SETTING_STORAGE_END_ADDRESS
+#define SUPERBLOCK_STORAGE_SIZE          (1 * SECTOR_SIZE)
+#define SUPERBLOCK_STORAGE_END_ADDRESS   (SUPERBLOCK_STORAGE_START_ADDRESS + SUPERBLOCK_STORAGE_SIZE)
+
+#define METADATA_STORAGE_START_ADDRESS (SUPERBLOCK_STORAGE_END_ADDRESS)
 #define METADATA_STORAGE_SIZE          (1 * SECTOR_SIZE)
 #define METADATA_STORAGE_END_ADDRESS   (METADATA_STORAGE_START_ADDRESS + METADATA_STORAGE_SIZE)
 
-// 2バイトのセンサデータあたりに割りつける、セクター数
-#define SENSOR_DATA_SECTOR_UNIT     85
+// エクステントの割当表。共有領域のエクステントごとに、割り当てたセンサー(ヘッダセクターの番号)を1バイトで記録する。
+#define LOG_EXTENT_TABLE_START_ADDRESS (METADATA_STORAGE_END_ADDRESS)
+#define LOG_EXTENT_TABLE_SIZE          (1 * SECTOR_SIZE)
+#define LOG_EXTENT_TABLE_END_ADDRESS   (LOG_EXTENT_TABLE_START_ADDRESS + LOG_EXTENT_TABLE_SIZE)
 
-// 書き込みは次のセクタを消去するため、前のデータ領域から1セクタ空ける。
-// ACCELERATION_SENSOR_STORAGE_SIZE は、ヘッダサイズ(1セクタ)+センサデータ(3*センサ単位)で割当。
-#define ACCELERATION_SENSOR_STORAGE_START_ADDRESS (METADATA_STORAGE_END_ADDRESS + SECTOR_SIZE)
-#define ACCELERATION_SENSOR_STORAGE_SIZE          ((1 + SENSOR_DATA_SECTOR_UNIT * 3 * 10) * SECTOR_SIZE)
+// センサーごとのログのヘッダ領域。1セクタを割り当てる。
+// ヘッダセクターには、ログのヘッダ、ストリームのエクステント表、消去済みビットマップを置く(log_controller.c)。
+#define SENSOR_LOG_HEADER_SIZE SECTOR_SIZE
+
+#define ACCELERATION_SENSOR_STORAGE_START_ADDRESS (LOG_EXTENT_TABLE_END_ADDRESS)
+#define ACCELERATION_SENSOR_STORAGE_SIZE          SENSOR_LOG_HEADER_SIZE
 #define ACCELERATION_SENSOR_STORAGE_END_ADDRESS   (ACCELERATION_SENSOR_STORAGE_START_ADDRESS + ACCELERATION_SENSOR_STORAGE_SIZE)
 
-#define GYRO_SENSOR_STORAGE_START_ADDRESS (ACCELERATION_SENSOR_STORAGE_END_ADDRESS + SECTOR_SIZE)
-#define GYRO_SENSOR_STORAGE_SIZE          ((1 + SENSOR_DATA_SECTOR_UNIT * 3 * 10) * SECTOR_SIZE)
+#define GYRO_SENSOR_STORAGE_START_ADDRESS (ACCELERATION_SENSOR_STORAGE_END_ADDRESS)
+#define GYRO_SENSOR_STORAGE_SIZE          SENSOR_LOG_HEADER_SIZE
 #define GYRO_SENSOR_STORAGE_END_ADDRESS   (GYRO_SENSOR_STORAGE_START_ADDRESS + GYRO_SENSOR_STORAGE_SIZE)
 
-#define MAGNETIC_SENSOR_STORAGE_START_ADDRESS (GYRO_SENSOR_STORAGE_END_ADDRESS + SECTOR_SIZE)
-#define MAGNETIC_SENSOR_STORAGE_SIZE          ((1 + SENSOR_DATA_SECTOR_UNIT * 3 * 10) * SECTOR_SIZE)
+#define MAGNETIC_SENSOR_STORAGE_START_ADDRESS (GYRO_SENSOR_STORAGE_END_ADDRESS)
+#define MAGNETIC_SENSOR_STORAGE_SIZE          SENSOR_LOG_HEADER_SIZE
 #define MAGNETIC_SENSOR_STORAGE_END_ADDRESS   (MAGNETIC_SENSOR_STORAGE_START_ADDRESS + MAGNETIC_SENSOR_STORAGE_SIZE)
 
-#define BRIGHTNESS_SENSOR_STORAGE_START_ADDRESS (MAGNETIC_SENSOR_STORAGE_END_ADDRESS + SECTOR_SIZE)
-#define BRIGHTNESS_SENSOR_STORAGE_SIZE          ((1 + SENSOR_DATA_SECTOR_UNIT * 1) * SECTOR_SIZE)
+#define BRIGHTNESS_SENSOR_STORAGE_START_ADDRESS (MAGNETIC_SENSOR_STORAGE_END_ADDRESS)
+#define BRIGHTNESS_SENSOR_STORAGE_SIZE          SENSOR_LOG_HEADER_SIZE
 #define BRIGHTNESS_SENSOR_STORAGE_END_ADDRESS   (BRIGHTNESS_SENSOR_STORAGE_START_ADDRESS + BRIGHTNESS_SENSOR_STORAGE_SIZE)
 
-#define UV_SENSOR_STORAGE_START_ADDRESS (BRIGHTNESS_SENSOR_STORAGE_END_ADDRESS + SECTOR_SIZE)
-#define UV_SENSOR_STORAGE_SIZE          ((1 + SENSOR_DATA_SECTOR_UNIT * 1) * SECTOR_SIZE)
+#define UV_SENSOR_STORAGE_START_ADDRESS (BRIGHTNESS_SENSOR_STORAGE_END_ADDRESS)
+#define UV_SENSOR_STORAGE_SIZE          SENSOR_LOG_HEADER_SIZE
 #define UV_SENSOR_STORAGE_END_ADDRESS   (UV_SENSOR_STORAGE_START_ADDRESS + UV_SENSOR_STORAGE_SIZE)
 
-#define HUMIDITY_SENSOR_STORAGE_START_ADDRESS (UV_SENSOR_STORAGE_END_ADDRESS + SECTOR_SIZE)
-#define HUMIDITY_SENSOR_STORAGE_SIZE          ((1 + SENSOR_DATA_SECTOR_UNIT * 2) * SECTOR_SIZE)
+#define HUMIDITY_SENSOR_STORAGE_START_ADDRESS (UV_SENSOR_STORAGE_END_ADDRESS)
+#define HUMIDITY_SENSOR_STORAGE_SIZE          SENSOR_LOG_HEADER_SIZE
 #define HUMIDITY_SENSOR_STORAGE_END_ADDRESS   (HUMIDITY_SENSOR_STORAGE_START_ADDRESS + HUMIDITY_SENSOR_STORAGE_SIZE)
 
-#define PRESSURE_SENSOR_STORAGE_START_ADDRESS (HUMIDITY_SENSOR_STORAGE_END_ADDRESS + SECTOR_SIZE)
-#define PRESSURE_SENSOR_STORAGE_SIZE          ((1 + SENSOR_DATA_SECTOR_UNIT * 2) * SECTOR_SIZE)
+#define PRESSURE_SENSOR_STORAGE_START_ADDRESS (HUMIDITY_SENSOR_STORAGE_END_ADDRESS)
+#define PRESSURE_SENSOR_STORAGE_SIZE          SENSOR_LOG_HEADER_SIZE
 #define PRESSURE_SENSOR_STORAGE_END_ADDRESS   (PRESSURE_SENSOR_STORAGE_START_ADDRESS + PRESSURE_SENSOR_STORAGE_SIZE)
 
+#define ORIENTATION_SENSOR_STORAGE_START_ADDRESS (PRESSURE_SENSOR_STORAGE_END_ADDRESS)
+#define ORIENTATION_SENSOR_STORAGE_SIZE          SENSOR_LOG_HEADER_SIZE
+#define ORIENTATION_SENSOR_STORAGE_END_ADDRESS   (ORIENTATION_SENSOR_STORAGE_START_ADDRESS + ORIENTATION_SENSOR_STORAGE_SIZE)
+
+// ログのデータ領域。全てのセンサーで共有し、64KBのエクステント単位でログに割り当てる。
+// エクステントはブロック消去の単位に揃えるため、64KB境界から始める。フラッシュの末尾(32MB)まで使う。
+#define LOG_EXTENT_SIZE           0x10000
+#define LOG_POOL_START_ADDRESS    0x10000
+#define LOG_POOL_END_ADDRESS      0x2000000
+#define LOG_NUM_OF_EXTENTS        ((LOG_POOL_END_ADDRESS - LOG_POOL_START_ADDRESS) / LOG_EXTENT_SIZE)
+
 #endif /* senstick_flash_address_definition_h */
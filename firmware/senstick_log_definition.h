@@ -4,4 +4,15 @@
 // ログ最大数
 #define MAX_NUM_OF_LOG 100
 
+// ギャップマーカー。サンプルを記録できなかった位置に、抜けたサンプルの代わりに、サンプル2つ分のレコードを書き込む。
+//  1つ目(マーカー): 全てのバイトがLOG_GAP_MARKER_BYTE。
+//  2つ目: 先頭2バイトが抜けたサンプル数(リトルエンディアン、1以上)、残りは0。
+// 記録するサンプルが、たまたまマーカーと同じ値のときは、値を変えずにマーカーとして書き、全てのバイトが0のレコードを続ける(エスケープ)。
+// マーカーの直後のレコードは、値によらず必ず2つ目のレコードなので、サンプル数がマーカーと同じ値でも区別できる。
+// 読み出すときは、先頭から順にレコードを読み、マーカーを読んだら次のレコードを読んで、
+//  全て0ならマーカーの値のサンプル、それ以外なら抜けたサンプル数とする。
+// 2つのレコードは1回の書き込みで書くが、記録中のリセットで2つ目がフラッシュに書き出されないことがある。ログの末尾の、対になるレコードがないマーカーは捨てる。
+// BLEのログデータの通知は、レコードをそのままシリアライズして送るので、受信側も同じ手順で読む。
+#define LOG_GAP_MARKER_BYTE 0x80
+
 #endif /* senstick_log_definition_h */
@@ -7,17 +7,26 @@
 #include "senstick_types.h"
 #include "senstick_sensor_base_data.h"
 
-#define MAX_SENSOR_RAW_DATA_SIZE 6
+#define MAX_SENSOR_RAW_DATA_SIZE 8
+
+// センサーを読み出すバス。サンプリングの受け入れ制御(senstickSensorControllerWriteSetting())が、バスの使用率を見積もるのに使う。
+typedef enum {
+    sensorBus_twi          = 0, // I2Cバス(twi0)。サンプルごとに単独で読み出す。
+    sensorBus_twiNineAxes  = 1, // I2Cバス(twi0)。9軸センサーの1回の読み出しで、加速度、ジャイロ、地磁気をまとめて読み出す。
+} sensor_bus_t;
 
 // センサーの初期化。
 typedef bool (* initSensorHandlerType)(void);
 // センサーのwakeup/sleepを指定します
 typedef void (* setSensorWakeupHandlerType)(bool shouldWakeUp, const sensor_service_setting_t *p_setting);
-// センサーの値を読み込みます。
-// duration_msはセンサ開始からの経過時間をミリ秒で、0カラスタートしてタイマ割り込み周期刻みで与えます。
-// 返り値は、有効なデータ長を示します。センサの値読み込み処理が継続中であれば、0を返します。
-// 呼び出し側は、時間をおいて、0以外の値が返ってくるまで、このメソッドを呼び出し続けます。
-typedef uint8_t (* getSensorDataHandlerType)(uint8_t *p_buffer, samplingDurationType duration_ms);
+// センサーの値を受け取るコールバック。TWIの完了割り込みから呼び出されます。
+typedef void (* sensorDataCallbackType)(sensor_device_t device_type, const uint8_t *p_data, uint8_t length);
+// センサーの値の読み込みを要求します。読み込みはTWIのキューに積まれ、完了するとcallbackにデータが渡されます。
+// duration_msはこのサンプルの読み出し時刻からの経過時間をミリ秒で、0からスタートして与えます。
+// このサンプルの読み込みを開始すればtrueを返します。センサの変換待ちなど、処理が継続中であれば、falseを返します。
+// 変換待ちでfalseを返すときは、次に呼び出してほしい経過時間(ミリ秒)を*p_wakeup_msに入れます。呼び出し側は、その時刻まで呼び出しません。
+// *p_wakeup_msを変えずにfalseを返すと(TWIのキューがいっぱいなど)、呼び出し側はタイマ割り込み周期の後に呼び直します。
+typedef bool (* requestSensorDataHandlerType)(samplingDurationType duration_ms, sensorDataCallbackType callback, samplingDurationType *p_wakeup_ms);
 // srcとdstのセンサデータの最大値/最小値をp_srcに入れます。p_srcは破壊されます。
 typedef void (* getMaxMinValueHandlerType)(bool isMax, uint8_t *p_src, uint8_t *p_dst);
 // センサ構造体データをBLEのシリアライズしたバイナリ配列に変換します。
@@ -29,11 +38,16 @@ typedef struct {
     
     flash_address_info_t address_info;   // フラッシュの割当領域情報
     
-    initSensorHandlerType       initSensorHandler;
-    setSensorWakeupHandlerType  setSensorWakeupHandler;
-    getSensorDataHandlerType    getSensorDataHandler;
-    getMaxMinValueHandlerType   getMaxMinValueHandler;
-    getBLEDataHandlerType       getBLEDataHandler;
+    sensor_bus_t bus;                    // 読み出すバス
+    uint16_t busTimeUs;                  // 1サンプルの読み出しでバスを占有する時間(マイクロ秒)。変換のトリガーの書き込みを含む。
+    uint32_t conversionLatencyUs;        // 新しい値を読み出せるまでの時間(マイクロ秒)。サンプリング周期の下限になる。
+    uint8_t  filterChannelCount;         // 間引きのローパスフィルタに通す、データの先頭の16ビット符号付きのチャネル数。0なら間引きを使えない。
+    
+    initSensorHandlerType        initSensorHandler;
+    setSensorWakeupHandlerType   setSensorWakeupHandler;
+    requestSensorDataHandlerType requestSensorDataHandler;
+    getMaxMinValueHandlerType    getMaxMinValueHandler;
+    getBLEDataHandlerType        getBLEDataHandler;
 } senstick_sensor_base_t;
 
 #endif /* senstick_sensor_base_h */
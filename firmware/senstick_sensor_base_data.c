@@ -10,20 +10,50 @@ bool isValidSensorServiceCommand(uint8_t value)
     return (value == 0x00 || value == 0x01 || value == 0x03);
 }
 
+uint32_t getSensorServiceSamplingPeriodUs(const sensor_service_setting_t *p_setting)
+{
+    if(p_setting->samplingPeriodUs != 0) {
+        return p_setting->samplingPeriodUs;
+    }
+    return (uint32_t)p_setting->samplingDuration * 1000;
+}
+
+uint8_t getSensorServiceDecimation(const sensor_service_setting_t *p_setting)
+{
+    return (p_setting->decimation > 1) ? p_setting->decimation : 1;
+}
+
 uint8_t serializesensor_service_setting(uint8_t *p_dst, sensor_service_setting_t *p_src)
 {
     p_dst[0] = p_src->command;
     uint16ToByteArrayLittleEndian(&p_dst[1], p_src->samplingDuration);
     uint16ToByteArrayLittleEndian(&p_dst[3], p_src->measurementRange);
+    const bool has_decimation = (getSensorServiceDecimation(p_src) > 1);
+    if(p_src->samplingPeriodUs == 0 && ! has_decimation) {
+        return 5;
+    }
+    uint32ToByteArrayLittleEndian(&p_dst[5], p_src->samplingPeriodUs);
+    if( ! has_decimation ) {
+        return 9;
+    }
+    p_dst[9] = p_src->decimation;
     
-    return 5;
+    return 10;
 }
 
-void deserializesensor_service_setting(sensor_service_setting_t *p_dst, uint8_t *p_src)
+void deserializesensor_service_setting(sensor_service_setting_t *p_dst, uint8_t *p_src, uint8_t length)
 {
     p_dst->command = (sensor_service_command_t) p_src[0];
     p_dst->samplingDuration = readUInt16AsLittleEndian(&p_src[1]);
     p_dst->measurementRange = readUInt16AsLittleEndian(&p_src[3]);
+    p_dst->samplingPeriodUs = 0;
+    p_dst->decimation       = 1;
+    if(length >= 9) {
+        p_dst->samplingPeriodUs = readUInt32AsLittleEndian(&p_src[5]);
+    }
+    if(length >= 10) {
+        p_dst->decimation = p_src[9];
+    }
 }
 
 uint8_t serializeSensorServiceLogID(uint8_t *p_dst, sensor_service_logID_t *p_src)
@@ -13,6 +13,7 @@ typedef enum {
     UltraVioletSensor               = 4,
     HumidityAndTemperatureSensor    = 5,
     AirPressureSensor               = 6,
+    OrientationSensor               = 7, // 9軸センサーから計算する姿勢(仮想のセンサー)
 } sensor_device_t;
 
 typedef enum {
@@ -25,13 +26,25 @@ typedef enum {
 // センサーのサンプリング周期
 typedef int16_t samplingDurationType;
 
+// センサーの非同期の読み出しが完了した時に、デコードしたデータを受け取るハンドラ。TWIの完了割り込みから呼び出されます。
+// 読み出しに失敗した時は呼び出されません。
+typedef void (* sensor_data_ready_handler_t)(const uint8_t *p_data, uint8_t length);
+
 // 設定キャラクタリスティクスのデータモデル
+// バイナリ配列は5バイト(コマンド、ミリ秒の周期、測定レンジ)。マイクロ秒の周期を使うときは、末尾に4バイトのマイクロ秒の周期を続けた9バイト。
+// 5バイトだけを読み書きする従来のクライアントは、ミリ秒の周期(マイクロ秒の周期の切り捨て)を扱う。
+// 間引きを使うときは、9バイトの末尾に1バイトの間引きを続けた10バイト(マイクロ秒の周期が0なら、ミリ秒の周期を使う)。
 typedef struct {
     sensor_service_command_t command;           // センサーの動作指定を示します。停止/センシング/センシング&ロギング。
     samplingDurationType     samplingDuration;  // サンプリング周期(ミリ秒)
     uint16_t                 measurementRange;  // 測定レンジ。値の意味は、センサごとに異なります。
+    uint32_t                 samplingPeriodUs;  // サンプリング周期(マイクロ秒)。0ならsamplingDuration(ミリ秒)の周期。
+    uint8_t                  decimation;        // 間引き。サンプリング周期で取得し、ローパスフィルタを通してdecimationごとに1つを記録、通知する。0または1なら使わない。
 } sensor_service_setting_t;
 
+// シリアライズした設定の最大のバイト数。マイクロ秒の周期と間引きを付けた長さ。
+#define SENSOR_SERVICE_SETTING_MAX_SIZE 10
+
 // logidキャラクタリスティクスのデータモデル
 typedef struct {
     uint8_t  logID;           // 読み出し対象のログIDを指定します。
@@ -52,9 +65,16 @@ typedef struct {
 // 有効なコマンド値か?
 bool isValidSensorServiceCommand(uint8_t value);
 
-// バイナリ配列に変換します。バッファは長さ6バイト以上。
+// サンプリング周期(マイクロ秒)を返します。
+uint32_t getSensorServiceSamplingPeriodUs(const sensor_service_setting_t *p_setting);
+// 間引き(1以上)を返します。
+uint8_t getSensorServiceDecimation(const sensor_service_setting_t *p_setting);
+
+// バイナリ配列に変換します。バッファは長さSENSOR_SERVICE_SETTING_MAX_SIZE以上。
+// マイクロ秒の周期も間引きもなければ5バイト、マイクロ秒の周期だけなら9バイト、間引きがあれば10バイト。
 uint8_t serializesensor_service_setting(uint8_t *p_dst, sensor_service_setting_t *p_src);
-void deserializesensor_service_setting(sensor_service_setting_t *p_dst, uint8_t *p_src);
+// lengthが9バイト未満なら、マイクロ秒の周期は0(ミリ秒の周期を使う)。10バイト未満なら、間引きは1(使わない)。
+void deserializesensor_service_setting(sensor_service_setting_t *p_dst, uint8_t *p_src, uint8_t length);
 // 7バイト以上
 uint8_t serializeSensorServiceLogID(uint8_t *p_dst, sensor_service_logID_t *p_src);
 void deserializeSensorServiceLogID(sensor_service_logID_t *p_dst, uint8_t *p_src);
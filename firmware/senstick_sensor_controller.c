@@ -1,12 +1,12 @@
 #include <app_timer_appsh.h>
 #include <nrf_log.h>
 #include <nrf_assert.h>
-#include <app_mailbox.h>
 #include <nrf_soc.h>
 #include <app_util_platform.h>
 #include <app_scheduler.h>
 
 #include "senstick_util.h"
+#include "value_types.h"
 
 #include "log_controller.h"
 
@@ -20,6 +20,9 @@
 #include "spi_slave_mx25_flash_memory.h"
 
 #include "twi_manager.h"
+#include "senstick_data_model.h"
+#include "senstick_log_definition.h"
+#include "superblock_controller.h"
 
 #include "acceleration_sensor_base.h"
 #include "gyro_sensor_base.h"
@@ -28,23 +31,123 @@
 #include "uv_sensor_base.h"
 #include "humidity_sensor_base.h"
 #include "pressure_sensor_base.h"
+#include "orientation_sensor_base.h"
+#include "twi_slave_nine_axes_sensor.h"
+#include "ring_buffer.h"
+#include "sample_filter.h"
 
-#define NUM_OF_SENSORS     7
-#define MAILBOX_ITEM_SIZE  (MAX_SENSOR_RAW_DATA_SIZE +2)
+#define NUM_OF_SENSORS     8
 
+// 割り込みからスケジューラにサンプルを渡すリングバッファのバイトサイズ(2のべき乗)。1サンプルは、1バイトのヘッダとデータ(2〜8バイト)。
 #ifdef NRF51
-#define MAILBOX_QUEUE_SIZE 40
+// 6バイトのサンプルで36個
+#define SAMPLE_RING_BUFFER_SIZE 256
 #else // NRF52
-// 消去max. 120ミリ秒 x 3センサー分、つまり360ミリ秒のうちに、3センサーx10ミリ秒サンプリング = 3 * 36 = 108
-#define MAILBOX_QUEUE_SIZE 255
+// 6バイトのサンプルで292個。消去max. 120ミリ秒 x 3センサー分、つまり360ミリ秒のうちに、3センサーx10ミリ秒サンプリング = 3 * 36 = 108
+#define SAMPLE_RING_BUFFER_SIZE 2048
 #endif
 
+// リングバッファが一杯のとき、サンプルは捨てて、センサーごとに数える。次に格納できたサンプルの前に、抜けたサンプル数のレコードを入れ、
+// ログにはギャップマーカー(senstick_log_definition.h)を書き込む。ギャップのレコードのペイロードは、[sensor_device_t, 抜けたサンプル数(uint16)]。
+#define SAMPLE_RING_GAP_TAG    RING_BUFFER_MAX_TAG
+#define SAMPLE_RING_GAP_LENGTH 3
+
+// 1ならば、リングバッファの使用量が高い水位を超えてから低い水位を下回るまで、最も周期の短いセンサーのサンプルを
+// SAMPLE_RING_DECIMATION_FACTORごとに1つに間引く。間引いたサンプルも、抜けたサンプルとしてギャップマーカーを書く。
+#define SAMPLE_RING_DECIMATION_ENABLED        1
+#define SAMPLE_RING_DECIMATION_HIGH_WATERMARK (SAMPLE_RING_BUFFER_SIZE * 3 / 4)
+#define SAMPLE_RING_DECIMATION_LOW_WATERMARK  (SAMPLE_RING_BUFFER_SIZE / 2)
+#define SAMPLE_RING_DECIMATION_FACTOR         8
+
+// サンプリングの受け入れ制御。設定全体で、I2Cバスの使用率、フラッシュの書き込み帯域の使用率、ログの書き込みが止まる間に
+// リングバッファに溜まるバイト数を見積もり(sampling_load_t)、上限(1000分率)を超える設定は受け入れない。
+// I2Cバスは、割り込みの遅れとトランザクションの間の隙間の分を残す。
+#define ADMISSION_MAX_BUS_LOAD   900
+// フラッシュは標準的な時間で見積もるので、最大時間(数倍)との差の分を残す。
+#define ADMISSION_MAX_FLASH_LOAD 500
+// リングバッファは、間引きを始める使用量(SAMPLE_RING_DECIMATION_HIGH_WATERMARK)まで。
+#define ADMISSION_MAX_RING_LOAD  1000
+// ログの書き込みが止まる時間の見積もり(マイクロ秒)。ページプログラムの最大時間(3ミリ秒) x プログラムバッファ4つと、スケジューラの遅れ。
+#define ADMISSION_RING_STALL_US  20000
+
+// 間引き(sensor_service_setting_tのdecimation)を使うセンサーは、リングバッファから取り出したサンプルを、ローパスフィルタを通して間引いてから、
+// ログとBLEの通知に渡す。フィルタの状態はRAMを使うので、同時に間引くセンサーの数はSAMPLE_FILTER_POOL_SIZEまで。
+#define SAMPLE_FILTER_POOL_SIZE 3
+
 // TIMER割り込みプリスケーラ。16MHz / 2^4 = 1MHz。
 #define TIMER_PRESCALERS_1US  (4)
 
-// 割り込み周期(かつサンプリング周期の最小量)
+// TIMER2はクリアせずに回し続け、センサーごとのサンプリング時刻(マイクロ秒)のうち、最も早いものをCC[0]に設定する。
+// カウンタの値はCC[1]にキャプチャして読む。NRF51のTIMER2は16ビットまで。
+#ifdef NRF52
+#define TIMER_BITMODE       TIMER_BITMODE_BITMODE_32Bit
+#define TIMER_COUNTER_MASK  0xffffffff
+#else // NRF51
+#define TIMER_BITMODE       TIMER_BITMODE_BITMODE_16Bit
+#define TIMER_COUNTER_MASK  0xffff
+#endif
+// コンペアの最大の間隔。16ビットのカウンタが一周する前に割り込みを入れて、ソフトウェアの時刻を進める。
+#define TIMER_MAX_INTERVAL_US 50000
+// コンペアの最小の間隔。CC[0]を書き込む前にカウンタが追い越さないだけの余裕。
+#define TIMER_MIN_INTERVAL_US 20
+
+#ifdef NRF52
+// TIMER2で読み出すセンサーの周期がすべてRTC_MIN_SAMPLING_PERIOD_US以上なら、TIMER2の代わりにRTC2(32.768kHzのLFCLK)で時刻を数える。
+// TIMER2はHFCLKを動かし続けるが、RTC2なら割り込みとI2Cの転送の間だけHFCLKが動く。NRF51にはRTC2がない。
+#define RTC_FREQUENCY              32768
+#define RTC_COUNTER_MASK           0xffffff
+// RTCのコンペアは、カウンタの2つ先以降でなければ発生しない場合がある。
+#define RTC_MIN_INTERVAL_TICKS     2
+// RTCの分解能(約30.5マイクロ秒)が、サンプルの時刻の揺らぎになる。
+#define RTC_MIN_SAMPLING_PERIOD_US (TIMER_PERIOD_MS * 1000)
+#endif
+
+// 1ならば、TIMER2で読み出すセンサーの最初のサンプルの時刻を、周期の中でずらして(位相)、サンプルの時刻が重ならないようにする。
+// 周期は変えないので、長い時間でのサンプル数は変わらない。0なら、すべてのセンサーがサンプリングの開始から1周期後に始まる。
+#ifndef SAMPLING_PHASE_STAGGER_ENABLED
+#define SAMPLING_PHASE_STAGGER_ENABLED 1
+#endif
+// 位相の刻み(マイクロ秒)と、センサーごとに試す位相の最大数。周期が長ければ、刻みを広げる。
+#define SAMPLING_PHASE_STEP_US        1000
+#define SAMPLING_PHASE_MAX_CANDIDATES 256
+
+// 読み出しを開始できなかったセンサー(変換待ちの状態遷移の途中を含む)を、再び呼び出す間隔。
+// 9軸センサーのチップの周期がこれより短ければFIFOで、それ以上ならデータレディ割り込みでサンプリングする。
 #define TIMER_PERIOD_MS 10
 
+// 加速度とジャイロの、サンプリング周期の最小値。TIMER_PERIOD_MSより短い周期は、9軸センサーのFIFOでサンプリングする。
+#ifdef NRF51
+// リングバッファ(256バイト)には、FIFOから一度に読み出したサンプルを格納できないため、FIFOは使わない。
+#define NINE_AXES_MIN_SAMPLING_DURATION_MS TIMER_PERIOD_MS
+#else // NRF52
+#define NINE_AXES_MIN_SAMPLING_DURATION_MS 1
+#endif
+// FIFOを読み出す周期。1kHzで加速度とジャイロを入れると、20ミリ秒で240バイト(FIFOは512バイト)。
+#define NINE_AXES_FIFO_DRAIN_PERIOD_MS 20
+// FIFOの読み出しの時刻は、センサーの時刻の表の末尾に置く。
+#define NINE_AXES_FIFO_DRAIN_SLOT NUM_OF_SENSORS
+// 1回の読み出しで取り出す最大のサンプル数。FIFOに入る最大のフレーム数(512 / 12)。
+#define NINE_AXES_FIFO_MAX_FRAMES 42
+#ifdef NRF52
+// ミリ秒の倍数でない、TIMER_PERIOD_MSより短い周期の加速度とジャイロは、ハードウェアの周期読み出し(TIMER3、PPI、TWIMのEasyDMA)で取得する。
+// CPUは、FIFOの読み出しと同じくNINE_AXES_FIFO_DRAIN_PERIOD_MSごと(のサンプル数)に、まとめて受け取る。
+#define NINE_AXES_PERIODIC_READ_BATCH_PERIOD_US (NINE_AXES_FIFO_DRAIN_PERIOD_MS * 1000)
+#endif
+
+// 割り込み処理時間の計測。NRF52はDWTのサイクルカウンタ(CPUクロック)で測る。NRF51にはDWTがないので、計測しない。
+typedef struct {
+    uint32_t count;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+} isr_profile_t;
+
+// サンプリングの設定全体の負荷の見積もり。1000分率。
+typedef struct {
+    uint32_t busLoad;   // I2Cバスの使用率
+    uint32_t flashLoad; // フラッシュがページプログラムとセクター消去でビジーになる時間の割合
+    uint32_t ringLoad;  // ログの書き込みが止まる間に溜まるサンプルの、リングバッファの間引きを始める使用量に対する割合
+} sampling_load_t;
+
 static const senstick_sensor_base_t *m_p_sensor_bases[] = {
     &accelerationSensorBase,
     &gyroSensorBase,
@@ -52,13 +155,16 @@ static const senstick_sensor_base_t *m_p_sensor_bases[] = {
     &brightnessSensorBase,
     &uvSensorBase,
     &humiditySensorBase,
-    &pressureSensorBase
+    &pressureSensorBase,
+    &orientationSensorBase
 };
 
 
 //APP_TIMER_DEF(m_timer_id);
-// メールボックスのバイナリ配列のフォーマットは、[sensor_device_t, length, シリアライズされた構造体]
-APP_MAILBOX_DEF(m_mailbox, MAILBOX_QUEUE_SIZE, MAILBOX_ITEM_SIZE);
+// サンプルのリングバッファ。レコードのタグはsensor_device_t、ペイロードはシリアライズされた構造体。
+// 生産者はAPP_IRQ_PRIORITY_HIGHの割り込み(TIMER2/RTC2、TWI、データレディ、周期読み出し)で、同じ優先度なので互いに割り込まない。
+// スレッドから書き込むのは、サンプリングを止めて、それらの割り込みが来なくなった後だけ。消費者はスケジューラのタスク。
+RING_BUFFER_DEF(m_sample_ring, SAMPLE_RING_BUFFER_SIZE);
 
 typedef struct {
     // センサー個別のアクセスベースのポインタ、無効なのはNULL
@@ -78,13 +184,60 @@ typedef struct {
     // 通知フラグ
     bool isNotificationRunning;
     
-    // センサのサンプリング周期積算カウンタ
-    samplingDurationType sensorSampling[NUM_OF_SENSORS];
+    // チップのサンプリング(または周期読み出し)で取得するセンサーの、サンプリング周期積算カウンタ(マイクロ秒)
+    uint32_t sensorSampling[NUM_OF_SENSORS];
+    
+    // TIMER2で読み出すセンサーの時刻(マイクロ秒)。TIMER2のカウンタを広げたソフトウェアの時刻で数える。
+    // 末尾(NINE_AXES_FIFO_DRAIN_SLOT)は、FIFOの読み出し。
+    // isRtcClockがtrueならRTC2、falseならTIMER2で数える。RTC2のカウントをマイクロ秒にした端数は、clockRemainderに持ち越す。
+    bool     isRtcClock;
+    uint32_t timerNowUs;
+    uint32_t timerLastCounter;
+    uint32_t clockRemainder;
+    uint32_t samplingDeadlineUs[NUM_OF_SENSORS + 1]; // 次のサンプルの時刻
+    uint32_t samplingWakeupUs[NUM_OF_SENSORS + 1];   // 次に読み出しを要求する時刻。変換待ちの間は、サンプルの時刻より後になる。
+    bool     isSampledByTimer[NUM_OF_SENSORS + 1];
+    
+    // 9軸センサーのチップのサンプリングで取得するセンサー(加速度とジャイロ)
+    bool isSampledByNineAxes[NUM_OF_SENSORS];
+    // チップのサンプリング周期(ミリ秒)。0ならチップのサンプリングを使わず、TIMER2で読み出す。
+    uint8_t nineAxesPeriod;
+    // trueならFIFOに溜めてTIMER2でまとめて読み出す。falseならデータレディ割り込みで読み出す。
+    bool isNineAxesFifoMode;
+    // ハードウェアの周期読み出しの周期(マイクロ秒)。0なら周期読み出しを使っていない。
+    uint32_t nineAxesPeriodicReadUs;
+    
+    // 過負荷の扱い。割り込み(リングバッファの生産者)だけが書き込む。サンプリングの開始でクリアする。
+    uint32_t droppedSampleCount[NUM_OF_SENSORS]; // 捨てた(間引いた)サンプル数
+    uint16_t pendingGapCount[NUM_OF_SENSORS];    // リングバッファにギャップのレコードを入れていない、抜けたサンプル数。65535で飽和する。
+    int      decimatedSensor;                    // 間引くセンサー。-1なら間引かない。
+    bool     isDecimating;
+    uint8_t  decimationPhase;
+    
+    // 間引きのフィルタ。センサーごとのフィルタへのポインタは、間引かなければNULL。消費者(スケジューラのタスク)だけが使う。
+    sample_filter_t filters[SAMPLE_FILTER_POOL_SIZE];
+    sample_filter_t *p_filters[NUM_OF_SENSORS];
+    
+    // 割り込み処理時間。TIMER2、データレディ割り込み、TWIの完了割り込みからのデータの受け取り、周期読み出しのバッチの受け取り。
+    isr_profile_t timerIsrProfile;
+    isr_profile_t dataReadyIsrProfile;
+    isr_profile_t twiCallbackProfile;
+    isr_profile_t periodicReadIsrProfile;
+    // 間引きのフィルタの、入力サンプル1つあたりの処理時間。
+    isr_profile_t filterProfile;
     
     log_context_t writingLogContext[NUM_OF_SENSORS];
     log_context_t readingLogContext[NUM_OF_SENSORS];
+    // 書き込み中のログの書き込みバッファ。読み込み用のコンテキストは書き込まないので、書き込み用のコンテキストの分だけ持つ。
+    uint8_t logWriteBuffer[NUM_OF_SENSORS][LOG_WRITE_BUFFER_SIZE];
     
     log_context_t *p_readingLogContext[NUM_OF_SENSORS];
+    
+    // 全消去で、次に消去するアドレス
+    uint32_t wipeAddress;
+    
+    // センサーごとの、最後のログのストリーム内の終端位置。スーパーブロックに記録する。
+    uint32_t dataEndPosition[NUM_OF_SENSORS];
 } seenstick_sensor_controller_context_t;
 
 static seenstick_sensor_controller_context_t context;
@@ -94,19 +247,25 @@ static seenstick_sensor_controller_context_t context;
  */
 
 // もしもフラッシュに有効なセンサ情報があれば、読み込みます
-#define MAGIC_WORD 0xabcd
+// sensor_service_setting_tの構造を変えたら、値を変える。
+#define MAGIC_WORD 0xabd0
 void loadSensorSetting(void)
 {
+    // スーパーブロックがマウントできていれば、そこから読み込む
+    superblock_t superblock;
+    if( superblockRead(&superblock) ) {
+        memcpy(context.sensorSetting, superblock.sensorSetting, sizeof(context.sensorSetting));
+        return;
+    }
+    
     // マジックワードを確認
     uint32_t i;
     readFlash(SENSOR_SETTING_STORAGE_START_ADDRESS, (uint8_t *)&i, sizeof(uint32_t));
     if( i!= MAGIC_WORD) {
         return;
     }
-    // センサ情報を読み込み
-    for(int i=0; i < NUM_OF_SENSORS; i++) {
-        readFlash(SENSOR_SETTING_STORAGE_START_ADDRESS + sizeof(uint32_t) + i * sizeof(sensor_service_setting_t), (uint8_t *)&context.sensorSetting[i], sizeof(sensor_service_setting_t));
-    }
+    // センサ情報を読み込み。センサ情報は配列と同じ並びで保存されているので、まとめて読み出す。
+    readFlashSequential(SENSOR_SETTING_STORAGE_START_ADDRESS + sizeof(uint32_t), (uint8_t *)context.sensorSetting, NUM_OF_SENSORS * sizeof(sensor_service_setting_t));
 }
 
 void saveSensorSetting(void)
@@ -128,6 +287,36 @@ void formatSensorSetting(void)
     formatFlash(SENSOR_SETTING_STORAGE_START_ADDRESS, SENSOR_SETTING_STORAGE_SIZE);
 }
 
+// 最後のログの終端位置から、データ領域がいっぱいかを返します。データ領域は全センサーで共有するので、空きは共有領域の残りで決まる。
+static bool isDataEndFull(int index, uint32_t data_end_position)
+{
+    // センサ構造体は最大でMAX_SENSOR_RAW_DATA_SIZEバイト。余裕を見て128サンプルくらいが空いているかを確認。
+    return getLogFreeSize(&(m_p_sensor_bases[index]->address_info), data_end_position) < (MAX_SENSOR_RAW_DATA_SIZE * 128);
+}
+
+// ログがないときの、データ領域の終端位置を設定します。
+static void clearDataEndPosition(void)
+{
+    memset(context.dataEndPosition, 0, sizeof(context.dataEndPosition));
+}
+
+// 現在の状態を、スーパーブロックに追記します。
+static void writeSuperblock(uint8_t log_count, bool is_disk_full, bool is_log_open)
+{
+    superblock_t superblock;
+    
+    superblock.logCount   = log_count;
+    superblock.isDiskFull = is_disk_full || (log_count >= MAX_NUM_OF_LOG);
+    superblock.isLogOpen  = is_log_open;
+    for(int i=0; i < NUM_OF_SENSORS; i++) {
+        superblock.dataEndPosition[i] = context.dataEndPosition[i];
+        superblock.isDiskFull        |= isDataEndFull(i, context.dataEndPosition[i]);
+    }
+    memcpy(superblock.sensorSetting, context.sensorSetting, sizeof(superblock.sensorSetting));
+    
+    superblockWrite(&superblock);
+}
+
 // BLEサービスにログデータを通知します。読み込んだバイト数を返します。
 // 先頭バイトは、有効なデータユニットの数、その後センサデータが並びます。
 static uint8_t fillBLESensorData(uint8_t *p_data, uint8_t length, sensor_device_t device_type)
@@ -223,49 +412,120 @@ static bool sensor_notify_raw_data(sensor_device_t deviceType, uint8_t *p_raw_da
 }
 
 static void setSensorShoudlWork(bool shouldWakeup, bool shouldLogging, uint8_t new_log_id);
-static void flash_mailbox(void)
+// ログにマーカーと、それに続くレコードを書き込みます。ログがいっぱいならfalseを返します。
+// 2つのレコードは1回で書き込むので、ログがいっぱいでもマーカーだけが書かれることはない。
+static bool writeMarkerLog(sensor_device_t device_type, const uint8_t *p_follower)
+{
+    const uint8_t size = m_p_sensor_bases[device_type]->rawSensorDataSize;
+    uint8_t records[2 * MAX_SENSOR_RAW_DATA_SIZE];
+    
+    memset(records, LOG_GAP_MARKER_BYTE, size);
+    memcpy(&(records[size]), p_follower, size);
+    return writeLog(&(context.writingLogContext[device_type]), records, 2 * size) == (2 * size);
+}
+
+// ログにギャップマーカーを書き込みます。countは1以上。ログがいっぱいならfalseを返します。
+static bool writeGapMarker(sensor_device_t device_type, uint16_t count)
 {
-    ret_code_t err_code;
-    uint8_t buffer[MAILBOX_ITEM_SIZE];
+    uint8_t gap_count[MAX_SENSOR_RAW_DATA_SIZE];
+    
+    ASSERT(count > 0);
+    memset(gap_count, 0, sizeof(gap_count));
+    uint16ToByteArrayLittleEndian(gap_count, count);
+    return writeMarkerLog(device_type, gap_count);
+}
 
+// サンプルをログに書き込みます。ログがいっぱいならfalseを返します。
+static bool writeSampleLog(sensor_device_t device_type, uint8_t *p_data, uint8_t length)
+{
+    // ギャップマーカーと同じ値のサンプルは、全て0のレコードを続けてエスケープする
+    bool is_marker = true;
+    for(int i = 0; i < length; i++) {
+        is_marker &= (p_data[i] == LOG_GAP_MARKER_BYTE);
+    }
+    if(is_marker) {
+        const uint8_t escape[MAX_SENSOR_RAW_DATA_SIZE] = {0};
+        return writeMarkerLog(device_type, escape);
+    }
+    return writeLog(&(context.writingLogContext[device_type]), p_data, length) == length;
+}
+
+static void recordIsrProfile(isr_profile_t *p_profile, uint32_t start_cycles);
+// 間引くセンサーのサンプルを、フィルタに通します。出力するサンプルがあれば、p_dataに書き込んでtrueを返します。間引かないセンサーは、そのままtrueを返します。
+static bool filterSample(sensor_device_t device_type, uint8_t *p_data)
+{
+    sample_filter_t *p_filter = context.p_filters[device_type];
+    if(p_filter == NULL) {
+        return true;
+    }
+    const uint32_t start_cycles = senstickSensorControllerGetCycleCount();
+    const bool has_output = sampleFilterProcess(p_filter, p_data, p_data);
+    recordIsrProfile(&(context.filterProfile), start_cycles);
+    return has_output;
+}
+
+// 抜けたサンプルを、ログにギャップマーカーとして書き込みます。ログがいっぱいならfalseを返します。
+static bool writeGapLog(sensor_device_t device_type, uint16_t gap_count)
+{
+    // 間引くセンサーは、フィルタの過去のサンプルを捨てて、抜けたサンプル数を間引いた後のサンプル数(切り上げ)にする
+    if(context.p_filters[device_type] != NULL) {
+        const uint8_t decimation = context.p_filters[device_type]->decimation;
+        sampleFilterReset(context.p_filters[device_type]);
+        gap_count = (gap_count + decimation - 1) / decimation;
+    }
+    if((context.sensorSetting[device_type].command & 0x02) == 0) {
+        return true;
+    }
+    const bool did_write = writeGapMarker(device_type, gap_count);
+    senstickSensorControllerNotifyLogData();
+    return did_write;
+}
+
+static void scheduleDequeueTask(void);
+static void flash_ring_buffer(void)
+{
 //    uint32_t prev_time = app_timer_cnt_get();
     
-    while(true) {
-        // キューの深さ表示
-/*
-        static uint32_t queue_length = 1;
-        uint32_t length = app_mailbox_length_get (&m_mailbox);
-        if( length > queue_length ) {
-            queue_length = length;
-            NRF_LOG_PRINTF_DEBUG("queue: %d.\n", queue_length);
-        }
-*/
-        // デキュー
-        err_code = app_mailbox_get(&m_mailbox, buffer);
-        if(err_code == NRF_ERROR_NO_MEM) {
+    // 過負荷で書き込みがサンプリングに追いつかないとき、メインループを止め続けないように、呼び出した時点で入っていた分だけを処理する。
+    uint16_t budget = ringBufferGetUsedSize(&m_sample_ring);
+    while(budget > 0) {
+        // デキュー。データはリングバッファの中をそのまま使い、処理し終えてから取り除く。
+        uint8_t tag;
+        uint8_t length;
+        uint8_t *p_data = (uint8_t *)ringBufferPeek(&m_sample_ring, &tag, &length);
+        if(p_data == NULL) {
             break;
         }
+        budget -= MIN(budget, 1 + length);
         
-        sensor_service_command_t command = context.sensorSetting[buffer[0]].command;
-        // BLEリアルタイム通知
-        if((command & 0x01) != 0) {
-            sensor_notify_raw_data((sensor_device_t)buffer[0], &buffer[2], buffer[1]);
-        }
-        // ログ保存とBLE通知
-        if((command & 0x02) != 0) {
-            int wlen = writeLog(&(context.writingLogContext[buffer[0]]), &buffer[2], buffer[1]);
-            senstickSensorControllerNotifyLogData();
-            // 書き込みサイズが指定と違う、つまりログがいっぱいだったら、ロギングの停止、ディスクフルフラグを立てる
-            // このメソッドは内部でflash_mailbox()を呼び出すので、再帰されても大丈夫なように、あらかじめメイルボックスをフラッシュしておく。
-            if( wlen != buffer[1]) {
-                do {
-                    err_code = app_mailbox_get(&m_mailbox, buffer);
-                } while(err_code == NRF_SUCCESS);
-                // ロギング停止
-                senstick_setControlCommand(sensorShouldSleep);
-                senstick_setDiskFull(true);    // ディスクフルフラグを立てる。
+        bool is_log_full = false;
+        if(tag == SAMPLE_RING_GAP_TAG) {
+            // 抜けたサンプルは、ログにギャップマーカーを書く
+            is_log_full = ! writeGapLog((sensor_device_t)p_data[0], readUInt16AsLittleEndian(&p_data[1]));
+        } else if(filterSample((sensor_device_t)tag, p_data)) {
+            // 間引くセンサーは、フィルタが出力したサンプルだけを、通知とログに渡す
+            const sensor_device_t device_type = (sensor_device_t)tag;
+            sensor_service_command_t command = context.sensorSetting[device_type].command;
+            // BLEリアルタイム通知
+            if((command & 0x01) != 0) {
+                sensor_notify_raw_data(device_type, p_data, length);
             }
+            // ログ保存とBLE通知
+            if((command & 0x02) != 0) {
+                is_log_full = ! writeSampleLog(device_type, p_data, length);
+                senstickSensorControllerNotifyLogData();
+            }
+        }
+        // 書き込みサイズが指定と違う、つまりログがいっぱいだったら、ロギングの停止、ディスクフルフラグを立てる
+        // このメソッドは内部でflash_ring_buffer()を呼び出すので、再帰されても大丈夫なように、あらかじめリングバッファを空にしておく。
+        if(is_log_full) {
+            ringBufferDiscard(&m_sample_ring);
+            // ロギング停止
+            senstick_setControlCommand(sensorShouldSleep);
+            senstick_setDiskFull(true);    // ディスクフルフラグを立てる。
+            continue;
         }
+        ringBufferRelease(&m_sample_ring);
     }
 
     // 処理時間表示
@@ -281,69 +541,801 @@ static void flash_mailbox(void)
     CRITICAL_REGION_ENTER();
     context.isDequeueTaskRunning = false;
     CRITICAL_REGION_EXIT();
+    // 残りは、タスクを積み直して処理する
+    if(ringBufferGetUsedSize(&m_sample_ring) > 0) {
+        scheduleDequeueTask();
+    }
 }
 
 static void sched_event_handler(void *p_event_data, uint16_t event_size)
 {
-    flash_mailbox();
+    flash_ring_buffer();
 }
 
-// Timer2 interrupt handler
-void TIMER2_IRQHandler(void)
+// サンプルを捨てて数えます。
+static void dropSample(int device_type)
 {
-    // clear event flag
-    NRF_TIMER2->EVENTS_COMPARE[0] = 0;
-    //  LOG("\nTIMER2_IRQHandler(), CC[0] %d", NRF_TIMER2->CC[0]);
+    context.droppedSampleCount[device_type]++;
+    if(context.pendingGapCount[device_type] < UINT16_MAX) {
+        context.pendingGapCount[device_type]++;
+    }
+}
+
+#if SAMPLE_RING_DECIMATION_ENABLED
+// 間引くセンサーのサンプルを、間引くならtrueを返します。使用量が高い水位を超えたら間引き始め、低い水位を下回ったら止める。
+static bool shouldDecimateSample(void)
+{
+    const uint16_t used = ringBufferGetUsedSize(&m_sample_ring);
+    if(used >= SAMPLE_RING_DECIMATION_HIGH_WATERMARK) {
+        context.isDecimating = true;
+    } else if(used < SAMPLE_RING_DECIMATION_LOW_WATERMARK) {
+        context.isDecimating = false;
+    }
+    if( ! context.isDecimating ) {
+        context.decimationPhase = 0;
+        return false;
+    }
+    context.decimationPhase = (context.decimationPhase + 1) % SAMPLE_RING_DECIMATION_FACTOR;
+    return (context.decimationPhase != 0);
+}
+#endif
+
+// リングバッファにセンサーデータを格納します。空きがなければ、サンプルを捨てて数える。
+// 前に抜けたサンプルがあれば、サンプルの前にギャップのレコードを入れる。ギャップのレコードが入らなければ、このサンプルも捨てる。
+static void enqueueSensorData(int device_type, const uint8_t *p_data, uint8_t length)
+{
+#if SAMPLE_RING_DECIMATION_ENABLED
+    if(device_type == context.decimatedSensor && shouldDecimateSample()) {
+        dropSample(device_type);
+        return;
+    }
+#endif
+    if(context.pendingGapCount[device_type] > 0) {
+        uint8_t *p_gap = ringBufferReserve(&m_sample_ring, SAMPLE_RING_GAP_TAG, SAMPLE_RING_GAP_LENGTH);
+        if(p_gap == NULL) {
+            dropSample(device_type);
+            return;
+        }
+        p_gap[0] = (uint8_t)device_type;
+        uint16ToByteArrayLittleEndian(&p_gap[1], context.pendingGapCount[device_type]);
+        ringBufferCommit(&m_sample_ring);
+        context.pendingGapCount[device_type] = 0;
+    }
+    
+    uint8_t *p_record = ringBufferReserve(&m_sample_ring, (uint8_t)device_type, length);
+    if(p_record == NULL) {
+        dropSample(device_type);
+        return;
+    }
+    memcpy(p_record, p_data, length);
+    ringBufferCommit(&m_sample_ring);
+}
+
+// 過負荷の計数をクリアし、間引くセンサー(動作するセンサーのうち、最も周期が短いもの)を決めます。サンプリングの開始時に呼び出す。
+static void resetOverloadCounters(void)
+{
+    memset(context.droppedSampleCount, 0, sizeof(context.droppedSampleCount));
+    memset(context.pendingGapCount,    0, sizeof(context.pendingGapCount));
+    context.isDecimating    = false;
+    context.decimationPhase = 0;
+    context.decimatedSensor = -1;
+#if SAMPLE_RING_DECIMATION_ENABLED
+    uint32_t shortest_period_us = UINT32_MAX;
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        const uint32_t period_us = getSensorServiceSamplingPeriodUs(&(context.sensorSetting[i]));
+        if(context.isSensorAvailable[i] && (context.sensorSetting[i].command & 0x03) != 0 && period_us < shortest_period_us) {
+            shortest_period_us      = period_us;
+            context.decimatedSensor = i;
+        }
+    }
+#endif
+}
+
+// 間引きを使うセンサーに、フィルタを割り当てて初期化します。サンプリングの開始時に呼び出す。
+static void initSampleFilters(void)
+{
+    int count = 0;
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        const uint8_t decimation = getSensorServiceDecimation(&(context.sensorSetting[i]));
+        context.p_filters[i] = NULL;
+        if( ! context.isSensorAvailable[i] || (context.sensorSetting[i].command & 0x03) == 0 || decimation <= 1) {
+            continue;
+        }
+        ASSERT(count < SAMPLE_FILTER_POOL_SIZE);
+        context.p_filters[i] = &(context.filters[count++]);
+        sampleFilterInit(context.p_filters[i], m_p_sensor_bases[i]->filterChannelCount, decimation);
+    }
+}
+
+// 間引きを使うセンサーの数を返します。
+static int getNumberOfFilteredSensors(const sensor_service_setting_t *p_settings)
+{
+    int count = 0;
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        if((p_settings[i].command & 0x03) != 0 && getSensorServiceDecimation(&(p_settings[i])) > 1) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// ログに記録するサンプルの周期(ミリ秒)。間引くセンサーは、サンプリング周期 x 間引き。
+static samplingDurationType getLoggedSamplingDuration(const sensor_service_setting_t *p_setting)
+{
+    const uint64_t period_us = (uint64_t)getSensorServiceSamplingPeriodUs(p_setting) * getSensorServiceDecimation(p_setting);
+    return (samplingDurationType)MIN(period_us / 1000, INT16_MAX);
+}
+
+// センサー単体で、周期に対応できるかを返します。
+static bool isSupportedSamplingPeriod(sensor_device_t device_type, uint32_t period_us)
+{
+    const senstick_sensor_base_t *p_base = m_p_sensor_bases[device_type];
+    // 新しい値が得られる間隔、また1回の読み出しの時間より短い周期では、サンプルが周期に間に合わない
+    if(period_us < p_base->conversionLatencyUs || period_us < p_base->busTimeUs) {
+        return false;
+    }
+    // 加速度とジャイロの、TIMER_PERIOD_MSより短い周期は、9軸センサーのFIFOか周期読み出しでサンプリングする(NRF51では使わない)
+    if((device_type == AccelerationSensor || device_type == GyroSensor) && period_us < NINE_AXES_MIN_SAMPLING_DURATION_MS * 1000) {
+        return false;
+    }
+    return true;
+}
+
+// 設定全体の負荷を見積もります。
+static void estimateSamplingLoad(const sensor_service_setting_t *p_settings, sampling_load_t *p_load)
+{
+    uint32_t bus_us_per_s      = 0; // 1秒あたりにI2Cバスを占有する時間
+    uint32_t ring_bytes_per_s  = 0; // 1秒あたりにリングバッファに入るバイト数(ヘッダを含む)
+    uint32_t flash_bytes_per_s = 0; // 1秒あたりにログに書き込むバイト数
+    bool     is_batched        = false;
+    
+    // 9軸センサーでまとめて読み出すセンサーは、最も周期の短いものが読み出し1回分の時間を、他はデータの転送時間だけを使う
+    int      nine_axes_leader    = -1;
+    uint32_t nine_axes_period_us = UINT32_MAX;
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        const uint32_t period_us = getSensorServiceSamplingPeriodUs(&(p_settings[i]));
+        if(context.isSensorAvailable[i] && (p_settings[i].command & 0x03) != 0
+           && m_p_sensor_bases[i]->bus == sensorBus_twiNineAxes && period_us < nine_axes_period_us) {
+            nine_axes_period_us = period_us;
+            nine_axes_leader    = i;
+        }
+    }
+    
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        if( ! context.isSensorAvailable[i] || (p_settings[i].command & 0x03) == 0) {
+            continue;
+        }
+        const senstick_sensor_base_t *p_base = m_p_sensor_bases[i];
+        const uint32_t period_us = getSensorServiceSamplingPeriodUs(&(p_settings[i]));
+        if(p_base->bus == sensorBus_twiNineAxes && i != nine_axes_leader) {
+            bus_us_per_s += (uint32_t)((uint64_t)p_base->rawSensorDataSize * TWI_BYTE_TIME_NS * 1000 / period_us);
+        } else {
+            bus_us_per_s += (uint32_t)((uint64_t)p_base->busTimeUs * 1000000 / period_us);
+        }
+        ring_bytes_per_s += (uint32_t)((uint64_t)(1 + p_base->rawSensorDataSize) * 1000000 / period_us);
+        // 間引くセンサーは、間引いた後のサンプルだけを書き込む
+        if((p_settings[i].command & 0x02) != 0) {
+            flash_bytes_per_s += (uint32_t)((uint64_t)p_base->rawSensorDataSize * 1000000 / period_us / getSensorServiceDecimation(&(p_settings[i])));
+        }
+#ifdef NRF52
+        // TIMER_PERIOD_MSより短い周期の加速度とジャイロは、FIFOまたは周期読み出しで、NINE_AXES_FIFO_DRAIN_PERIOD_MSの分がまとめて届く
+        if((i == AccelerationSensor || i == GyroSensor) && period_us < TIMER_PERIOD_MS * 1000) {
+            is_batched = true;
+        }
+#endif
+    }
+    
+    p_load->busLoad = bus_us_per_s / 1000;
+    // ログはページ単位でプログラムし、セクターは先行してバックグラウンドで消去する
+    const uint64_t flash_busy_us_per_s = (uint64_t)flash_bytes_per_s * MX25L25635F_PAGE_PROGRAM_TYPICAL_US / MX25L25635F_PAGE_SIZE
+                                       + (uint64_t)flash_bytes_per_s * MX25L25635F_SECTOR_ERASE_TYPICAL_US / MX25L25635F_SECTOR_SIZE;
+    p_load->flashLoad = (uint32_t)(flash_busy_us_per_s / 1000);
+    const uint32_t stall_us    = ADMISSION_RING_STALL_US + (is_batched ? NINE_AXES_FIFO_DRAIN_PERIOD_MS * 1000 : 0);
+    const uint32_t burst_bytes = (uint32_t)((uint64_t)ring_bytes_per_s * stall_us / 1000000);
+    p_load->ringLoad = burst_bytes * 1000 / SAMPLE_RING_DECIMATION_HIGH_WATERMARK;
+}
+
+static bool isAdmissibleLoad(const sampling_load_t *p_load)
+{
+    return p_load->busLoad   <= ADMISSION_MAX_BUS_LOAD
+        && p_load->flashLoad <= ADMISSION_MAX_FLASH_LOAD
+        && p_load->ringLoad  <= ADMISSION_MAX_RING_LOAD;
+}
+
+// 上限までの余裕(1000分率)。超えていれば負の値。
+static int16_t getHeadroom(uint32_t limit, uint32_t load)
+{
+    return (int16_t)((int32_t)limit - (int32_t)MIN(load, INT16_MAX));
+}
+
+static void initCycleCounter(void)
+{
+#ifdef NRF52
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT       = 0;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+uint32_t senstickSensorControllerGetCycleCount(void)
+{
+#ifdef NRF52
+    return DWT->CYCCNT;
+#else // NRF51
+    return 0;
+#endif
+}
+
+// 割り込み処理の開始時刻start_cyclesから、処理時間を記録します。
+static void recordIsrProfile(isr_profile_t *p_profile, uint32_t start_cycles)
+{
+    const uint32_t cycles = senstickSensorControllerGetCycleCount() - start_cycles;
+    p_profile->count++;
+    p_profile->totalCycles += cycles;
+    p_profile->maxCycles    = MAX(p_profile->maxCycles, cycles);
+}
+
+static void logIsrProfile(const char *p_name, const isr_profile_t *p_profile)
+{
+    if(p_profile->count == 0) {
+        return;
+    }
+    NRF_LOG_PRINTF_DEBUG("%s: count:%d max:%d avg:%d cycles.\n", (uint32_t)p_name, p_profile->count, p_profile->maxCycles, (uint32_t)(p_profile->totalCycles / p_profile->count));
+}
+
+// センサーのデータを受け取るコールバック。TWIの完了割り込みから呼び出される。リングバッファに格納して、吐き出すタスクを積む。
+static void sensorDataCallback(sensor_device_t device_type, const uint8_t *p_data, uint8_t length)
+{
+    const uint32_t start_cycles = senstickSensorControllerGetCycleCount();
     
-    ret_code_t err_code;
-    uint8_t buffer[MAX_SENSOR_RAW_DATA_SIZE];
-    uint8_t mailbox_buffer[MAILBOX_ITEM_SIZE];
+    enqueueSensorData(device_type, p_data, length);
+    scheduleDequeueTask();
+    
+    recordIsrProfile(&(context.twiCallbackProfile), start_cycles);
+}
+
+// 最大公約数
+static uint32_t greatestCommonDivisor(uint32_t a, uint32_t b)
+{
+    while(b != 0) {
+        uint32_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// チップのサンプル(または周期読み出しのサンプル)が1つ進んだときに、センサーのサンプリング周期積算カウンタをその周期だけ進めます。
+// センサーの周期に達していればtrueを返します。
+static bool isNineAxesSampleDue(sensor_device_t device)
+{
+    if( ! context.isSampledByNineAxes[device]) {
+        return false;
+    }
+    const uint32_t period_us = getSensorServiceSamplingPeriodUs(&(context.sensorSetting[device]));
+    context.sensorSampling[device] += (context.nineAxesPeriodicReadUs > 0) ? context.nineAxesPeriodicReadUs : context.nineAxesPeriod * 1000;
+    if(context.sensorSampling[device] < period_us) {
+        return false;
+    }
+    context.sensorSampling[device] -= period_us;
+    return true;
+}
+
+// 9軸センサーのFIFO(または周期読み出し)で取得したサンプルを、リングバッファに格納します。格納すればtrueを返します。
+static bool enqueueNineAxesFifoSamples(const NineAxesFifoData_t *p_samples, uint8_t count)
+{
     bool did_enqueue = false;
     
+    for(int i = 0; i < count; i++) {
+        if(isNineAxesSampleDue(AccelerationSensor)) {
+            enqueueSensorData(AccelerationSensor, (const uint8_t *)&(p_samples[i].acceleration), sizeof(AccelerationData_t));
+            did_enqueue = true;
+        }
+        if(isNineAxesSampleDue(GyroSensor)) {
+            enqueueSensorData(GyroSensor, (const uint8_t *)&(p_samples[i].rotationRate), sizeof(RotationRateData_t));
+            did_enqueue = true;
+        }
+        // 地磁気は、周期読み出しに含めたときだけ
+        if(isNineAxesSampleDue(MagneticFieldSensor)) {
+            enqueueSensorData(MagneticFieldSensor, (const uint8_t *)&(p_samples[i].magneticField), sizeof(MagneticFieldData_t));
+            did_enqueue = true;
+        }
+    }
+    return did_enqueue;
+}
+
+// FIFOの非同期の読み出しのハンドラ。TWIの完了割り込みから呼び出される。
+static void nineAxesFifoHandler(const NineAxesFifoData_t *p_samples, uint8_t count)
+{
+    const uint32_t start_cycles = senstickSensorControllerGetCycleCount();
+    
+    if(enqueueNineAxesFifoSamples(p_samples, count)) {
+        scheduleDequeueTask();
+    }
+    
+    recordIsrProfile(&(context.twiCallbackProfile), start_cycles);
+}
+
+#ifdef NRF52
+// 周期読み出しのハンドラ。TIMER4の割り込みから、バッチごとに呼び出される。
+static void nineAxesPeriodicReadHandler(const NineAxesFifoData_t *p_samples, uint8_t count)
+{
+    const uint32_t start_cycles = senstickSensorControllerGetCycleCount();
+    
+    if(enqueueNineAxesFifoSamples(p_samples, count)) {
+        scheduleDequeueTask();
+    }
+    
+    recordIsrProfile(&(context.periodicReadIsrProfile), start_cycles);
+}
+
+// 加速度とジャイロを、ハードウェアの周期読み出しで取得します。開始すればtrueを返します。
+// 動作中の9軸センサー(加速度、ジャイロ、地磁気)を、すべて周期読み出しで取得できるときだけ使う。周期読み出しの間、twi0は他の読み出しに使えないため。
+// 姿勢はTIMER2からstartNineAxesMotionRead()で読み出すので、姿勢が動作中なら使わない。
+//  - 加速度とジャイロに、ミリ秒の倍数でない周期があり、両方の周期の公約数が、TWI_PERIODIC_READ_MIN_PERIOD_US以上、TIMER_PERIOD_MSより短い。
+//  - 地磁気の周期は、その公約数の倍数(地磁気はI2Cマスターで、同じ読み出しに含める)。
+static bool startNineAxesPeriodicRead(void)
+{
+    const sensor_device_t devices[] = {AccelerationSensor, GyroSensor, MagneticFieldSensor};
+    bool is_active[3];
+    bool has_microsecond_period = false;
+    uint32_t period_us = 0;
+    
+    for(int i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+        const sensor_service_setting_t *p_setting = &(context.sensorSetting[devices[i]]);
+        is_active[i] = context.isSensorAvailable[devices[i]] && (p_setting->command & 0x03) != 0;
+        if(is_active[i] && devices[i] != MagneticFieldSensor) {
+            const uint32_t sensor_period_us = getSensorServiceSamplingPeriodUs(p_setting);
+            period_us = (period_us == 0) ? sensor_period_us : greatestCommonDivisor(period_us, sensor_period_us);
+            has_microsecond_period |= (p_setting->samplingPeriodUs != 0);
+        }
+    }
+    if( ! has_microsecond_period || period_us < TWI_PERIODIC_READ_MIN_PERIOD_US || period_us >= TIMER_PERIOD_MS * 1000) {
+        return false;
+    }
+    if(context.isSensorAvailable[OrientationSensor] && (context.sensorSetting[OrientationSensor].command & 0x03) != 0) {
+        return false;
+    }
+    if(is_active[2] && (getSensorServiceSamplingPeriodUs(&(context.sensorSetting[MagneticFieldSensor])) % period_us) != 0) {
+        return false;
+    }
+    
+    // バッチのサンプル数は、NINE_AXES_PERIODIC_READ_BATCH_PERIOD_USに入る数(周期読み出しのリングの大きさまで)
+    const uint8_t batch_size = (uint8_t)MAX(1, MIN(NINE_AXES_PERIODIC_READ_BATCH_PERIOD_US / period_us, TWI_PERIODIC_READ_MAX_BATCH_SIZE));
+    context.nineAxesPeriodicReadUs = period_us;
+    for(int i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+        context.isSampledByNineAxes[devices[i]] = is_active[i];
+        context.sensorSampling[devices[i]]      = 0;
+    }
+    if( ! startNineAxesSensorPeriodicRead(is_active[2], period_us, batch_size, nineAxesPeriodicReadHandler) ) {
+        context.nineAxesPeriodicReadUs = 0;
+        memset(context.isSampledByNineAxes, 0, sizeof(context.isSampledByNineAxes));
+        return false;
+    }
+    return true;
+}
+#endif
+
+// 9軸センサーのFIFOに溜まったサンプルを、完了まで待って読み出し、リングバッファに格納します。サンプリングの停止時に使う。
+static void drainNineAxesFifo(void)
+{
+    NineAxesFifoData_t samples[NINE_AXES_FIFO_MAX_FRAMES];
+    
+    uint8_t count = getNineAxesSensorFifoData(samples, NINE_AXES_FIFO_MAX_FRAMES);
+    enqueueNineAxesFifoSamples(samples, count);
+}
+
+// 9軸センサーのデータレディ割り込みハンドラ。チップの1サンプルごとに呼び出される。読み出しをTWIのキューに積んで、すぐに返る。
+static void nineAxesDataReadyHandler(void)
+{
+    const uint32_t start_cycles = senstickSensorControllerGetCycleCount();
+    const sensor_device_t devices[] = {AccelerationSensor, GyroSensor, MagneticFieldSensor};
+    
+    for(int i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+        if(isNineAxesSampleDue(devices[i])) {
+            samplingDurationType wakeup_ms;
+            (m_p_sensor_bases[devices[i]]->requestSensorDataHandler)(0, sensorDataCallback, &wakeup_ms);
+        }
+    }
+    // 要求した加速度とジャイロ(と地磁気)を、1回の読み出しで取得する
+    startNineAxesMotionRead();
+    
+    recordIsrProfile(&(context.dataReadyIsrProfile), start_cycles);
+}
+
+// 加速度とジャイロを、9軸センサーのチップのサンプリングに合わせて取得します。
+// チップは両方の周期の公約数の周期でサンプリングし、各センサーの周期ごとにサンプルを取り出す。サンプルの間隔はチップのサンプリング周期で決まる。
+//  - チップの周期がTIMER_PERIOD_MSより短い: FIFOに溜めて、TIMER2でNINE_AXES_FIFO_DRAIN_PERIOD_MSごとにまとめて読み出す。
+//  - それ以上: INTピンのデータレディ割り込みで、サンプルごとに読み出す。
+// チップの周期(255ミリ秒まで)にできる公約数がなければ、またはミリ秒の倍数でない周期のセンサーは、TIMER2で読み出す。
+// データレディ割り込みで読み出すとき、地磁気の周期がチップの周期の倍数なら、地磁気も同じ割り込みで取得する。
+// NRF52で、ミリ秒の倍数でない短い周期は、ハードウェアの周期読み出しで取得する(startNineAxesPeriodicRead())。
+static void startNineAxesSampling(void)
+{
+    const sensor_device_t devices[] = {AccelerationSensor, GyroSensor};
+    bool is_active[2];
+    uint16_t period = 0;
+    
+    context.nineAxesPeriod         = 0;
+    context.isNineAxesFifoMode     = false;
+    context.nineAxesPeriodicReadUs = 0;
+#ifdef NRF52
+    if(startNineAxesPeriodicRead()) {
+        return;
+    }
+#endif
+    
+    for(int i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+        const sensor_service_setting_t *p_setting = &(context.sensorSetting[devices[i]]);
+        is_active[i] = context.isSensorAvailable[devices[i]] && (p_setting->command & 0x03) != 0 && p_setting->samplingPeriodUs == 0;
+        if(is_active[i]) {
+            period = (period == 0) ? p_setting->samplingDuration : greatestCommonDivisor(period, p_setting->samplingDuration);
+        }
+    }
+    
+    // チップの周期は、公約数そのもの(TIMER_PERIOD_MSより短いとき)、またはTIMER_PERIOD_MS以上255以下の、最大の約数。
+    if(period > 0 && period < TIMER_PERIOD_MS) {
+        context.nineAxesPeriod = period;
+    } else {
+        for(uint16_t p = MIN(period, 255); p >= TIMER_PERIOD_MS; p--) {
+            if((period % p) == 0) {
+                context.nineAxesPeriod = p;
+                break;
+            }
+        }
+    }
+    context.isNineAxesFifoMode = (context.nineAxesPeriod > 0) && (context.nineAxesPeriod < TIMER_PERIOD_MS);
+    for(int i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+        context.isSampledByNineAxes[devices[i]] = is_active[i] && (context.nineAxesPeriod > 0);
+        context.sensorSampling[devices[i]]      = 0;
+    }
+    
+    if(context.nineAxesPeriod == 0) {
+        return;
+    }
+    // 地磁気の周期がチップの周期の倍数なら、地磁気もデータレディ割り込みで、加速度とジャイロと同じサンプルから取得する。
+    const sensor_service_setting_t *p_magnetic_setting = &(context.sensorSetting[MagneticFieldSensor]);
+    if( ! context.isNineAxesFifoMode && context.isSensorAvailable[MagneticFieldSensor] && (p_magnetic_setting->command & 0x03) != 0
+       && p_magnetic_setting->samplingPeriodUs == 0 && (p_magnetic_setting->samplingDuration % context.nineAxesPeriod) == 0) {
+        context.isSampledByNineAxes[MagneticFieldSensor] = true;
+        context.sensorSampling[MagneticFieldSensor]      = 0;
+    }
+    if(context.isNineAxesFifoMode) {
+        setNineAxesSensorFifo(is_active[0], is_active[1], context.nineAxesPeriod);
+    } else {
+        setNineAxesSensorDataReady(context.nineAxesPeriod, nineAxesDataReadyHandler);
+    }
+}
+
+// チップのサンプリングを止めます。FIFOに残ったサンプルは読み出します。
+static void stopNineAxesSampling(void)
+{
+#ifdef NRF52
+    if(context.nineAxesPeriodicReadUs > 0) {
+        // 積んである他のセンサーの読み出しを終えてから止める。残りのサンプルは、ハンドラからリングバッファに入る。
+        twiWaitForIdle();
+        const uint32_t missed_count = stopNineAxesSensorPeriodicRead();
+        if(missed_count > 0) {
+            NRF_LOG_PRINTF_DEBUG("nine axes periodic read: %d missed triggers.\n", missed_count);
+        }
+        context.nineAxesPeriodicReadUs = 0;
+        memset(context.isSampledByNineAxes, 0, sizeof(context.isSampledByNineAxes));
+        return;
+    }
+#endif
+    if(context.nineAxesPeriod == 0) {
+        return;
+    }
+    if(context.isNineAxesFifoMode) {
+        // 積んである非同期の読み出しを終えてから、残りを読み出す。
+        twiWaitForIdle();
+        drainNineAxesFifo();
+        setNineAxesSensorFifo(false, false, 0);
+    } else {
+        setNineAxesSensorDataReady(0, NULL);
+    }
+    context.nineAxesPeriod = 0;
+    memset(context.isSampledByNineAxes, 0, sizeof(context.isSampledByNineAxes));
+}
+
+// サンプリングクロック(TIMER2、またはRTC2)のカウンタを読み、ソフトウェアの時刻(マイクロ秒)を進めます。TIMER2のカウンタはCC[1]にキャプチャして読む。
+static uint32_t updateTimerNow(void)
+{
+#ifdef NRF52
+    if(context.isRtcClock) {
+        const uint32_t counter = NRF_RTC2->COUNTER;
+        const uint64_t scaled  = (uint64_t)((counter - context.timerLastCounter) & RTC_COUNTER_MASK) * 1000000 + context.clockRemainder;
+        context.timerNowUs      += (uint32_t)(scaled / RTC_FREQUENCY);
+        context.clockRemainder   = (uint32_t)(scaled % RTC_FREQUENCY);
+        context.timerLastCounter = counter;
+        return context.timerNowUs;
+    }
+#endif
+    NRF_TIMER2->TASKS_CAPTURE[1] = 1;
+    const uint32_t counter = NRF_TIMER2->CC[1];
+    context.timerNowUs      += (counter - context.timerLastCounter) & TIMER_COUNTER_MASK;
+    context.timerLastCounter = counter;
+    return context.timerNowUs;
+}
+
+uint32_t senstickSensorControllerGetSamplingTimeUs(void)
+{
+    return context.timerNowUs;
+}
+
+// RTC2で数えられるかを返します。TIMER2で読み出すセンサーの周期が、すべてRTC_MIN_SAMPLING_PERIOD_US以上であること。
+static bool canUseRtcClock(void)
+{
+#ifdef NRF52
     for(int i=0 ; i < NUM_OF_SENSORS; i++) {
-        // データ取得および通知とロギング対象?
-        sensor_service_command_t command = context.sensorSetting[i].command;
-        if(!(context.isSensorAvailable[i] && (command & 0x03) != 0)) {
+        if(context.isSampledByTimer[i] && getSensorServiceSamplingPeriodUs(&(context.sensorSetting[i])) < RTC_MIN_SAMPLING_PERIOD_US) {
+            return false;
+        }
+    }
+    return true;
+#else // NRF51
+    return false;
+#endif
+}
+
+// サンプリングクロックを、時刻0からスタートします。
+static void startSamplingClock(void)
+{
+    context.isRtcClock       = canUseRtcClock();
+    context.timerNowUs       = 0;
+    context.timerLastCounter = 0;
+    context.clockRemainder   = 0;
+#ifdef NRF52
+    if(context.isRtcClock) {
+        NRF_RTC2->TASKS_CLEAR = 1;
+        NRF_RTC2->TASKS_START = 1;
+        return;
+    }
+#endif
+    NRF_TIMER2->TASKS_CLEAR = 1;
+    NRF_TIMER2->TASKS_START = 1;
+}
+
+static void stopSamplingClock(void)
+{
+    NRF_TIMER2->TASKS_SHUTDOWN = 1;
+#ifdef NRF52
+    NRF_RTC2->TASKS_STOP = 1;
+#endif
+}
+
+#if SAMPLING_PHASE_STAGGER_ENABLED
+// 周期と位相の決まる2つのサンプルの列の、サンプルの時刻の最小の距離(マイクロ秒)。時刻の差は、周期の最大公約数を法として位相の差になる。
+static uint32_t getPhaseDistance(uint32_t period_a, uint32_t phase_a, uint32_t period_b, uint32_t phase_b)
+{
+    const uint32_t gcd = greatestCommonDivisor(period_a, period_b);
+    const uint32_t d   = (phase_a % gcd + gcd - phase_b % gcd) % gcd;
+    return MIN(d, gcd - d);
+}
+
+// TIMER2で読み出すセンサーの位相(サンプリングの開始からの、サンプルの時刻の周期の中の位置)を決めます。
+// バスを長く使うセンサーから順に、既に決めたサンプルの列との最小の距離が最大になる位相を選ぶ。同じ距離なら小さい位相。
+// 9軸センサーのデータレディ割り込みと、TIMER2で読み出す加速度、ジャイロ、地磁気(1回の読み出しにまとめる)は、位相0に固定する。
+static void assignSamplingPhases(uint32_t *p_phases)
+{
+    uint32_t periods[NUM_OF_SENSORS + 2];
+    uint32_t costs[NUM_OF_SENSORS + 2];
+    bool     is_placed[NUM_OF_SENSORS + 2];
+    bool     is_target[NUM_OF_SENSORS + 2];
+    uint32_t phases[NUM_OF_SENSORS + 2];
+    const int data_ready_slot = NINE_AXES_FIFO_DRAIN_SLOT + 1;
+    
+    memset(is_placed, 0, sizeof(is_placed));
+    memset(is_target, 0, sizeof(is_target));
+    memset(phases,    0, sizeof(phases));
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        if( ! context.isSampledByTimer[i]) {
             continue;
         }
-        // 時間を増分
-        context.sensorSampling[i] += TIMER_PERIOD_MS;
-        // しきい値を超えていたら
-        if(context.sensorSampling[i] >= context.sensorSetting[i].samplingDuration) {
-            // データ取得
-            // センサ取得トリガー時間からの差分時間。
-            samplingDurationType duration = context.sensorSampling[i] - context.sensorSetting[i].samplingDuration;
-            const senstick_sensor_base_t *ptr = m_p_sensor_bases[i];
-            uint8_t length = (ptr->getSensorDataHandler)(buffer, duration);
-            // データが取得できれば、メールボックスにデータを保存して、次のサンプリングに。
-            if( length > 0) {
-                // 次のサンプリング時間。
-                context.sensorSampling[i] -= context.sensorSetting[i].samplingDuration;
-                // メールボックスに格納
-                did_enqueue       = true;
-                mailbox_buffer[0] = i;
-                mailbox_buffer[1] = length;
-                memcpy(&mailbox_buffer[2], buffer, length);
-                err_code = app_mailbox_put (&m_mailbox, mailbox_buffer);
-                APP_ERROR_CHECK(err_code);
+        periods[i] = getSensorServiceSamplingPeriodUs(&(context.sensorSetting[i]));
+        costs[i]   = m_p_sensor_bases[i]->busTimeUs;
+        if(m_p_sensor_bases[i]->bus == sensorBus_twiNineAxes) {
+            is_placed[i] = true;
+        } else {
+            is_target[i] = true;
+        }
+    }
+    // FIFOの読み出しは、どのセンサーよりもバスを長く使う
+    if(context.isSampledByTimer[NINE_AXES_FIFO_DRAIN_SLOT]) {
+        periods[NINE_AXES_FIFO_DRAIN_SLOT]   = NINE_AXES_FIFO_DRAIN_PERIOD_MS * 1000;
+        costs[NINE_AXES_FIFO_DRAIN_SLOT]     = UINT32_MAX;
+        is_target[NINE_AXES_FIFO_DRAIN_SLOT] = true;
+    }
+    if(context.nineAxesPeriod > 0 && ! context.isNineAxesFifoMode && context.nineAxesPeriodicReadUs == 0) {
+        periods[data_ready_slot]   = (uint32_t)context.nineAxesPeriod * 1000;
+        is_placed[data_ready_slot] = true;
+    }
+    
+    while(true) {
+        // 位相を決めていないうちで、バスを最も長く使うもの
+        int target = -1;
+        for(int i = 0; i <= NINE_AXES_FIFO_DRAIN_SLOT; i++) {
+            if(is_target[i] && ! is_placed[i] && (target < 0 || costs[i] > costs[target])) {
+                target = i;
+            }
+        }
+        if(target < 0) {
+            break;
+        }
+        const uint32_t period = periods[target];
+        const uint32_t step   = CEIL_DIV(CEIL_DIV(period, SAMPLING_PHASE_MAX_CANDIDATES), SAMPLING_PHASE_STEP_US) * SAMPLING_PHASE_STEP_US;
+        uint32_t best_phase    = 0;
+        uint32_t best_distance = 0;
+        for(uint32_t phase = 0; phase < period; phase += step) {
+            uint32_t distance = UINT32_MAX;
+            for(int i = 0; i <= data_ready_slot; i++) {
+                if(is_placed[i]) {
+                    distance = MIN(distance, getPhaseDistance(period, phase, periods[i], phases[i]));
+                }
+            }
+            if(phase == 0 || distance > best_distance) {
+                best_phase    = phase;
+                best_distance = distance;
             }
         }
+        phases[target]    = best_phase;
+        is_placed[target] = true;
     }
-    // メールボックスに何かしらデータが入っている、かつ、タスクにメールボックス吐き出すがないならば、タスクを積む。
+    memcpy(p_phases, phases, sizeof(uint32_t) * (NUM_OF_SENSORS + 1));
+}
+#endif
+
+// TIMER2で読み出すセンサーを決め、最初のサンプルの時刻を設定します。TIMER2が必要ならtrueを返します。
+// チップのサンプリングで取得するセンサーだけなら、TIMER2は止めておく。
+static bool startTimerSampling(uint32_t now_us)
+{
+    bool is_required = false;
+    
+    for(int i=0 ; i < NUM_OF_SENSORS; i++) {
+        context.isSampledByTimer[i] = context.isSensorAvailable[i] && (context.sensorSetting[i].command & 0x03) != 0 && !context.isSampledByNineAxes[i];
+        is_required |= context.isSampledByTimer[i];
+    }
+    context.isSampledByTimer[NINE_AXES_FIFO_DRAIN_SLOT] = (context.nineAxesPeriod > 0) && context.isNineAxesFifoMode;
+    is_required |= context.isSampledByTimer[NINE_AXES_FIFO_DRAIN_SLOT];
+    
+    // 最初のサンプルは、位相が0なら1周期後、そうでなければ位相の時刻
+    uint32_t phases[NUM_OF_SENSORS + 1];
+#if SAMPLING_PHASE_STAGGER_ENABLED
+    assignSamplingPhases(phases);
+#else
+    memset(phases, 0, sizeof(phases));
+#endif
+    for(int i=0 ; i <= NINE_AXES_FIFO_DRAIN_SLOT; i++) {
+        const uint32_t period_us = (i == NINE_AXES_FIFO_DRAIN_SLOT) ? NINE_AXES_FIFO_DRAIN_PERIOD_MS * 1000 : getSensorServiceSamplingPeriodUs(&(context.sensorSetting[i]));
+        context.samplingDeadlineUs[i] = now_us + ((phases[i] == 0) ? period_us : phases[i]);
+        context.samplingWakeupUs[i]   = context.samplingDeadlineUs[i];
+    }
+    
+    return is_required;
+}
+
+// 最も早い読み出しの時刻を、CC[0]に設定します。設定し終えた時点で、その時刻を過ぎていればfalseを返します。
+static bool setNextTimerCompare(void)
+{
+    const uint32_t now_us = updateTimerNow();
+    
+    uint32_t interval = TIMER_MAX_INTERVAL_US;
+    for(int i=0 ; i <= NINE_AXES_FIFO_DRAIN_SLOT; i++) {
+        if( ! context.isSampledByTimer[i]) {
+            continue;
+        }
+        const int32_t remaining = (int32_t)(context.samplingWakeupUs[i] - now_us);
+        if(remaining < (int32_t)interval) {
+            interval = MAX(remaining, TIMER_MIN_INTERVAL_US);
+        }
+    }
+    // 間隔をカウンタの単位にする。RTC2では切り上げて、時刻より前に割り込まないようにする。
+    const uint32_t start_counter = context.timerLastCounter;
+    uint32_t interval_count = interval;
+    uint32_t counter_mask   = TIMER_COUNTER_MASK;
+    uint32_t margin         = 0;
+#ifdef NRF52
+    if(context.isRtcClock) {
+        interval_count = MAX((uint32_t)(((uint64_t)interval * RTC_FREQUENCY + 999999) / 1000000), RTC_MIN_INTERVAL_TICKS);
+        counter_mask   = RTC_COUNTER_MASK;
+        margin         = RTC_MIN_INTERVAL_TICKS - 1;
+        NRF_RTC2->CC[0] = (start_counter + interval_count) & RTC_COUNTER_MASK;
+    } else {
+        NRF_TIMER2->CC[0] = (start_counter + interval_count) & TIMER_COUNTER_MASK;
+    }
+#else // NRF51
+    NRF_TIMER2->CC[0] = (start_counter + interval_count) & TIMER_COUNTER_MASK;
+#endif
+    
+    // 書き込む前にカウンタが追い越していれば(RTC2では、直前まで進んでいれば)、コンペアは次の一周まで発生しない
+    updateTimerNow();
+    return ((context.timerLastCounter - start_counter) & counter_mask) + margin < interval_count;
+}
+
+// 読み出しの時刻に達したセンサーの読み出しを、TWIのキューに積みます。
+static void serviceTimerSampling(uint32_t now_us)
+{
+    for(int i=0 ; i < NUM_OF_SENSORS; i++) {
+        if( ! context.isSampledByTimer[i] || (int32_t)(now_us - context.samplingWakeupUs[i]) < 0) {
+            continue;
+        }
+        // センサ取得トリガー時間からの差分時間(ミリ秒)。
+        const samplingDurationType duration = (samplingDurationType)((now_us - context.samplingDeadlineUs[i]) / 1000);
+        const senstick_sensor_base_t *ptr = m_p_sensor_bases[i];
+        samplingDurationType wakeup_ms = -1;
+        // 読み出しを開始できれば、次のサンプリングに。変換待ちなら、センサーが指定した変換の終わる時刻に呼び直す。
+        // 時刻の指定がなければ(TWIのキューがいっぱいなど)、しばらくして呼び直す。
+        if( (ptr->requestSensorDataHandler)(duration, sensorDataCallback, &wakeup_ms) ) {
+            context.samplingDeadlineUs[i] += getSensorServiceSamplingPeriodUs(&(context.sensorSetting[i]));
+            context.samplingWakeupUs[i]    = context.samplingDeadlineUs[i];
+        } else if(wakeup_ms >= 0) {
+            context.samplingWakeupUs[i]    = context.samplingDeadlineUs[i] + (uint32_t)wakeup_ms * 1000;
+        } else {
+            context.samplingWakeupUs[i]    = now_us + TIMER_PERIOD_MS * 1000;
+        }
+    }
+    
+    // 要求した加速度とジャイロを、1回の読み出しで取得する。2つのデータは同じサンプルになる。
+    startNineAxesMotionRead();
+    
+    // 9軸センサーのFIFOを、まとめて読み出す
+    if(context.isSampledByTimer[NINE_AXES_FIFO_DRAIN_SLOT] && (int32_t)(now_us - context.samplingWakeupUs[NINE_AXES_FIFO_DRAIN_SLOT]) >= 0) {
+        context.samplingWakeupUs[NINE_AXES_FIFO_DRAIN_SLOT] = now_us + NINE_AXES_FIFO_DRAIN_PERIOD_MS * 1000;
+        requestNineAxesSensorFifoData(nineAxesFifoHandler);
+    }
+}
+
+// リングバッファにデータが入っていて、リングバッファを吐き出すタスクがないならば、タスクを積む。
+static void scheduleDequeueTask(void)
+{
     CRITICAL_REGION_ENTER();
-    if( did_enqueue && !context.isDequeueTaskRunning) {
+    if( !context.isDequeueTaskRunning) {
         context.isDequeueTaskRunning = true;
-        err_code = app_sched_event_put(NULL, 0, sched_event_handler);
+        app_sched_event_put(NULL, 0, sched_event_handler);
     }
     CRITICAL_REGION_EXIT();
 }
 
+// サンプリングクロックのコンペア割り込みの処理。
+// センサーの読み出しはTWIのキューに積むだけで、I2Cの転送を待たない。データはTWIの完了割り込みから、sensorDataCallback()でリングバッファに格納される。
+static void handleSamplingClockInterrupt(void)
+{
+    const uint32_t start_cycles = senstickSensorControllerGetCycleCount();
+    
+    // 次のコンペアを設定するまでに、次の読み出しの時刻を過ぎていれば、続けて処理する。
+    do {
+        serviceTimerSampling(updateTimerNow());
+    } while( ! setNextTimerCompare());
+    
+    recordIsrProfile(&(context.timerIsrProfile), start_cycles);
+}
+
+// Timer2 interrupt handler
+void TIMER2_IRQHandler(void)
+{
+    // clear event flag
+    NRF_TIMER2->EVENTS_COMPARE[0] = 0;
+    handleSamplingClockInterrupt();
+}
+
+#ifdef NRF52
+// RTC2 interrupt handler
+void RTC2_IRQHandler(void)
+{
+    NRF_RTC2->EVENTS_COMPARE[0] = 0;
+    handleSamplingClockInterrupt();
+}
+#endif
+
 static void startLogging(uint8_t new_log_id)
 {
+    // 記録中であることを、ログのヘッダより先に記録する。記録中にリセットされたら、起動時に従来の方法でマウントして、ログを復旧する。
+    writeSuperblock(new_log_id, false, true);
+    
     // ログを開き、メタデータを、先頭要素として書き込み。
     for(int i=0 ; i < NUM_OF_SENSORS; i++) {
-        createLog(&(context.writingLogContext[i]), new_log_id,
-                  context.sensorSetting[i].samplingDuration, context.sensorSetting[i].measurementRange,
+        createLog(&(context.writingLogContext[i]), context.logWriteBuffer[i], new_log_id,
+                  getLoggedSamplingDuration(&(context.sensorSetting[i])), context.sensorSetting[i].measurementRange,
                   &(m_p_sensor_bases[i]->address_info));
     }
 }
@@ -352,6 +1344,7 @@ static void stopLogging(void)
 {
     for(int i=0 ; i < NUM_OF_SENSORS; i++) {
         closeLog(&(context.writingLogContext[i]));
+        context.dataEndPosition[i] = context.writingLogContext[i].header.startPosition + context.writingLogContext[i].header.size;
     }
     
     // 読込中のがいたら、それを書き込みログから読み込みログに切り替える。
@@ -390,21 +1383,59 @@ static void setSensorShoudlWork(bool shouldWakeup, bool shouldLogging, uint8_t n
         if( shouldLogging ) {
             startLogging(new_log_id);
         }
-        // タイマーをスタート
-        NRF_TIMER2->TASKS_CLEAR = 1;
-        NRF_TIMER2->CC[0]       = TIMER_PERIOD_MS * 1000; // prescalerは1us。1msec = 1,000us
-        NRF_TIMER2->TASKS_START = 1;
+        // 割り込み処理時間の計測をクリア
+        memset(&(context.timerIsrProfile),     0, sizeof(isr_profile_t));
+        memset(&(context.dataReadyIsrProfile), 0, sizeof(isr_profile_t));
+        memset(&(context.twiCallbackProfile),  0, sizeof(isr_profile_t));
+        memset(&(context.periodicReadIsrProfile), 0, sizeof(isr_profile_t));
+        memset(&(context.filterProfile), 0, sizeof(isr_profile_t));
+        ringBufferClearHighWaterMark(&m_sample_ring);
+        resetOverloadCounters();
+        initSampleFilters();
+        sampling_load_t load;
+        estimateSamplingLoad(context.sensorSetting, &load);
+        NRF_LOG_PRINTF_DEBUG("sampling load: bus %d, flash %d, ring %d permille.\n", load.busLoad, load.flashLoad, load.ringLoad);
+        // 加速度とジャイロのサンプリングをスタート
+        startNineAxesSampling();
+        // タイマーをスタート。チップのデータレディ割り込みだけで足りるなら、タイマーは動かさない。
+        if(startTimerSampling(0)) {
+            startSamplingClock();
+            setNextTimerCompare();
+        }
     } else {
         // タイマーをシャットダウン
-        NRF_TIMER2->TASKS_SHUTDOWN = 1;
-        // メールボックスをフラッシュ。
-        flash_mailbox();
+        stopSamplingClock();
+        // 加速度とジャイロのサンプリングを止める。FIFOに残ったサンプルは読み出す。
+        stopNineAxesSampling();
+        // 積んであるセンサーの読み出しの完了を待つ。完了したデータはリングバッファに入る。
+        twiWaitForIdle();
+        logIsrProfile(context.isRtcClock ? "RTC2" : "TIMER2", &(context.timerIsrProfile));
+        logIsrProfile("data ready", &(context.dataReadyIsrProfile));
+        logIsrProfile("twi callback", &(context.twiCallbackProfile));
+        logIsrProfile("periodic read", &(context.periodicReadIsrProfile));
+        NRF_LOG_PRINTF_DEBUG("sample ring buffer: max %d of %d bytes.\n", ringBufferGetHighWaterMark(&m_sample_ring), SAMPLE_RING_BUFFER_SIZE);
+        for(int i = 0; i < NUM_OF_SENSORS; i++) {
+            if(context.droppedSampleCount[i] > 0) {
+                NRF_LOG_PRINTF_DEBUG("sensor %d: %d samples dropped.\n", i, context.droppedSampleCount[i]);
+            }
+        }
+        // リングバッファをフラッシュ。
+        flash_ring_buffer();
+        logIsrProfile("sample filter", &(context.filterProfile));
+        // 最後に捨てたサンプルは、次のサンプルがないのでリングバッファに入っていない。閉じる前にギャップマーカーを書く。
+        for(int i = 0; i < NUM_OF_SENSORS; i++) {
+            if(shouldLogging && context.pendingGapCount[i] > 0 && ! writeGapLog((sensor_device_t)i, context.pendingGapCount[i])) {
+                senstick_setDiskFull(true);
+            }
+            context.pendingGapCount[i] = 0;
+        }
         // ログを閉じる
         if(shouldLogging) {
             stopLogging();
         }
         // センサ設定情報の永続化処理
         saveSensorSetting();
+        writeSuperblock(new_log_id, senstick_isDiskFull(), false);
         // センサーの電源を落とす
         setSensorPower(false);
     }
@@ -433,17 +1464,32 @@ static void init_timer(void)
     
     // TIMERは、16MHzのHCLKをソースにする。分周比は2^x。もしもソースが1MHz以下の場合は、消費電流が低減される。
     NRF_TIMER2->MODE        = TIMER_MODE_MODE_Timer;
-    NRF_TIMER2->BITMODE     = TIMER_BITMODE_BITMODE_16Bit << TIMER_BITMODE_BITMODE_Pos;
+    NRF_TIMER2->BITMODE     = TIMER_BITMODE << TIMER_BITMODE_BITMODE_Pos;
     NRF_TIMER2->PRESCALER   = TIMER_PRESCALERS_1US;
     
-    // Set a shortcut register to clear a counter register by a compare match event.
-    NRF_TIMER2->SHORTS = (TIMER_SHORTS_COMPARE0_CLEAR_Enabled << TIMER_SHORTS_COMPARE0_CLEAR_Pos);
+    // カウンタはクリアせずに回し続ける。サンプリングの時刻は、CC[0]をその都度設定する。
+    NRF_TIMER2->SHORTS = 0;
     
     // Interrupt setup. Enable interuptions by CC0;
     NRF_TIMER2->INTENSET = (TIMER_INTENSET_COMPARE0_Enabled << TIMER_INTENSET_COMPARE0_Pos);
     
     // タイマーをシャットダウン
     NRF_TIMER2->TASKS_SHUTDOWN = 1;    
+
+#ifdef NRF52
+    // RTC2はLFCLKをソースにする。LFCLKはSoftDeviceが動かしている。分周なしで32.768kHz。
+    err_code = sd_nvic_ClearPendingIRQ(RTC2_IRQn);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_SetPriority(RTC2_IRQn, APP_IRQ_PRIORITY_HIGH);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_EnableIRQ(RTC2_IRQn);
+    APP_ERROR_CHECK(err_code);
+    
+    NRF_RTC2->TASKS_STOP = 1;
+    NRF_RTC2->PRESCALER  = 0;
+    NRF_RTC2->EVTENSET   = RTC_EVTENSET_COMPARE0_Msk;
+    NRF_RTC2->INTENSET   = RTC_INTENSET_COMPARE0_Msk;
+#endif
 }
 
 /**
@@ -451,8 +1497,6 @@ static void init_timer(void)
  */
 ret_code_t initSenstickSensorController(uint8_t uuid_type)
 {
-    ret_code_t err_code;
-    
     // 初期化
     memset(&context, 0, sizeof(seenstick_sensor_controller_context_t));
     // 設定、周期を200ミリ秒に初期化。
@@ -461,9 +1505,11 @@ ret_code_t initSenstickSensorController(uint8_t uuid_type)
     }
     // 永続化していたデフォルト設定値を読み込み
     loadSensorSetting();
+    clearDataEndPosition();
     
     // タイマーの初期化
     init_timer();
+    initCycleCounter();
     
     // センサの初期化と、配列を初期化。初期化の成否は、センサ有効フラグに収める。
     for(int i =0; i < NUM_OF_SENSORS; i++) {
@@ -478,14 +1524,19 @@ ret_code_t initSenstickSensorController(uint8_t uuid_type)
     for(int i=0; i < NUM_OF_SENSORS; i++) {
         // 初期化に失敗したセンサーのサービスは構築しない
 //        if( context.isSensorAvailable[i] ) {
+#ifdef NRF51
+            // 姿勢はNRF52だけ。GATTサーバのメモリが足りないので、姿勢のサービスは構築しない。
+            if(i == OrientationSensor) {
+                continue;
+            }
+#endif
             ret_code_t err_code = initSensorService(&(context.services[i]), uuid_type, (sensor_device_t)i);
             APP_ERROR_CHECK(err_code);
 //        }
     }
 
-    // メールボックスを用意
-    err_code = app_mailbox_create(&m_mailbox);
-    APP_ERROR_CHECK(err_code);
+    // リングバッファを用意
+    ringBufferInit(&m_sample_ring);
     
     return NRF_SUCCESS;
 }
@@ -521,7 +1572,7 @@ uint8_t senstickSensorControllerGetNumOfLoggingReadySensor(void)
 uint8_t senstickSensorControllerReadSetting(sensor_device_t device_type, uint8_t *p_buffer, uint8_t length)
 {
     ASSERT(device_type < NUM_OF_SENSORS);
-    ASSERT(length >= 6);
+    ASSERT(length >= SENSOR_SERVICE_SETTING_MAX_SIZE);
     return serializesensor_service_setting(p_buffer, &(context.sensorSetting[device_type]));
 }
 
@@ -531,23 +1582,42 @@ uint32_t readSampleCount(sensor_device_t device_type)
     const senstick_sensor_base_t *p_base = m_p_sensor_bases[device_type];
     uint8_t log_count = senstick_getCurrentLogCount();
     
-    if(log_count == 0) { // ログがない, すべて空いている
-        return p_base->address_info.size / p_base->rawSensorDataSize;
+    // 末尾のログの終端位置を求める。書き込み中であればログコンテキストから、停止中であればスーパーブロックに記録する終端位置を使う。
+    // ログがなければ、ストリームは空。
+    uint32_t data_end_position = 0;
+    if(log_count > 0) {
+        data_end_position = context.dataEndPosition[device_type];
     }
-    
-    // 最後のログヘッダを読みだし、サイズを求める
-
-    // ログコンテキストを読みだす。書き込み中であればそれをコピー。停止中であれば末尾のログコンテキストを読みだす。
-    log_context_t log_context;
     if(context.isSensorWorking) {
-        log_context = context.writingLogContext[device_type];
-    } else {
-        openLog(&log_context, (log_count -1),  &(p_base->address_info));
+        const log_context_t *p_log_context = &(context.writingLogContext[device_type]);
+        data_end_position = p_log_context->header.startPosition + p_log_context->writePosition;
+    }
+
+    // ストリームに割り当て済みの残りと、全センサーで共有する領域の空き。
+    return getLogFreeSize(&(p_base->address_info), data_end_position) / p_base->rawSensorDataSize;
+}
+
+uint8_t senstickSensorControllerReadDropStatistics(uint8_t *p_buffer, uint8_t length)
+{
+    ASSERT(length >= 2 + 2 * NUM_OF_SENSORS);
+    
+    uint16ToByteArrayLittleEndian(&p_buffer[0], ringBufferGetHighWaterMark(&m_sample_ring));
+    for(int i = 0; i < NUM_OF_SENSORS; i++) {
+        uint16ToByteArrayLittleEndian(&p_buffer[2 + 2 * i], (uint16_t)MIN(context.droppedSampleCount[i], UINT16_MAX));
     }
+    return 2 + 2 * NUM_OF_SENSORS;
+}
 
-    uint32_t storage_last_address = (p_base->address_info.startAddress + p_base->address_info.size);
-    uint32_t data_last_address    = (log_context.header.startAddress + log_context.header.size);
-    return (storage_last_address - data_last_address) / p_base->rawSensorDataSize;
+uint8_t senstickSensorControllerReadSamplingHeadroom(uint8_t *p_buffer, uint8_t length)
+{
+    ASSERT(length >= 6);
+    
+    sampling_load_t load;
+    estimateSamplingLoad(context.sensorSetting, &load);
+    int16ToByteArrayLittleEndian(&p_buffer[0], getHeadroom(ADMISSION_MAX_BUS_LOAD,   load.busLoad));
+    int16ToByteArrayLittleEndian(&p_buffer[2], getHeadroom(ADMISSION_MAX_FLASH_LOAD, load.flashLoad));
+    int16ToByteArrayLittleEndian(&p_buffer[4], getHeadroom(ADMISSION_MAX_RING_LOAD,  load.ringLoad));
+    return 6;
 }
 
 uint8_t senstickSensorControllerReadMetaData(sensor_device_t device_type, uint8_t *p_buffer, uint8_t length)
@@ -568,8 +1638,8 @@ uint8_t senstickSensorControllerReadMetaData(sensor_device_t device_type, uint8_
         if(p_log->canWrite) {
             // 書き込み中、有効なサンプル数は、書き込みサイズで決まる
             metadata.sampleCount  = p_log->writePosition / p_base->rawSensorDataSize; // 単位はサンプル数
-            // 書き込み中、残り容量はこのヘッダから計算できる
-            metadata.remainingStorage = (p_log->header.size - p_log->writePosition) / p_base->rawSensorDataSize;
+            // 書き込み中、残り容量は書き込み位置と共有領域の空きから計算できる
+            metadata.remainingStorage = readSampleCount(device_type);
         } else {
             metadata.sampleCount = p_log->header.size    / p_base->rawSensorDataSize;
             // 読み込み時は、最後のヘッダを読みだして、残り残量を求めるs
@@ -590,54 +1660,64 @@ bool senstickSensorControllerWriteSetting(sensor_device_t device_type, uint8_t *
         return false;
     }
     
+    // 未知のデバイスタイプは除外
+    if(device_type >= NUM_OF_SENSORS) {
+        return false;
+    }
+    
     // センサーが使用不可能なときはfalseを返す
     if(!context.isSensorAvailable[device_type]) {
         return false;
     }
     
-    // デシリアライズ
+    // デシリアライズ。5バイト、マイクロ秒の周期を付けた9バイト、または間引きを付けた10バイト。
+    if(length < 5) {
+        return false;
+    }
     sensor_service_setting_t setting;
-    deserializesensor_service_setting(&setting, p_data);
+    deserializesensor_service_setting(&setting, p_data, length);
     // 値の正当性確認
     if( ! isValidSensorServiceCommand((uint8_t)setting.command)) {
         return false;
     }
+    if(setting.samplingPeriodUs == 0 && setting.samplingDuration <= 0) {
+        return false;
+    }
+    // マイクロ秒の周期が指定されたら、ミリ秒の周期はその切り捨て。ミリ秒の倍数なら、ミリ秒の周期だけにする。
+    // ログのヘッダとメタデータには、ミリ秒の周期を記録する。
+    if(setting.samplingPeriodUs != 0) {
+        setting.samplingDuration = (samplingDurationType)MIN(setting.samplingPeriodUs / 1000, INT16_MAX);
+        if(setting.samplingPeriodUs == (uint32_t)setting.samplingDuration * 1000) {
+            setting.samplingPeriodUs = 0;
+        }
+    }
+    const uint32_t period_us = getSensorServiceSamplingPeriodUs(&setting);
     
-    // センササンプリング周期の制約条件。
-    // 本来はここにベタ書きするものではない。本来はセンサごとに処理を委譲すべき。
-    // I2Cバスを共有している都合、センサー単体で値の領域判定ができない部分があるので、それはここで処理する。
-    switch(device_type) {
-        case AccelerationSensor:  // I2Cバスを330マイクロ秒使う。
-        case GyroSensor:          // I2Cバスを330マイクロ秒使う。
-        case MagneticFieldSensor: // I2Cバスを360マイクロ秒使う。
-#ifdef NRF52
-            // これらのセンサーは10ミリ秒以上の周期。
-            if( setting.samplingDuration < 10) {
-                return false;
-            }
-#else // NRF51, 16kB
-            // フラッシュのセクタ消去Typ.30ミリ秒の条件で、30ミリ秒サンプリングでメールボックスの深さは10に達する。
-            // ワースト120ミリ秒、またメールボックスは40までなので、サンプリング周期の上限は30ミリ秒が限度。
-            if( setting.samplingDuration < 30) {
-                return false;
-            }
-            
-#endif
-            break;
-
-        case UltraVioletSensor:            // I2Cバスを170マイクロ秒使う。
-        case AirPressureSensor:            // I2Cバスを500マイクロ秒使う。
-        case BrightnessSensor:             // 変換処理に150ミリ秒かかかる。
-        case HumidityAndTemperatureSensor: // 変換処理に21ミリ秒かかる。
-            // 周期は200ミリ秒以上
-            if (setting.samplingDuration < 200) {
-                return false;
-            }
-            break;
-            
-        default:
-            // 未知のデバイスタイプは除外
+    // センサー単体の周期の制約。
+    if( ! isSupportedSamplingPeriod(device_type, period_us)) {
+        return false;
+    }
+    // 間引きは、フィルタに通せるセンサーだけ。
+    const uint8_t decimation = getSensorServiceDecimation(&setting);
+    if( ! isValidSampleFilterDecimation(decimation) || (decimation > 1 && m_p_sensor_bases[device_type]->filterChannelCount == 0)) {
+        return false;
+    }
+    setting.decimation = decimation;
+    // 要求された設定を入れた設定全体で、I2Cバス、フラッシュ、リングバッファの負荷を見積もり、上限を超えるなら受け入れない。
+    // センサーを止める設定は、負荷を減らすだけなので受け入れる。
+    if(setting.command != sensorServiceCommand_stop) {
+        sensor_service_setting_t settings[NUM_OF_SENSORS];
+        memcpy(settings, context.sensorSetting, sizeof(settings));
+        settings[device_type] = setting;
+        if(getNumberOfFilteredSensors(settings) > SAMPLE_FILTER_POOL_SIZE) {
             return false;
+        }
+        sampling_load_t load;
+        estimateSamplingLoad(settings, &load);
+        if( ! isAdmissibleLoad(&load)) {
+            NRF_LOG_PRINTF_DEBUG("sampling setting rejected: bus %d, flash %d, ring %d permille.\n", load.busLoad, load.flashLoad, load.ringLoad);
+            return false;
+        }
     }
     
     // 代入
@@ -703,13 +1783,12 @@ void senstickSensorControllerNotifyLogData(void)
 // データ領域がいっぱいかを返します。
 bool senstickSensorControllerIsDataFull(uint8_t logID)
 {
-    log_context_t log_context;
+    log_header_t header;
     for(int i =0; i < NUM_OF_SENSORS; i++) {
-        openLog(&log_context, logID, &(m_p_sensor_bases[i]->address_info));
+        readLogHeader(logID, &(m_p_sensor_bases[i]->address_info), &header);
 
         // 末尾がデータ領域を超えていないか?
-        // センサ構造体は最大で6バイト。余裕を見て128サンプルくらいが空いているかを確認。
-        if( (log_context.header.startAddress + log_context.header.size + 6 * 128) > (m_p_sensor_bases[i]->address_info.startAddress + m_p_sensor_bases[i]->address_info.size) ) {
+        if( isDataEndFull(i, header.startPosition + header.size) ) {
             NRF_LOG_PRINTF_DEBUG("storage over: sensor:%d.\n", i);
             return true;
         }
@@ -717,6 +1796,43 @@ bool senstickSensorControllerIsDataFull(uint8_t logID)
     return false;
 }
 
+bool senstickSensorControllerMountSuperblock(uint8_t *p_log_count, bool *p_is_disk_full)
+{
+    superblock_t superblock;
+    if( ! superblockRead(&superblock) || superblock.isLogOpen ) {
+        return false;
+    }
+    
+    memcpy(context.dataEndPosition, superblock.dataEndPosition, sizeof(context.dataEndPosition));
+    *p_log_count    = superblock.logCount;
+    *p_is_disk_full = superblock.isDiskFull;
+    return true;
+}
+
+void senstickSensorControllerWriteSuperblock(uint8_t log_count, bool is_disk_full)
+{
+    // 最後のログのヘッダから、終端アドレスを求める
+    clearDataEndPosition();
+    if(log_count > 0) {
+        log_header_t header;
+        for(int i =0; i < NUM_OF_SENSORS; i++) {
+            readLogHeader(log_count -1, &(m_p_sensor_bases[i]->address_info), &header);
+            context.dataEndPosition[i] = header.startPosition + header.size;
+        }
+    }
+    writeSuperblock(log_count, is_disk_full, false);
+}
+
+// 記録中のリセットで閉じられなかったログを、全てのセンサーで復旧します。
+void senstickSensorControllerRecoverLog(uint8_t logID)
+{
+    for(int i =0; i < NUM_OF_SENSORS; i++) {
+        if( recoverLog(logID, m_p_sensor_bases[i]->rawSensorDataSize, &(m_p_sensor_bases[i]->address_info)) ) {
+            NRF_LOG_PRINTF_DEBUG("recovered log, sensor:%d id:%d.\n", i, logID);
+        }
+    }
+}
+
 /**
  *  observer
  */
@@ -733,6 +1849,9 @@ void senstickSensorController_observeControlCommand(senstick_control_command_t c
             senstickSensorControllerFormatStorage();
             formatSensorSetting();
             break;
+        case wipingStorage:
+            senstickSensorControllerWipeStorage();
+            break;
         case shouldDeviceSleep:
             setSensorShoudlWork(false, shouldStartLogging, new_log_id);
             break;
@@ -764,8 +1883,63 @@ void senstickSensorControllerFormatStorage(void)
     setSensorShoudlWork(false, false, 0);
     memset(context.p_readingLogContext, 0, sizeof(log_context_t *) * NUM_OF_SENSORS);
     
-    // 各センサーのストレージ初期化
+    // 共有のデータ領域と、各センサーのストレージ初期化
+    formatLogPool();
     for(int i =0; i < NUM_OF_SENSORS; i++) {
         formatLog(&(m_p_sensor_bases[i]->address_info));
     }
+    superblockFormat();
+    clearDataEndPosition();
+}
+
+// 全消去の1回の消去単位。境界に合わせて分割したときに、消去コマンドがフラッシュのコマンドキューに収まる大きさにする。
+#define STORAGE_WIPE_STEP_SIZE      (8 * MX25L25635F_BLOCK64K_SIZE)
+#define STORAGE_WIPE_START_ADDRESS  ACCELERATION_SENSOR_STORAGE_START_ADDRESS
+#define STORAGE_WIPE_END_ADDRESS    LOG_POOL_END_ADDRESS
+
+// 次の消去単位の消去を開始します。消去単位の終わりは、STORAGE_WIPE_STEP_SIZEの境界に揃えます。
+static void wipe_completion_handler(void *p_context);
+static void startNextWipeStep(void)
+{
+    uint32_t end = (context.wipeAddress / STORAGE_WIPE_STEP_SIZE + 1) * STORAGE_WIPE_STEP_SIZE;
+    end = MIN(end, STORAGE_WIPE_END_ADDRESS);
+    
+    const uint32_t address = context.wipeAddress;
+    context.wipeAddress = end;
+    eraseFlashAsync(address, end - address, wipe_completion_handler, NULL);
+}
+
+static void wipe_sched_event_handler(void *p_event_data, uint16_t event_size)
+{
+    if(context.wipeAddress >= STORAGE_WIPE_END_ADDRESS) {
+        senstick_setStorageWipeProgress(100);
+        return;
+    }
+    
+    const uint32_t done  = context.wipeAddress - STORAGE_WIPE_START_ADDRESS;
+    const uint32_t total = STORAGE_WIPE_END_ADDRESS - STORAGE_WIPE_START_ADDRESS;
+    senstick_setStorageWipeProgress((uint8_t)((uint64_t)done * 100 / total));
+    
+    startNextWipeStep();
+}
+
+// SPIの割り込みコンテキストから呼び出されるので、次の消去はスケジューラから積む。
+static void wipe_completion_handler(void *p_context)
+{
+    ret_code_t err_code = app_sched_event_put(NULL, 0, wipe_sched_event_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+void senstickSensorControllerWipeStorage(void)
+{
+    setSensorShoudlWork(false, false, 0);
+    memset(context.p_readingLogContext, 0, sizeof(log_context_t *) * NUM_OF_SENSORS);
+    
+    formatSensorSetting();
+    superblockFormat();
+    formatLogPool();
+    clearDataEndPosition();
+    
+    context.wipeAddress = STORAGE_WIPE_START_ADDRESS;
+    startNextWipeStep();
 }
@@ -14,6 +14,12 @@ uint8_t senstickSensorControllerGetNumOfLoggingReadySensor(void);
 
 // 指定したlog_idで、データ領域がいっぱいかを返します。
 bool senstickSensorControllerIsDataFull(uint8_t log_id);
+// スーパーブロックから、ログの数とディスクフルの状態を読み込みます。スーパーブロックが無効、またはログの記録中だったときはfalseを返します。
+bool senstickSensorControllerMountSuperblock(uint8_t *p_log_count, bool *p_is_disk_full);
+// ログのヘッダから終端アドレスを読み込み、スーパーブロックを書き込みます。従来の方法でマウントしたときに呼び出します。
+void senstickSensorControllerWriteSuperblock(uint8_t log_count, bool is_disk_full);
+// 記録中のリセットで閉じられなかった、指定したlog_idのログを復旧します。
+void senstickSensorControllerRecoverLog(uint8_t log_id);
 
 // sensor serviceが呼び出す、データの読み書きメソッド
 uint8_t senstickSensorControllerReadSetting(sensor_device_t device_type, uint8_t *p_buffer, uint8_t length);
@@ -22,6 +28,19 @@ bool senstickSensorControllerWriteSetting(sensor_device_t device_type, uint8_t *
 void senstickSensorControllerWriteLogID(sensor_device_t device_type, uint8_t *p_data, uint8_t length);
 void senstickSensorControllerNotifyLogData(void);
 
+// サンプリングの過負荷の統計を、BLEで送るバイト列にして返します。統計はサンプリングの開始でクリアされます。
+// フォーマット(リトルエンディアン)は、[リングバッファの使用量の最大値(バイト, uint16), センサーごとの捨てたサンプル数(uint16, 65535で飽和) x 8]。
+uint8_t senstickSensorControllerReadDropStatistics(uint8_t *p_buffer, uint8_t length);
+// 今のサンプリングの設定全体の、資源の上限までの余裕を、BLEで送るバイト列にして返します。設定の書き込みは、余裕が負になるなら受け入れられません。
+// フォーマット(リトルエンディアン)は、[I2Cバス, フラッシュの書き込み帯域, リングバッファ]の余裕(1000分率, int16)。
+uint8_t senstickSensorControllerReadSamplingHeadroom(uint8_t *p_buffer, uint8_t length);
+
+// 処理時間の計測に使う、CPUのサイクルカウンタの値を返します。NRF52はDWTのサイクルカウンタ(SystemCoreClockで数える)。NRF51は常に0。
+uint32_t senstickSensorControllerGetCycleCount(void);
+
+// サンプリングクロックの時刻(マイクロ秒)を返します。タイマーで読み出すセンサーのrequestSensorDataHandler()の中では、そのサンプルの読み出しを開始する時刻です。
+uint32_t senstickSensorControllerGetSamplingTimeUs(void);
+
 // observer
 void senstickSensorController_observeControlCommand(senstick_control_command_t command, bool shouldStartLogging, uint8_t new_log_id);
 
@@ -30,5 +49,7 @@ void senstickSensorController_handleBLEEvent(ble_evt_t * p_ble_evt);
 
 // フラッシュメモリの初期化
 void senstickSensorControllerFormatStorage(void);
+// ログ領域全体を、ブロック消去で非同期に消去します。進捗はデータモデルに通知します。
+void senstickSensorControllerWipeStorage(void);
 
 #endif /* senstick_sensor_controller_h */
@@ -6,6 +6,7 @@ bool isValidSenstickControlCommand(uint8_t value)
      sensorShouldSleep = 0x00,
      sensorShouldWork  = 0x01,
      formattingStorage = 0x10,
+     wipingStorage     = 0x11,
      shouldDeviceSleep    = 0x20,
      enterDFUmode      = 0x40*/
     switch(value)
@@ -13,6 +14,7 @@ bool isValidSenstickControlCommand(uint8_t value)
         case 0x00:
         case 0x01:
         case 0x10:
+        case 0x11:
         case 0x20:
         case 0x40:
             return true;
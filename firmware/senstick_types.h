@@ -13,6 +13,7 @@ typedef enum {
     sensorShouldSleep = 0x00,
     sensorShouldWork  = 0x01,
     formattingStorage = 0x10,
+    wipingStorage     = 0x11, // ログ領域全体の消去。非同期に実行し、完了するとsensorShouldSleepに戻る。
     shouldDeviceSleep = 0x20,
     enterDFUmode      = 0x40,
     
@@ -6,9 +6,12 @@
 #include <nrf_assert.h>
 #include <nrf_drv_gpiote.h>
 #include <nrf_drv_spi.h>
+#include <nrf_drv_common.h>
 #include <app_util_platform.h>
 #include <app_error.h>
 #include <app_timer.h>
+#include <nrf_soc.h>
+#include <nrf_sdm.h>
 
 #include "senstick_util.h"
 #include "senstick_io_definition.h"
@@ -16,6 +19,82 @@
 
 static nrf_drv_spi_t spi;
 
+// コマンドキューの深さ
+#define FLASH_COMMAND_QUEUE_SIZE 16
+
+// WIPのポーリング間隔(マイクロ秒)と、タイムアウト時間(マイクロ秒)。
+// タイムアウトは、データシートの最大時間(tPP 3ms, tSE 400ms, tBE32 2s, tBE 4s)に余裕を持たせた値。
+#define FLASH_PROGRAM_POLLING_INTERVAL_US 500
+#define FLASH_ERASE_POLLING_INTERVAL_US   2000
+#define FLASH_BLOCK_ERASE_POLLING_INTERVAL_US 10000
+#define FLASH_POLLING_TIMEOUT_US          500000
+#define FLASH_BLOCK32K_ERASE_TIMEOUT_US   2500000
+#define FLASH_BLOCK64K_ERASE_TIMEOUT_US   5000000
+
+// WIPのポーリングに使うタイマー。
+#define FLASH_TIMER          NRF_TIMER1
+#define FLASH_TIMER_IRQn     TIMER1_IRQn
+#define FLASH_TIMER_PRESCALERS_1US 4
+
+// キューに積まれる1つのコマンド
+typedef struct {
+    uint8_t  opcode;            // コマンド
+    bool     hasAddress;        // コマンドに続けて4バイトのアドレスを送るか
+    uint8_t  dummyLength;       // アドレスに続けて送るダミーバイトの数
+    bool     needsWriteEnable;  // コマンドの前にWRENを送るか
+    bool     needsWaitReady;    // コマンドの後でWIPが落ちるのを待つか
+    uint32_t address;
+    uint8_t  *p_tx_data;        // 送信データ。NULLならば受信。
+    uint8_t  *p_rx_data;        // 受信データ
+    uint32_t length;
+    flash_command_callback_t callback;
+    void     *p_context;
+    uint32_t pollingCount;      // WIPのポーリング回数
+} flash_command_t;
+
+typedef struct {
+    flash_command_t items[FLASH_COMMAND_QUEUE_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t count;
+} flash_command_queue_t;
+
+// コマンド実行の状態
+typedef enum {
+    FLASH_STATE_IDLE,           // 実行中のコマンドなし
+    FLASH_STATE_WRITE_ENABLE,   // WRENの送信中
+    FLASH_STATE_HEADER,         // コマンドとアドレスの送信中
+    FLASH_STATE_DATA,           // データの送受信中
+    FLASH_STATE_POLLING,        // ステータスレジスタの読み出し中
+    FLASH_STATE_WAITING,        // 次のステータスレジスタ読み出しまでのタイマー待ち
+    FLASH_STATE_SUSPENDING,     // 消去サスペンドコマンドの送信中
+    FLASH_STATE_SUSPEND_POLLING,// サスペンド完了を待つ、ステータスレジスタの読み出し中
+    FLASH_STATE_RESUMING,       // 消去再開コマンドの送信中
+} flash_state_t;
+
+typedef struct {
+    // 通常のコマンド。積まれた順に実行する。
+    flash_command_queue_t queue;
+    // バックグラウンドの消去。通常のコマンドがない時に実行し、通常のコマンドが積まれたらサスペンドして先に通す。
+    flash_command_queue_t backgroundQueue;
+    
+    volatile flash_state_t state;
+    flash_command_t *p_current; // 実行中のコマンド
+    bool     isBackground;      // 実行中のコマンドがバックグラウンドの消去か
+    bool     isEraseSuspended;  // バックグラウンドの消去をサスペンドしているか
+    uint8_t  pollsSinceResume;  // 消去の開始/再開からのポーリング回数。再開直後の再サスペンドを避ける。
+    uint32_t dataPosition;      // 実行中コマンドのデータ転送位置
+    uint8_t  chunkLength;       // 転送中のデータの長さ
+    
+    // SPI転送に使うバッファ。EasyDMAで転送するのでRAMに置く。
+    uint8_t  header[6];
+    uint8_t  status[2];
+    
+    // アクセス統計
+    flash_memory_statistics_t statistics;
+} flash_memory_context_t;
+
+static flash_memory_context_t m_context;
+
 //#ifdef MX25L25635F
 //#define    FlashID          0xc22019
 //#define    ElectronicID     0x18
@@ -45,6 +124,7 @@ typedef enum {
     
     //READ comands
     FLASH_CMD_READ4B =    0x13,    //READ4B (1 x I/O with 4 byte address)
+    FLASH_CMD_FASTREAD4B = 0x0C,   //FASTREAD4B (1 x I/O with 4 byte address)
     
     //Program comands
     FLASH_CMD_WREN =     0x06,    //WREN (Write Enable)
@@ -53,10 +133,15 @@ typedef enum {
     FLASH_CMD_PP4B =     0x12,    //PP4B (page program with 4 byte address)
     
     //Erase comands
-//    FLASH_CMD_BE4B =     0xDC,    //BE4B (Block Erase with 4 byte address)
+    FLASH_CMD_BE4B =     0xDC,    //BE4B (Block Erase 64KB with 4 byte address)
+    FLASH_CMD_BE32K4B =  0x5C,    //BE32K4B (Block Erase 32KB with 4 byte address)
 //    FLASH_CMD_CE   =     0x60,    //CE (Chip Erase) hex code: 60 or C7
     FLASH_CMD_SE4B =     0x21,    //SE (Sector Erase with 4 byte addr)
     
+    //Suspend/Resume comands
+    FLASH_CMD_PGM_ERS_S = 0x75,   //PGM/ERS Suspend (Suspends Program/Erase) old: 0xB0
+    FLASH_CMD_PGM_ERS_R = 0x7A,   //PGM/ERS Erase (Resumes Program/Erase) old: 0x30
+    
     //Mode setting comands
 
     FLASH_CMD_EN4B =    0xB7,    //EN4B( Enter 4-byte Mode )
@@ -97,6 +182,7 @@ typedef enum {
 /**
  * Private methods
  */
+static void startNextCommand(void);
 
 // nCSを設定してチップを選択します。isEnabledがtrueならばチップが選択されます。
 // 物理的な電圧や負論理かいなかなどは、このメソッドが吸収します。
@@ -119,132 +205,382 @@ static void uint32ToByteArray(uint8_t *p_dst, uint32_t src)
     p_dst[3] = (uint8_t)(0x0ff & (src >>  0));
 }
 
-static void transferToSPISlave(FlashMemoryCommand_t command, uint8_t *p_tx_buffer, uint8_t tx_buffer_length, uint8_t *p_rx_buffer, uint8_t rx_buffer_length)
+// WIPのポーリング用タイマーを、指定時間後に1回だけ発火させます。
+static void startPollingTimer(uint32_t interval_us)
 {
-    ret_code_t err_code;
-    
-    // nCSをネゲート
+    FLASH_TIMER->TASKS_CLEAR = 1;
+    FLASH_TIMER->CC[0]       = interval_us;
+    FLASH_TIMER->TASKS_START = 1;
+}
+
+static void initPollingTimer(void)
+{
+    // TIMERは、16MHzのHCLKをソースにする。1MHzにして、1回の比較一致でクリアして止める。
+    FLASH_TIMER->TASKS_STOP = 1;
+    FLASH_TIMER->MODE       = TIMER_MODE_MODE_Timer;
+    FLASH_TIMER->BITMODE    = TIMER_BITMODE_BITMODE_16Bit << TIMER_BITMODE_BITMODE_Pos;
+    FLASH_TIMER->PRESCALER  = FLASH_TIMER_PRESCALERS_1US;
+    FLASH_TIMER->SHORTS     = (TIMER_SHORTS_COMPARE0_CLEAR_Enabled << TIMER_SHORTS_COMPARE0_CLEAR_Pos)
+                            | (TIMER_SHORTS_COMPARE0_STOP_Enabled  << TIMER_SHORTS_COMPARE0_STOP_Pos);
+    FLASH_TIMER->INTENSET   = (TIMER_INTENSET_COMPARE0_Enabled << TIMER_INTENSET_COMPARE0_Pos);
+    
+    // SPIの割り込みと同じ優先度にして、コマンド実行の状態遷移が互いに割り込まないようにする。
+#ifdef NRF52
+    nrf_drv_common_irq_enable(FLASH_TIMER_IRQn, APP_IRQ_PRIORITY_LOW);
+#else // NRF51
+    nrf_drv_common_irq_enable(FLASH_TIMER_IRQn, NRF_APP_PRIORITY_LOW);
+#endif
+}
+
+// SPIの転送を開始します。完了はspi_event_handler()に通知されます。
+static void startSPITransfer(uint8_t *p_tx_buffer, uint8_t tx_buffer_length, uint8_t *p_rx_buffer, uint8_t rx_buffer_length)
+{
+    ret_code_t err_code = nrf_drv_spi_transfer(&spi, p_tx_buffer, tx_buffer_length, p_rx_buffer, rx_buffer_length);
+    APP_ERROR_CHECK(err_code);
+}
+
+// ステータスレジスタの読み出しを開始します。
+static void startStatusRead(flash_state_t state)
+{
+    m_context.state     = state;
+    m_context.header[0] = FLASH_CMD_RDSR;
     setChipEnable(true);
+    // 1バイト目はコマンド送信中の受信データなので、2バイト目がステータスレジスタ
+    startSPITransfer(m_context.header, 1, m_context.status, 2);
+}
+
+// 1バイトのコマンドの送信を開始します。
+static void startOpcode(flash_state_t state, FlashMemoryCommand_t opcode)
+{
+    m_context.state     = state;
+    m_context.header[0] = opcode;
+    setChipEnable(true);
+    startSPITransfer(m_context.header, 1, NULL, 0);
+}
+
+static void startCommandHeader(flash_command_t *p_command)
+{
+    m_context.state     = FLASH_STATE_HEADER;
+    m_context.header[0] = p_command->opcode;
+    uint8_t length = 1;
+    if(p_command->hasAddress) {
+        uint32ToByteArray(&(m_context.header[1]), p_command->address);
+        length += 4;
+    }
+    for(int i=0; i < p_command->dummyLength; i++) {
+        m_context.header[length++] = 0xff;
+    }
+    setChipEnable(true);
+    startSPITransfer(m_context.header, length, NULL, 0);
+}
+
+// SPIの1回の転送は255バイトまでなので、それを超えるデータは分割して転送します。
+static void startDataChunk(flash_command_t *p_command)
+{
+    m_context.state       = FLASH_STATE_DATA;
+    m_context.chunkLength = (uint8_t)MIN(255, p_command->length - m_context.dataPosition);
+    if(p_command->p_tx_data != NULL) {
+        startSPITransfer(&(p_command->p_tx_data[m_context.dataPosition]), m_context.chunkLength, NULL, 0);
+    } else {
+        startSPITransfer(NULL, 0, &(p_command->p_rx_data[m_context.dataPosition]), m_context.chunkLength);
+    }
+}
+
+static flash_command_t *getQueueHead(flash_command_queue_t *p_queue)
+{
+    return &(p_queue->items[p_queue->head]);
+}
+
+static bool isEraseOpcode(uint8_t opcode)
+{
+    return (opcode == FLASH_CMD_SE4B || opcode == FLASH_CMD_BE32K4B || opcode == FLASH_CMD_BE4B);
+}
+
+// 通常のコマンドを実行できるか。消去のサスペンド中は、消去コマンドは実行できない。
+static bool canExecuteForegroundCommand(void)
+{
+    if(m_context.queue.count == 0) {
+        return false;
+    }
+    return ! (m_context.isEraseSuspended && isEraseOpcode(getQueueHead(&m_context.queue)->opcode));
+}
+
+// コマンドごとのWIPのポーリング間隔
+static uint32_t getPollingInterval(uint8_t opcode)
+{
+    switch(opcode) {
+        case FLASH_CMD_PP4B:    return FLASH_PROGRAM_POLLING_INTERVAL_US;
+        case FLASH_CMD_BE32K4B:
+        case FLASH_CMD_BE4B:    return FLASH_BLOCK_ERASE_POLLING_INTERVAL_US;
+        default:                return FLASH_ERASE_POLLING_INTERVAL_US;
+    }
+}
+
+// コマンドごとのWIPのタイムアウト時間
+static uint32_t getPollingTimeout(uint8_t opcode)
+{
+    switch(opcode) {
+        case FLASH_CMD_BE32K4B: return FLASH_BLOCK32K_ERASE_TIMEOUT_US;
+        case FLASH_CMD_BE4B:    return FLASH_BLOCK64K_ERASE_TIMEOUT_US;
+        default:                return FLASH_POLLING_TIMEOUT_US;
+    }
+}
+
+// 実行中のコマンドを完了させ、次のコマンドを開始します。
+static void completeCommand(void)
+{
+    flash_command_t command = *(m_context.p_current);
+    flash_command_queue_t *p_queue = m_context.isBackground ? &m_context.backgroundQueue : &m_context.queue;
     
-    // コマンドを書き込み
-    uint8_t com = (uint8_t)command;
-    err_code = nrf_drv_spi_transfer(&spi, &com, 1, NULL, 0);
-    APP_ERROR_CHECK(err_code);
+    CRITICAL_REGION_ENTER();
+    p_queue->head   = (p_queue->head + 1) % FLASH_COMMAND_QUEUE_SIZE;
+    p_queue->count--;
+    m_context.state = FLASH_STATE_IDLE;
+    CRITICAL_REGION_EXIT();
     
-    // データを書き込み
-    if(tx_buffer_length > 0 || rx_buffer_length > 0) {
-        err_code = nrf_drv_spi_transfer(&spi, p_tx_buffer, tx_buffer_length, p_rx_buffer, rx_buffer_length);
-        APP_ERROR_CHECK(err_code);
+    if(command.callback != NULL) {
+        (command.callback)(command.p_context);
     }
     
-    // nCSをアサート
+    startNextCommand();
+}
+
+// コマンドとデータの転送が終わった時の処理。書き込みと消去は、WIPが落ちるまで待つ。
+static void finishCommandTransfer(flash_command_t *p_command)
+{
     setChipEnable(false);
     
+    if(p_command->needsWaitReady) {
+        m_context.pollsSinceResume = 0;
+        startStatusRead(FLASH_STATE_POLLING);
+    } else {
+        completeCommand();
+    }
 }
 
-static void writeToSPISlave(FlashMemoryCommand_t command, uint8_t *p_tx_buffer, uint8_t tx_buffer_length)
+// WIPが立っている時の処理。バックグラウンドの消去中に通常のコマンドが来ていれば、消去をサスペンドする。
+static void waitCommandReady(flash_command_t *p_command)
 {
-    transferToSPISlave(command, p_tx_buffer, tx_buffer_length, NULL, 0);
+    uint32_t interval = getPollingInterval(p_command->opcode);
+    p_command->pollingCount++;
+    if((p_command->pollingCount * interval) > getPollingTimeout(p_command->opcode)) {
+        APP_ERROR_CHECK(NRF_ERROR_TIMEOUT);
+    }
+    
+    if(m_context.isBackground && m_context.pollsSinceResume > 0 && canExecuteForegroundCommand()) {
+        startOpcode(FLASH_STATE_SUSPENDING, FLASH_CMD_PGM_ERS_S);
+    } else {
+        m_context.pollsSinceResume++;
+        m_context.state = FLASH_STATE_WAITING;
+        startPollingTimer(interval);
+    }
 }
 
-static void readFromSPISlave(FlashMemoryCommand_t command, uint8_t *p_rx_buffer, uint8_t rx_buffer_length)
+// SPI転送完了、またはポーリングタイマーの発火ごとに呼び出され、コマンド実行の状態を進めます。
+static void processFlashCommand(void)
 {
-    transferToSPISlave(command, NULL, 0, p_rx_buffer, rx_buffer_length);
+    flash_command_t *p_command = m_context.p_current;
+    
+    switch(m_context.state) {
+        case FLASH_STATE_WRITE_ENABLE:
+            setChipEnable(false);
+            startCommandHeader(p_command);
+            break;
+        case FLASH_STATE_HEADER:
+            m_context.dataPosition = 0;
+            if(p_command->length > 0) {
+                startDataChunk(p_command);
+            } else {
+                finishCommandTransfer(p_command);
+            }
+            break;
+        case FLASH_STATE_DATA:
+            m_context.dataPosition += m_context.chunkLength;
+            if(m_context.dataPosition < p_command->length) {
+                startDataChunk(p_command);
+            } else {
+                finishCommandTransfer(p_command);
+            }
+            break;
+        case FLASH_STATE_POLLING:
+            setChipEnable(false);
+            if((m_context.status[1] & STATUS_REGISTER_WIP) == 0) {
+                completeCommand();
+            } else {
+                waitCommandReady(p_command);
+            }
+            break;
+        case FLASH_STATE_WAITING:
+            startStatusRead(FLASH_STATE_POLLING);
+            break;
+        case FLASH_STATE_SUSPENDING:
+            setChipEnable(false);
+            startStatusRead(FLASH_STATE_SUSPEND_POLLING);
+            break;
+        case FLASH_STATE_SUSPEND_POLLING:
+            setChipEnable(false);
+            // サスペンドはtESL(最大20マイクロ秒)で完了する。WIPが落ちるまで読み続ける。
+            if((m_context.status[1] & STATUS_REGISTER_WIP) != 0) {
+                startStatusRead(FLASH_STATE_SUSPEND_POLLING);
+                break;
+            }
+            m_context.isEraseSuspended = true;
+            m_context.statistics.eraseSuspendCount++;
+            CRITICAL_REGION_ENTER();
+            m_context.state = FLASH_STATE_IDLE;
+            CRITICAL_REGION_EXIT();
+            startNextCommand();
+            break;
+        case FLASH_STATE_RESUMING:
+            setChipEnable(false);
+            m_context.isEraseSuspended = false;
+            m_context.pollsSinceResume = 0;
+            m_context.state = FLASH_STATE_WAITING;
+            startPollingTimer(getPollingInterval(p_command->opcode));
+            break;
+        case FLASH_STATE_IDLE:
+        default:
+            break;
+    }
 }
 
-static void transferSPISlaveWithAddress(FlashMemoryCommand_t command, uint32_t address, uint8_t *p_tx_buffer, uint8_t tx_buffer_length, uint8_t *p_rx_buffer, uint8_t rx_buffer_length)
+// 実行中のコマンドがなければ、次のコマンドを開始します。通常のコマンドを、バックグラウンドの消去より優先します。
+static void startNextCommand(void)
 {
-    ret_code_t err_code;
-    
-    // nCSをネゲート
-    setChipEnable(true);
+    flash_command_t *p_command = NULL;
+    flash_state_t   next_state = FLASH_STATE_IDLE;
+    
+    CRITICAL_REGION_ENTER();
+    if(m_context.state == FLASH_STATE_IDLE) {
+        if(canExecuteForegroundCommand()) {
+            p_command              = getQueueHead(&m_context.queue);
+            m_context.isBackground = false;
+        } else if(m_context.backgroundQueue.count > 0) {
+            p_command              = getQueueHead(&m_context.backgroundQueue);
+            m_context.isBackground = true;
+        }
+        if(p_command != NULL) {
+            if(m_context.isBackground && m_context.isEraseSuspended) {
+                next_state = FLASH_STATE_RESUMING;
+            } else {
+                next_state = p_command->needsWriteEnable ? FLASH_STATE_WRITE_ENABLE : FLASH_STATE_HEADER;
+            }
+            m_context.state     = next_state;
+            m_context.p_current = p_command;
+        }
+    }
+    CRITICAL_REGION_EXIT();
     
-    // コマンドを書き込み
-    uint8_t com = (uint8_t)command;
-    err_code = nrf_drv_spi_transfer(&spi, &com, 1, NULL, 0);
-    APP_ERROR_CHECK(err_code);
+    if(p_command == NULL) {
+        return;
+    }
     
-    // アドレスを書き込み
-    uint8_t buffer[4];
-    uint32ToByteArray(buffer, address);
-    err_code = nrf_drv_spi_transfer(&spi, buffer, 4, NULL, 0);
-    APP_ERROR_CHECK(err_code);
+    // サスペンドした消去の再開
+    if(next_state == FLASH_STATE_RESUMING) {
+        startOpcode(FLASH_STATE_RESUMING, FLASH_CMD_PGM_ERS_R);
+        return;
+    }
     
-    // データを読み出し
-    if(tx_buffer_length > 0 || rx_buffer_length > 0) {
-        err_code = nrf_drv_spi_transfer(&spi, p_tx_buffer, tx_buffer_length, p_rx_buffer, rx_buffer_length);
-        APP_ERROR_CHECK(err_code);
+    // 統計
+    switch(p_command->opcode) {
+        case FLASH_CMD_PP4B:
+            m_context.statistics.pageProgramCount++;
+            m_context.statistics.programByteCount += p_command->length;
+            break;
+        case FLASH_CMD_SE4B:
+            m_context.statistics.sectorEraseCount++;
+            break;
+        case FLASH_CMD_BE32K4B:
+        case FLASH_CMD_BE4B:
+            m_context.statistics.blockEraseCount++;
+            break;
+        case FLASH_CMD_FASTREAD4B:
+            m_context.statistics.readCount++;
+            break;
+        default: break;
     }
     
-    // nCSをアサート
-    setChipEnable(false);
+    p_command->pollingCount = 0;
+    if(p_command->needsWriteEnable) {
+        startOpcode(FLASH_STATE_WRITE_ENABLE, FLASH_CMD_WREN);
+    } else {
+        startCommandHeader(p_command);
+    }
 }
 
-static void writeToSPISlaveWithAddress(FlashMemoryCommand_t command, uint32_t address, uint8_t *p_tx_buffer, uint8_t tx_buffer_length)
+// コマンドをキューに積みます。キューがいっぱいならば、空くまで待ちます。
+static void enqueueCommand(flash_command_queue_t *p_queue, const flash_command_t *p_command)
 {
-    transferSPISlaveWithAddress(command, address, p_tx_buffer, tx_buffer_length, NULL, 0);
+    while(true) {
+        bool did_enqueue = false;
+        CRITICAL_REGION_ENTER();
+        if(p_queue->count < FLASH_COMMAND_QUEUE_SIZE) {
+            p_queue->items[(p_queue->head + p_queue->count) % FLASH_COMMAND_QUEUE_SIZE] = *p_command;
+            p_queue->count++;
+            did_enqueue = true;
+        }
+        CRITICAL_REGION_EXIT();
+    
+        if(did_enqueue) {
+            break;
+        }
+        waitFlashCommandProgress();
+    }
+    
+    startNextCommand();
 }
 
-static void readFromSPISlaveWithAddress(FlashMemoryCommand_t command, uint32_t address, uint8_t *p_rx_buffer, uint8_t rx_buffer_length)
+static void enqueueSimpleCommand(FlashMemoryCommand_t opcode, uint8_t *p_tx_data, uint8_t *p_rx_data, uint32_t length, flash_command_callback_t callback, void *p_context)
 {
-    transferSPISlaveWithAddress(command, address, NULL, 0, p_rx_buffer, rx_buffer_length);
+    flash_command_t command;
+    memset(&command, 0, sizeof(flash_command_t));
+    command.opcode    = opcode;
+    command.p_tx_data = p_tx_data;
+    command.p_rx_data = p_rx_data;
+    command.length    = length;
+    command.callback  = callback;
+    command.p_context = p_context;
+    enqueueCommand(&m_context.queue, &command);
 }
 
-static void readStatusRegister(uint8_t *p_data)
+// 同期呼び出しのための完了コールバック。
+static void syncCompletionHandler(void *p_context)
 {
-    readFromSPISlave(FLASH_CMD_RDSR, p_data, 1);
+    *((volatile bool *)p_context) = true;
 }
 
-static void readConfigrationRegister(uint8_t *p_data)
+static void waitForCompletion(volatile bool *p_is_completed)
 {
-    readFromSPISlave(FLASH_CMD_RDCR, p_data, 1);
+    while( ! *p_is_completed ) {
+        waitFlashCommandProgress();
+    }
 }
-/*
-static void readDeviceID(flash_memory_context_t *p_context, uint32_t *p_data)
+
+// アドレスのないコマンドを同期実行します。
+static void executeSimpleCommand(FlashMemoryCommand_t opcode, uint8_t *p_tx_data, uint8_t *p_rx_data, uint32_t length)
 {
-    uint8_t buffer[3];
-    
-    readFromSPISlave( FLASH_CMD_RDID, buffer, 3);
-    
-    *p_data = ((uint32_t)buffer[0] << 16) |  ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 0);
-}*/
+    volatile bool is_completed = false;
+    enqueueSimpleCommand(opcode, p_tx_data, p_rx_data, length, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
+}
 
-static void waitFlashReady(void)
+static void readStatusRegister(uint8_t *p_data)
 {
-    const int TIMEOUT_LOOP = 500; // 0.5 * 500 = 250msec
-    
-    int cnt = 0;
-    while( isFlashBusy() ) {
-        nrf_delay_us(500);
-        cnt++;
-        if(cnt > TIMEOUT_LOOP) {
-            APP_ERROR_CHECK(NRF_ERROR_TIMEOUT);
-            break;
-        }
-    }
+    executeSimpleCommand(FLASH_CMD_RDSR, NULL, p_data, 1);
 }
 
-static void writeCommandWriteEnable(void)
+static void readConfigrationRegister(uint8_t *p_data)
 {
-    writeToSPISlave( FLASH_CMD_WREN, NULL, 0);
+    executeSimpleCommand(FLASH_CMD_RDCR, NULL, p_data, 1);
 }
 /*
-static void writeStatusConfigrationRegister(flash_memory_context_t *p_context, uint8_t status, uint8_t config)
+static void readDeviceID(flash_memory_context_t *p_context, uint32_t *p_data)
 {
-    // Write in progressフラグをチェック
-    if( isFlashBusy(p_context) ) {
-        APP_ERROR_CHECK(NRF_ERROR_BUSY);
-    }
+    uint8_t buffer[3];
     
-    // Setting Write Enable Latch bit
-    writeCommandWriteEnable(p_context);
-
-    uint8_t buffer[2];
-    buffer[0] = status;
-    buffer[1] = config;
-    writeToSPISlave( FLASH_CMD_WRSR, buffer, sizeof(buffer));
+    readFromSPISlave( FLASH_CMD_RDID, buffer, 3);
     
-    waitFlashReady(p_context);
+    *p_data = ((uint32_t)buffer[0] << 16) |  ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 0);
 }*/
 
 static bool isAddress4ByteMode(void)
@@ -258,7 +594,7 @@ static bool isAddress4ByteMode(void)
 static void enableAddress4ByteMode(void)
 {
     // コマンドを書き込み。
-    writeToSPISlave( FLASH_CMD_EN4B, NULL, 0);
+    executeSimpleCommand(FLASH_CMD_EN4B, NULL, NULL, 0);
     
     bool isAddress4BM = isAddress4ByteMode();
     if( ! isAddress4BM ) {
@@ -266,28 +602,47 @@ static void enableAddress4ByteMode(void)
     }
 }
 
-static void rawWriteFlash(uint32_t address,  uint8_t *data, uint8_t data_length)
+// 1ページ(256バイト)以内のデータを書き込むコマンドを、キューに積みます。
+static void enqueueProgram(uint32_t address,  uint8_t *p_data, uint16_t data_length, flash_command_callback_t callback, void *p_context)
 {
     // アドレスチェック
     ASSERT(address < MX25L25635F_FLASH_SIZE);
-    
-    // フラッシュの準備待ち。
-    waitFlashReady();
-    // weビットを立てる。
-    writeCommandWriteEnable();
-    // 書き込み。32-bitアドレスモード。
-    writeToSPISlaveWithAddress(FLASH_CMD_PP4B, address, data, data_length);
+    ASSERT(((address % MX25L25635F_PAGE_SIZE) + data_length) <= MX25L25635F_PAGE_SIZE);
+    
+    flash_command_t command;
+    command.opcode           = FLASH_CMD_PP4B;
+    command.hasAddress       = true;
+    command.dummyLength      = 0;
+    command.needsWriteEnable = true;
+    command.needsWaitReady   = true;
+    command.address          = address;
+    command.p_tx_data        = p_data;
+    command.p_rx_data        = NULL;
+    command.length           = data_length;
+    command.callback         = callback;
+    command.p_context        = p_context;
+    enqueueCommand(&m_context.queue, &command);
 }
 
-static void rawReadFlash(uint32_t address, uint8_t *data, uint8_t data_length)
+#ifdef NRF52
+static void spi_event_handler(nrf_drv_spi_evt_t const * p_event)
 {
-    // アドレスチェック
-    ASSERT(address < MX25L25635F_FLASH_SIZE);
+    processFlashCommand();
+}
+#else // NRF51
+static void spi_event_handler(nrf_drv_spi_event_t event)
+{
+    processFlashCommand();
+}
+#endif
 
-    // フラッシュの準備待ち。
-    waitFlashReady();
-    // 読み込む。
-    readFromSPISlaveWithAddress(FLASH_CMD_READ4B, address, data, data_length);
+// ポーリングタイマーの割り込み
+void TIMER1_IRQHandler(void)
+{
+    FLASH_TIMER->EVENTS_COMPARE[0] = 0;
+    if(m_context.state == FLASH_STATE_WAITING) {
+        processFlashCommand();
+    }
 }
 
 /**
@@ -298,6 +653,8 @@ void initFlashMemory(void)
 {
     ret_code_t err_code;
 
+    memset(&m_context, 0, sizeof(flash_memory_context_t));
+    
     // gpioteモジュールを初期化する
     if(!nrf_drv_gpiote_is_init()) {
         err_code = nrf_drv_gpiote_init();
@@ -333,14 +690,17 @@ void initFlashMemory(void)
     config.ss_pin       = NRF_DRV_SPI_PIN_NOT_USED;
     config.irq_priority = APP_IRQ_PRIORITY_LOW; // SPI0_CONFIG_IRQ_PRIORITY;
     config.orc          = 0xff;
-    config.frequency    = NRF_DRV_SPI_FREQ_4M;
+    config.frequency    = NRF_DRV_SPI_FREQ_8M;
     //    config.frequency    = NRF_DRV_SPI_FREQ_250K;
     config.mode         = NRF_DRV_SPI_MODE_0;
     config.bit_order    = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST;
     
-    err_code = nrf_drv_spi_init(&spi, &config, NULL); // blocking mode
+    // ノンブロッキングモード。転送完了はイベントハンドラに通知される。nRF52ではSPIMのEasyDMAで転送する。
+    err_code = nrf_drv_spi_init(&spi, &config, spi_event_handler);
     APP_ERROR_CHECK(err_code);
     
+    initPollingTimer();
+    
     // DeepSleepモードに入っていたものが、ファームリセットで再起動した場合、メモリを通常モードに戻す必要がある。
     flashMemoryReleasePowerDown();
     
@@ -355,7 +715,38 @@ bool isFlashBusy(void)
     return ((status & STATUS_REGISTER_WIP) != 0);
 }
 
-void writeFlash(uint32_t address, uint8_t *p_buffer, uint8_t size)
+bool isFlashCommandQueueEmpty(void)
+{
+    return (m_context.queue.count == 0 && m_context.backgroundQueue.count == 0);
+}
+
+void waitFlashCommandQueueEmpty(void)
+{
+    while( ! isFlashCommandQueueEmpty() ) {
+        waitFlashCommandProgress();
+    }
+}
+
+void waitFlashCommandProgress(void)
+{
+    // 割り込みでコマンドが進むのを待つ。
+    // 割り込みハンドラの中から呼ばれた時は、スリープすると同じ優先度の割り込みで起こされない場合があるため、そのままループさせる。
+    if(current_int_priority_get() != APP_IRQ_PRIORITY_THREAD) {
+        return;
+    }
+
+    // スレッドモードでは、次の割り込みまでスリープする。
+    // 起動時のスーパーブロック読み出しはソフトデバイス有効化の前なので、その間は__WFE()を使う。
+    uint8_t is_softdevice_enabled = 0;
+    sd_softdevice_is_enabled(&is_softdevice_enabled);
+    if(is_softdevice_enabled) {
+        sd_app_evt_wait();
+    } else {
+        __WFE();
+    }
+}
+
+void writeFlashAsync(uint32_t address, uint8_t *p_buffer, uint32_t size, flash_command_callback_t callback, void *p_context)
 {
     // 末尾がフラッシュの領域を超える場合は、書き込み失敗
     ASSERT((address + size) < FLASH_BYTE_SIZE);
@@ -365,95 +756,174 @@ void writeFlash(uint32_t address, uint8_t *p_buffer, uint8_t size)
     uint32_t index = 0;
     uint32_t write_address = address;
     do {
-        // 1ページは256バイト。
-        // 255バイトまでなので、そのサイズで書き込み可能サイズを求める
-        int remainingSize  = (size - index);
-        int page_size      = 256 - (write_address % 256);
-        uint8_t write_size = (uint8_t) MIN(255, MIN(page_size, remainingSize));
-        // 書き込む。
-        rawWriteFlash(write_address, &(p_buffer[index]), write_size);
+        // 1ページは256バイト。ページをまたがないように書き込み可能サイズを求める
+        uint32_t remainingSize = (size - index);
+        uint32_t page_size     = MX25L25635F_PAGE_SIZE - (write_address % MX25L25635F_PAGE_SIZE);
+        uint16_t write_size    = (uint16_t) MIN(page_size, remainingSize);
+        // 書き込む。完了通知は最後のページのみ。
+        bool is_last = ((index + write_size) >= size);
+        enqueueProgram(write_address, &(p_buffer[index]), write_size, is_last ? callback : NULL, is_last ? p_context : NULL);
         // 書き込み位置を更新、全て書き終わるまで繰り返す
         index += write_size;
         write_address += write_size;
-        // 次に書き込む位置を示すwrite_addressが次のセクション先頭アドレスのときは、そのセクターを消去する。
-        if((write_address % MX25L25635F_SECTOR_SIZE) == 0) {
-            erase4kSector(write_address);
-        }
     } while (index < size);
 }
 
-void readFlash(uint32_t address, uint8_t *p_buffer, uint8_t size)
+void readFlashAsync(uint32_t address, uint8_t *p_buffer, uint32_t size, flash_command_callback_t callback, void *p_context)
 {
     // 末尾がフラッシュの領域を超える場合は、読み出し失敗
-    ASSERT((address + size) < FLASH_BYTE_SIZE);
+    ASSERT((address + size) <= FLASH_BYTE_SIZE);
+    
+    flash_command_t command;
+    // 高速読み出し。アドレスの後に8クロック(1バイト)のダミーサイクルが入る。
+    // 1回のコマンドで、ページやセクターの境界をまたいで連続して読み出せる。
+    command.opcode           = FLASH_CMD_FASTREAD4B;
+    command.hasAddress       = true;
+    command.dummyLength      = 1;
+    command.needsWriteEnable = false;
+    command.needsWaitReady   = false;
+    command.address          = address;
+    command.p_tx_data        = NULL;
+    command.p_rx_data        = p_buffer;
+    command.length           = size;
+    command.callback         = callback;
+    command.p_context        = p_context;
+    enqueueCommand(&m_context.queue, &command);
+}
+
+static void setEraseCommand(flash_command_t *p_command, uint8_t opcode, uint32_t address, flash_command_callback_t callback, void *p_context)
+{
+    // アドレスチェック。消去されるのは、アドレスを含むセクター(ブロック)全体。
+    ASSERT(address < MX25L25635F_FLASH_SIZE);
     
-//    NRF_LOG_PRINTF_DEBUG("readFlash:0x%04x, %d\n", address, size);
+    p_command->opcode           = opcode;
+    p_command->hasAddress       = true;
+    p_command->dummyLength      = 0;
+    p_command->needsWriteEnable = true;
+    p_command->needsWaitReady   = true;
+    p_command->address          = address;
+    p_command->p_tx_data        = NULL;
+    p_command->p_rx_data        = NULL;
+    p_command->length           = 0;
+    p_command->callback         = callback;
+    p_command->p_context        = p_context;
+}
+
+void erase4kSectorAsync(uint32_t address, flash_command_callback_t callback, void *p_context)
+{
+    flash_command_t command;
+    setEraseCommand(&command, FLASH_CMD_SE4B, address, callback, p_context);
+    enqueueCommand(&m_context.queue, &command);
     
+//    NRF_LOG_PRINTF_DEBUG("erase4kSector:0x%04x\n",address);
+}
+
+void eraseFlashAsync(uint32_t address, uint32_t size, flash_command_callback_t callback, void *p_context)
+{
+    ASSERT((address % MX25L25635F_SECTOR_SIZE) == 0);
+    ASSERT((size    % MX25L25635F_SECTOR_SIZE) == 0);
+    
+    while(size > 0) {
+        // アドレスの境界と残りサイズから、使える最大の消去単位を選ぶ
+        uint8_t  opcode;
+        uint32_t unit;
+        if((address % MX25L25635F_BLOCK64K_SIZE) == 0 && size >= MX25L25635F_BLOCK64K_SIZE) {
+            opcode = FLASH_CMD_BE4B;
+            unit   = MX25L25635F_BLOCK64K_SIZE;
+        } else if((address % MX25L25635F_BLOCK32K_SIZE) == 0 && size >= MX25L25635F_BLOCK32K_SIZE) {
+            opcode = FLASH_CMD_BE32K4B;
+            unit   = MX25L25635F_BLOCK32K_SIZE;
+        } else {
+            opcode = FLASH_CMD_SE4B;
+            unit   = MX25L25635F_SECTOR_SIZE;
+        }
+        
+        // コールバックは最後の消去にのみ設定する
+        const bool is_last = (size == unit);
+        flash_command_t command;
+        setEraseCommand(&command, opcode, address, is_last ? callback : NULL, is_last ? p_context : NULL);
+        enqueueCommand(&m_context.queue, &command);
+        
+        address += unit;
+        size    -= unit;
+    }
+}
+
+void erase4kSectorInBackground(uint32_t address, flash_command_callback_t callback, void *p_context)
+{
+    flash_command_t command;
+    setEraseCommand(&command, FLASH_CMD_SE4B, address, callback, p_context);
+    enqueueCommand(&m_context.backgroundQueue, &command);
+}
+
+void writeFlash(uint32_t address, uint8_t *p_buffer, uint32_t size)
+{
+    volatile bool is_completed = false;
+    writeFlashAsync(address, p_buffer, size, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
+}
+
+void readFlashSequential(uint32_t address, uint8_t *p_buffer, uint32_t size)
+{
     // サイズが0なら終了
     if(size == 0) {
         return ;
     }
     
-    uint32_t index = 0;
-    uint32_t read_address = address;
-    do {
-        // 256バイト単位で読みだすので、読み出し可能サイズを求める
-        int remainingSize  = (size - index);
-        int page_size      = 256 - (read_address % 256);
-        uint8_t read_size  = (uint8_t) MIN(255, MIN(page_size, remainingSize));
-        if(read_size <= 0) {
-//            return index;
-            return;
-        }
-        // 先頭セクターはファイル情報に使うので、1セクター分アドレスをずらす
-        rawReadFlash(read_address, &(p_buffer[index]), (uint8_t)read_size);
-        // 位置などを変更する
-        index         += read_size;
-        read_address  += read_size;
-    } while (index < size);
+    volatile bool is_completed = false;
+    readFlashAsync(address, p_buffer, size, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
+}
+
+void readFlash(uint32_t address, uint8_t *p_buffer, uint8_t size)
+{
+    readFlashSequential(address, p_buffer, size);
 }
 
 // 4kバイト単位のセクターのデータを消去します
 void erase4kSector(uint32_t address)
 {
-    // アドレスチェック
-    ASSERT(address < MX25L25635F_FLASH_SIZE);
-    
-    waitFlashReady();
-    
-    // weビットを立てる。
-    writeCommandWriteEnable();
-    
-    uint8_t buffer[4];
-    uint32ToByteArray(buffer, address);
-    writeToSPISlave( FLASH_CMD_SE4B, buffer, sizeof(buffer));
-    
-//    NRF_LOG_PRINTF_DEBUG("erase4kSector:0x%04x\n",address);
+    volatile bool is_completed = false;
+    erase4kSectorAsync(address, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
 }
 
 void formatFlash(uint32_t address, int size)
 {
-    ASSERT((address % MX25L25635F_SECTOR_SIZE) == 0);
-    ASSERT((size    % MX25L25635F_SECTOR_SIZE) == 0);
+    ASSERT(size >= 0);
     
-    const int count = size / MX25L25635F_SECTOR_SIZE;
-    for(int i=0; i < count; i++) {
-        erase4kSector(address);
-        address += MX25L25635F_SECTOR_SIZE;
+    if(size == 0) {
+        return;
     }
+    
+    volatile bool is_completed = false;
+    eraseFlashAsync(address, (uint32_t)size, syncCompletionHandler, (void *)&is_completed);
+    waitForCompletion(&is_completed);
+}
+
+void flashMemoryGetStatistics(flash_memory_statistics_t *p_statistics)
+{
+    *p_statistics = m_context.statistics;
+}
+
+void flashMemoryClearStatistics(void)
+{
+    memset(&(m_context.statistics), 0, sizeof(flash_memory_statistics_t));
 }
 
 void flashMemoryEnterDeepPowerDown(void)
 {
-    writeToSPISlave(FLASH_CMD_DEEP_POWER_DOWN , NULL, 0);
+    // キューのコマンドを全て終えてから、パワーダウンする
+    waitFlashCommandQueueEmpty();
+    executeSimpleCommand(FLASH_CMD_DEEP_POWER_DOWN , NULL, NULL, 0);
     nrf_delay_us(10); // tDP 10us
 }
 
 void flashMemoryReleasePowerDown(void)
 {
-    uint8_t tx_buffer[3];
-    uint8_t rx_buffer[1];
+    uint8_t rx_buffer[4];
     
-    transferToSPISlave(FLASH_CMD_RELEASE_POWER_DOWN,tx_buffer, sizeof(tx_buffer), rx_buffer, sizeof(rx_buffer));
+    // コマンドに続く3バイトのダミーの後に、Electronic IDが読み出される。
+    executeSimpleCommand(FLASH_CMD_RELEASE_POWER_DOWN, NULL, rx_buffer, sizeof(rx_buffer));
     nrf_delay_us(30); //tRES2 30us
 }
@@ -8,22 +8,71 @@
 
 #define  MX25L25635F_FLASH_SIZE  0x2000000  // 32 MB
 #define  MX25L25635F_SECTOR_SIZE 0x01000    // 4KB
+#define  MX25L25635F_BLOCK32K_SIZE 0x08000  // 32KB, ブロック消去(BE32K4B)の単位
+#define  MX25L25635F_BLOCK64K_SIZE 0x10000  // 64KB, ブロック消去(BE4B)の単位
+#define  MX25L25635F_PAGE_SIZE   0x00100    // 256B, ページプログラムの単位
+
+// ページプログラムとセクター消去の標準的な時間(マイクロ秒)。ログの書き込み帯域の見積もりに使う。
+#define  MX25L25635F_PAGE_PROGRAM_TYPICAL_US 600
+#define  MX25L25635F_SECTOR_ERASE_TYPICAL_US 45000
 
 #define FLASH_BYTE_SIZE MX25L25635F_FLASH_SIZE
 
+// フラッシュへのアクセス統計
+typedef struct {
+    uint32_t pageProgramCount; // ページプログラム(PP4B)の発行回数
+    uint32_t programByteCount; // プログラムしたバイト数
+    uint32_t sectorEraseCount; // セクター消去の回数
+    uint32_t blockEraseCount;  // ブロック消去(32KB/64KB)の回数
+    uint32_t readCount;        // 読み出しコマンドの発行回数
+    uint32_t eraseSuspendCount;// バックグラウンドの消去をサスペンドした回数
+} flash_memory_statistics_t;
+
+// コマンド完了のコールバック。SPIの割り込みコンテキスト(APP_IRQ_PRIORITY_LOW)から呼び出されます。
+typedef void (*flash_command_callback_t)(void *p_context);
+
 // 初期化関数。
 void initFlashMemory(void);
 
 bool isFlashBusy(void);
 
-void writeFlash(uint32_t address, uint8_t *data, uint8_t data_length);
+// 非同期API。コマンドはキューに積まれ、積まれた順に実行されます。完了時にcallbackが呼び出されます(NULLも可)。
+// バッファは完了まで保持しておくこと。キューがいっぱいの時は空くまで待つので、コールバックの中からは呼び出さないこと。
+// ページ境界で分割して書き込みます。書き込み先は消去済みであること。
+void writeFlashAsync(uint32_t address, uint8_t *p_buffer, uint32_t size, flash_command_callback_t callback, void *p_context);
+// 読み出しは、長さによらず1回の読み出しコマンドで行います。
+void readFlashAsync(uint32_t address, uint8_t *p_buffer, uint32_t size, flash_command_callback_t callback, void *p_context);
+void erase4kSectorAsync(uint32_t address, flash_command_callback_t callback, void *p_context);
+// 範囲を、アドレスの境界に合った最大の消去単位(64KB/32KB/4KB)に分けて消去します。callbackは最後の消去の完了時に呼び出されます。
+// アドレスとサイズは4KB単位であること。
+void eraseFlashAsync(uint32_t address, uint32_t size, flash_command_callback_t callback, void *p_context);
+// バックグラウンドでセクターを消去します。他のコマンドがない時に実行され、実行中に他のコマンドが積まれると、消去をサスペンドしてそちらを先に実行します。
+// 他のコマンドとの順序は保証されないので、完了通知を受けるまで、そのセクターを読み書きしないこと。
+void erase4kSectorInBackground(uint32_t address, flash_command_callback_t callback, void *p_context);
+
+// キューが空か(実行中のコマンドがないか)を返します。
+bool isFlashCommandQueueEmpty(void);
+// キューのコマンドが全て完了するまで待ちます。
+void waitFlashCommandQueueEmpty(void);
+// コマンドの完了をループで待つ時に、ループの中で呼び出します。実機では、スレッドモードなら次の割り込みまでスリープし、割り込みハンドラの中では何もしません。
+// ホストのエミュレータ(host/flash_emulator.c)では、模擬時刻を次のコマンド完了まで進めます。
+void waitFlashCommandProgress(void);
+
+// 同期API。非同期APIでコマンドを積み、完了するまで待ちます。
+void writeFlash(uint32_t address, uint8_t *data, uint32_t data_length);
 void readFlash(uint32_t address,  uint8_t *data, uint8_t data_length);
+// 任意の長さのデータを、1回の読み出しコマンドで連続して読み出します。
+void readFlashSequential(uint32_t address, uint8_t *p_buffer, uint32_t size);
 
 // 4kバイト単位のセクターのデータを消去します
 void erase4kSector(uint32_t address);
-// 4kバイト単位のセクター単位で、データを消去します
+// 範囲のデータを消去します。ブロック消去が使える範囲はブロック単位で消去します。
 void formatFlash(uint32_t address, int size);
 
+// アクセス統計を取得/クリアします。
+void flashMemoryGetStatistics(flash_memory_statistics_t *p_statistics);
+void flashMemoryClearStatistics(void);
+
 void flashMemoryEnterDeepPowerDown(void);
 void flashMemoryReleasePowerDown(void);
 #endif
@@ -0,0 +1,175 @@
+#include <string.h>
+
+#include <nrf_assert.h>
+#include <nordic_common.h>
+
+#include "superblock_controller.h"
+
+#include "spi_slave_mx25_flash_memory.h"
+#include "senstick_flash_address_definition.h"
+#include "senstick_device_definition.h"
+#include "value_types.h"
+
+// レコードのフォーマットのバージョン。レコードや領域の構造を変えたら更新する。
+#define SUPERBLOCK_VERSION 0x04
+
+// 1つのレコードのバイトサイズ。ページ境界をまたがないように、ページサイズの約数にする。
+#define SUPERBLOCK_RECORD_SIZE 128
+
+// 領域(1セクター)の構造
+//  先頭のスロット  インデックス。バイトiは、レコードiを書いたら0x00にする(未使用は0xff)。
+//  残りのスロット  レコード。レコードiは、i+1番目のスロットに置く。
+// 領域全体をRAMに読み込まずに、インデックスと最新のレコードの2回の読み出しでマウントする。領域を消去するのは、全てのスロットを使ってから。
+#define SUPERBLOCK_NUM_OF_RECORDS (SUPERBLOCK_STORAGE_SIZE / SUPERBLOCK_RECORD_SIZE - 1)
+#define SUPERBLOCK_RECORD_ADDRESS(index) (SUPERBLOCK_STORAGE_START_ADDRESS + ((index) + 1) * SUPERBLOCK_RECORD_SIZE)
+
+// レコードのフォーマット(リトルエンディアン)
+//  0       バージョン。0xffは未使用のレコード。
+//  1       フラグ。bit0 ログの記録中、bit1 ディスクフル
+//  2-3     ファームウェアのリビジョン。リビジョンが変わると、メタデータの領域がフォーマットされるので、レコードも無効にする。
+//  4       ログの数
+//  5-7     予約
+//  8-39    センサーごとの、最後のログのストリーム内の終端位置(4バイト x 8)
+//  40-79   センサーの設定(5バイト x 8)
+//  80-111  センサーの設定の、マイクロ秒の周期(4バイト x 8)
+//  112-119 センサーの設定の、間引き(1バイト x 8)
+//  120-125 予約
+//  126-127 チェックサム(Fletcher-16)
+#define RECORD_FLAG_LOG_OPEN   0x01
+#define RECORD_FLAG_DISK_FULL  0x02
+#define RECORD_DATA_END_OFFSET 8
+#define RECORD_SETTING_OFFSET  (RECORD_DATA_END_OFFSET + SUPERBLOCK_NUM_OF_SENSORS * sizeof(uint32_t))
+#define RECORD_SETTING_SIZE    5
+// センサーの設定の、マイクロ秒の周期。0ならミリ秒の周期を使う。予約領域だったので、以前のレコードでは0。
+#define RECORD_SETTING_PERIOD_OFFSET (RECORD_SETTING_OFFSET + SUPERBLOCK_NUM_OF_SENSORS * RECORD_SETTING_SIZE)
+// センサーの設定の、間引き。0なら使わない。予約領域だったので、以前のレコードでは0。
+#define RECORD_SETTING_DECIMATION_OFFSET (RECORD_SETTING_PERIOD_OFFSET + SUPERBLOCK_NUM_OF_SENSORS * sizeof(uint32_t))
+#define RECORD_CHECKSUM_OFFSET (SUPERBLOCK_RECORD_SIZE - 2)
+
+typedef struct {
+    bool         isMounted;
+    superblock_t superblock;
+    uint8_t      nextRecordIndex; // 次に書き込むレコードの位置
+} superblock_controller_context_t;
+
+static superblock_controller_context_t m_context;
+
+/**
+ * Private methods
+ */
+static uint16_t getChecksum(const uint8_t *p_data, int length)
+{
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    for(int i=0; i < length; i++) {
+        sum1 = (sum1 + p_data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+static void serializeRecord(uint8_t *p_dst, const superblock_t *p_src)
+{
+    memset(p_dst, 0, SUPERBLOCK_RECORD_SIZE);
+    
+    p_dst[0] = SUPERBLOCK_VERSION;
+    p_dst[1] = (p_src->isLogOpen ? RECORD_FLAG_LOG_OPEN : 0) | (p_src->isDiskFull ? RECORD_FLAG_DISK_FULL : 0);
+    uint16ToByteArrayLittleEndian(&p_dst[2], FIRMWARE_REVISION);
+    p_dst[4] = p_src->logCount;
+    for(int i=0; i < SUPERBLOCK_NUM_OF_SENSORS; i++) {
+        uint32ToByteArrayLittleEndian(&p_dst[RECORD_DATA_END_OFFSET + i * sizeof(uint32_t)], p_src->dataEndPosition[i]);
+        // マイクロ秒の周期と間引きは、5バイトの設定とは別の領域に置く
+        uint8_t setting[SENSOR_SERVICE_SETTING_MAX_SIZE];
+        serializesensor_service_setting(setting, (sensor_service_setting_t *)&(p_src->sensorSetting[i]));
+        memcpy(&p_dst[RECORD_SETTING_OFFSET + i * RECORD_SETTING_SIZE], setting, RECORD_SETTING_SIZE);
+        uint32ToByteArrayLittleEndian(&p_dst[RECORD_SETTING_PERIOD_OFFSET + i * sizeof(uint32_t)], p_src->sensorSetting[i].samplingPeriodUs);
+        p_dst[RECORD_SETTING_DECIMATION_OFFSET + i] = p_src->sensorSetting[i].decimation;
+    }
+    uint16ToByteArrayLittleEndian(&p_dst[RECORD_CHECKSUM_OFFSET], getChecksum(p_dst, RECORD_CHECKSUM_OFFSET));
+}
+
+// レコードを読み込みます。バージョン、リビジョン、チェックサムのいずれかが一致しなければfalseを返します。
+static bool deserializeRecord(superblock_t *p_dst, uint8_t *p_src)
+{
+    if(p_src[0] != SUPERBLOCK_VERSION
+       || readUInt16AsLittleEndian(&p_src[2]) != FIRMWARE_REVISION
+       || readUInt16AsLittleEndian(&p_src[RECORD_CHECKSUM_OFFSET]) != getChecksum(p_src, RECORD_CHECKSUM_OFFSET)) {
+        return false;
+    }
+    
+    p_dst->isLogOpen  = ((p_src[1] & RECORD_FLAG_LOG_OPEN)  != 0);
+    p_dst->isDiskFull = ((p_src[1] & RECORD_FLAG_DISK_FULL) != 0);
+    p_dst->logCount   = p_src[4];
+    for(int i=0; i < SUPERBLOCK_NUM_OF_SENSORS; i++) {
+        p_dst->dataEndPosition[i] = readUInt32AsLittleEndian(&p_src[RECORD_DATA_END_OFFSET + i * sizeof(uint32_t)]);
+        deserializesensor_service_setting(&(p_dst->sensorSetting[i]), &p_src[RECORD_SETTING_OFFSET + i * RECORD_SETTING_SIZE], RECORD_SETTING_SIZE);
+        p_dst->sensorSetting[i].samplingPeriodUs = readUInt32AsLittleEndian(&p_src[RECORD_SETTING_PERIOD_OFFSET + i * sizeof(uint32_t)]);
+        p_dst->sensorSetting[i].decimation       = p_src[RECORD_SETTING_DECIMATION_OFFSET + i];
+    }
+    return true;
+}
+
+/**
+ * Public methods
+ */
+void initSuperblockController(void)
+{
+    uint8_t index[SUPERBLOCK_NUM_OF_RECORDS];
+    uint8_t record[SUPERBLOCK_RECORD_SIZE];
+    
+    ASSERT(sizeof(index) <= SUPERBLOCK_RECORD_SIZE);
+    ASSERT(RECORD_SETTING_DECIMATION_OFFSET + SUPERBLOCK_NUM_OF_SENSORS <= RECORD_CHECKSUM_OFFSET);
+    memset(&m_context, 0, sizeof(superblock_controller_context_t));
+    
+    // レコードは先頭から順に追記されるので、インデックスで最後に書かれたレコードが最新。
+    readFlashSequential(SUPERBLOCK_STORAGE_START_ADDRESS, index, sizeof(index));
+    int last_index = -1;
+    for(int i=0; i < SUPERBLOCK_NUM_OF_RECORDS; i++) {
+        if(index[i] == 0xff) {
+            break;
+        }
+        last_index = i;
+    }
+    m_context.nextRecordIndex = last_index + 1;
+    
+    // 最新のレコードが壊れていれば(書き込み中の電源断)、古いレコードは使わず、マウントしない。
+    if(last_index >= 0) {
+        readFlashSequential(SUPERBLOCK_RECORD_ADDRESS(last_index), record, sizeof(record));
+        m_context.isMounted = deserializeRecord(&(m_context.superblock), record);
+    }
+}
+
+bool superblockRead(superblock_t *p_superblock)
+{
+    if( ! m_context.isMounted) {
+        return false;
+    }
+    *p_superblock = m_context.superblock;
+    return true;
+}
+
+void superblockWrite(const superblock_t *p_superblock)
+{
+    uint8_t record[SUPERBLOCK_RECORD_SIZE];
+    
+    if(m_context.nextRecordIndex >= SUPERBLOCK_NUM_OF_RECORDS) {
+        superblockFormat();
+    }
+    
+    // インデックスを先に書く。レコードの書き込み中に電源が落ちると、壊れたレコードが最新になり、マウントしない。
+    uint8_t used_mark = 0x00;
+    writeFlash(SUPERBLOCK_STORAGE_START_ADDRESS + m_context.nextRecordIndex, &used_mark, sizeof(used_mark));
+    serializeRecord(record, p_superblock);
+    writeFlash(SUPERBLOCK_RECORD_ADDRESS(m_context.nextRecordIndex), record, SUPERBLOCK_RECORD_SIZE);
+    m_context.nextRecordIndex++;
+    
+    m_context.isMounted  = true;
+    m_context.superblock = *p_superblock;
+}
+
+void superblockFormat(void)
+{
+    formatFlash(SUPERBLOCK_STORAGE_START_ADDRESS, SUPERBLOCK_STORAGE_SIZE);
+    m_context.isMounted       = false;
+    m_context.nextRecordIndex = 0;
+}
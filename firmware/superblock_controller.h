@@ -0,0 +1,33 @@
+#ifndef superblock_controller_h
+#define superblock_controller_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "senstick_sensor_base_data.h"
+
+// スーパーブロックが記録するセンサー数
+#define SUPERBLOCK_NUM_OF_SENSORS 8
+
+// スーパーブロック。起動時のマウントに必要な状態を、1つのレコードにまとめたもの。
+typedef struct {
+    uint8_t  logCount;    // 有効なログの数
+    bool     isDiskFull;  // ディスクフル
+    bool     isLogOpen;   // ログの記録中。記録中のリセットでは、従来の方法でマウントして、ログを復旧する。
+    uint32_t dataEndPosition[SUPERBLOCK_NUM_OF_SENSORS];        // センサーごとの、最後のログのストリーム内の終端位置
+    sensor_service_setting_t sensorSetting[SUPERBLOCK_NUM_OF_SENSORS]; // センサーの設定
+} superblock_t;
+
+// 初期化関数。スーパーブロックの領域のインデックスと最新のレコードを読み込み、マウントします。
+void initSuperblockController(void);
+
+// マウントしたスーパーブロックを取得します。有効なレコードがなければfalseを返します。
+bool superblockRead(superblock_t *p_superblock);
+
+// スーパーブロックのレコードを追記します。領域が一杯ならば、領域を消去して先頭に書き込みます。
+void superblockWrite(const superblock_t *p_superblock);
+
+// スーパーブロックの領域を消去します。次の起動は、ログのヘッダとメタデータを読む従来の方法でマウントします。
+void superblockFormat(void);
+
+#endif /* superblock_controller_h */
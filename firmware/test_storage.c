@@ -12,7 +12,10 @@
 #include "test_storage.h"
 #include "log_controller.h"
 
-static flash_address_info_t address_info = { 0x00000, 0x1000 * 12 };
+// テスト用のログのヘッダ領域。データは共有領域のエクステントに置かれる。
+static flash_address_info_t address_info = { 0x00000, 0x1000 };
+// テスト用のログの書き込みバッファ
+static uint8_t write_buffer[LOG_WRITE_BUFFER_SIZE];
 
 // 基本的なテスト
 void test01()
@@ -23,10 +26,11 @@ void test01()
 //    int hoge = 0x1234;
 //    flashRawWrite(&(p_stream->flash_context), 0, (uint8_t *)&hoge, sizeof(int));
     
+    formatLogPool();
     formatLog(&address_info);
     
     // 書き込みで開いてみる
-    createLog(&log_context, 0x00, 0, 0, &address_info);
+    createLog(&log_context, write_buffer, 0x00, 0, 0, &address_info);
     // 適当にデータを1つ書いてみる
     uint32_t data = 0x1234;
     writeLog(&log_context, (uint8_t *)&data, sizeof(uint32_t));
@@ -34,6 +38,12 @@ void test01()
     uint32_t read_data = 0;
     readLog(&log_context, (uint8_t *)&read_data, sizeof(uint32_t));
     ASSERT(read_data == 0x1234);
+    // 閉じると、バッファに残っていたデータがフラッシュに書き出される
+    closeLog(&log_context);
+    openLog(&log_context, 0x00, &address_info);
+    read_data = 0;
+    readLog(&log_context, (uint8_t *)&read_data, sizeof(uint32_t));
+    ASSERT(read_data == 0x1234);
 
 /*
     // 読み込み位置が移動しているかを確認
@@ -183,9 +193,154 @@ void testFlashMemory(void)
     }
 }
 
+static bool isErased(const uint8_t *p_data, int length)
+{
+    for(int i=0; i < length; i++) {
+        if(p_data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ブロック消去の確認。testFlashMemory()で書き込んだ範囲の一部を消去する。
+// 0x7000-0x40000 は、4kBセクター1つ(0x7000)、32kBブロック1つ(0x8000)、64kBブロック3つ(0x10000-0x30000)に分割されるはず。
+void testBlockErase(void)
+{
+    uint8_t rd_buffer[128];
+    flash_memory_statistics_t statistics;
+    
+    flashMemoryClearStatistics();
+    formatFlash(0x7000, 0x40000 - 0x7000);
+    flashMemoryGetStatistics(&statistics);
+    if(statistics.sectorEraseCount != 1 || statistics.blockEraseCount != 4) {
+        APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+    }
+    
+    // 範囲の内側は消去されている
+    const uint32_t erased_addresses[] = {0x7000, 0x8000, 0x10000, 0x3ff80};
+    for(int i=0; i < sizeof(erased_addresses) / sizeof(uint32_t); i++) {
+        readFlash(erased_addresses[i], rd_buffer, sizeof(rd_buffer));
+        if( ! isErased(rd_buffer, sizeof(rd_buffer))) {
+            APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+        }
+    }
+    // 範囲の外側は消去されていない
+    const uint32_t kept_addresses[] = {0x6f80, 0x40000};
+    for(int i=0; i < sizeof(kept_addresses) / sizeof(uint32_t); i++) {
+        readFlash(kept_addresses[i], rd_buffer, sizeof(rd_buffer));
+        if( isErased(rd_buffer, sizeof(rd_buffer))) {
+            APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+        }
+    }
+}
+
+// ログ書き込みのベンチマーク。6バイトのサンプルを逐次書き込み、ページプログラムの発行回数を確認する。
+// 書き込みバッファがなければサンプル数と同じ回数、あればおおよそ (総バイト数 / LOG_WRITE_BUFFER_SIZE) 回になる。
+void benchmarkLogWrite(void)
+{
+    const int num_of_samples = 1000;
+    log_context_t log_context;
+    flash_memory_statistics_t statistics;
+    uint8_t sample[6];
+    uint8_t rd_buffer[6];
+    
+    formatLogPool();
+    formatLog(&address_info);
+    createLog(&log_context, write_buffer, 0x00, 10, 0, &address_info);
+    
+    flashMemoryClearStatistics();
+    clearLogEraseStatistics();
+    srand(2);
+    for(int i = 0; i < num_of_samples; i++) {
+        for(int j=0; j < sizeof(sample); j++) {
+            sample[j] = (uint8_t) rand();
+        }
+        writeLog(&log_context, sample, sizeof(sample));
+    }
+    closeLog(&log_context);
+    waitFlashCommandQueueEmpty();
+    flashMemoryGetStatistics(&statistics);
+    log_erase_statistics_t erase_statistics;
+    getLogEraseStatistics(&erase_statistics);
+    
+    NRF_LOG_PRINTF_DEBUG("benchmarkLogWrite: samples:%d, page program:%d, program bytes:%d, erase:%d\n",
+                         num_of_samples, statistics.pageProgramCount, statistics.programByteCount, statistics.sectorEraseCount);
+    NRF_LOG_PRINTF_DEBUG("benchmarkLogWrite: erase-ahead margin min:%d, erase wait:%d, erase suspend:%d\n",
+                         erase_statistics.minEraseAheadMargin, erase_statistics.eraseWaitCount, statistics.eraseSuspendCount);
+    // ページプログラム数が、書き込みバッファの数に、閉じる時のサイズの書き込みと、消去済みビットマップの記録(先行消去したセクターごとに1回)を加えた数を超えないこと
+    const int num_of_marks = (num_of_samples * sizeof(sample)) / MX25L25635F_SECTOR_SIZE + 1 + LOG_ERASE_AHEAD_SECTORS;
+    if( statistics.pageProgramCount > ((num_of_samples * sizeof(sample) + LOG_WRITE_BUFFER_SIZE -1) / LOG_WRITE_BUFFER_SIZE + 1 + num_of_marks) ) {
+        APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+    }
+    
+    // 読み出して比較
+    openLog(&log_context, 0x00, &address_info);
+    srand(2);
+    for(int i = 0; i < num_of_samples; i++) {
+        if( readLog(&log_context, rd_buffer, sizeof(rd_buffer)) != sizeof(rd_buffer)) {
+            APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+        }
+        for(int j=0; j < sizeof(rd_buffer); j++) {
+            if( rd_buffer[j] != (uint8_t)rand() ) {
+                APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+            }
+        }
+    }
+}
+
+// ログ読み出しのベンチマーク。BLEのログ通知と同じく、20バイトのパケットに収まる3サンプルずつ読み出し、読み出しコマンドの発行回数を確認する。
+// キャッシュがなければサンプル数と同じ回数、あればおおよそ (総バイト数 / LOG_READ_CACHE_SIZE) 回になる。
+// 読み出し位置を戻した先がキャッシュの外ならば読み直すので、その分の余裕をみて判定する。
+void benchmarkLogRead(void)
+{
+    const int num_of_samples = 1000;
+    log_context_t log_context;
+    flash_memory_statistics_t statistics;
+    uint8_t sample[6];
+    
+    formatLogPool();
+    formatLog(&address_info);
+    createLog(&log_context, write_buffer, 0x00, 10, 0, &address_info);
+    for(int i = 0; i < num_of_samples; i++) {
+        memset(sample, (uint8_t)i, sizeof(sample));
+        writeLog(&log_context, sample, sizeof(sample));
+    }
+    closeLog(&log_context);
+    
+    openLog(&log_context, 0x00, &address_info);
+    flashMemoryClearStatistics();
+    int count = 0;
+    int packet = 0;
+    while(count < num_of_samples) {
+        uint32_t read_position = log_context.readPosition;
+        int      read_count    = count;
+        for(int i=0; i < 3 && count < num_of_samples; i++, count++) {
+            readLog(&log_context, sample, sizeof(sample));
+            if( sample[0] != (uint8_t)count ) {
+                APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+            }
+        }
+        // 10パケットに1回、通知に失敗して読み出し位置を戻す場合を模擬する
+        packet++;
+        if( (packet % 10) == 0 ) {
+            seekLog(&log_context, read_position);
+            count = read_count;
+        }
+    }
+    flashMemoryGetStatistics(&statistics);
+    
+    NRF_LOG_PRINTF_DEBUG("benchmarkLogRead: samples:%d, read:%d\n", num_of_samples, statistics.readCount);
+    if( statistics.readCount > 2 * ((num_of_samples * sizeof(sample) + LOG_READ_CACHE_SIZE -1) / LOG_READ_CACHE_SIZE + 1) ) {
+        APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+    }
+}
 
 void do_storage_test()
 {
 //    test01(p_stream);
     testFlashMemory();
+    testBlockErase();
+    benchmarkLogWrite();
+    benchmarkLogRead();
 }
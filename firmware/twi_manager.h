@@ -7,14 +7,69 @@
 #include <sdk_errors.h>
 #include <nrf_drv_twi.h>
 
+// トランザクションで送信する最大バイト数(レジスタアドレスを含む)
+#define TWI_TRANSACTION_MAX_TX_LENGTH 8
+
+// 400kHzで、1バイト(8ビットとACK)の転送時間(ナノ秒)
+#define TWI_BYTE_TIME_NS 22500
+
+// トランザクションの完了ハンドラ。TWIの割り込みから呼び出されます。
+typedef void (* twi_transaction_handler_t)(bool is_success, void *p_context);
+
+// TWIのトランザクション。送信(txLength > 0)、受信(rxLength > 0)、または送信に続けてリピーテッドスタートで受信します。
+typedef struct {
+    uint8_t  address;
+    uint8_t  txLength;
+    uint8_t  txData[TWI_TRANSACTION_MAX_TX_LENGTH];
+    uint8_t  rxLength;
+    uint8_t  *p_rxData;                 // 完了まで有効なバッファ
+    twi_transaction_handler_t handler;  // NULLなら完了を通知しない
+    void     *p_context;
+} twi_transaction_t;
+
 void initTWIManager(void);
 
+// トランザクションをバス(アドレスで決まる)のキューに積み、すぐに返ります。キューがいっぱいならfalseを返します。
+// トランザクションはバスごとに積んだ順に実行され、完了するとハンドラが呼び出されます。割り込みの中から呼び出せます。
+bool twiEnqueueTransaction(const twi_transaction_t *p_transaction);
+// レジスタの読み出しを積みます。p_dataは完了まで有効なこと。
+bool twiEnqueueRead(uint8_t twi_address, uint8_t target_register, uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context);
+// 送信を積みます。データはキューにコピーされます。lengthはTWI_TRANSACTION_MAX_TX_LENGTHまで。
+bool twiEnqueueWrite(uint8_t twi_address, const uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context);
+// 受信を積みます。p_dataは完了まで有効なこと。
+bool twiEnqueueReceive(uint8_t twi_address, uint8_t *p_data, uint8_t length, twi_transaction_handler_t handler, void *p_context);
+
+// 積まれたトランザクションが全て完了するまで待ちます。完了まで待つ呼び出しと同じく、TWIの割り込みより優先度の高い割り込みから呼び出さないこと。
+void twiWaitForIdle(void);
+
 // TWIバスアクセス
+// 以下は完了まで待ちます。TWIの割り込みより優先度の高い割り込み(センサーのTIMER2、GPIOTEと同じ優先度を含む)から呼び出さないこと。
 ret_code_t TwiSlave_TX(uint8_t address, uint8_t const *p_data, uint32_t length, bool xfer_pending);
 ret_code_t TwiSlave_RX(uint8_t address, uint8_t *p_data, uint32_t length);
 bool writeToTwiSlave(uint8_t twi_address, uint8_t target_register, const uint8_t *data, uint8_t length);
 bool readFromTwiSlave(uint8_t twi_address, uint8_t target_register, uint8_t *data, uint8_t length);
 
+#ifdef NRF52
+// twi0の周期読み出し。TIMER3のコンペアからPPIでTWIMを起動して、レジスタの読み出しをCPUを介さずに繰り返します。
+// 受信データはEasyDMAのリストモードで、RAMのリングバッファにサンプルの順に並びます。CPUはbatch_sizeサンプルごとにだけ起きます。
+// リングの末尾では、CPUが受信の位置を先頭に戻すまで読み出しを止めるので、その割り込みの遅れが(周期 - 転送時間)を超えると、サンプルを取りこぼします。
+#define TWI_PERIODIC_READ_MAX_SAMPLE_SIZE 20
+#define TWI_PERIODIC_READ_MAX_BATCH_SIZE  32
+// 周期の最小値。400kHzで、アドレスとレジスタを含めて20バイトの読み出しは約520マイクロ秒。
+#define TWI_PERIODIC_READ_MIN_PERIOD_US   600
+
+// 周期読み出しのハンドラ。TIMER4の割り込み(TWIと同じ優先度)から、リングバッファの中の連続したcount個のサンプルが渡されます。
+typedef void (* twi_periodic_read_handler_t)(const uint8_t *p_samples, uint8_t count);
+
+// twi0のキューが空くのを待って、twi_addressのtarget_registerからsample_sizeバイトを、period_usマイクロ秒ごとに読み出し始めます。
+// 読み出しの間、twi0に積んだトランザクションは、twiStopPeriodicRead()まで開始されません。完了まで待つ呼び出しはしないこと。
+// period_usがTWI_PERIODIC_READ_MIN_PERIOD_USより短い、または読み出し中なら、falseを返します。
+bool twiStartPeriodicRead(uint8_t twi_address, uint8_t target_register, uint8_t sample_size, uint32_t period_us, uint8_t batch_size, twi_periodic_read_handler_t handler);
+// 周期読み出しを止めて、バッチに満たない残りのサンプルをハンドラに渡します。リングの折り返しで、トリガーを取りこぼした回数を返します。
+// 完了まで待つ呼び出しと同じく、TWIの割り込みより優先度の高い割り込みから呼び出さないこと。
+uint32_t twiStopPeriodicRead(void);
+#endif
+
 void twiPowerUp(void);
 void twiPowerDown(void);
 
@@ -27,6 +27,10 @@ typedef enum {
  * Private methods
  */
 
+// 読み出し中は、ハンドラがNULLではない。
+static sensor_data_ready_handler_t _readHandler;
+static uint8_t _readBuffer[2];
+
 static bool writeToBH1780GLI(uint8_t target_reg, uint8_t data)
 {
     return writeToTwiSlave(TWI_BH1780GLI_ADDRESS, target_reg, &data, 1);
@@ -44,6 +48,8 @@ bool initBrightnessSensor(void)
     //      "10" : Resv
     //      "11" : Power up
 
+    _readHandler = NULL;
+    
     // Power up
     bool result = writeToBH1780GLI((uint8_t)Control | (uint8_t)0x80, 0x03);
     
@@ -53,26 +59,32 @@ bool initBrightnessSensor(void)
 void triggerBrightnessData(void)
 {
     // 読み出しレジスタのアドレスを設定
-    ret_code_t err_code;
-    uint8_t data = 0x80 | (uint8_t)DataLow; // 1000_1100
-    err_code = nrf_drv_twi_tx(&twi, TWI_BH1780GLI_ADDRESS, &data, 1, false);
-    APP_ERROR_CHECK(err_code);
+    const uint8_t data[] = {0x80 | (uint8_t)DataLow}; // 1000_1100
+    twiEnqueueWrite(TWI_BH1780GLI_ADDRESS, data, sizeof(data), NULL, NULL);
 }
 
-void getBrightnessData(BrightnessData_t *p_data)
+static void brightnessReadHandler(bool is_success, void *p_context)
+{
+    sensor_data_ready_handler_t handler = _readHandler;
+    _readHandler = NULL;
+    if( ! is_success ) {
+        return;
+    }
+    BrightnessData_t data = (uint16_t)_readBuffer[1] << 8 | (uint16_t)_readBuffer[0];
+//    NRF_LOG_PRINTF_DEBUG("requestBrightnessData() 0x%02x\n", data);
+    (handler)((const uint8_t *)&data, sizeof(data));
+}
+
+bool requestBrightnessData(sensor_data_ready_handler_t handler)
 {
     // データを読み出し。トリガーがかかっていること、トリガーから150ミリ秒が経過していることを前提としている。
-    ret_code_t err_code;
-    uint8_t buffer[2];
-#ifdef NRF51
-    err_code = nrf_drv_twi_rx(&twi, TWI_BH1780GLI_ADDRESS, buffer, 2, false);
-    APP_ERROR_CHECK(err_code);
-#else // NRF52
-    err_code = nrf_drv_twi_rx(&twi, TWI_BH1780GLI_ADDRESS, buffer, 2);
-    APP_ERROR_CHECK(err_code);
-#endif
-    
-    *p_data = (uint16_t)buffer[1] << 8 | (uint16_t)buffer[0];
-    
-//    NRF_LOG_PRINTF_DEBUG("getBrightnessData() 0x%02x\n", *p_data);
+    if(_readHandler != NULL) {
+        return false;
+    }
+    _readHandler = handler;
+    if( ! twiEnqueueReceive(TWI_BH1780GLI_ADDRESS, _readBuffer, sizeof(_readBuffer), brightnessReadHandler, NULL) ) {
+        _readHandler = NULL;
+        return false;
+    }
+    return true;
 }
@@ -15,7 +15,9 @@ bool initBrightnessSensor(void);
 
 // 単位 lx
 // 変換時間約150ミリ秒
+// トリガーは、TWIのキューに積んですぐに返ります。
 void triggerBrightnessData(void);
-void getBrightnessData(BrightnessData_t *p_data);
+// データの読み出しをTWIのキューに積みます。完了するとhandlerにBrightnessData_tが渡されます。前の読み出しが終わっていなければfalseを返します。
+bool requestBrightnessData(sensor_data_ready_handler_t handler);
 
 #endif /* twi_slave_brightness_sensor_h */
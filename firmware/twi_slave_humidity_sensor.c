@@ -36,6 +36,10 @@ typedef enum {
  * Private methods
  */
 
+// 読み出し中は、ハンドラがNULLではない。
+static sensor_data_ready_handler_t _readHandler;
+static uint8_t _readBuffer[3];
+
 static bool writeToSHT20(const SHT20Command_t command, const uint8_t *p_data, const uint8_t data_length)
 {
     return writeToTwiSlave(TWI_SHT20_ADDRESS, (uint8_t)command, p_data, data_length);
@@ -45,11 +49,26 @@ static bool readFromSHT20(const SHT20Command_t command, uint8_t *data, const uin
     return readFromTwiSlave(TWI_SHT20_ADDRESS, (uint8_t)command, data, data_length);
 }
 
+static void measurementReadHandler(bool is_success, void *p_context)
+{
+    sensor_data_ready_handler_t handler = _readHandler;
+    _readHandler = NULL;
+    if( ! is_success ) {
+        NRF_LOG_PRINTF_DEBUG("\nrequestMeasurementData() failed.");
+        return;
+    }
+    // データをデコードする
+    const uint16_t data = (((uint16_t)_readBuffer[0] << 8) | (uint16_t)_readBuffer[1]); // & 0x07ff;
+    (handler)((const uint8_t *)&data, sizeof(data));
+}
+
 /**
 * public methods
 */
 bool initHumiditySensor(void)
 {
+    _readHandler = NULL;
+    
     // ソフトウェア・リセット
     writeToSHT20(SoftReset, NULL, 0);
     nrf_delay_ms(15); // リセット処理待ち
@@ -88,55 +107,42 @@ bool initHumiditySensor(void)
     return result;
 }
 
-// 湿度及び温度の測定トリガ。
+// 測定値の読み出しを積みます。湿度と温度は同じ形式(3バイト、上位から2バイトが値、最後はチェックサム)。
+static bool requestMeasurementData(sensor_data_ready_handler_t handler)
+{
+    if(_readHandler != NULL) {
+        return false;
+    }
+    _readHandler = handler;
+    if( ! twiEnqueueReceive(TWI_SHT20_ADDRESS, _readBuffer, sizeof(_readBuffer), measurementReadHandler, NULL) ) {
+        _readHandler = NULL;
+        return false;
+    }
+    return true;
+}
+
+// 湿度及び温度の測定トリガ。トリガーは、TWIのキューに積んですぐに返る。
 void triggerHumidityMeasurement(void)
 {
-    ret_code_t err_code;
-    uint8_t data = TriggerRHMeasurement;
-    err_code = TwiSlave_TX(TWI_SHT20_ADDRESS, &data, 1, false);
-    APP_ERROR_CHECK(err_code);
+    const uint8_t data[] = {TriggerRHMeasurement};
+    twiEnqueueWrite(TWI_SHT20_ADDRESS, data, sizeof(data), NULL, NULL);
 }
 
 // 計測時間中はI2Cバスを離さない。
 // 相対湿度計測 12-bit精度 typ 22ミリ秒 max 30ミリ秒
 // 温度計測 14-bit精度 typ 66ミリ秒 max 85ミリ秒
-void getHumidityData(HumidityData_t *p_data)
+bool requestHumidityData(sensor_data_ready_handler_t handler)
 {
-    ret_code_t err_code;
-    uint8_t buffer[3];
-    err_code = TwiSlave_RX(TWI_SHT20_ADDRESS, buffer, 3);
-    if(err_code == NRF_SUCCESS) {
-        *p_data = (((uint16_t)buffer[0] << 8) | (uint16_t)buffer[1]);
-    } else {
-        NRF_LOG_PRINTF_DEBUG("\ngetHumidityData() err_code:0x%04x.", err_code);
-    }
-    /*
-    uint8_t buffer[3];
-    readFromSHT20(TriggerRHMeasurementHoldMaster, buffer, 3);
-    */
-    
-    // データをデコードする
-    *p_data = (((uint16_t)buffer[0] << 8) | (uint16_t)buffer[1]); // & 0x07ff;
-//NRF_LOG_PRINTF_DEBUG("getHumidityData() 0x%04x\n", *p_data);
+    return requestMeasurementData(handler);
 }
 
 void triggerTemperatureMeasurement(void)
 {
-    ret_code_t err_code;
-    uint8_t data = TriggerTempMeasurement;
-    err_code = TwiSlave_TX(TWI_SHT20_ADDRESS, &data, 1, false);
-    APP_ERROR_CHECK(err_code);
+    const uint8_t data[] = {TriggerTempMeasurement};
+    twiEnqueueWrite(TWI_SHT20_ADDRESS, data, sizeof(data), NULL, NULL);
 }
 
-void getTemperatureData(TemperatureData_t *p_data)
+bool requestTemperatureData(sensor_data_ready_handler_t handler)
 {
-    ret_code_t err_code;
-    uint8_t buffer[3];
-    err_code = TwiSlave_RX(TWI_SHT20_ADDRESS, buffer, 3);
-    if(err_code == NRF_SUCCESS) {
-        *p_data = (((uint16_t)buffer[0] << 8) | (uint16_t)buffer[1]);
-    } else {
-        NRF_LOG_PRINTF_DEBUG("\ngetHumidityData() err_code:0x%04x.", err_code);
-    }
-//NRF_LOG_PRINTF_DEBUG("getTemperatureData() 0x%04x\n", *p_data);
+    return requestMeasurementData(handler);
 }
@@ -25,12 +25,15 @@ bool initHumiditySensor(void);
 // 計測時間中はI2Cバスを離さない。
 // 相対湿度計測 11-bit精度 typ 12ミリ秒 max 15ミリ秒
 // 変換式、仕様書10ページ、RH = -6 + 125 * SRH / 2^(16)
+// トリガーはTWIのキューに積んですぐに返ります。読み出しはキューに積み、完了するとhandlerにHumidityData_tが渡されます。
+// 前の読み出しが終わっていなければfalseを返します。
 void triggerHumidityMeasurement(void);
-void getHumidityData(HumidityData_t *p_data);
+bool requestHumidityData(sensor_data_ready_handler_t handler);
 
 // 温度計測 11-bit typ. 9ミリ秒 max 11ミリ秒
 // 変換式、仕様書10ページ、T = -46.85 + 175.72 * St/ 2^(16)
+// 読み出しが完了すると、handlerにTemperatureData_tが渡されます。
 void triggerTemperatureMeasurement(void);
-void getTemperatureData(TemperatureData_t *p_data);
+bool requestTemperatureData(sensor_data_ready_handler_t handler);
 
 #endif /* twi_slave_humidity_sensor_h */
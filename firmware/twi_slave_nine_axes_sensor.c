@@ -6,6 +6,7 @@
 #include <nrf_assert.h>
 #include <app_error.h>
 #include <sdk_errors.h>
+#include <nrf_drv_gpiote.h>
 
 #include "value_types.h"
 #include "twi_manager.h"
@@ -25,8 +26,12 @@
 // レジスタアドレスの列挙型
 typedef enum {
     // 加速度、ジャイロセンサー
+    SMPLRT_DIV      = 0x19,
+    CONFIG          = 0x1a,
     GYRO_CONFIG     = 0x1b,
     ACCEL_CONFIG    = 0x1c,
+    ACCEL_CONFIG2   = 0x1d,
+    FIFO_EN         = 0x23,
     PWR_MGMT_1      = 0x6b,
     PWR_MGMT_2      = 0x6c,
     ACCEL_XOUT_H    = 0x3b,
@@ -36,13 +41,23 @@ typedef enum {
     I2C_SLV0_ADDR   = 0x25,
     I2C_SLV0_REG    = 0x26,
     I2C_SLV0_CTRL   = 0x27,
+    I2C_SLV4_CTRL   = 0x34,
     EXT_SENS_DATA_00= 0x49,
+    I2C_MST_DELAY_CTRL = 0x67,
     
     USER_CTRL = 0x6a,
     INT_PIN_CFG = 0x37,
+    INT_ENABLE  = 0x38,
     
+    FIFO_COUNTH     = 0x72,
+    FIFO_R_W        = 0x74,
 } MPU9250Register_t;
 
+// FIFOの大きさ(バイト)
+#define MPU9250_FIFO_SIZE 512
+// 1回のI2Cの読み出しの最大バイト数。TWIドライバの転送長はuint8_t。12バイト(加速度とジャイロ)、6バイトのフレームの倍数にする。
+#define FIFO_BURST_READ_SIZE 252
+
 typedef enum {
     ST1   = 0x02,
     HXL   = 0x03,
@@ -55,6 +70,85 @@ typedef enum {
  */
 static bool _isActive;
 
+// ジャイロの範囲。チップのリセット後の値は、250dps。
+static RotationRange_t _rotationRange;
+
+// FIFOに入れるセンサー。FIFOの1フレームは、レジスタアドレス順に、加速度(6バイト)、ジャイロ(6バイト)が並ぶ。
+static bool _isAccelerationInFifo;
+static bool _isRotationRateInFifo;
+static uint8_t _fifoFrameSize;
+
+// データレディ割り込みのハンドラ。NULLなら割り込みを使っていない。
+static nine_axes_data_ready_handler_t _dataReadyHandler;
+
+#ifndef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+// バイパスでの地磁気の非同期の読み出し。読み出し中は、handlerがNULLではない。
+typedef struct {
+    uint8_t buffer[7];
+    sensor_data_ready_handler_t handler;
+} nine_axes_read_t;
+static nine_axes_read_t _magneticFieldRead;
+#endif
+
+// 加速度、温度、ジャイロのデータレジスタは、ACCEL_XOUT_HからGYRO_ZOUT_Lまで連続した14バイト。
+// I2Cマスターで読んだ地磁気は、その直後のEXT_SENS_DATA_00から(HXLからHZHの6バイト)。
+#define MOTION_BLOCK_SIZE           20
+
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+// USER_CTRLのI2C_MST_EN。USER_CTRLを書き込むときは、常にこのビットを含める。
+#define USER_CTRL_I2C_MST_EN 0x20
+#else
+#define USER_CTRL_I2C_MST_EN 0x00
+#endif
+
+// 読み出しステージで取得するデータ
+typedef enum {
+    MOTION_SLICE_ACCELERATION   = 0,
+    MOTION_SLICE_ROTATION_RATE  = 1,
+    MOTION_SLICE_MAGNETIC_FIELD = 2,
+    NUM_OF_MOTION_SLICES        = 3,
+} motion_slice_t;
+
+// ブロックの中の、各データの位置(ACCEL_XOUT_Hからのオフセット)
+static const uint8_t _motionSliceOffsets[NUM_OF_MOTION_SLICES] = { 0, 8, 14 };
+
+// 加速度、ジャイロ(、地磁気)の読み出しステージ。要求されたセンサーの分を1回のI2Cの読み出しで取得して、各ハンドラに切り出して渡す。
+typedef struct {
+    // 次の読み出しで渡すハンドラ。NULLなら要求されていない。
+    sensor_data_ready_handler_t pendingHandlers[NUM_OF_MOTION_SLICES];
+    // 読み出し中のハンドラ
+    sensor_data_ready_handler_t handlers[NUM_OF_MOTION_SLICES];
+    // 全てのデータを同じサンプルとして受け取るハンドラ(requestNineAxesMotionData())と、サンプルの時刻。次の読み出しの分と、読み出し中の分。
+    nine_axes_motion_handler_t pendingSampleHandler;
+    nine_axes_motion_handler_t sampleHandler;
+    uint32_t pendingSampleTimestampUs;
+    uint32_t sampleTimestampUs;
+    bool isReading;
+    uint8_t buffer[MOTION_BLOCK_SIZE];
+} nine_axes_motion_read_t;
+static nine_axes_motion_read_t _motionRead;
+
+// FIFOの非同期の読み出し。読み出し中は、handlerがNULLではない。
+typedef struct {
+    nine_axes_fifo_handler_t handler;
+    uint8_t countBuffer[2];
+    uint8_t remainingFrames;
+    uint8_t burstFrames;
+    uint8_t buffer[FIFO_BURST_READ_SIZE];
+    NineAxesFifoData_t samples[FIFO_BURST_READ_SIZE / sizeof(AccelerationData_t)];
+} nine_axes_fifo_read_t;
+static nine_axes_fifo_read_t _fifoRead;
+
+#ifdef NRF52
+// ハードウェアの周期読み出し。リングバッファのブロックをデコードしてハンドラに渡す。周期読み出しをしていなければ、handlerはNULL。
+typedef struct {
+    nine_axes_fifo_handler_t handler;
+    uint8_t blockSize;
+    NineAxesFifoData_t samples[TWI_PERIODIC_READ_MAX_BATCH_SIZE];
+} nine_axes_periodic_read_t;
+static nine_axes_periodic_read_t _periodicRead;
+#endif
+
 // MPU9250に書き込みます。
 // TWI_MPU9250_ADDRESS は senstick_io_definitions.h で定義されているI2Cバスのアドレスです。
 static bool writeToMPU9250(MPU9250Register_t target_register, const uint8_t *data, uint8_t data_length)
@@ -73,10 +167,286 @@ static void writeToAK8963(AK8963Register_t target_register, const uint8_t *data,
     writeToTwiSlave(TWI_AK8963_ADDRESS, (uint8_t)target_register, data, data_length);
 }
 
-// MPU9250から読み込みます。
-static void readFromAK8963(AK8963Register_t target_register, uint8_t *data, uint8_t data_length)
+// 加速度とジャイロのサンプリング周期を設定します。
+static void setSampleRate(uint8_t period_ms)
+{
+    // Register 26 – Configuration
+    // D6: FIFO_MODE        1   1- FIFOがいっぱいになったら、それ以上書き込まない。(0は古いデータを上書き)
+    // D5: EXT_SYNC_SET     0
+    // D2: DLPF_CFG[2:0]    1   ジャイロの帯域 184Hz。内部のサンプリングは1kHz。(0と7は8kHzで、SMPLRT_DIVが効かない)
+    const uint8_t config[] = {0x41};
+    writeToMPU9250(CONFIG, config, sizeof(config));
+    
+    // Register 29 – Accelerometer Configuration 2
+    // D3: ACCEL_FCHOICE_B  0
+    // D2: A_DLPF_CFG[2:0]  1   加速度の帯域 218Hz。内部のサンプリングは1kHz。
+    const uint8_t accel_config2[] = {0x01};
+    writeToMPU9250(ACCEL_CONFIG2, accel_config2, sizeof(accel_config2));
+    
+    // Register 25 – Sample Rate Divider
+    // SAMPLE_RATE = 1kHz / (1 + SMPLRT_DIV)
+    const uint8_t smplrt_div[] = { period_ms - 1 };
+    writeToMPU9250(SMPLRT_DIV, smplrt_div, sizeof(smplrt_div));
+    
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+    // I2Cマスターは、サンプリングの(1 + I2C_MST_DLY)回に1回、AK8963を読み出す。AK8963の更新周期(10ミリ秒)より頻繁に読まないようにする。
+    // Register 52 – I2C Slave 4 Control  D4-D0: I2C_MST_DLY
+    // Register 103 – I2C Master Delay Control  D0: I2C_SLV0_DLY_EN
+    const uint8_t i2c_mst_dly[]    = { (period_ms < 10) ? (10 / period_ms - 1) : 0 };
+    const uint8_t mst_delay_ctrl[] = { (i2c_mst_dly[0] > 0) ? 0x01 : 0x00 };
+    writeToMPU9250(I2C_SLV4_CTRL,      i2c_mst_dly,    sizeof(i2c_mst_dly));
+    writeToMPU9250(I2C_MST_DELAY_CTRL, mst_delay_ctrl, sizeof(mst_delay_ctrl));
+#endif
+}
+
+// INTピンのGPIOTEの割り込みハンドラ
+static void gpioteEventHandler(nrf_drv_gpiote_pin_t pin, nrf_gpiote_polarity_t action)
+{
+    if(_dataReadyHandler != NULL) {
+        (_dataReadyHandler)();
+    }
+}
+
+// FIFOの読み出しバイト列を、サンプルにデコードします。
+static void decodeFifoFrames(uint8_t *p, NineAxesFifoData_t *p_data, uint8_t frames)
+{
+    for(int i = 0; i < frames; i++) {
+        NineAxesFifoData_t *p_frame = &(p_data[i]);
+        if(_isAccelerationInFifo) {
+            p_frame->acceleration.x = readInt16AsBigEndian(&(p[0]));
+            p_frame->acceleration.y = readInt16AsBigEndian(&(p[2]));
+            p_frame->acceleration.z = readInt16AsBigEndian(&(p[4]));
+            p += sizeof(AccelerationData_t);
+        }
+        if(_isRotationRateInFifo) {
+            p_frame->rotationRate.x = readInt16AsBigEndian(&(p[0]));
+            p_frame->rotationRate.y = readInt16AsBigEndian(&(p[2]));
+            p_frame->rotationRate.z = readInt16AsBigEndian(&(p[4]));
+            p += sizeof(RotationRateData_t);
+        }
+    }
+}
+
+// FIFOのバイト数から、読み出すフレーム数を返します。FIFOが溢れていれば、FIFOをリセットして0を返します。
+static uint8_t getFifoFrameCount(const uint8_t *p_count_buffer, bool is_blocking)
+{
+    // FIFO_COUNTH, FIFO_COUNTL。13ビットのバイト数。
+    const uint16_t fifo_count = readUInt16AsBigEndian((uint8_t *)p_count_buffer) & 0x1fff;
+    
+    // FIFOがいっぱいになると(FIFO_MODE=1)、フレームの途中で書き込みが止まり、フレームの区切りがずれる。FIFOをリセットして捨てる。
+    // いっぱいでなければ、残りがフレームより少なくても溢れてはいない(12バイトのフレームで504バイト、6バイトで510バイトなど)。
+    if(fifo_count >= MPU9250_FIFO_SIZE) {
+        const uint8_t user_ctrl[] = {(uint8_t)USER_CTRL, 0x44 | USER_CTRL_I2C_MST_EN};
+        if(is_blocking) {
+            writeToMPU9250(USER_CTRL, &(user_ctrl[1]), 1);
+        } else {
+            twiEnqueueWrite(TWI_MPU9250_ADDRESS, user_ctrl, sizeof(user_ctrl), NULL, NULL);
+        }
+        return 0;
+    }
+    // 書き込み途中のフレームは、次の読み出しに残す。
+    return fifo_count / _fifoFrameSize;
+}
+
+// ACCEL_XOUT_Hから読み出したブロックから、データを切り出します。
+static void decodeMotionSlice(const uint8_t *p_block, motion_slice_t slice, AccelerationData_t *p_data)
+{
+    // AccelerationData_t、RotationRateData_t、MagneticFieldData_tは同じ並び。加速度とジャイロはビッグエンディアン、地磁気はリトルエンディアン。
+    const uint8_t *p = &(p_block[_motionSliceOffsets[slice]]);
+    if(slice == MOTION_SLICE_MAGNETIC_FIELD) {
+        p_data->x = readInt16AsLittleEndian((uint8_t *)&(p[0]));
+        p_data->y = readInt16AsLittleEndian((uint8_t *)&(p[2]));
+        p_data->z = readInt16AsLittleEndian((uint8_t *)&(p[4]));
+    } else {
+        p_data->x = readInt16AsBigEndian((uint8_t *)&(p[0]));
+        p_data->y = readInt16AsBigEndian((uint8_t *)&(p[2]));
+        p_data->z = readInt16AsBigEndian((uint8_t *)&(p[4]));
+    }
+}
+
+// 読み出したブロックから、データを切り出してハンドラに渡します。
+static void passMotionSlice(motion_slice_t slice, sensor_data_ready_handler_t handler)
+{
+    if(handler == NULL) {
+        return;
+    }
+    AccelerationData_t data;
+    decodeMotionSlice(_motionRead.buffer, slice, &data);
+    (handler)((const uint8_t *)&data, sizeof(data));
+}
+
+static void motionReadHandler(bool is_success, void *p_context)
+{
+    sensor_data_ready_handler_t handlers[NUM_OF_MOTION_SLICES];
+    memcpy(handlers, _motionRead.handlers, sizeof(handlers));
+    memset(_motionRead.handlers, 0, sizeof(_motionRead.handlers));
+    nine_axes_motion_handler_t sample_handler = _motionRead.sampleHandler;
+    const uint32_t sample_timestamp_us        = _motionRead.sampleTimestampUs;
+    _motionRead.sampleHandler = NULL;
+    _motionRead.isReading     = false;
+    if( ! is_success ) {
+        return;
+    }
+    for(int i = 0; i < NUM_OF_MOTION_SLICES; i++) {
+        passMotionSlice((motion_slice_t)i, handlers[i]);
+    }
+    if(sample_handler != NULL) {
+        NineAxesFifoData_t sample;
+        memset(&sample, 0, sizeof(sample));
+        decodeMotionSlice(_motionRead.buffer, MOTION_SLICE_ACCELERATION,  &(sample.acceleration));
+        decodeMotionSlice(_motionRead.buffer, MOTION_SLICE_ROTATION_RATE, (AccelerationData_t *)&(sample.rotationRate));
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+        decodeMotionSlice(_motionRead.buffer, MOTION_SLICE_MAGNETIC_FIELD, (AccelerationData_t *)&(sample.magneticField));
+#endif
+        (sample_handler)(&sample, sample_timestamp_us);
+    }
+}
+
+// 読み出しステージに、要求を登録します。前の要求が読み出されていなければfalseを返します。
+static bool requestMotionSlice(motion_slice_t slice, sensor_data_ready_handler_t handler)
+{
+    if(_motionRead.pendingHandlers[slice] != NULL) {
+        return false;
+    }
+    _motionRead.pendingHandlers[slice] = handler;
+    return true;
+}
+
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+// MPU9250の内部のI2Cマスターが、サンプリングごとにAK8963のHXLからST2までの7バイトを読み出し、EXT_SENS_DATA_00からに置くように設定します。
+// AK8963のCNTL1は、バイパスで設定した後に呼び出すこと。
+static void startAuxI2CMaster(void)
+{
+    // バイパスを止める(INT_PIN_CFGのBYPASS_EN = 0)。INTピンの設定は、awakeNineAxesSensor()と同じ。
+    const uint8_t int_pin_cfg[] = {0x00};
+    writeToMPU9250(INT_PIN_CFG, int_pin_cfg, sizeof(int_pin_cfg));
+    
+    // Register 36 – I2C Master Control
+    // D6: WAIT_FOR_ES      1   外部センサーのデータが揃うまで、データレディ割り込みを遅らせる。
+    // D3: I2C_MST_CLK[3:0] 13  400kHz
+    const uint8_t i2c_mst_ctrl[] = {0x4d};
+    writeToMPU9250(I2C_MST_CTRL, i2c_mst_ctrl, sizeof(i2c_mst_ctrl));
+    
+    // Register 37-39 – I2C Slave 0 Control
+    // I2C_SLV0_ADDR    D7: I2C_SLV0_RNW 1(読み出し), D6-D0: AK8963のアドレス
+    // I2C_SLV0_REG     読み出しを開始するレジスタ HXL
+    // I2C_SLV0_CTRL    D7: I2C_SLV0_EN 1, D3-D0: I2C_SLV0_LENG 7。ST2まで読むと、AK8963のデータの読み出しロックが解除される。
+    const uint8_t slv0_addr[] = {0x80 | TWI_AK8963_ADDRESS};
+    const uint8_t slv0_reg[]  = {(uint8_t)HXL};
+    const uint8_t slv0_ctrl[] = {0x87};
+    writeToMPU9250(I2C_SLV0_ADDR, slv0_addr, sizeof(slv0_addr));
+    writeToMPU9250(I2C_SLV0_REG,  slv0_reg,  sizeof(slv0_reg));
+    writeToMPU9250(I2C_SLV0_CTRL, slv0_ctrl, sizeof(slv0_ctrl));
+    
+    // AK8963は100Hzで更新するので、チップのサンプリングを10ミリ秒にしておく。FIFO、データレディ割り込みでは、setSampleRate()で変わる。
+    setSampleRate(10);
+    
+    // Register 106 – User Control
+    // D5: I2C_MST_EN       1
+    const uint8_t user_ctrl[] = {USER_CTRL_I2C_MST_EN};
+    writeToMPU9250(USER_CTRL, user_ctrl, sizeof(user_ctrl));
+}
+
+// I2Cマスターを止めて、バイパスに戻します。
+static void stopAuxI2CMaster(void)
+{
+    const uint8_t user_ctrl[] = {0x00};
+    writeToMPU9250(USER_CTRL, user_ctrl, sizeof(user_ctrl));
+    // I2Cマスターの読み出し(400kHzで7バイト)が終わるのを待つ
+    nrf_delay_ms(1);
+    const uint8_t int_pin_cfg[] = {0x02};
+    writeToMPU9250(INT_PIN_CFG, int_pin_cfg, sizeof(int_pin_cfg));
+}
+#else
+// 読み出しを積みます。前の読み出しが終わっていなければfalseを返します。
+static bool requestRead(nine_axes_read_t *p_read, uint8_t twi_address, uint8_t target_register, uint8_t length, twi_transaction_handler_t completion, sensor_data_ready_handler_t handler)
+{
+    if(p_read->handler != NULL) {
+        return false;
+    }
+    p_read->handler = handler;
+    if( ! twiEnqueueRead(twi_address, target_register, p_read->buffer, length, completion, p_read) ) {
+        p_read->handler = NULL;
+        return false;
+    }
+    return true;
+}
+
+// 読み出しを終えて、ハンドラを返します。失敗していればNULLを返します。
+static sensor_data_ready_handler_t finishRead(nine_axes_read_t *p_read, bool is_success)
+{
+    sensor_data_ready_handler_t handler = p_read->handler;
+    p_read->handler = NULL;
+    return is_success ? handler : NULL;
+}
+
+static void magneticFieldReadHandler(bool is_success, void *p_context)
+{
+    nine_axes_read_t *p_read = (nine_axes_read_t *)p_context;
+    sensor_data_ready_handler_t handler = finishRead(p_read, is_success);
+    if(handler == NULL) {
+        return;
+    }
+    MagneticFieldData_t data;
+    data.x = readInt16AsLittleEndian(&(p_read->buffer[0]));
+    data.y = readInt16AsLittleEndian(&(p_read->buffer[2]));
+    data.z = readInt16AsLittleEndian(&(p_read->buffer[4]));
+    (handler)((const uint8_t *)&data, sizeof(data));
+}
+#endif
+
+#ifdef NRF52
+// 周期読み出しのハンドラ。TIMER4の割り込みから、ACCEL_XOUT_Hからのブロックが、サンプルの順に渡される。
+static void periodicReadHandler(const uint8_t *p_samples, uint8_t count)
+{
+    for(int i = 0; i < count; i++) {
+        const uint8_t *p_block = &(p_samples[i * _periodicRead.blockSize]);
+        NineAxesFifoData_t *p_sample = &(_periodicRead.samples[i]);
+        decodeMotionSlice(p_block, MOTION_SLICE_ACCELERATION,  &(p_sample->acceleration));
+        decodeMotionSlice(p_block, MOTION_SLICE_ROTATION_RATE, (AccelerationData_t *)&(p_sample->rotationRate));
+        if(_periodicRead.blockSize == MOTION_BLOCK_SIZE) {
+            decodeMotionSlice(p_block, MOTION_SLICE_MAGNETIC_FIELD, (AccelerationData_t *)&(p_sample->magneticField));
+        }
+    }
+    (_periodicRead.handler)(_periodicRead.samples, count);
+}
+#endif
+
+static void fifoDataReadHandler(bool is_success, void *p_context);
+// FIFOの次のまとめ読みを積みます。読み終えていれば、FIFOの読み出しを終えます。
+static void readNextFifoBurst(void)
 {
-    readFromTwiSlave(TWI_AK8963_ADDRESS, (uint8_t)target_register, data, data_length);
+    if(_fifoRead.remainingFrames == 0 || _fifoFrameSize == 0) {
+        _fifoRead.handler = NULL;
+        return;
+    }
+    _fifoRead.burstFrames = MIN(_fifoRead.remainingFrames, FIFO_BURST_READ_SIZE / _fifoFrameSize);
+    if( ! twiEnqueueRead(TWI_MPU9250_ADDRESS, FIFO_R_W, _fifoRead.buffer, _fifoRead.burstFrames * _fifoFrameSize, fifoDataReadHandler, NULL) ) {
+        _fifoRead.handler = NULL;
+    }
+}
+
+static void fifoCountReadHandler(bool is_success, void *p_context)
+{
+    if( ! is_success || _fifoFrameSize == 0) {
+        _fifoRead.handler = NULL;
+        return;
+    }
+    _fifoRead.remainingFrames = getFifoFrameCount(_fifoRead.countBuffer, false);
+    readNextFifoBurst();
+}
+
+static void fifoDataReadHandler(bool is_success, void *p_context)
+{
+    if( ! is_success || _fifoFrameSize == 0) {
+        _fifoRead.handler = NULL;
+        return;
+    }
+    decodeFifoFrames(_fifoRead.buffer, _fifoRead.samples, _fifoRead.burstFrames);
+    (_fifoRead.handler)(_fifoRead.samples, _fifoRead.burstFrames);
+    
+    _fifoRead.remainingFrames -= _fifoRead.burstFrames;
+    readNextFifoBurst();
 }
 
 /**
@@ -86,6 +456,25 @@ static void readFromAK8963(AK8963Register_t target_register, uint8_t *data, uint
 bool initNineAxesSensor(void)
 {
     _isActive = false;
+    _isAccelerationInFifo = false;
+    _isRotationRateInFifo = false;
+    _fifoFrameSize        = 0;
+    _dataReadyHandler     = NULL;
+#ifndef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+    memset(&_magneticFieldRead, 0, sizeof(nine_axes_read_t));
+#endif
+    memset(&_motionRead,        0, sizeof(nine_axes_motion_read_t));
+    _fifoRead.handler     = NULL;
+#ifdef NRF52
+    _periodicRead.handler = NULL;
+#endif
+    
+    // INTピンは、ボタンと同じGPIOTEドライバで受ける。
+    if( ! nrf_drv_gpiote_is_init() ) {
+        ret_code_t err_code = nrf_drv_gpiote_init();
+        APP_ERROR_CHECK(err_code);
+    }
+    
     awakeNineAxesSensor();
 
     return true;
@@ -97,6 +486,18 @@ void sleepNineAxesSensor(void)
         return;
     }
     _isActive = false;
+    // スリープでFIFOも止まる。次のawakeでチップはリセットされる。
+    _isAccelerationInFifo = false;
+    _isRotationRateInFifo = false;
+    _fifoFrameSize        = 0;
+    setNineAxesSensorDataReady(0, NULL);
+    // 読み出されなかった要求は捨てる
+    memset(_motionRead.pendingHandlers, 0, sizeof(_motionRead.pendingHandlers));
+    _motionRead.pendingSampleHandler = NULL;
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+    // AK8963のパワーダウンは、バイパスで書き込む
+    stopAuxI2CMaster();
+#endif
     
     // CNTL1
     // D4: BIT              0   0: 14-bit output, 1: 16-bit output
@@ -190,6 +591,11 @@ void awakeNineAxesSensor(void)
     // D0: =
     const uint8_t data3[] = {0x16};
     writeToAK8963( CNTL1, data3, sizeof(data3));
+    
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+    // 以降の地磁気は、MPU9250のI2Cマスターが読み出す
+    startAuxI2CMaster();
+#endif
 }
 
 void setNineAxesSensorAccelerationRange(AccelerationRange_t range)
@@ -236,6 +642,7 @@ void setNineAxesSensorRotationRange(RotationRange_t range)
 //    1:0       Fchoice_b[1:0], Used to bypass DLPF as shown in table 1 above. NOTE: Register is Fchoice_b (inverted version of Fchoice), table 1 uses Fchoice (which is the inverted version of this register).
     uint8_t value = 0;
     
+    _rotationRange = range;
     switch (range) {
         case ROTATION_RANGE_250DPS: value = 0x00 << 3; break;
         case ROTATION_RANGE_500DPS: value = 0x01 << 3; break;
@@ -248,48 +655,226 @@ void setNineAxesSensorRotationRange(RotationRange_t range)
     writeToMPU9250(GYRO_CONFIG, data, sizeof(data));
 }
 
-void getAccelerationData(uint8_t *p_data)
+RotationRange_t getNineAxesSensorRotationRange(void)
+{
+    return _rotationRange;
+}
+
+void setNineAxesSensorFifo(bool acceleration, bool rotation_rate, uint8_t period_ms)
 {
-    AccelerationData_t *p_acceleration = (AccelerationData_t *)p_data;
+    _isAccelerationInFifo = acceleration && (period_ms > 0);
+    _isRotationRateInFifo = rotation_rate && (period_ms > 0);
+    _fifoFrameSize        = (_isAccelerationInFifo ? sizeof(AccelerationData_t) : 0) + (_isRotationRateInFifo ? sizeof(RotationRateData_t) : 0);
     
-    uint8_t buffer[6];
-    // 加速度のデータは一連の連続するアドレスから読み出す。
-    // ACCEL_XOUT_H 0x3b
-    // ACCEL_XOUT_L
-    // ACCEL_YOUT_H
-    // ACCEL_YOUT_L
-    // ACCEL_ZOUT_H
-    // ACCEL_ZOUT_L
-    readFromMPU9250( ACCEL_XOUT_H, buffer, sizeof(buffer));
-    p_acceleration->x = readInt16AsBigEndian(&(buffer[0]));
-    p_acceleration->y = readInt16AsBigEndian(&(buffer[2]));
-    p_acceleration->z = readInt16AsBigEndian(&(buffer[4]));
+    // Register 35 – FIFO Enable
+    // D7: TEMP_OUT         0
+    // D6: GYRO_XOUT        x   1- ジャイロのデータをFIFOに書き込む。
+    // D5: GYRO_YOUT        x
+    // D4: GYRO_ZOUT        x
+    // D3: ACCEL            x   1- 加速度のデータをFIFOに書き込む。
+    // D2: SLV_2            0
+    // D1: SLV_1            0
+    // D0: SLV_0            0
+    const uint8_t fifo_en[] = { (_isRotationRateInFifo ? 0x70 : 0x00) | (_isAccelerationInFifo ? 0x08 : 0x00) };
+    
+    // Register 106 – User Control
+    // D6: FIFO_EN          x   1- FIFOを有効にする。
+    // D5: I2C_MST_EN       x   地磁気センサーをI2Cマスターで読むなら1。
+    // D2: FIFO_RST         1   FIFOをリセットする。ビットは自動でクリアされる。
+    const uint8_t user_ctrl[] = { (_fifoFrameSize > 0 ? 0x40 : 0x00) | 0x04 | USER_CTRL_I2C_MST_EN };
+    
+    if(_fifoFrameSize == 0) {
+        writeToMPU9250(FIFO_EN,   fifo_en,   sizeof(fifo_en));
+        writeToMPU9250(USER_CTRL, user_ctrl, sizeof(user_ctrl));
+        return;
+    }
+    
+    setSampleRate(period_ms);
+    
+    writeToMPU9250(FIFO_EN,   fifo_en,   sizeof(fifo_en));
+    writeToMPU9250(USER_CTRL, user_ctrl, sizeof(user_ctrl));
 }
 
-void getRotationRateData(uint8_t *p_data)
+void setNineAxesSensorDataReady(uint8_t period_ms, nine_axes_data_ready_handler_t handler)
 {
-    RotationRateData_t *p_rotationRate = (RotationRateData_t *)p_data;
+    ret_code_t err_code;
+    
+    // 割り込みを止める
+    if(_dataReadyHandler != NULL) {
+        nrf_drv_gpiote_in_event_disable(PIN_NUMBER_9AXIS_INT);
+        nrf_drv_gpiote_in_uninit(PIN_NUMBER_9AXIS_INT);
+        _dataReadyHandler = NULL;
+    }
+    
+    // Register 56 – Interrupt Enable
+    // D6: WOM_EN           0
+    // D4: FIFO_OFLOW_EN    0
+    // D3: FSYNC_INT_EN     0
+    // D0: RAW_RDY_EN       x   1- データレジスタが更新されるたびに、INTピンにパルス(50us)を出す。
+    const uint8_t int_enable[] = { (period_ms > 0 && handler != NULL) ? 0x01 : 0x00 };
+    if(int_enable[0] == 0) {
+        writeToMPU9250(INT_ENABLE, int_enable, sizeof(int_enable));
+        return;
+    }
+    
+    setSampleRate(period_ms);
     
-    uint8_t buffer[6];
-    // ジャイロのデータは一連の連続するアドレスから読み出す。
-    // GYRO_XOUT_H 0x43
-    // GYRO_XOUT_L
-    // GYRO_YOUT_H
-    // GYRO_YOUT_L
-    // GYRO_ZOUT_H
-    // GYRO_ZOUT_L
-    readFromMPU9250( GYRO_XOUT_H, buffer, sizeof(buffer));
+    // INTピンはアクティブハイ、プッシュプル(awakeNineAxesSensor()のINT_PIN_CFG)。立ち上がりでGPIOTEのチャネルのイベントにする。
+    _dataReadyHandler = handler;
+    nrf_drv_gpiote_in_config_t config = GPIOTE_CONFIG_IN_SENSE_LOTOHI(true);
+    err_code = nrf_drv_gpiote_in_init(PIN_NUMBER_9AXIS_INT, &config, gpioteEventHandler);
+    APP_ERROR_CHECK(err_code);
+    nrf_drv_gpiote_in_event_enable(PIN_NUMBER_9AXIS_INT, true);
     
-    p_rotationRate->x = readInt16AsBigEndian(&(buffer[0]));
-    p_rotationRate->y = readInt16AsBigEndian(&(buffer[2]));
-    p_rotationRate->z = readInt16AsBigEndian(&(buffer[4]));
+    writeToMPU9250(INT_ENABLE, int_enable, sizeof(int_enable));
 }
 
-void getMagneticFieldData(uint8_t *p_data)
+uint8_t getNineAxesSensorFifoData(NineAxesFifoData_t *p_data, uint8_t max_count)
 {
-    MagneticFieldData_t *p_magneticField = (MagneticFieldData_t *)p_data;
+    if(_fifoFrameSize == 0) {
+        return 0;
+    }
     
-    uint8_t buffer[7];
+    uint8_t count_buffer[2];
+    readFromMPU9250(FIFO_COUNTH, count_buffer, sizeof(count_buffer));
+    uint8_t count = MIN(getFifoFrameCount(count_buffer, true), max_count);
+    
+    // I2Cの1回の読み出しの最大バイト数ごとに、まとめて読み出す。
+    uint8_t buffer[FIFO_BURST_READ_SIZE];
+    const uint8_t frames_per_burst = FIFO_BURST_READ_SIZE / _fifoFrameSize;
+    uint8_t index = 0;
+    while(index < count) {
+        const uint8_t frames = MIN(count - index, frames_per_burst);
+        readFromMPU9250(FIFO_R_W, buffer, frames * _fifoFrameSize);
+        decodeFifoFrames(buffer, &(p_data[index]), frames);
+        index += frames;
+    }
+    
+    return count;
+}
+
+bool requestNineAxesSensorFifoData(nine_axes_fifo_handler_t handler)
+{
+    if(_fifoFrameSize == 0 || _fifoRead.handler != NULL) {
+        return false;
+    }
+    _fifoRead.handler = handler;
+    if( ! twiEnqueueRead(TWI_MPU9250_ADDRESS, FIFO_COUNTH, _fifoRead.countBuffer, sizeof(_fifoRead.countBuffer), fifoCountReadHandler, NULL) ) {
+        _fifoRead.handler = NULL;
+        return false;
+    }
+    return true;
+}
+
+#ifdef NRF52
+bool startNineAxesSensorPeriodicRead(bool magnetic_field, uint32_t period_us, uint8_t batch_size, nine_axes_fifo_handler_t handler)
+{
+#ifndef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+    // バイパスでは、地磁気はtwi0の別のアドレスなので、同じ読み出しに含められない。
+    if(magnetic_field) {
+        return false;
+    }
+#endif
+    if(_periodicRead.handler != NULL) {
+        return false;
+    }
+    // チップは1ミリ秒(内部のサンプリング)ごとにデータレジスタを更新する。I2Cマスターは、10ミリ秒ごとに地磁気を読む。
+    setSampleRate(1);
+    
+    // 加速度、温度、ジャイロの14バイト。地磁気を含めるなら、EXT_SENS_DATAの6バイトを続けて読む。
+    _periodicRead.blockSize = magnetic_field ? MOTION_BLOCK_SIZE : _motionSliceOffsets[MOTION_SLICE_ROTATION_RATE] + sizeof(RotationRateData_t);
+    _periodicRead.handler   = handler;
+    if( ! twiStartPeriodicRead(TWI_MPU9250_ADDRESS, (uint8_t)ACCEL_XOUT_H, _periodicRead.blockSize, period_us, batch_size, periodicReadHandler) ) {
+        _periodicRead.handler = NULL;
+        return false;
+    }
+    return true;
+}
+
+uint32_t stopNineAxesSensorPeriodicRead(void)
+{
+    if(_periodicRead.handler == NULL) {
+        return 0;
+    }
+    const uint32_t missed_count = twiStopPeriodicRead();
+    _periodicRead.handler = NULL;
+    return missed_count;
+}
+#endif
+
+bool requestAccelerationData(sensor_data_ready_handler_t handler)
+{
+    return requestMotionSlice(MOTION_SLICE_ACCELERATION, handler);
+}
+
+bool requestRotationRateData(sensor_data_ready_handler_t handler)
+{
+    return requestMotionSlice(MOTION_SLICE_ROTATION_RATE, handler);
+}
+
+bool startNineAxesMotionRead(void)
+{
+    if(_motionRead.isReading) {
+        return false;
+    }
+    // 要求されたデータを含む、最初から最後までの範囲を1回で読み出す。
+    // ACCEL_XOUT_H      0x3b 〜 ACCEL_ZOUT_L 0x40
+    // TEMP_OUT_H        0x41 〜 TEMP_OUT_L   0x42
+    // GYRO_XOUT_H       0x43 〜 GYRO_ZOUT_L  0x48
+    // EXT_SENS_DATA_00  0x49 〜 EXT_SENS_DATA_05 0x4e (I2Cマスターで読んだ地磁気 HXL〜HZH)
+    int first = -1;
+    int last  = -1;
+    for(int i = 0; i < NUM_OF_MOTION_SLICES; i++) {
+        if(_motionRead.pendingHandlers[i] != NULL) {
+            first = (first < 0) ? i : first;
+            last  = i;
+        }
+    }
+    // 1サンプルの要求があれば、全てのデータ(バイパスでは、加速度とジャイロ)を読み出す
+    if(_motionRead.pendingSampleHandler != NULL) {
+        first = MOTION_SLICE_ACCELERATION;
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+        last  = MOTION_SLICE_MAGNETIC_FIELD;
+#else
+        last  = MAX(last, MOTION_SLICE_ROTATION_RATE);
+#endif
+    }
+    if(first < 0) {
+        return false;
+    }
+    memcpy(_motionRead.handlers, _motionRead.pendingHandlers, sizeof(_motionRead.handlers));
+    memset(_motionRead.pendingHandlers, 0, sizeof(_motionRead.pendingHandlers));
+    _motionRead.sampleHandler        = _motionRead.pendingSampleHandler;
+    _motionRead.sampleTimestampUs    = _motionRead.pendingSampleTimestampUs;
+    _motionRead.pendingSampleHandler = NULL;
+    _motionRead.isReading = true;
+    
+    const uint8_t offset = _motionSliceOffsets[first];
+    const uint8_t length = _motionSliceOffsets[last] + sizeof(AccelerationData_t) - offset;
+    if( ! twiEnqueueRead(TWI_MPU9250_ADDRESS, (uint8_t)ACCEL_XOUT_H + offset, &(_motionRead.buffer[offset]), length, motionReadHandler, NULL) ) {
+        memset(_motionRead.handlers, 0, sizeof(_motionRead.handlers));
+        _motionRead.sampleHandler = NULL;
+        _motionRead.isReading = false;
+        return false;
+    }
+    return true;
+}
+
+bool requestNineAxesMotionData(nine_axes_motion_handler_t handler, uint32_t timestamp_us)
+{
+    if(_motionRead.pendingSampleHandler != NULL) {
+        return false;
+    }
+    _motionRead.pendingSampleHandler     = handler;
+    _motionRead.pendingSampleTimestampUs = timestamp_us;
+    return true;
+}
+
+bool requestMagneticFieldData(sensor_data_ready_handler_t handler)
+{
+#ifdef NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+    return requestMotionSlice(MOTION_SLICE_MAGNETIC_FIELD, handler);
+#else
     // 地磁気のデータは一連の連続するアドレスから読み出す。
     // HXL 0x03
     // HXH
@@ -299,11 +884,6 @@ void getMagneticFieldData(uint8_t *p_data)
     // HZH
     //
     // 内部データはHZHの次のアドレスにあるST2を読みだすことで、読み出しロックが解除されて、次のデータに更新される。そのため7バイトを読みだす。
-    readFromAK8963( HXL, buffer, sizeof(buffer));
-    
-    p_magneticField->x = readInt16AsLittleEndian(&(buffer[0]));
-    p_magneticField->y = readInt16AsLittleEndian(&(buffer[2]));
-    p_magneticField->z = readInt16AsLittleEndian(&(buffer[4]));
-    
-//    NRF_LOG_PRINTF_DEBUG("\nmag x:%d y:%d z:%d.", p_magneticField->x, p_magneticField->y, p_magneticField->z);
+    return requestRead(&_magneticFieldRead, TWI_AK8963_ADDRESS, HXL, 7, magneticFieldReadHandler, handler);
+#endif
 }
@@ -5,6 +5,10 @@
 #include <stdbool.h>
 #include "senstick_sensor_base_data.h"
 
+// 地磁気センサー(AK8963)を、MPU9250の内部のI2Cマスターで読み出す。AK8963のデータは、加速度とジャイロと同じ読み出しで取得します。
+// 定義しなければ、従来通りバイパスでAK8963から直接読み出します。
+#define NINE_AXES_MAGNETOMETER_VIA_I2C_MASTER
+
 // 16ビット 符号付き数値。フルスケールは設定レンジ値による。2, 4, 8, 16G。
 typedef struct {
     int16_t x;
@@ -28,6 +32,13 @@ typedef struct MagneticFieldData_s {
     int16_t z;
 } MagneticFieldData_t;
 
+// FIFO、周期読み出し、またはrequestNineAxesMotionData()の1サンプル分のデータ。読み出していないセンサーのデータは不定。
+typedef struct {
+    AccelerationData_t  acceleration;
+    RotationRateData_t  rotationRate;
+    MagneticFieldData_t magneticField;  // 周期読み出しと、requestNineAxesMotionData()だけ
+} NineAxesFifoData_t;
+
 // 加速度センサーの範囲設定値。列挙側の値は、BLEでの設定値に合わせている。
 typedef enum {
     ACCELERATION_RANGE_2G   = 0x00, // +- 2g
@@ -52,9 +63,59 @@ void awakeNineAxesSensor(void);
 
 void setNineAxesSensorAccelerationRange(AccelerationRange_t range);
 void setNineAxesSensorRotationRange(RotationRange_t range);
+// 最後に設定したジャイロの範囲を返します。
+RotationRange_t getNineAxesSensorRotationRange(void);
+
+// データレディ割り込みのハンドラ。INTピンのGPIOTEの割り込みから呼び出されます。
+typedef void (* nine_axes_data_ready_handler_t)(void);
+
+// FIFOを設定します。チップはperiod_msミリ秒(1〜255)ごとにサンプリングして、指定されたセンサーのデータをFIFOに溜めます。
+// 両方falseなら、FIFOを止めます。awakeNineAxesSensor()の後、範囲設定の後に呼び出します。
+void setNineAxesSensorFifo(bool acceleration, bool rotation_rate, uint8_t period_ms);
+// FIFOに溜まったサンプルを、古い順に最大max_count個読み出します。読み出したサンプル数を返します。完了まで待ちます。
+// FIFOが溢れていたら、FIFOをリセットして0を返します。
+uint8_t getNineAxesSensorFifoData(NineAxesFifoData_t *p_data, uint8_t max_count);
+
+// FIFOの読み出しで、サンプルを受け取るハンドラ。TWIの完了割り込みから、古い順にまとめて(1回のI2Cの読み出しの分ずつ)呼び出されます。
+typedef void (* nine_axes_fifo_handler_t)(const NineAxesFifoData_t *p_data, uint8_t count);
+// FIFOに溜まったサンプルの読み出しを、TWIのキューに積みます。前の読み出しが終わっていなければfalseを返します。
+// FIFOが溢れていたら、FIFOをリセットして、サンプルは渡しません。
+bool requestNineAxesSensorFifoData(nine_axes_fifo_handler_t handler);
+
+#ifdef NRF52
+// 加速度とジャイロ(magnetic_fieldなら、I2Cマスターで読んだ地磁気も)を、period_usマイクロ秒ごとにハードウェアだけで読み出し始めます。
+// TIMER3からPPIでTWIMを起動し、データレジスタの1ブロックをEasyDMAでリングバッファに受け取ります(twiStartPeriodicRead())。
+// チップは1ミリ秒ごとにデータレジスタを更新します。batch_sizeサンプルごとに、TIMER4の割り込みからhandlerにまとめて渡します。
+// 読み出しの間は、twi0の他の読み出し(FIFO、データレディ、startNineAxesMotionRead())はできません。開始できなければfalseを返します。
+bool startNineAxesSensorPeriodicRead(bool magnetic_field, uint32_t period_us, uint8_t batch_size, nine_axes_fifo_handler_t handler);
+// 周期読み出しを止めます。バッチに満たない残りのサンプルはhandlerに渡します。リングの折り返しで取りこぼしたトリガーの回数を返します。
+uint32_t stopNineAxesSensorPeriodicRead(void);
+#endif
+
+// チップがperiod_msミリ秒(1〜255)ごとにサンプリングし、サンプルごとにINTピンのデータレディ割り込みでhandlerを呼び出すように設定します。
+// handlerの中で、requestAccelerationData()、requestRotationRateData()とstartNineAxesMotionRead()で、そのサンプルを読み出します。period_msが0なら割り込みを止めます。
+// GPIOTEの割り込み優先度は、センサーのサンプリングのTIMER2と同じにすること(I2Cバスの読み出しが、互いに割り込まないようにする)。
+void setNineAxesSensorDataReady(uint8_t period_ms, nine_axes_data_ready_handler_t handler);
+
+// 加速度とジャイロの読み出しを要求します。要求を登録するだけで、読み出しはstartNineAxesMotionRead()で開始します。
+// 完了すると、handlerにデコードしたデータ構造体が渡されます。前の要求が読み出されていなければ、falseを返します(このサンプルは取得できない)。
+bool requestAccelerationData(sensor_data_ready_handler_t handler);
+bool requestRotationRateData(sensor_data_ready_handler_t handler);
+// 要求された加速度とジャイロ(と、I2Cマスターで読んだ地磁気)を、1回のI2Cの読み出しでTWIのキューに積みます。レジスタは連続しているので、
+// 最初から最後のデータまで(全部なら、間の温度を含む20バイト)を読み出し、それぞれのデータは同じサンプルになります。
+// サンプリングの割り込みで、各センサーの要求の後に呼び出します。要求がない、または前の読み出し中ならfalseを返します(要求は次の呼び出しまで残る)。
+bool startNineAxesMotionRead(void);
+// 地磁気の読み出しを要求します。I2Cマスターで読み出すときは、加速度とジャイロと同じく、startNineAxesMotionRead()で読み出します。
+// バイパスで読み出すときは、TWIのキューに積みます。完了すると、handlerにデコードしたデータ構造体が渡されます。
+// 前の読み出しが終わっていなければ、falseを返します(このサンプルは取得できない)。
+bool requestMagneticFieldData(sensor_data_ready_handler_t handler);
 
-void getAccelerationData(uint8_t *p_data);
-void getRotationRateData(uint8_t *p_data);
-void getMagneticFieldData(uint8_t *p_data);
+// 加速度、ジャイロ、地磁気の1サンプルを受け取るハンドラ。TWIの完了割り込みから呼び出されます。timestamp_usは、要求したときに渡した時刻。
+typedef void (* nine_axes_motion_handler_t)(const NineAxesFifoData_t *p_data, uint32_t timestamp_us);
+// 加速度、ジャイロ、地磁気の、同じサンプルの読み出しを要求します。startNineAxesMotionRead()で、他の要求と同じ1回の読み出しで取得します。
+// 地磁気は、I2Cマスターで読み出すときだけ。バイパスで読み出すときは0になります。
+// timestamp_usは、サンプルの時刻(呼び出し側の時計、マイクロ秒)。そのままハンドラに渡します。読み出し中に次の要求を受け付けても、サンプルと時刻は対応します。
+// 前の要求が読み出されていなければ、falseを返します(このサンプルは取得できない)。
+bool requestNineAxesMotionData(nine_axes_motion_handler_t handler, uint32_t timestamp_us);
 
 #endif /* twi_slave_nine_axes_sensor_h */
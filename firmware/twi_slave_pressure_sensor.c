@@ -70,6 +70,21 @@ static void setRegisterBitOfLPS25HB( const LPS25HBRegister_t target_register, co
 }
 */
 
+// 読み出し中は、ハンドラがNULLではない。
+static sensor_data_ready_handler_t _readHandler;
+static uint8_t _readBuffer[4];
+
+static void pressureReadHandler(bool is_success, void *p_context)
+{
+    sensor_data_ready_handler_t handler = _readHandler;
+    _readHandler = NULL;
+    if( ! is_success ) {
+        return;
+    }
+    AirPressureData_t data = readUInt32AsLittleEndian(_readBuffer);
+    (handler)((const uint8_t *)&data, sizeof(data));
+}
+
 /**
  * public methods
  */
@@ -86,6 +101,8 @@ bool initPressureSensor(void)
 // 1   RESET_AZ  Reset Autozero function. Default value: 0. (0: normal mode; 1: reset Autozero function)
 // 0   SIM       SPI Serial Interface Mode selection.Default value: 0 (0: 4-wire interface; 1: 3-wire interface)
 
+    _readHandler = NULL;
+    
     // Active, one-shot mode,  1_000_0000
     const uint8_t data_CTRL_REG1[] = {0x80};
     bool result = writeToLPS25HB( CTRL_REG1, data_CTRL_REG1, sizeof(data_CTRL_REG1));
@@ -125,6 +142,24 @@ void getPressureData(AirPressureData_t *p_data)
     const uint8_t data_CTRL_REG2[] = {0x11};
     writeToLPS25HB( CTRL_REG2, data_CTRL_REG2, sizeof(data_CTRL_REG2));
 }
+bool requestPressureData(sensor_data_ready_handler_t handler)
+{
+    if(_readHandler != NULL) {
+        return false;
+    }
+    // 変換済のはずの値を読みだし、続けて次の変換を開始する(getPressureData()と同じ)。
+    memset(_readBuffer, 0, sizeof(_readBuffer));
+    _readHandler = handler;
+    if( ! twiEnqueueRead(TWI_LPS25HB_ADDRESS, (uint8_t)PRESS_OUT_XL, _readBuffer, 3, pressureReadHandler, NULL) ) {
+        _readHandler = NULL;
+        return false;
+    }
+    // CTRL_REG2, 0001_0001
+    const uint8_t data_CTRL_REG2[] = {(uint8_t)CTRL_REG2, 0x11};
+    twiEnqueueWrite(TWI_LPS25HB_ADDRESS, data_CTRL_REG2, sizeof(data_CTRL_REG2), NULL, NULL);
+    return true;
+}
+
 /*
 bool isPressureSensor(void)
 {
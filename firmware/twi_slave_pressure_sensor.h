@@ -12,6 +12,10 @@ typedef uint32_t AirPressureData_t;
 // 初期化関数。センサ使用前に必ずこの関数を呼出ます。
 bool initPressureSensor(void);
 
+// 変換済みの値を読み出し、次の変換を開始します。完了まで待ちます。
 void getPressureData(AirPressureData_t *p_data);
+// getPressureData()と同じ処理を、TWIのキューに積みます。完了するとhandlerにAirPressureData_tが渡されます。
+// 前の読み出しが終わっていなければfalseを返します。
+bool requestPressureData(sensor_data_ready_handler_t handler);
 
 #endif /* twi_slave_pressure_sensor_h */
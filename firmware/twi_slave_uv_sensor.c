@@ -17,6 +17,11 @@
 #include "senstick_sensor_base_data.h"
 #include "senstick_io_definition.h"
 
+// 読み出し中は、ハンドラがNULLではない。
+static sensor_data_ready_handler_t _readHandler;
+static uint8_t _readBuffer[2];
+static bool _isReadFailed;
+
 // 初期化関数。センサ使用前に必ずこの関数を呼出ます。
 bool initUVSensor(void)
 {
@@ -32,6 +37,8 @@ bool initUVSensor(void)
     // 1    Reserved ('1')
     // 0    SD, Shutdown mode setting
 
+    _readHandler = NULL;
+    
     // ACK disable, Shutdown mode disable, Integration time '01' 1T, 0000_0110, 0x06
     // 外付け抵抗が560kohm, 1T = 250ミリ秒位
     data = 0x06;
@@ -40,7 +47,28 @@ bool initUVSensor(void)
     return (err_code == NRF_SUCCESS);
 }
 
-void getUVSensorData(UltraVioletData_t *p_data)
+static void uvMsbReadHandler(bool is_success, void *p_context)
+{
+    _isReadFailed = ! is_success;
+    if( ! is_success ) {
+        NRF_LOG_PRINTF_DEBUG("getUVSensorData1, failed.\n");
+    }
+}
+
+static void uvLsbReadHandler(bool is_success, void *p_context)
+{
+    sensor_data_ready_handler_t handler = _readHandler;
+    _readHandler = NULL;
+    if( ! is_success || _isReadFailed ) {
+        NRF_LOG_PRINTF_DEBUG("getUVSensorData2, failed.\n");
+        return;
+    }
+    UltraVioletData_t data = ((uint16_t)_readBuffer[0] << 8) | (uint16_t)_readBuffer[1];
+//    NRF_LOG_PRINTF_DEBUG("getUVSensorData() 0x%02x\n", data);
+    (handler)((const uint8_t *)&data, sizeof(data));
+}
+
+bool requestUVSensorData(sensor_data_ready_handler_t handler)
 {
     /*
      • Slave addresses (8 bits) for data read: 0x71 and 0x73
@@ -48,25 +76,20 @@ void getUVSensorData(UltraVioletData_t *p_data)
      -Set read command to 0x73, read MSB 8 bits of 16 bits light data (sequence 1)
      -Set read command to 0x71, read LSB 8 bits of 16 bits light data for completing data structure (sequence 2)
      */
-    ret_code_t err_code;
-
-    uint8_t data0;
-    err_code = TwiSlave_RX(TWI_VEML6070_RD_ADDRESS, &data0, 1);
-//    APP_ERROR_CHECK(err_code);
-    if(err_code != NRF_SUCCESS) {
-        NRF_LOG_PRINTF_DEBUG("getUVSensorData1, error: %d.\n", err_code);
-        return;
+    if(_readHandler != NULL) {
+        return false;
     }
-
-    uint8_t data1;
-    err_code = TwiSlave_RX(TWI_VEML6070_ADDRESS, &data1, 1);
-//    APP_ERROR_CHECK(err_code);
-    if(err_code != NRF_SUCCESS) {
-        NRF_LOG_PRINTF_DEBUG("getUVSensorData2, error: %d.\n", err_code);
-        return;
+    // 2つの読み出しは、キューに積んだ順に続けて実行される。
+    _readHandler  = handler;
+    _isReadFailed = false;
+    if( ! twiEnqueueReceive(TWI_VEML6070_RD_ADDRESS, &(_readBuffer[0]), 1, uvMsbReadHandler, NULL) ) {
+        _readHandler = NULL;
+        return false;
     }
-    
-    *p_data = ((uint16_t)data0 << 8) | (uint16_t)data1 ;
-    
-//    NRF_LOG_PRINTF_DEBUG("getUVSensorData() 0x%02x\n", *p_data);
+    if( ! twiEnqueueReceive(TWI_VEML6070_ADDRESS, &(_readBuffer[1]), 1, uvLsbReadHandler, NULL) ) {
+        // MSBの読み出しは捨てる
+        _readHandler = NULL;
+        return false;
+    }
+    return true;
 }
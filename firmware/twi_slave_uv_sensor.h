@@ -14,6 +14,7 @@ bool initUVSensor(void);
 
 // UVA sensitivity, RSET =240kΩ,IT =1T, typ. 5 μW/cm2/step
 // 560kohm 1T、サンプリング周期275ミリ秒。 2.14 uW/cm2/step。
-void getUVSensorData(UltraVioletData_t *p_data);
+// データの読み出しをTWIのキューに積みます。完了するとhandlerにUltraVioletData_tが渡されます。前の読み出しが終わっていなければfalseを返します。
+bool requestUVSensorData(sensor_data_ready_handler_t handler);
 
 #endif /* twi_slave_uv_sensor_h */
@@ -22,11 +22,18 @@ static void setSensorWakeupHandler(bool shouldWakeUp, const sensor_service_setti
     }
 }
 
-// センサーの値を読み込みます。
-static uint8_t getSensorDataHandler(uint8_t *p_buffer, samplingDurationType duration_ms)
+static sensorDataCallbackType _callback;
+
+static void sensorDataReadyHandler(const uint8_t *p_data, uint8_t length)
+{
+    (_callback)(UltraVioletSensor, p_data, length);
+}
+
+// センサーの値の読み込みを要求します。
+static bool requestSensorDataHandler(samplingDurationType duration_ms, sensorDataCallbackType callback, samplingDurationType *p_wakeup_ms)
 {
-    getUVSensorData((UltraVioletData_t *)p_buffer);
-    return sizeof(UltraVioletData_t);
+    _callback = callback;
+    return requestUVSensorData(sensorDataReadyHandler);
 }
 
 // srcとdstのセンサデータの最大値/最小値をp_srcに入れます。p_srcは破壊されます。
@@ -53,9 +60,13 @@ const senstick_sensor_base_t uvSensorBase =
         UV_SENSOR_STORAGE_START_ADDRESS, // スタートアドレス
         UV_SENSOR_STORAGE_SIZE           // サイズ
     },
+    sensorBus_twi,
+    170,                        // I2Cバスを170マイクロ秒使う
+    0,                          // 連続で積分していて、読み出しは最後の積分結果
+    0,                          // 符号なしの値なので、間引きは使えない
     initSensorHandler,
     setSensorWakeupHandler,
-    getSensorDataHandler,
+    requestSensorDataHandler,
     getMaxMinValueHandler,
     getBLEDataHandler
 };